@@ -0,0 +1,721 @@
+/**
+ * @file main.cpp
+ *
+ * This module holds the main() function of the MoonUnitBenchmarks program,
+ * which measures the overhead of the test runner itself, by generating
+ * a synthetic tree of Lua test files and timing how long the runner takes
+ * to find, run, and report on the tests in it.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Reporter.hpp"
+#include "Runner.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <utility>
+#include <StringExtensions/StringExtensions.hpp>
+#include <SystemAbstractions/File.hpp>
+#include <vector>
+
+namespace {
+
+    /**
+     * This is the Lua test script used to measure the cost of individual
+     * operations of the runner, which don't depend on the size of the
+     * generated tree.  The "%d" is replaced with the number of
+     * expectations checked by each test.
+     */
+    const char* const microBenchmarkScript = (
+        "moonunit:test(\"micro\", \"empty\", function()\n"
+        "end)\n"
+        "\n"
+        "moonunit:test(\"micro\", \"scalars\", function()\n"
+        "    for i = 1, %d do\n"
+        "        moonunit:expect_eq(i, i)\n"
+        "    end\n"
+        "end)\n"
+        "\n"
+        "moonunit:test(\"micro\", \"tables\", function()\n"
+        "    local expected = {1, 2, 3, name = \"moon\", inner = {x = 1, y = 2}}\n"
+        "    local actual = {1, 2, 3, name = \"moon\", inner = {x = 1, y = 2}}\n"
+        "    for i = 1, %d do\n"
+        "        moonunit:expect_eq(expected, actual)\n"
+        "    end\n"
+        "end)\n"
+    );
+
+    /**
+     * This holds the settings of the program, given on the command line.
+     */
+    struct Environment {
+        /**
+         * This is the path to the folder in which to generate
+         * the synthetic tree of Lua test files.
+         */
+        std::string treePath;
+
+        /**
+         * This is the number of Lua test files to generate.
+         */
+        size_t files = 100;
+
+        /**
+         * This is the number of tests to generate in each Lua test file.
+         */
+        size_t tests = 10;
+
+        /**
+         * This is the number of expectations each generated test checks.
+         */
+        size_t asserts = 10;
+
+        /**
+         * This is the number of times to repeat each measurement.
+         */
+        size_t repetitions = 5;
+
+        /**
+         * This is the number of Lua test files the runner should load
+         * at the same time while finding tests.
+         */
+        size_t jobs = 1;
+
+        /**
+         * This flag indicates whether or not the user asked
+         * for usage information.
+         */
+        bool helpRequested = false;
+    };
+
+    /**
+     * This holds the summary of the repeated measurements
+     * of one benchmark.
+     */
+    struct Measurement {
+        /**
+         * This is the median of the measured times, in seconds.
+         */
+        double median = 0.0;
+
+        /**
+         * This is the smallest of the measured times, in seconds.
+         */
+        double minimum = 0.0;
+    };
+
+    /**
+     * This function prints to the standard output stream information
+     * about how to use this program.
+     */
+    void PrintUsageInformation() {
+        printf(
+            "Usage: MoonUnitBenchmarks [--tree=TREE]\n"
+            "                          [--files=FILES]\n"
+            "                          [--tests=TESTS]\n"
+            "                          [--asserts=ASSERTS]\n"
+            "                          [--repetitions=REPETITIONS]\n"
+            "                          [--jobs=JOBS]\n"
+            "\n"
+            "   or: MoonUnitBenchmarks --help\n"
+            "\n"
+            "Options:\n"
+            "\n"
+            "    TREE    The relative or absolute path to a folder in which to generate\n"
+            "            the synthetic tree of Lua test files to benchmark against.\n"
+            "            Anything already in the folder may be overwritten.\n"
+            "            If not specified, a folder named 'MoonUnitBenchmarksTree'\n"
+            "            next to the program is used.\n"
+            "\n"
+            "    FILES   The number of Lua test files to generate.\n"
+            "            If not specified, 100 files are generated.\n"
+            "\n"
+            "    TESTS   The number of tests to generate in each Lua test file.\n"
+            "            If not specified, 10 tests are generated in each file.\n"
+            "\n"
+            "    ASSERTS The number of expectations checked by each generated test.\n"
+            "            If not specified, each test checks 10 expectations.\n"
+            "\n"
+            "    REPETITIONS\n"
+            "            The number of times to repeat each measurement.  The median\n"
+            "            and minimum of the measured times are reported.\n"
+            "            If not specified, each measurement is repeated 5 times.\n"
+            "\n"
+            "    JOBS    The number of Lua test files to load at the same time\n"
+            "            while finding tests.\n"
+            "            If not specified, files are loaded one at a time.\n"
+        );
+    }
+
+    /**
+     * Parse the given command-line argument as a positive number.
+     *
+     * @param[in] value
+     *     This is the argument to parse.
+     *
+     * @param[out] number
+     *     This is where to store the number parsed.
+     *
+     * @return
+     *     An indication of whether or not the argument
+     *     is a positive number is returned.
+     */
+    bool ParsePositiveNumber(
+        const std::string& value,
+        size_t& number
+    ) {
+        char* valueEnd = nullptr;
+        number = (size_t)strtoul(value.c_str(), &valueEnd, 10);
+        return (
+            !value.empty()
+            && (*valueEnd == '\0')
+            && (number != 0)
+        );
+    }
+
+    /**
+     * This function updates the program environment to incorporate
+     * any applicable command-line arguments.
+     *
+     * @param[in] argc
+     *     This is the number of command-line arguments given to the program.
+     *
+     * @param[in] argv
+     *     This is the array of command-line arguments given to the program.
+     *
+     * @param[in,out] environment
+     *     This is the environment to update.
+     *
+     * @return
+     *     An indication of whether or not the function succeeded
+     *     is returned.
+     */
+    bool ProcessCommandLineArguments(
+        int argc,
+        char* argv[],
+        Environment& environment
+    ) {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg(argv[i]);
+            static const std::string treeOptionPrefix = "--tree=";
+            static const size_t treeOptionPrefixLength = treeOptionPrefix.length();
+            static const std::string filesOptionPrefix = "--files=";
+            static const size_t filesOptionPrefixLength = filesOptionPrefix.length();
+            static const std::string testsOptionPrefix = "--tests=";
+            static const size_t testsOptionPrefixLength = testsOptionPrefix.length();
+            static const std::string assertsOptionPrefix = "--asserts=";
+            static const size_t assertsOptionPrefixLength = assertsOptionPrefix.length();
+            static const std::string repetitionsOptionPrefix = "--repetitions=";
+            static const size_t repetitionsOptionPrefixLength = repetitionsOptionPrefix.length();
+            static const std::string jobsOptionPrefix = "--jobs=";
+            static const size_t jobsOptionPrefixLength = jobsOptionPrefix.length();
+            if (arg.substr(0, treeOptionPrefixLength) == treeOptionPrefix) {
+                environment.treePath = arg.substr(treeOptionPrefixLength);
+                if (environment.treePath.empty()) {
+                    return false;
+                }
+            } else if (arg.substr(0, filesOptionPrefixLength) == filesOptionPrefix) {
+                if (!ParsePositiveNumber(arg.substr(filesOptionPrefixLength), environment.files)) {
+                    return false;
+                }
+            } else if (arg.substr(0, testsOptionPrefixLength) == testsOptionPrefix) {
+                if (!ParsePositiveNumber(arg.substr(testsOptionPrefixLength), environment.tests)) {
+                    return false;
+                }
+            } else if (arg.substr(0, assertsOptionPrefixLength) == assertsOptionPrefix) {
+                if (!ParsePositiveNumber(arg.substr(assertsOptionPrefixLength), environment.asserts)) {
+                    return false;
+                }
+            } else if (arg.substr(0, repetitionsOptionPrefixLength) == repetitionsOptionPrefix) {
+                if (!ParsePositiveNumber(arg.substr(repetitionsOptionPrefixLength), environment.repetitions)) {
+                    return false;
+                }
+            } else if (arg.substr(0, jobsOptionPrefixLength) == jobsOptionPrefix) {
+                if (!ParsePositiveNumber(arg.substr(jobsOptionPrefixLength), environment.jobs)) {
+                    return false;
+                }
+            } else if (arg == "--help") {
+                environment.helpRequested = true;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Write the given contents to the file at the given path,
+     * replacing anything already there.
+     *
+     * @param[in] path
+     *     This is the path of the file to write.
+     *
+     * @param[in] contents
+     *     These are the contents to write to the file.
+     *
+     * @return
+     *     An indication of whether or not the file was written is returned.
+     */
+    bool WriteFile(
+        const std::string& path,
+        const std::string& contents
+    ) {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (file == NULL) {
+            return false;
+        }
+        const auto written = (fwrite(contents.data(), contents.length(), 1, file) == 1);
+        return (
+            (fclose(file) == 0)
+            && written
+        );
+    }
+
+    /**
+     * Return the contents of the generated Lua test file
+     * with the given index.
+     *
+     * Each file has one test suite, named after the file, containing one
+     * test which does nothing (used to measure the cost of loading the
+     * file), followed by the given number of tests which each check the
+     * given number of expectations.
+     *
+     * @param[in] fileIndex
+     *     This is the index of the file to generate.
+     *
+     * @param[in] tests
+     *     This is the number of tests in the file which check expectations.
+     *
+     * @param[in] asserts
+     *     This is the number of expectations each test checks.
+     *
+     * @return
+     *     The contents of the generated Lua test file are returned.
+     */
+    std::string GenerateTestFile(
+        size_t fileIndex,
+        size_t tests,
+        size_t asserts
+    ) {
+        std::string script = StringExtensions::sprintf(
+            "moonunit:test(\"file%zu\", \"empty\", function()\n"
+            "end)\n",
+            fileIndex
+        );
+        for (size_t i = 0; i < tests; ++i) {
+            script += StringExtensions::sprintf(
+                "\n"
+                "moonunit:test(\"file%zu\", \"test%zu\", function()\n"
+                "    local value = %zu\n"
+                "    for i = 1, %zu do\n"
+                "        moonunit:expect_eq(value + i, %zu + i)\n"
+                "    end\n"
+                "end)\n",
+                fileIndex,
+                i,
+                i,
+                asserts,
+                i
+            );
+        }
+        return script;
+    }
+
+    /**
+     * Generate the synthetic tree of Lua test files.
+     *
+     * The tree has two folders, each with its own configuration file:
+     * "tree", which holds the generated Lua test files, and "micro",
+     * which holds the script used to measure individual operations.
+     *
+     * @param[in] environment
+     *     This holds the settings which determine the size of the tree.
+     *
+     * @return
+     *     An indication of whether or not the tree was generated
+     *     is returned.
+     */
+    bool GenerateTree(const Environment& environment) {
+        const auto& root = environment.treePath;
+        (void)SystemAbstractions::File::DeleteDirectory(root);
+        if (
+            !SystemAbstractions::File::CreateDirectory(root + "/tree")
+            || !SystemAbstractions::File::CreateDirectory(root + "/micro")
+            || !WriteFile(root + "/tree/.moonunit", "tests\n")
+            || !SystemAbstractions::File::CreateDirectory(root + "/tree/tests")
+            || !WriteFile(root + "/micro/.moonunit", "micro.lua\n")
+            || !WriteFile(
+                root + "/micro/micro.lua",
+                StringExtensions::sprintf(
+                    microBenchmarkScript,
+                    (int)environment.asserts,
+                    (int)environment.asserts
+                )
+            )
+        ) {
+            return false;
+        }
+        for (size_t i = 0; i < environment.files; ++i) {
+            if (
+                !WriteFile(
+                    StringExtensions::sprintf(
+                        "%s/tree/tests/file%zu.lua",
+                        root.c_str(),
+                        i
+                    ),
+                    GenerateTestFile(i, environment.tests, environment.asserts)
+                )
+            ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Call the given function the given number of times, and return
+     * the summary of how long each call took.
+     *
+     * @param[in] repetitions
+     *     This is the number of times to call the function.
+     *
+     * @param[in] setUp
+     *     This is the function to call before each timed call,
+     *     without timing it.
+     *
+     * @param[in] benchmark
+     *     This is the function to time.
+     *
+     * @return
+     *     The summary of the measured times is returned.
+     */
+    Measurement Measure(
+        size_t repetitions,
+        std::function< void() > setUp,
+        std::function< void() > benchmark
+    ) {
+        std::vector< double > times;
+        for (size_t i = 0; i < repetitions; ++i) {
+            setUp();
+            const auto start = std::chrono::steady_clock::now();
+            benchmark();
+            const auto end = std::chrono::steady_clock::now();
+            times.push_back(std::chrono::duration< double >(end - start).count());
+        }
+        std::sort(times.begin(), times.end());
+        Measurement measurement;
+        measurement.minimum = times.front();
+        measurement.median = (
+            ((times.size() % 2) == 0)
+            ? (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2.0
+            : times[times.size() / 2]
+        );
+        return measurement;
+    }
+
+    /**
+     * Print the given measurement, scaled to the time per unit of work.
+     *
+     * @param[in] name
+     *     This is the name of the benchmark.
+     *
+     * @param[in] measurement
+     *     This is the measurement to print.
+     *
+     * @param[in] units
+     *     This is the number of units of work done in each measured call.
+     *
+     * @param[in] unitName
+     *     This is the name of the unit of work.
+     */
+    void PrintMeasurement(
+        const std::string& name,
+        const Measurement& measurement,
+        size_t units,
+        const std::string& unitName
+    ) {
+        printf(
+            "[    BENCH ] %-20s median %12.1f ns, min %12.1f ns per %s\n",
+            name.c_str(),
+            measurement.median * 1e9 / (double)units,
+            measurement.minimum * 1e9 / (double)units,
+            unitName.c_str()
+        );
+    }
+
+    /**
+     * Configure the given runner using the given configuration file,
+     * and return whether or not it was configured without errors.
+     *
+     * @param[in,out] runner
+     *     This is the runner to configure.
+     *
+     * @param[in] configurationFilePath
+     *     This is the path to the configuration file to use.
+     *
+     * @return
+     *     An indication of whether or not the runner was configured
+     *     without errors is returned.
+     */
+    bool Configure(
+        Runner& runner,
+        const std::string& configurationFilePath
+    ) {
+        bool configured = true;
+        SystemAbstractions::File configurationFile(configurationFilePath);
+        runner.Configure(
+            configurationFile,
+            [&configured](const std::string& message){
+                (void)fwrite(message.data(), message.length(), 1, stderr);
+                configured = false;
+            }
+        );
+        return configured;
+    }
+
+    /**
+     * Run the given test, reporting any errors.
+     *
+     * @param[in] runner
+     *     This is the runner to use to run the test.
+     *
+     * @param[in] testSuiteName
+     *     This is the name of the test suite containing the test.
+     *
+     * @param[in] testName
+     *     This is the name of the test.
+     *
+     * @param[in,out] passed
+     *     This is cleared if the test fails.
+     */
+    void RunTest(
+        Runner& runner,
+        const std::string& testSuiteName,
+        const std::string& testName,
+        bool& passed
+    ) {
+        if (
+            !runner.RunTest(
+                testSuiteName,
+                testName,
+                [](const std::string& message){
+                    (void)fwrite(message.data(), message.length(), 1, stderr);
+                }
+            )
+        ) {
+            passed = false;
+        }
+    }
+
+}
+
+/**
+ * This function is the entrypoint of the program.
+ *
+ * @param[in] argc
+ *     This is the number of command-line arguments given to the program.
+ *
+ * @param[in] argv
+ *     This is the array of command-line arguments given to the program.
+ */
+int main(int argc, char* argv[]) {
+    // Process command line.
+    Environment environment;
+    if (!ProcessCommandLineArguments(argc, argv, environment)) {
+        PrintUsageInformation();
+        return EXIT_FAILURE;
+    }
+    if (environment.helpRequested) {
+        PrintUsageInformation();
+        return EXIT_SUCCESS;
+    }
+    if (environment.treePath.empty()) {
+        environment.treePath = (
+            SystemAbstractions::File::GetExeParentDirectory()
+            + "/MoonUnitBenchmarksTree"
+        );
+    }
+
+    // Generate the synthetic tree of Lua test files.
+    if (!GenerateTree(environment)) {
+        fprintf(
+            stderr,
+            "ERROR: Unable to generate tree of Lua test files in '%s'\n",
+            environment.treePath.c_str()
+        );
+        return EXIT_FAILURE;
+    }
+    const auto treeConfigurationFilePath = environment.treePath + "/tree/.moonunit";
+    const auto microConfigurationFilePath = environment.treePath + "/micro/.moonunit";
+    const auto discoveryIndexPath = environment.treePath + "/tree/.moonunit-cache";
+    const auto numTests = environment.files * (environment.tests + 1);
+    Runner::Options options;
+    options.jobs = environment.jobs;
+    printf(
+        "[==========] Benchmarking with %zu files x %zu tests x %zu asserts, %zu repetitions.\n",
+        environment.files,
+        environment.tests,
+        environment.asserts,
+        environment.repetitions
+    );
+    bool passed = true;
+
+    // Measure finding tests, by executing every Lua test file,
+    // and by using a discovery index of the unchanged files.
+    std::unique_ptr< Runner > runner;
+    const auto newRunner = [&]{
+        runner.reset(new Runner());
+        runner->SetOptions(options);
+    };
+    const auto discovery = Measure(
+        environment.repetitions,
+        newRunner,
+        [&]{
+            passed &= Configure(*runner, treeConfigurationFilePath);
+        }
+    );
+    PrintMeasurement("discovery", discovery, environment.files, "file");
+    PrintMeasurement("discovery", discovery, numTests, "test");
+    if (runner->SaveDiscoveryIndex(discoveryIndexPath)) {
+        const auto discoveryCached = Measure(
+            environment.repetitions,
+            [&]{
+                newRunner();
+                runner->LoadDiscoveryIndex(discoveryIndexPath);
+            },
+            [&]{
+                passed &= Configure(*runner, treeConfigurationFilePath);
+            }
+        );
+        PrintMeasurement("discovery (cached)", discoveryCached, environment.files, "file");
+    }
+
+    // Measure running every test in the tree, and generating the report.
+    std::vector< std::pair< std::string, std::vector< Reporter::TestResult > > > results;
+    const auto run = Measure(
+        environment.repetitions,
+        [&]{
+            results.clear();
+        },
+        [&]{
+            runner->VisitTests(
+                [&](
+                    Runner::TestId testId,
+                    const std::string& testSuiteName,
+                    const std::string& testName
+                ){
+                    if (
+                        results.empty()
+                        || (results.back().first != testSuiteName)
+                    ) {
+                        results.emplace_back(testSuiteName, std::vector< Reporter::TestResult >());
+                    }
+                    Reporter::TestResult result;
+                    result.testName = testName;
+                    result.ran = true;
+                    result.passed = runner->RunTest(
+                        testId,
+                        [](const std::string& message){
+                            (void)fwrite(message.data(), message.length(), 1, stderr);
+                        },
+                        &result.metrics
+                    );
+                    (void)runner->GetTestLocation(testId, result.filePath, result.lineNumber);
+                    passed &= result.passed;
+                    results.back().second.push_back(std::move(result));
+                }
+            );
+        }
+    );
+    PrintMeasurement("run", run, numTests, "test");
+    for (const auto format: {Reporter::Format::Xml, Reporter::Format::Json}) {
+        const auto reportGeneration = Measure(
+            environment.repetitions,
+            []{},
+            [&]{
+                Reporter reporter(format, false);
+                if (!reporter.Open(environment.treePath + "/report", numTests)) {
+                    passed = false;
+                    return;
+                }
+                for (const auto& testSuite: results) {
+                    reporter.BeginTestSuite(testSuite.first, testSuite.second.size());
+                    for (const auto& result: testSuite.second) {
+                        reporter.ReportTest(result);
+                    }
+                    reporter.EndTestSuite();
+                }
+                passed &= reporter.Close();
+            }
+        );
+        PrintMeasurement(
+            ((format == Reporter::Format::Xml) ? "report (xml)" : "report (json)"),
+            reportGeneration,
+            numTests,
+            "test"
+        );
+    }
+
+    // Measure individual operations.  Every test runs in a fresh Lua
+    // interpreter, after executing its script, so the cost of creating
+    // the interpreter is measured with an empty test in a tiny script;
+    // the cost of loading a generated file is the extra time taken
+    // by an empty test in that file; and the cost of each expectation
+    // is the extra time taken by a test which checks expectations,
+    // divided by the number checked.
+    Runner microRunner;
+    passed &= Configure(microRunner, microConfigurationFilePath);
+    const auto repeatTest = [&](Runner& testRunner, const std::string& testSuiteName, const std::string& testName){
+        return Measure(
+            environment.repetitions,
+            []{},
+            [&]{
+                for (size_t i = 0; i < environment.files; ++i) {
+                    RunTest(testRunner, testSuiteName, testName, passed);
+                }
+            }
+        );
+    };
+    const auto emptyTest = repeatTest(microRunner, "micro", "empty");
+    PrintMeasurement("state creation", emptyTest, environment.files, "test");
+
+    // Measure the same empty test run in an interpreter prepared ahead of
+    // time, as with '--isolate=fork', where each test runs in a copy of a
+    // template made once per worker.  The difference from the above is
+    // what the template saves each test, before the cost of forking.
+    const auto preparedEmptyTest = Measure(
+        environment.repetitions * environment.files,
+        [&]{ microRunner.PrepareInterpreter(); },
+        [&]{ RunTest(microRunner, "micro", "empty", passed); }
+    );
+    PrintMeasurement("prepared state", preparedEmptyTest, 1, "test");
+    const auto generatedFileTest = repeatTest(*runner, "file0", "empty");
+    Measurement scriptLoad;
+    scriptLoad.median = std::max(0.0, generatedFileTest.median - emptyTest.median);
+    scriptLoad.minimum = std::max(0.0, generatedFileTest.minimum - emptyTest.minimum);
+    PrintMeasurement("script load", scriptLoad, environment.files, "file");
+    for (const auto& testName: std::vector< std::string >{"scalars", "tables"}) {
+        const auto test = repeatTest(microRunner, "micro", testName);
+        Measurement expectation;
+        expectation.median = std::max(0.0, test.median - emptyTest.median);
+        expectation.minimum = std::max(0.0, test.minimum - emptyTest.minimum);
+        PrintMeasurement(
+            "expect_eq " + testName,
+            expectation,
+            environment.files * environment.asserts,
+            "assert"
+        );
+    }
+    if (!passed) {
+        printf("[  FAILED  ] Some Lua test files or tests had errors.\n");
+        return EXIT_FAILURE;
+    }
+    printf("[==========] Done.\n");
+    return EXIT_SUCCESS;
+}
@@ -5,6 +5,23 @@ if not moonunit then return end
 
 require("example-code")
 
+local squares
+
+moonunit:suite_setup("examples_passing", function()
+    squares = {}
+    for i = 1, 10 do
+        squares[i] = square(i)
+    end
+end)
+
+moonunit:suite_teardown("examples_passing", function()
+    squares = nil
+end)
+
+moonunit:test("examples_passing", "square_from_suite_setup", function()
+    moonunit:expect_eq(25, squares[5])
+end)
+
 moonunit:test("examples_passing", "square_zero", function()
     local x = 0
     local y = square(x)
@@ -41,6 +58,30 @@ moonunit:test("examples_passing", "buggy_abs_should_pass", function()
     moonunit:expect_eq(5, buggy_abs(-5))
 end)
 
+moonunit:test("examples_passing", "square_arrays", function()
+    local x = {}
+    local y = {}
+    for i = 1, 10 do
+        x[i] = i * i
+        y[i] = square(i)
+    end
+    moonunit:expect_all_eq(x, y)
+    moonunit:assert_all_eq(x, y)
+    moonunit:expect_all_near({1, 4, 9}, {square(1.0001), square(2), square(3)}, 1e-3)
+    moonunit:assert_all_near({1, 4, 9}, {square(1.0001), square(2), square(3)}, 1e-3)
+    moonunit:expect_sorted(y)
+    moonunit:assert_sorted(y)
+end)
+
+moonunit:async_test("examples_passing", "delayed_square", function()
+    local result = moonunit:future()
+    moonunit:spawn(function()
+        moonunit:sleep(0.01)
+        result:resolve(square(5))
+    end)
+    moonunit:expect_eq(25, moonunit:await(result))
+end)
+
 moonunit:test("examples_failing", "square_non_zero", function()
     local x = 5
     local y = square(x)
@@ -127,3 +168,64 @@ moonunit:test("examples_failing", "buggy_abs_should_fail_but_continue", function
     moonunit:expect_eq(1, buggy_abs(-1))
     moonunit:expect_eq(1, buggy_abs(-1))
 end)
+
+moonunit:test("examples_failing", "buggy_abs_arrays", function()
+    local x = {}
+    for i = -3, 3 do
+        x[#x + 1] = buggy_abs(i)
+    end
+    moonunit:expect_all_eq({3, 2, 1, 0, 1, 2, 3}, x)
+    moonunit:expect_all_near({3, 2, 1, 0, 1, 2, 3}, x, 0.5)
+    moonunit:expect_sorted(x)
+end)
+
+moonunit:test("examples_failing", "buggy_abs_arrays_all_eq", function()
+    moonunit:assert_all_eq({1, 0, 1}, {buggy_abs(-1), buggy_abs(0), buggy_abs(1)})
+    moonunit:assert_true(false)
+end)
+
+moonunit:test("examples_failing", "buggy_abs_arrays_all_near", function()
+    moonunit:assert_all_near({1, 0, 1}, {buggy_abs(-1), buggy_abs(0), buggy_abs(1)}, 0.5)
+    moonunit:assert_true(false)
+end)
+
+moonunit:test("examples_failing", "buggy_abs_arrays_sorted", function()
+    moonunit:assert_sorted({buggy_abs(0), buggy_abs(-1), buggy_abs(-2)})
+    moonunit:assert_true(false)
+end)
+
+moonunit:async_test("examples_failing", "delayed_buggy_abs", function()
+    local result = moonunit:future()
+    moonunit:spawn(function()
+        moonunit:sleep(0.01)
+        result:resolve(buggy_abs(-1))
+    end)
+    moonunit:expect_eq(1, moonunit:await(result))
+end)
+
+moonunit:async_test("examples_failing", "delayed_buggy_abs_in_task", function()
+    moonunit:spawn(function()
+        moonunit:sleep(0.01)
+        moonunit:assert_eq(1, buggy_abs(-1))
+    end)
+end)
+
+moonunit:async_test("examples_failing", "never_resolved", function()
+    moonunit:await(moonunit:future())
+end)
+
+moonunit:suite_setup("examples_failing_suite_setup", function()
+    moonunit:assert_eq(1, buggy_abs(-1))
+end)
+
+moonunit:test("examples_failing_suite_setup", "buggy_abs_should_not_run", function()
+    moonunit:expect_eq(5, buggy_abs(-5))
+end)
+
+moonunit:benchmark("examples_passing", "square", function()
+    moonunit:expect_eq(25, square(5))
+end)
+
+moonunit:benchmark("examples_failing", "buggy_abs_should_fail", function()
+    moonunit:expect_eq(1, buggy_abs(-1))
+end)
@@ -0,0 +1,227 @@
+/**
+ * @file Arena.cpp
+ *
+ * This module contains the implementation of the Arena class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Arena.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+
+    /**
+     * This is the difference in size between one size class
+     * and the next.  It's also the alignment of every block.
+     */
+    constexpr size_t sizeClassGranularity = 16;
+
+    /**
+     * This is the number of size classes.  Blocks larger than the
+     * largest size class are passed through to the system allocator.
+     */
+    constexpr size_t numSizeClasses = 32;
+
+    /**
+     * This is the size of the largest block carved out of a chunk.
+     */
+    constexpr size_t maxBlockSize = sizeClassGranularity * numSizeClasses;
+
+    /**
+     * This is the size of each chunk out of which blocks are carved.
+     */
+    constexpr size_t chunkSize = 64 * 1024;
+
+    /**
+     * Return the index of the size class for blocks of the given size.
+     *
+     * @param[in] size
+     *     This is the size of the block, which must be nonzero and no
+     *     larger than the largest size class.
+     *
+     * @return
+     *     The index of the size class for blocks of the given size
+     *     is returned.
+     */
+    size_t SizeClass(size_t size) {
+        return (size - 1) / sizeClassGranularity;
+    }
+
+    /**
+     * This is overlaid on top of each free block to link it to
+     * the next free block of the same size class.
+     */
+    struct FreeBlock {
+        /**
+         * This points to the next free block of the same size class.
+         */
+        FreeBlock* next;
+    };
+
+}
+
+/**
+ * This is the internal interface/implementation of the Arena class.
+ */
+struct Arena::Impl {
+    // Properties
+
+    /**
+     * These are the chunks out of which blocks are carved.
+     */
+    std::vector< char* > chunks;
+
+    /**
+     * This is the index of the chunk from which new blocks
+     * are currently being carved.
+     */
+    size_t currentChunk = 0;
+
+    /**
+     * This is the offset in the current chunk of the next block to carve.
+     */
+    size_t nextBlockOffset = chunkSize;
+
+    /**
+     * These are the heads of the lists of freed blocks,
+     * one list per size class.
+     */
+    FreeBlock* freeBlocks[numSizeClasses] = {};
+
+    // Methods
+
+    /**
+     * Allocate a block of the given size class.
+     *
+     * @param[in] sizeClass
+     *     This is the index of the size class of the block to allocate.
+     *
+     * @return
+     *     A pointer to the allocated block is returned, or NULL is returned
+     *     if the memory could not be allocated.
+     */
+    void* Allocate(size_t sizeClass) {
+        auto& freeBlock = freeBlocks[sizeClass];
+        if (freeBlock != nullptr) {
+            const auto block = freeBlock;
+            freeBlock = block->next;
+            return block;
+        }
+        const auto blockSize = (sizeClass + 1) * sizeClassGranularity;
+        if (nextBlockOffset + blockSize > chunkSize) {
+            if (chunks.empty()) {
+                currentChunk = 0;
+            } else {
+                ++currentChunk;
+            }
+            if (currentChunk == chunks.size()) {
+                const auto chunk = (char*)malloc(chunkSize);
+                if (chunk == NULL) {
+                    if (currentChunk > 0) {
+                        --currentChunk;
+                    }
+                    return NULL;
+                }
+                chunks.push_back(chunk);
+            }
+            nextBlockOffset = 0;
+        }
+        const auto block = chunks[currentChunk] + nextBlockOffset;
+        nextBlockOffset += blockSize;
+        return block;
+    }
+
+    /**
+     * Return the given block of the given size class to the arena.
+     *
+     * @param[in] block
+     *     This points to the block to free.
+     *
+     * @param[in] sizeClass
+     *     This is the index of the size class of the block.
+     */
+    void Free(void* block, size_t sizeClass) {
+        const auto freeBlock = (FreeBlock*)block;
+        freeBlock->next = freeBlocks[sizeClass];
+        freeBlocks[sizeClass] = freeBlock;
+    }
+};
+
+Arena::~Arena() noexcept {
+    if (impl_ == nullptr) {
+        return;
+    }
+    for (const auto chunk: impl_->chunks) {
+        free(chunk);
+    }
+}
+Arena::Arena(Arena&&) noexcept = default;
+Arena& Arena::operator=(Arena&&) noexcept = default;
+
+Arena::Arena()
+    : impl_(new Impl())
+{
+}
+
+void* Arena::Reallocate(
+    void* block,
+    size_t oldSize,
+    size_t newSize
+) {
+    if (block == NULL) {
+        oldSize = 0;
+    }
+    const auto oldSmall = ((oldSize > 0) && (oldSize <= maxBlockSize));
+    if (newSize == 0) {
+        if (oldSmall) {
+            impl_->Free(block, SizeClass(oldSize));
+        } else {
+            free(block);
+        }
+        return NULL;
+    }
+    const auto newSmall = (newSize <= maxBlockSize);
+    if (
+        !oldSmall
+        && !newSmall
+    ) {
+        return realloc(block, newSize);
+    }
+    if (
+        oldSmall
+        && newSmall
+        && (SizeClass(oldSize) == SizeClass(newSize))
+    ) {
+        return block;
+    }
+    void* newBlock;
+    if (newSmall) {
+        newBlock = impl_->Allocate(SizeClass(newSize));
+    } else {
+        newBlock = malloc(newSize);
+    }
+    if (newBlock == NULL) {
+        return NULL;
+    }
+    if (block != NULL) {
+        (void)memcpy(newBlock, block, (oldSize < newSize) ? oldSize : newSize);
+        if (oldSmall) {
+            impl_->Free(block, SizeClass(oldSize));
+        } else {
+            free(block);
+        }
+    }
+    return newBlock;
+}
+
+void Arena::Reset() {
+    for (auto& freeBlock: impl_->freeBlocks) {
+        freeBlock = nullptr;
+    }
+    impl_->currentChunk = 0;
+    impl_->nextBlockOffset = (impl_->chunks.empty() ? chunkSize : 0);
+}
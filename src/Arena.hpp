@@ -0,0 +1,94 @@
+#ifndef MOON_UNIT_ARENA_HPP
+#define MOON_UNIT_ARENA_HPP
+
+/**
+ * @file Arena.hpp
+ *
+ * This module declares the Arena class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+
+/**
+ * This class is a memory allocator which carves small blocks out of large
+ * chunks, keeping freed blocks on lists sorted by size class for reuse,
+ * and which can release all of its blocks at once, to be reused again
+ * from the beginning.  It's meant for short-lived users, such as Lua
+ * interpreters which are thrown away after each test, where the cost of
+ * returning each block individually to the system isn't worth paying.
+ *
+ * Blocks larger than the largest size class are passed through
+ * to the system allocator.
+ *
+ * An arena is not safe to use from more than one thread at a time.
+ */
+class Arena {
+    // Lifecycle Methods
+public:
+    ~Arena() noexcept;
+    Arena(const Arena&) = delete;
+    Arena(Arena&&) noexcept;
+    Arena& operator=(const Arena&) = delete;
+    Arena& operator=(Arena&&) noexcept;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     */
+    Arena();
+
+    /**
+     * Allocate, reallocate, or free a block of memory, following the
+     * same rules as the allocation functions given to Lua interpreters.
+     *
+     * @param[in] block
+     *     If not NULL, this points to the block to be freed or reallocated.
+     *
+     * @param[in] oldSize
+     *     This is the size of the block pointed to by "block",
+     *     if it's not NULL.
+     *
+     * @param[in] newSize
+     *     This is the size of the block to allocate or reallocate,
+     *     or zero if the given block should be freed instead.
+     *
+     * @return
+     *     A pointer to the allocated or reallocated block is returned, or
+     *     NULL is returned if the given block was freed or if the memory
+     *     could not be allocated.
+     */
+    void* Reallocate(
+        void* block,
+        size_t oldSize,
+        size_t newSize
+    );
+
+    /**
+     * Release all blocks carved out of the arena's chunks at once,
+     * keeping the chunks so they can be reused for future allocations.
+     * Any blocks still in use become invalid.  Blocks passed through
+     * to the system allocator are not affected, and must be freed
+     * individually.
+     */
+    void Reset();
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
+
+#endif /* MOON_UNIT_ARENA_HPP */
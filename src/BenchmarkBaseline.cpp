@@ -0,0 +1,319 @@
+/**
+ * @file BenchmarkBaseline.cpp
+ *
+ * This module contains the implementation of the BenchmarkBaseline class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "BenchmarkBaseline.hpp"
+
+#include <Json/Value.hpp>
+#include <limits>
+#include <map>
+#include <math.h>
+#include <utility>
+
+namespace {
+
+    /**
+     * This holds the summary statistics of the samples of a benchmark.
+     */
+    struct Summary {
+        /**
+         * This is the number of samples.
+         */
+        size_t numSamples = 0;
+
+        /**
+         * This is the mean of the samples.
+         */
+        double mean = 0.0;
+
+        /**
+         * This is the sample variance of the samples.
+         */
+        double variance = 0.0;
+    };
+
+    /**
+     * Return the summary statistics of the given samples.
+     *
+     * @param[in] samples
+     *     These are the samples to summarize.
+     *
+     * @return
+     *     The summary statistics of the given samples are returned.
+     */
+    Summary Summarize(const std::vector< double >& samples) {
+        Summary summary;
+        summary.numSamples = samples.size();
+        if (samples.empty()) {
+            return summary;
+        }
+        double sum = 0.0;
+        for (const auto sample: samples) {
+            sum += sample;
+        }
+        summary.mean = sum / (double)samples.size();
+        if (samples.size() > 1) {
+            double sumOfSquares = 0.0;
+            for (const auto sample: samples) {
+                sumOfSquares += (sample - summary.mean) * (sample - summary.mean);
+            }
+            summary.variance = sumOfSquares / (double)(samples.size() - 1);
+        }
+        return summary;
+    }
+
+    /**
+     * Evaluate the continued fraction used to compute the regularized
+     * incomplete beta function, using the modified Lentz method.
+     *
+     * @param[in] a
+     *     This is the first shape parameter of the beta function.
+     *
+     * @param[in] b
+     *     This is the second shape parameter of the beta function.
+     *
+     * @param[in] x
+     *     This is the point at which to evaluate the function.
+     *
+     * @return
+     *     The value of the continued fraction is returned.
+     */
+    double IncompleteBetaContinuedFraction(double a, double b, double x) {
+        constexpr int maxIterations = 200;
+        constexpr double epsilon = 1e-14;
+        constexpr double tiny = 1e-300;
+        double c = 1.0;
+        double d = 1.0 - (a + b) * x / (a + 1.0);
+        if (fabs(d) < tiny) {
+            d = tiny;
+        }
+        d = 1.0 / d;
+        double h = d;
+        for (int m = 1; m <= maxIterations; ++m) {
+            const double m2 = 2.0 * m;
+            double aa = m * (b - m) * x / ((a + m2 - 1.0) * (a + m2));
+            d = 1.0 + aa * d;
+            if (fabs(d) < tiny) {
+                d = tiny;
+            }
+            c = 1.0 + aa / c;
+            if (fabs(c) < tiny) {
+                c = tiny;
+            }
+            d = 1.0 / d;
+            h *= d * c;
+            aa = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1.0));
+            d = 1.0 + aa * d;
+            if (fabs(d) < tiny) {
+                d = tiny;
+            }
+            c = 1.0 + aa / c;
+            if (fabs(c) < tiny) {
+                c = tiny;
+            }
+            d = 1.0 / d;
+            const double delta = d * c;
+            h *= delta;
+            if (fabs(delta - 1.0) < epsilon) {
+                break;
+            }
+        }
+        return h;
+    }
+
+    /**
+     * Return the regularized incomplete beta function I_x(a, b).
+     *
+     * @param[in] a
+     *     This is the first shape parameter of the beta function.
+     *
+     * @param[in] b
+     *     This is the second shape parameter of the beta function.
+     *
+     * @param[in] x
+     *     This is the point at which to evaluate the function,
+     *     which must be between zero and one.
+     *
+     * @return
+     *     The value of the regularized incomplete beta function
+     *     is returned.
+     */
+    double RegularizedIncompleteBeta(double a, double b, double x) {
+        if (x <= 0.0) {
+            return 0.0;
+        }
+        if (x >= 1.0) {
+            return 1.0;
+        }
+        const double front = exp(
+            lgamma(a + b) - lgamma(a) - lgamma(b)
+            + a * log(x) + b * log(1.0 - x)
+        );
+        if (x < (a + 1.0) / (a + b + 2.0)) {
+            return front * IncompleteBetaContinuedFraction(a, b, x) / a;
+        } else {
+            return 1.0 - front * IncompleteBetaContinuedFraction(b, a, 1.0 - x) / b;
+        }
+    }
+
+    /**
+     * Return the probability that a random variable following Student's
+     * t-distribution with the given degrees of freedom exceeds
+     * the given value.
+     *
+     * @param[in] t
+     *     This is the value of the t statistic.
+     *
+     * @param[in] degreesOfFreedom
+     *     This is the number of degrees of freedom of the distribution.
+     *
+     * @return
+     *     The upper tail probability of the t-distribution is returned.
+     */
+    double StudentTUpperTail(double t, double degreesOfFreedom) {
+        const double tail = 0.5 * RegularizedIncompleteBeta(
+            degreesOfFreedom / 2.0,
+            0.5,
+            degreesOfFreedom / (degreesOfFreedom + t * t)
+        );
+        return (t > 0.0) ? tail : 1.0 - tail;
+    }
+
+    /**
+     * Return the one-sided p-value of Welch's t-test for the hypothesis
+     * that the mean of the new samples is greater than the mean of the
+     * baseline samples.
+     *
+     * @param[in] baseline
+     *     This summarizes the baseline samples.
+     *
+     * @param[in] current
+     *     This summarizes the new samples.
+     *
+     * @return
+     *     The one-sided p-value of the test is returned.
+     */
+    double WelchTTestPValue(
+        const Summary& baseline,
+        const Summary& current
+    ) {
+        if (
+            (baseline.numSamples < 2)
+            || (current.numSamples < 2)
+        ) {
+            return 1.0;
+        }
+        const double baselineError = baseline.variance / (double)baseline.numSamples;
+        const double currentError = current.variance / (double)current.numSamples;
+        const double standardError = sqrt(baselineError + currentError);
+        if (standardError == 0.0) {
+            return (current.mean > baseline.mean) ? 0.0 : 1.0;
+        }
+        const double t = (current.mean - baseline.mean) / standardError;
+        const double degreesOfFreedom = (
+            (baselineError + currentError) * (baselineError + currentError)
+            / (
+                baselineError * baselineError / (double)(baseline.numSamples - 1)
+                + currentError * currentError / (double)(current.numSamples - 1)
+            )
+        );
+        return StudentTUpperTail(t, degreesOfFreedom);
+    }
+
+}
+
+/**
+ * This is the internal interface/implementation of the BenchmarkBaseline
+ * class.
+ */
+struct BenchmarkBaseline::Impl {
+    /**
+     * This is the smallest relative slowdown of a benchmark's mean
+     * time considered a regression.
+     */
+    double threshold = 0.0;
+
+    /**
+     * This is the largest p-value at which a slowdown
+     * is considered statistically significant.
+     */
+    double significanceLevel = 0.0;
+
+    /**
+     * These are the summaries of the samples of the benchmarks
+     * in the baseline, keyed by benchmark suite name and benchmark name.
+     */
+    std::map< std::pair< std::string, std::string >, Summary > benchmarks;
+};
+
+BenchmarkBaseline::~BenchmarkBaseline() noexcept = default;
+BenchmarkBaseline::BenchmarkBaseline(BenchmarkBaseline&&) noexcept = default;
+BenchmarkBaseline& BenchmarkBaseline::operator=(BenchmarkBaseline&&) noexcept = default;
+
+BenchmarkBaseline::BenchmarkBaseline(
+    double threshold,
+    double significanceLevel
+)
+    : impl_(new Impl())
+{
+    impl_->threshold = threshold;
+    impl_->significanceLevel = significanceLevel;
+}
+
+bool BenchmarkBaseline::Load(const std::string& encoding) {
+    impl_->benchmarks.clear();
+    const auto results = Json::Value::FromEncoding(encoding);
+    if (
+        (results.GetType() != Json::Value::Type::Object)
+        || !results.Has("benchmarks")
+    ) {
+        return false;
+    }
+    const auto& benchmarks = results["benchmarks"];
+    for (size_t i = 0; i < benchmarks.GetSize(); ++i) {
+        const auto& benchmark = benchmarks[i];
+        const auto& encodedSamples = benchmark["samples"];
+        std::vector< double > samples;
+        for (size_t j = 0; j < encodedSamples.GetSize(); ++j) {
+            samples.push_back((double)encodedSamples[j]);
+        }
+        impl_->benchmarks[
+            std::make_pair(
+                (std::string)benchmark["suite"],
+                (std::string)benchmark["name"]
+            )
+        ] = Summarize(samples);
+    }
+    return true;
+}
+
+auto BenchmarkBaseline::Compare(
+    const std::string& benchmarkSuiteName,
+    const std::string& benchmarkName,
+    const std::vector< double >& samples
+) const -> Comparison {
+    Comparison comparison;
+    const auto benchmarksEntry = impl_->benchmarks.find(
+        std::make_pair(benchmarkSuiteName, benchmarkName)
+    );
+    if (benchmarksEntry == impl_->benchmarks.end()) {
+        return comparison;
+    }
+    const auto& baseline = benchmarksEntry->second;
+    const auto current = Summarize(samples);
+    comparison.found = true;
+    comparison.baselineMean = baseline.mean;
+    if (baseline.mean > 0.0) {
+        comparison.change = (current.mean - baseline.mean) / baseline.mean;
+    }
+    comparison.pValue = WelchTTestPValue(baseline, current);
+    comparison.regression = (
+        (comparison.change > impl_->threshold)
+        && (comparison.pValue < impl_->significanceLevel)
+    );
+    return comparison;
+}
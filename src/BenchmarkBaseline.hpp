@@ -0,0 +1,140 @@
+#ifndef MOON_UNIT_BENCHMARK_BASELINE_HPP
+#define MOON_UNIT_BENCHMARK_BASELINE_HPP
+
+/**
+ * @file BenchmarkBaseline.hpp
+ *
+ * This module declares the BenchmarkBaseline class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * This class holds the results of a previous run of benchmarks, and
+ * compares the results of new runs against them, to find statistically
+ * significant slowdowns.
+ */
+class BenchmarkBaseline {
+    // Types
+public:
+    /**
+     * This holds the outcome of comparing a benchmark's results with
+     * the results of the same benchmark in the baseline.
+     */
+    struct Comparison {
+        /**
+         * This flag indicates whether or not the benchmark was found
+         * in the baseline.  If not, the other fields are not used.
+         */
+        bool found = false;
+
+        /**
+         * This is the mean time, in nanoseconds per iteration,
+         * of the benchmark in the baseline.
+         */
+        double baselineMean = 0.0;
+
+        /**
+         * This is the relative change of the mean time of the benchmark,
+         * compared to the baseline, where positive values mean the
+         * benchmark got slower (for example, 0.1 means 10% slower).
+         */
+        double change = 0.0;
+
+        /**
+         * This is the probability (one-sided p-value of Welch's t-test)
+         * of seeing a slowdown at least this large if the benchmark
+         * didn't actually get slower.
+         */
+        double pValue = 1.0;
+
+        /**
+         * This flag indicates whether or not the benchmark got slower
+         * by more than the threshold, with statistical significance.
+         */
+        bool regression = false;
+    };
+
+    // Lifecycle Methods
+public:
+    ~BenchmarkBaseline() noexcept;
+    BenchmarkBaseline(const BenchmarkBaseline&) = delete;
+    BenchmarkBaseline(BenchmarkBaseline&&) noexcept;
+    BenchmarkBaseline& operator=(const BenchmarkBaseline&) = delete;
+    BenchmarkBaseline& operator=(BenchmarkBaseline&&) noexcept;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     *
+     * @param[in] threshold
+     *     This is the smallest relative slowdown of a benchmark's mean
+     *     time (for example, 0.05 for 5%) considered a regression.
+     *
+     * @param[in] significanceLevel
+     *     This is the largest p-value at which a slowdown
+     *     is considered statistically significant.
+     */
+    BenchmarkBaseline(
+        double threshold,
+        double significanceLevel
+    );
+
+    /**
+     * Load the baseline from the encoding of benchmark results,
+     * in the format written by the "--benchmark_out" option.
+     *
+     * @param[in] encoding
+     *     This is the encoding of the benchmark results to use
+     *     as the baseline.
+     *
+     * @return
+     *     An indication of whether or not the baseline
+     *     was loaded is returned.
+     */
+    bool Load(const std::string& encoding);
+
+    /**
+     * Compare the given samples of the benchmark with the given name
+     * with the samples of the same benchmark in the baseline.
+     *
+     * @param[in] benchmarkSuiteName
+     *     This is the name of the benchmark suite containing the benchmark.
+     *
+     * @param[in] benchmarkName
+     *     This is the name of the benchmark.
+     *
+     * @param[in] samples
+     *     These are the new samples of the benchmark, each the mean time,
+     *     in nanoseconds, of one iteration in a batch of iterations.
+     *
+     * @return
+     *     The outcome of the comparison is returned.
+     */
+    Comparison Compare(
+        const std::string& benchmarkSuiteName,
+        const std::string& benchmarkName,
+        const std::vector< double >& samples
+    ) const;
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
+
+#endif /* MOON_UNIT_BENCHMARK_BASELINE_HPP */
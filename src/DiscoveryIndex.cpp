@@ -0,0 +1,263 @@
+/**
+ * @file DiscoveryIndex.cpp
+ *
+ * This module contains the implementation of the DiscoveryIndex class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "DiscoveryIndex.hpp"
+
+#include <Json/Value.hpp>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <StringExtensions/StringExtensions.hpp>
+#include <SystemAbstractions/File.hpp>
+
+namespace {
+
+    /**
+     * This identifies the format of the saved index.  It should be changed
+     * whenever the format changes, or whenever the way tests are found
+     * changes, so that indexes saved by other versions are not used.
+     */
+    constexpr int discoveryIndexVersion = 5;
+
+    /**
+     * Return the given unsigned integer encoded as a string.  Integers are
+     * stored as strings because JSON numbers can't hold all 64-bit values.
+     *
+     * @param[in] value
+     *     This is the value to encode.
+     *
+     * @return
+     *     The encoded value is returned.
+     */
+    std::string EncodeUnsigned(uint64_t value) {
+        return StringExtensions::sprintf("%llu", (unsigned long long)value);
+    }
+
+    /**
+     * Return the unsigned integer encoded in the given JSON value.
+     *
+     * @param[in] value
+     *     This is the encoded value.
+     *
+     * @return
+     *     The decoded value is returned, or zero if it could not be decoded.
+     */
+    uint64_t DecodeUnsigned(const Json::Value& value) {
+        if (value.GetType() != Json::Value::Type::String) {
+            return 0;
+        }
+        const std::string encoding = value;
+        return (uint64_t)strtoull(encoding.c_str(), NULL, 10);
+    }
+
+}
+
+/**
+ * This is the internal interface/implementation of the DiscoveryIndex class.
+ */
+struct DiscoveryIndex::Impl {
+    /**
+     * This holds an entry of the index along with bookkeeping information.
+     */
+    struct IndexedFile {
+        /**
+         * This is what is known about the file.
+         */
+        Entry entry;
+
+        /**
+         * This flag indicates whether or not the entry was updated
+         * since the index was loaded.
+         */
+        bool updated = false;
+    };
+
+    /**
+     * These are the files in the index, keyed by path.
+     */
+    std::map< std::string, IndexedFile > files;
+};
+
+DiscoveryIndex::~DiscoveryIndex() noexcept = default;
+DiscoveryIndex::DiscoveryIndex(DiscoveryIndex&&) noexcept = default;
+DiscoveryIndex& DiscoveryIndex::operator=(DiscoveryIndex&&) noexcept = default;
+
+DiscoveryIndex::DiscoveryIndex()
+    : impl_(new Impl())
+{
+}
+
+bool DiscoveryIndex::Load(const std::string& path) {
+    impl_->files.clear();
+    SystemAbstractions::File file(path);
+    if (!file.OpenReadOnly()) {
+        return false;
+    }
+    SystemAbstractions::IFile::Buffer buffer(file.GetSize());
+    const auto amountRead = file.Read(buffer);
+    file.Close();
+    if (amountRead != buffer.size()) {
+        return false;
+    }
+    const auto index = Json::Value::FromEncoding(
+        std::string(buffer.begin(), buffer.end())
+    );
+    if (
+        (index.GetType() != Json::Value::Type::Object)
+        || !index.Has("version")
+        || (index["version"] != Json::Value(discoveryIndexVersion))
+        || !index.Has("files")
+    ) {
+        return false;
+    }
+    const auto& files = index["files"];
+    for (const auto& filePath: files.GetKeys()) {
+        const auto& file = files[filePath];
+        Entry entry;
+        entry.stamp.size = DecodeUnsigned(file["size"]);
+        entry.stamp.lastModifiedTime = (int64_t)DecodeUnsigned(file["modified"]);
+        entry.stamp.hash = DecodeUnsigned(file["hash"]);
+        entry.stamp.recordedTime = (int64_t)DecodeUnsigned(file["recorded"]);
+        const auto& tests = file["tests"];
+        for (size_t i = 0; i < tests.GetSize(); ++i) {
+            const auto& test = tests[i];
+            Test indexedTest;
+            indexedTest.testSuiteName = (std::string)test["suite"];
+            indexedTest.testName = (std::string)test["test"];
+            indexedTest.lineNumber = (int)test["line"];
+            indexedTest.benchmark = (
+                test.Has("benchmark")
+                && (bool)test["benchmark"]
+            );
+            indexedTest.async = (
+                test.Has("async")
+                && (bool)test["async"]
+            );
+            entry.tests.push_back(std::move(indexedTest));
+        }
+        const auto& dependencies = file["dependencies"];
+        for (size_t i = 0; i < dependencies.GetSize(); ++i) {
+            const auto& dependency = dependencies[i];
+            Dependency indexedDependency;
+            indexedDependency.filePath = (std::string)dependency["path"];
+            indexedDependency.stamp.size = DecodeUnsigned(dependency["size"]);
+            indexedDependency.stamp.lastModifiedTime = (int64_t)DecodeUnsigned(dependency["modified"]);
+            indexedDependency.stamp.hash = DecodeUnsigned(dependency["hash"]);
+            indexedDependency.stamp.recordedTime = (int64_t)DecodeUnsigned(dependency["recorded"]);
+            entry.dependencies.push_back(std::move(indexedDependency));
+        }
+        impl_->files[filePath].entry = std::move(entry);
+    }
+    return true;
+}
+
+bool DiscoveryIndex::Save(const std::string& path) const {
+    Json::Value files(Json::Value::Type::Object);
+    for (const auto& indexedFile: impl_->files) {
+        if (!indexedFile.second.updated) {
+            continue;
+        }
+        const auto& entry = indexedFile.second.entry;
+        Json::Value file(Json::Value::Type::Object);
+        file.Set("size", EncodeUnsigned(entry.stamp.size));
+        file.Set("modified", EncodeUnsigned((uint64_t)entry.stamp.lastModifiedTime));
+        file.Set("hash", EncodeUnsigned(entry.stamp.hash));
+        file.Set("recorded", EncodeUnsigned((uint64_t)entry.stamp.recordedTime));
+        Json::Value tests(Json::Value::Type::Array);
+        for (const auto& indexedTest: entry.tests) {
+            Json::Value test(Json::Value::Type::Object);
+            test.Set("suite", indexedTest.testSuiteName);
+            test.Set("test", indexedTest.testName);
+            test.Set("line", indexedTest.lineNumber);
+            if (indexedTest.benchmark) {
+                test.Set("benchmark", true);
+            }
+            if (indexedTest.async) {
+                test.Set("async", true);
+            }
+            tests.Add(test);
+        }
+        file.Set("tests", tests);
+        Json::Value dependencies(Json::Value::Type::Array);
+        for (const auto& indexedDependency: entry.dependencies) {
+            Json::Value dependency(Json::Value::Type::Object);
+            dependency.Set("path", indexedDependency.filePath);
+            dependency.Set("size", EncodeUnsigned(indexedDependency.stamp.size));
+            dependency.Set("modified", EncodeUnsigned((uint64_t)indexedDependency.stamp.lastModifiedTime));
+            dependency.Set("hash", EncodeUnsigned(indexedDependency.stamp.hash));
+            dependency.Set("recorded", EncodeUnsigned((uint64_t)indexedDependency.stamp.recordedTime));
+            dependencies.Add(dependency);
+        }
+        file.Set("dependencies", dependencies);
+        files.Set(indexedFile.first, file);
+    }
+    Json::Value index(Json::Value::Type::Object);
+    index.Set("version", discoveryIndexVersion);
+    index.Set("files", files);
+    const auto encoding = index.ToEncoding();
+
+    // Write the index to a temporary file first and then move it into
+    // place, so that another instance of the program never reads
+    // a partially-written index.
+    const auto temporaryPath = path + ".tmp";
+    FILE* indexFile = fopen(temporaryPath.c_str(), "wb");
+    if (indexFile == NULL) {
+        return false;
+    }
+    const auto written = (fwrite(encoding.data(), encoding.length(), 1, indexFile) == 1);
+    if (
+        (fclose(indexFile) != 0)
+        || !written
+    ) {
+        (void)remove(temporaryPath.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    (void)remove(path.c_str());
+#endif /* _WIN32 */
+    if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        (void)remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool DiscoveryIndex::Find(
+    const std::string& filePath,
+    Entry& entry
+) const {
+    const auto filesEntry = impl_->files.find(filePath);
+    if (filesEntry == impl_->files.end()) {
+        return false;
+    }
+    entry = filesEntry->second.entry;
+    return true;
+}
+
+void DiscoveryIndex::Update(
+    const std::string& filePath,
+    const Entry& entry
+) {
+    auto& indexedFile = impl_->files[filePath];
+    indexedFile.entry = entry;
+    indexedFile.updated = true;
+}
+
+uint64_t DiscoveryIndex::Hash(
+    const void* data,
+    size_t size
+) {
+    // This is the 64-bit FNV-1a hash function.
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const auto bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
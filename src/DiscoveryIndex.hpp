@@ -0,0 +1,233 @@
+#ifndef MOON_UNIT_DISCOVERY_INDEX_HPP
+#define MOON_UNIT_DISCOVERY_INDEX_HPP
+
+/**
+ * @file DiscoveryIndex.hpp
+ *
+ * This module declares the DiscoveryIndex class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * This class remembers which tests were found in which Lua script files,
+ * along with enough information about each file to tell whether or not
+ * it has changed since, so that unchanged files don't have to be executed
+ * again in order to find their tests.  The index can be saved to and
+ * loaded from a file, so that it persists between runs.
+ */
+class DiscoveryIndex {
+    // Types
+public:
+    /**
+     * This identifies a particular version of a file's contents.
+     */
+    struct Stamp {
+        /**
+         * This is the size of the file, in bytes.
+         */
+        uint64_t size = 0;
+
+        /**
+         * This is the time the file was last modified, in seconds
+         * since the UNIX epoch.
+         */
+        int64_t lastModifiedTime = 0;
+
+        /**
+         * This is a hash of the contents of the file.
+         */
+        uint64_t hash = 0;
+
+        /**
+         * This is the time the stamp was recorded, in seconds
+         * since the UNIX epoch.
+         */
+        int64_t recordedTime = 0;
+    };
+
+    /**
+     * This holds information about a test found in a file.
+     */
+    struct Test {
+        /**
+         * This is the name of the test suite containing the test.
+         */
+        std::string testSuiteName;
+
+        /**
+         * This is the name of the test.
+         */
+        std::string testName;
+
+        /**
+         * This is the line number where the test was defined in the file.
+         */
+        int lineNumber = 0;
+
+        /**
+         * This flag indicates whether the test is a benchmark
+         * rather than a regular test.
+         */
+        bool benchmark = false;
+
+        /**
+         * This flag indicates whether the test is an asynchronous test,
+         * registered with "async_test".
+         */
+        bool async = false;
+    };
+
+    /**
+     * This holds information about another file which was loaded
+     * while finding the tests in a file, such as a module
+     * loaded through "require".
+     */
+    struct Dependency {
+        /**
+         * This is the path of the file which was loaded.
+         */
+        std::string filePath;
+
+        /**
+         * This identifies the version of the file which was loaded.
+         */
+        Stamp stamp;
+    };
+
+    /**
+     * This holds what is known about one file in the index.
+     */
+    struct Entry {
+        /**
+         * This identifies the version of the file in which
+         * the tests were found.
+         */
+        Stamp stamp;
+
+        /**
+         * These are the tests that were found in the file.
+         */
+        std::vector< Test > tests;
+
+        /**
+         * These are the other files which were loaded
+         * while finding the tests.
+         */
+        std::vector< Dependency > dependencies;
+    };
+
+    // Lifecycle Methods
+public:
+    ~DiscoveryIndex() noexcept;
+    DiscoveryIndex(const DiscoveryIndex&) = delete;
+    DiscoveryIndex(DiscoveryIndex&&) noexcept;
+    DiscoveryIndex& operator=(const DiscoveryIndex&) = delete;
+    DiscoveryIndex& operator=(DiscoveryIndex&&) noexcept;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     */
+    DiscoveryIndex();
+
+    /**
+     * Replace the contents of the index with what was saved
+     * in the file at the given path.
+     *
+     * @param[in] path
+     *     This is the path of the file from which to load the index.
+     *
+     * @return
+     *     An indication of whether or not the index was loaded
+     *     is returned.  If the file doesn't exist, or wasn't saved
+     *     by a compatible version of the program, the index is left empty.
+     */
+    bool Load(const std::string& path);
+
+    /**
+     * Save to the file at the given path the entries of all the files
+     * which were updated since the index was loaded.
+     *
+     * @param[in] path
+     *     This is the path of the file in which to save the index.
+     *
+     * @return
+     *     An indication of whether or not the index was saved is returned.
+     */
+    bool Save(const std::string& path) const;
+
+    /**
+     * Look up the entry for the file at the given path.
+     *
+     * @param[in] filePath
+     *     This is the path of the file to look up.
+     *
+     * @param[out] entry
+     *     This is where to store a copy of the entry, if found.
+     *
+     * @return
+     *     An indication of whether or not the file was found
+     *     in the index is returned.
+     */
+    bool Find(
+        const std::string& filePath,
+        Entry& entry
+    ) const;
+
+    /**
+     * Set the entry for the file at the given path.  Only the entries of
+     * files updated since the index was loaded are saved with the index,
+     * so every file in use should be updated, even if unchanged.
+     *
+     * @param[in] filePath
+     *     This is the path of the file to update.
+     *
+     * @param[in] entry
+     *     This is the new entry for the file.
+     */
+    void Update(
+        const std::string& filePath,
+        const Entry& entry
+    );
+
+    /**
+     * Return the hash of the given file contents, as used in file stamps.
+     *
+     * @param[in] data
+     *     This points to the contents of the file.
+     *
+     * @param[in] size
+     *     This is the size of the contents of the file.
+     *
+     * @return
+     *     The hash of the given file contents is returned.
+     */
+    static uint64_t Hash(
+        const void* data,
+        size_t size
+    );
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
+
+#endif /* MOON_UNIT_DISCOVERY_INDEX_HPP */
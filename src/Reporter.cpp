@@ -0,0 +1,394 @@
+/**
+ * @file Reporter.cpp
+ *
+ * This module contains the implementation of the Reporter class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Reporter.hpp"
+
+#include <Json/Value.hpp>
+#include <stdio.h>
+#include <StringExtensions/StringExtensions.hpp>
+
+namespace {
+
+    /**
+     * This is the size, in bytes, of the buffer used to collect
+     * what is written to the report file before it goes to the file.
+     */
+    constexpr size_t reportBufferSize = 65536;
+
+    /**
+     * Return the given text, with characters which have special
+     * meaning in XML replaced by the references to them, so that
+     * it can be used as the value of an XML attribute.
+     *
+     * @param[in] text
+     *     This is the text to escape.
+     *
+     * @return
+     *     The escaped text is returned.
+     */
+    std::string EscapeXmlAttribute(const std::string& text) {
+        std::string escaped;
+        escaped.reserve(text.length());
+        for (const auto c: text) {
+            switch (c) {
+                case '&': escaped += "&amp;"; break;
+                case '<': escaped += "&lt;"; break;
+                case '>': escaped += "&gt;"; break;
+                case '"': escaped += "&quot;"; break;
+                case '\'': escaped += "&apos;"; break;
+                case '\n': escaped += "&#x0A;"; break;
+                case '\r': escaped += "&#x0D;"; break;
+                case '\t': escaped += "&#x09;"; break;
+                default: {
+                    if ((unsigned char)c >= 0x20) {
+                        escaped += c;
+                    }
+                } break;
+            }
+        }
+        return escaped;
+    }
+
+    /**
+     * Return the given text as an XML character data section.
+     *
+     * @param[in] text
+     *     This is the text to put in the section.
+     *
+     * @return
+     *     The XML character data section holding
+     *     the given text is returned.
+     */
+    std::string MakeXmlCharacterData(const std::string& text) {
+        std::string section = "<![CDATA[";
+        size_t start = 0;
+        for (;;) {
+            const auto end = text.find("]]>", start);
+            if (end == std::string::npos) {
+                section += text.substr(start);
+                break;
+            }
+            // The end marker can't appear in a character data section,
+            // so split the section in the middle of the marker.
+            section += text.substr(start, end + 2 - start);
+            section += "]]><![CDATA[";
+            start = end + 2;
+        }
+        section += "]]>";
+        return section;
+    }
+
+    /**
+     * Return the combined failure messages of the given test,
+     * or a generic message if the test failed without any.
+     *
+     * @param[in] result
+     *     This holds everything to report about the test.
+     *
+     * @return
+     *     The combined failure messages of the given test are returned.
+     */
+    std::string GetFailureMessage(const Reporter::TestResult& result) {
+        std::string message;
+        for (const auto& failureMessage: result.failureMessages) {
+            message += failureMessage;
+        }
+        if (message.empty()) {
+            message = "Test failed";
+        }
+        return message;
+    }
+
+}
+
+/**
+ * This is the internal interface/implementation of the Reporter class.
+ */
+struct Reporter::Impl {
+    // Properties
+
+    /**
+     * This is the format in which to write the report.
+     */
+    Format format = Format::Xml;
+
+    /**
+     * This indicates whether or not to include in the report the
+     * processor time, garbage collection cycles, and instruction
+     * counts measured while running tests.
+     */
+    bool includeMetrics = false;
+
+    /**
+     * This is the report file, if it's open.
+     */
+    FILE* file = NULL;
+
+    /**
+     * This indicates whether or not everything written to the report
+     * file so far has been written successfully.
+     */
+    bool ok = true;
+
+    /**
+     * This is the number of test suites reported so far.
+     */
+    size_t numTestSuites = 0;
+
+    /**
+     * This is the number of tests of the current test suite
+     * reported so far.
+     */
+    size_t numTests = 0;
+
+    // Methods
+
+    /**
+     * Write the given text to the report file.
+     *
+     * @param[in] text
+     *     This is the text to write.
+     */
+    void Write(const std::string& text) {
+        if (
+            !text.empty()
+            && (fwrite(text.data(), text.length(), 1, file) != 1)
+        ) {
+            ok = false;
+        }
+    }
+
+    /**
+     * Write the given test to the report file, in XML format.
+     *
+     * @param[in] result
+     *     This holds everything to report about the test.
+     */
+    void WriteXmlTest(const TestResult& result) {
+        std::string testCase = StringExtensions::sprintf(
+            "    <testcase name=\"%s\" file=\"%s\" line=\"%d\"",
+            EscapeXmlAttribute(result.testName).c_str(),
+            EscapeXmlAttribute(result.filePath).c_str(),
+            result.lineNumber
+        );
+        if (result.ran) {
+            const auto& metrics = result.metrics;
+            testCase += StringExtensions::sprintf(
+                " status=\"run\" result=\"completed\" time=\"%.6f\""
+                " memory_in_use=\"%zu\" peak_memory=\"%zu\" allocations=\"%zu\"",
+                result.duration,
+                metrics.memoryInUse,
+                metrics.peakMemory,
+                metrics.numAllocations
+            );
+            if (includeMetrics) {
+                testCase += StringExtensions::sprintf(
+                    " cpu_time=\"%.6f\" gc_cycles=\"%zu\" instructions=\"%llu\"",
+                    metrics.cpuTime,
+                    metrics.gcCycles,
+                    (unsigned long long)metrics.instructionCount
+                );
+            }
+        }
+        if (
+            result.ran
+            && !result.passed
+        ) {
+            const auto message = GetFailureMessage(result);
+            testCase += StringExtensions::sprintf(
+                ">\n"
+                "      <failure message=\"%s\" type=\"\">%s</failure>\n"
+                "    </testcase>\n",
+                EscapeXmlAttribute(StringExtensions::Trim(message)).c_str(),
+                MakeXmlCharacterData(message).c_str()
+            );
+        } else {
+            testCase += " />\n";
+        }
+        Write(testCase);
+    }
+
+    /**
+     * Write the given test to the report file, in JSON format.
+     *
+     * @param[in] result
+     *     This holds everything to report about the test.
+     */
+    void WriteJsonTest(const TestResult& result) {
+        Json::Value testCase(Json::Value::Type::Object);
+        testCase.Set("name", result.testName);
+        testCase.Set("file", result.filePath);
+        testCase.Set("line", result.lineNumber);
+        if (result.ran) {
+            const auto& metrics = result.metrics;
+            testCase.Set("status", "RUN");
+            testCase.Set("result", "COMPLETED");
+            testCase.Set("time", StringExtensions::sprintf("%.6fs", result.duration));
+            testCase.Set("memory_in_use", metrics.memoryInUse);
+            testCase.Set("peak_memory", metrics.peakMemory);
+            testCase.Set("allocations", metrics.numAllocations);
+            if (includeMetrics) {
+                testCase.Set("cpu_time", StringExtensions::sprintf("%.6fs", metrics.cpuTime));
+                testCase.Set("gc_cycles", metrics.gcCycles);
+                testCase.Set("instructions", (intmax_t)metrics.instructionCount);
+            }
+            if (!result.passed) {
+                Json::Value failure(Json::Value::Type::Object);
+                failure.Set("failure", GetFailureMessage(result));
+                failure.Set("type", "");
+                Json::Value failures(Json::Value::Type::Array);
+                failures.Add(failure);
+                testCase.Set("failures", failures);
+            }
+        }
+        Write(
+            StringExtensions::sprintf(
+                "%s        %s",
+                ((numTests == 0) ? "" : ",\n"),
+                testCase.ToEncoding().c_str()
+            )
+        );
+    }
+};
+
+Reporter::~Reporter() noexcept {
+    if (
+        (impl_ != nullptr)
+        && (impl_->file != NULL)
+    ) {
+        (void)fclose(impl_->file);
+    }
+}
+Reporter::Reporter(Reporter&&) noexcept = default;
+Reporter& Reporter::operator=(Reporter&&) noexcept = default;
+
+Reporter::Reporter(
+    Format format,
+    bool includeMetrics
+)
+    : impl_(new Impl())
+{
+    impl_->format = format;
+    impl_->includeMetrics = includeMetrics;
+}
+
+bool Reporter::Open(
+    const std::string& path,
+    size_t numTests
+) {
+    impl_->file = fopen(path.c_str(), "wt");
+    if (impl_->file == NULL) {
+        return false;
+    }
+    (void)setvbuf(impl_->file, NULL, _IOFBF, reportBufferSize);
+    impl_->ok = true;
+    impl_->numTestSuites = 0;
+    if (impl_->format == Format::Xml) {
+        impl_->Write(
+            StringExtensions::sprintf(
+                "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                "<testsuites tests=\"%zu\" name=\"AllTests\">\n",
+                numTests
+            )
+        );
+    } else {
+        impl_->Write(
+            StringExtensions::sprintf(
+                "{\n"
+                "  \"tests\": %zu,\n"
+                "  \"name\": \"AllTests\",\n"
+                "  \"testsuites\": [",
+                numTests
+            )
+        );
+    }
+    return impl_->ok;
+}
+
+void Reporter::BeginTestSuite(
+    const std::string& testSuiteName,
+    size_t numTests
+) {
+    if (impl_->file == NULL) {
+        return;
+    }
+    if (impl_->format == Format::Xml) {
+        impl_->Write(
+            StringExtensions::sprintf(
+                "  <testsuite name=\"%s\" tests=\"%zu\">\n",
+                EscapeXmlAttribute(testSuiteName).c_str(),
+                numTests
+            )
+        );
+    } else {
+        impl_->Write(
+            StringExtensions::sprintf(
+                "%s\n"
+                "    {\n"
+                "      \"name\": %s,\n"
+                "      \"tests\": %zu,\n"
+                "      \"testsuite\": [\n",
+                ((impl_->numTestSuites == 0) ? "" : ","),
+                Json::Value(testSuiteName).ToEncoding().c_str(),
+                numTests
+            )
+        );
+    }
+    ++impl_->numTestSuites;
+    impl_->numTests = 0;
+}
+
+void Reporter::ReportTest(const TestResult& result) {
+    if (impl_->file == NULL) {
+        return;
+    }
+    if (impl_->format == Format::Xml) {
+        impl_->WriteXmlTest(result);
+    } else {
+        impl_->WriteJsonTest(result);
+    }
+    ++impl_->numTests;
+}
+
+void Reporter::EndTestSuite() {
+    if (impl_->file == NULL) {
+        return;
+    }
+    if (impl_->format == Format::Xml) {
+        impl_->Write("  </testsuite>\n");
+    } else {
+        impl_->Write(
+            "\n"
+            "      ]\n"
+            "    }"
+        );
+    }
+    if (fflush(impl_->file) != 0) {
+        impl_->ok = false;
+    }
+}
+
+bool Reporter::Close() {
+    if (impl_->file == NULL) {
+        return false;
+    }
+    if (impl_->format == Format::Xml) {
+        impl_->Write("</testsuites>\n");
+    } else {
+        impl_->Write(
+            "\n"
+            "  ]\n"
+            "}\n"
+        );
+    }
+    if (fclose(impl_->file) != 0) {
+        impl_->ok = false;
+    }
+    impl_->file = NULL;
+    return impl_->ok;
+}
@@ -0,0 +1,190 @@
+#ifndef MOON_UNIT_REPORTER_HPP
+#define MOON_UNIT_REPORTER_HPP
+
+/**
+ * @file Reporter.hpp
+ *
+ * This module declares the Reporter class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Runner.hpp"
+
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/**
+ * This class writes a report, conforming to the report output of Google
+ * Test, about tests found and/or run.  The report is written to its file
+ * as each test is reported, rather than all at once at the end, so that
+ * large reports aren't held in memory, and the results of the tests
+ * reported so far survive even if the program doesn't finish.
+ */
+class Reporter {
+    // Types
+public:
+    /**
+     * These are the formats in which reports can be written.
+     */
+    enum class Format {
+        /**
+         * The report is an XML document, in the format
+         * written by the "--gtest_output=xml" option of Google Test.
+         */
+        Xml,
+
+        /**
+         * The report is a JSON document, in the format
+         * written by the "--gtest_output=json" option of Google Test.
+         */
+        Json,
+    };
+
+    /**
+     * This holds everything reported about one test.
+     */
+    struct TestResult {
+        /**
+         * This is the name of the test.
+         */
+        std::string testName;
+
+        /**
+         * This is the path of the Lua script file which defined the test.
+         */
+        std::string filePath;
+
+        /**
+         * This is the line number where the test was defined
+         * in the Lua script file.
+         */
+        int lineNumber = 0;
+
+        /**
+         * This flag indicates whether or not the test was run.  If not,
+         * only the name and location of the test are reported.
+         */
+        bool ran = false;
+
+        /**
+         * This indicates whether or not the test passed.
+         */
+        bool passed = false;
+
+        /**
+         * This is the amount of time, in seconds, it took to run the test.
+         */
+        double duration = 0.0;
+
+        /**
+         * These are the error messages reported while running the test.
+         */
+        std::vector< std::string > failureMessages;
+
+        /**
+         * These are the measurements taken while running the test.
+         */
+        Runner::TestMetrics metrics;
+    };
+
+    // Lifecycle Methods
+public:
+    ~Reporter() noexcept;
+    Reporter(const Reporter&) = delete;
+    Reporter(Reporter&&) noexcept;
+    Reporter& operator=(const Reporter&) = delete;
+    Reporter& operator=(Reporter&&) noexcept;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     *
+     * @param[in] format
+     *     This is the format in which to write the report.
+     *
+     * @param[in] includeMetrics
+     *     This indicates whether or not to include in the report the
+     *     processor time, garbage collection cycles, and instruction
+     *     counts measured while running tests.
+     */
+    Reporter(
+        Format format,
+        bool includeMetrics
+    );
+
+    /**
+     * Create the report file at the given path, and write
+     * the beginning of the report to it.
+     *
+     * @param[in] path
+     *     This is the path of the report file to create.
+     *
+     * @param[in] numTests
+     *     This is the total number of tests which will be reported.
+     *
+     * @return
+     *     An indication of whether or not the report file
+     *     was created is returned.
+     */
+    bool Open(
+        const std::string& path,
+        size_t numTests
+    );
+
+    /**
+     * Begin reporting the tests of a test suite.
+     *
+     * @param[in] testSuiteName
+     *     This is the name of the test suite.
+     *
+     * @param[in] numTests
+     *     This is the number of tests of the suite which will be reported.
+     */
+    void BeginTestSuite(
+        const std::string& testSuiteName,
+        size_t numTests
+    );
+
+    /**
+     * Report one test of the current test suite.
+     *
+     * @param[in] result
+     *     This holds everything to report about the test.
+     */
+    void ReportTest(const TestResult& result);
+
+    /**
+     * Finish reporting the tests of the current test suite.  Everything
+     * reported so far is flushed to the report file.
+     */
+    void EndTestSuite();
+
+    /**
+     * Write the end of the report, and close the report file.
+     *
+     * @return
+     *     An indication of whether or not the whole report
+     *     was written is returned.
+     */
+    bool Close();
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
+
+#endif /* MOON_UNIT_REPORTER_HPP */
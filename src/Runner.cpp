@@ -6,17 +6,38 @@
  * © 2019 by Richard Walters
  */
 
+#include "Arena.hpp"
+#include "DiscoveryIndex.hpp"
 #include "Runner.hpp"
+#include "TestPack.hpp"
+#include "WorkerPool.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <Json/Value.hpp>
+#include <list>
+#include <map>
+#include <math.h>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string>
+#include <string.h>
 #include <StringExtensions/StringExtensions.hpp>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else /* POSIX */
+#include <time.h>
+#endif /* _WIN32 / POSIX */
+
 extern "C" {
 #include <lua.h>
 #include <lualib.h>
@@ -30,31 +51,184 @@ namespace {
      */
     static const std::string luaFileExtension = ".lua";
 
+    /**
+     * This is the number of Lua virtual machine instructions executed
+     * between calls to the count hook installed while collecting test
+     * metrics.  Instruction counts are accurate only to this many
+     * instructions.
+     */
+    constexpr int instructionCountHookInterval = 1000;
+
+    /**
+     * This is the least amount of time, in seconds, to spend running
+     * a benchmark before measuring it, to warm up caches and let the
+     * garbage collector settle.
+     */
+    constexpr double benchmarkWarmUpTime = 0.05;
+
+    /**
+     * This is the least amount of time, in seconds, each measured batch
+     * of benchmark iterations should take.  The number of iterations in
+     * each batch is calibrated so that timer resolution and the cost of
+     * reading the timer don't skew the measurements.
+     */
+    constexpr double benchmarkBatchTime = 0.01;
+
+    /**
+     * This is the number of batches of iterations to measure
+     * for each benchmark.
+     */
+    constexpr size_t benchmarkRepetitions = 20;
+
+    /**
+     * This is the largest number of iterations to run in one batch
+     * of benchmark iterations.
+     */
+    constexpr size_t maxBenchmarkIterations = 1000000000;
+
+    /**
+     * This is the number of mismatched elements described by a check made
+     * over whole arrays, unless the check is given a different number.
+     */
+    constexpr lua_Integer defaultMaxReportedMismatches = 10;
+
+    /**
+     * This is how long, in seconds, after a file was last modified that
+     * a stamp of the file has to be recorded in order to trust that the
+     * file hasn't changed if its size and last modification time are still
+     * the same.  File modification times only have a resolution of about
+     * a second, so a file changed again within that time may look the same.
+     */
+    constexpr int64_t racyStampSeconds = 2;
+
+    /**
+     * Compute the statistics of the samples of the given benchmark result.
+     *
+     * @param[in,out] result
+     *     This is the benchmark result whose statistics to compute.
+     */
+    void ComputeBenchmarkStatistics(Runner::BenchmarkResult& result) {
+        const auto& samples = result.samples;
+        if (samples.empty()) {
+            return;
+        }
+        double sum = 0.0;
+        for (const auto sample: samples) {
+            sum += sample;
+        }
+        result.mean = sum / (double)samples.size();
+        double sumOfSquares = 0.0;
+        for (const auto sample: samples) {
+            sumOfSquares += (sample - result.mean) * (sample - result.mean);
+        }
+        result.standardDeviation = (
+            (samples.size() < 2)
+            ? 0.0
+            : sqrt(sumOfSquares / (double)(samples.size() - 1))
+        );
+        auto sortedSamples = samples;
+        std::sort(sortedSamples.begin(), sortedSamples.end());
+        result.minimum = sortedSamples.front();
+        const auto middle = sortedSamples.size() / 2;
+        result.median = (
+            ((sortedSamples.size() % 2) == 0)
+            ? (sortedSamples[middle - 1] + sortedSamples[middle]) / 2.0
+            : sortedSamples[middle]
+        );
+    }
+
+    /**
+     * Return the amount of processor time used so far
+     * by the calling thread.
+     *
+     * @return
+     *     The amount of processor time, in seconds, used so far
+     *     by the calling thread is returned.
+     */
+    double GetThreadCpuTime() {
+#ifdef _WIN32
+        FILETIME creationTime, exitTime, kernelTime, userTime;
+        if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+            return 0.0;
+        }
+        const auto kernel = (((uint64_t)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime);
+        const auto user = (((uint64_t)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime);
+        return (double)(kernel + user) / 10000000.0;
+#else /* POSIX */
+        struct timespec cpuTime;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuTime) != 0) {
+            return 0.0;
+        }
+        return (double)cpuTime.tv_sec + (double)cpuTime.tv_nsec / 1000000000.0;
+#endif /* _WIN32 / POSIX */
+    }
+
     /**
      * This is the length of the file extension expected for Lua script files.
      */
     static const auto luaFileExtensionLength = luaFileExtension.length();
 
     /**
-     * This holds information needed to run or report about a Lua test.
+     * This holds a Lua script file which defines tests.  It is shared
+     * by all the tests defined in the file.
      */
-    struct Test {
+    struct Script {
         /**
-         * This is the Lua script to execute to prepare
-         * the Lua interpreter for running the test.
+         * This is the compiled Lua script (in the binary chunk format
+         * produced by lua_dump) to execute to prepare the Lua interpreter
+         * for running a test.  It's compiled once, when tests are
+         * found, so it doesn't have to be parsed again for every test.
          */
-        std::string file;
+        std::string bytecode;
 
         /**
          * This is the path to the file from which the Lua script was loaded.
          */
         std::string filePath;
 
+        /**
+         * If the tests of the script were found in the discovery index
+         * rather than by executing the script, the script isn't compiled
+         * until the first time one of its tests is run.  This is used
+         * to make sure that happens only once.
+         */
+        std::once_flag compileOnce;
+
+        /**
+         * If the script could not be compiled when one of its tests
+         * was run, this holds a human-readable description of the problem.
+         */
+        std::string compileErrorMessage;
+
+        /**
+         * These are the paths of the files in which the Lua modules
+         * loaded through "require" by the script were found, keyed by
+         * module name.  They're only known if the script was executed
+         * to find its tests, or loaded from a test pack.
+         */
+        std::map< std::string, std::string > modules;
+    };
+
+    /**
+     * This holds information needed to run or report about a Lua test.
+     */
+    struct Test {
+        /**
+         * This is the Lua script which defines the test.
+         */
+        std::shared_ptr< Script > script;
+
         /**
          * This is the line number where the test was defined in the Lua
          * script from which the test was loaded.
          */
         int lineNumber = 0;
+
+        /**
+         * This flag indicates whether the test is an asynchronous test,
+         * registered with "async_test".
+         */
+        bool async = false;
     };
 
     /**
@@ -74,6 +248,86 @@ namespace {
      */
     using TestSuites = std::unordered_map< std::string, TestSuite >;
 
+    /**
+     * This holds one entry in the table of all tests, which refers
+     * to the names and information of the test kept in the collection
+     * of test suites.
+     */
+    struct TestTableEntry {
+        /**
+         * This is the name of the test suite containing the test.
+         */
+        const std::string* testSuiteName = nullptr;
+
+        /**
+         * This is the name of the test.
+         */
+        const std::string* testName = nullptr;
+
+        /**
+         * This is the information about the test.
+         */
+        Test* test = nullptr;
+    };
+
+    /**
+     * Determine whether or not the first of the given test table entries
+     * comes before the second, when sorted by test suite name
+     * and then test name.
+     *
+     * @param[in] lhs
+     *     This is the first entry to compare.
+     *
+     * @param[in] rhs
+     *     This is the second entry to compare.
+     *
+     * @return
+     *     An indication of whether or not the first entry comes
+     *     before the second is returned.
+     */
+    bool TestTableEntryLess(
+        const TestTableEntry& lhs,
+        const TestTableEntry& rhs
+    ) {
+        const auto testSuiteNameComparison = lhs.testSuiteName->compare(*rhs.testSuiteName);
+        if (testSuiteNameComparison != 0) {
+            return (testSuiteNameComparison < 0);
+        }
+        return (*lhs.testName < *rhs.testName);
+    }
+
+    /**
+     * This holds what was found by loading one Lua script file.
+     */
+    struct LoadedFile {
+        /**
+         * These are the test suites and tests found in the file.
+         */
+        TestSuites testSuites;
+
+        /**
+         * These are the benchmark suites and benchmarks found in the file.
+         */
+        TestSuites benchmarkSuites;
+
+        /**
+         * These are the error messages generated while loading the file.
+         */
+        std::vector< std::string > errorMessages;
+
+        /**
+         * This flag indicates whether or not the file loaded successfully,
+         * in which case the discovery index entry describes what was found.
+         */
+        bool loaded = false;
+
+        /**
+         * This describes the file and the tests found in it,
+         * for the discovery index.
+         */
+        DiscoveryIndex::Entry indexEntry;
+    };
+
     /**
      * This function is provided to the Lua interpreter for use in
      * allocating memory.
@@ -114,7 +368,13 @@ namespace {
         /**
          * This is the code chunk to be read by the Lua interpreter.
          */
-        const std::string* chunk = nullptr;
+        const char* chunk = nullptr;
+
+        /**
+         * This is the size of the code chunk to be read by the Lua
+         * interpreter.
+         */
+        size_t chunkSize = 0;
 
         /**
          * This flag indicates whether or not the Lua interpreter
@@ -151,11 +411,37 @@ namespace {
             return NULL;
         } else {
             state->read = true;
-            *size = state->chunk->length();
-            return state->chunk->c_str();
+            *size = state->chunkSize;
+            return state->chunk;
         }
     }
 
+    /**
+     * This function is provided to the Lua interpreter when lua_dump
+     * is called, in order to collect the compiled code chunk.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] data
+     *     This points to the next piece of the compiled code chunk.
+     *
+     * @param[in] size
+     *     This is the size of the next piece of the compiled code chunk.
+     *
+     * @param[in] ud
+     *     This points to the string in which to collect
+     *     the compiled code chunk.
+     *
+     * @return
+     *     Zero is returned to indicate success.
+     */
+    int LuaWriter(lua_State* lua, const void* data, size_t size, void* ud) {
+        auto bytecode = (std::string*)ud;
+        bytecode->append((const char*)data, size);
+        return 0;
+    }
+
     /**
      * This function is provided to the Lua interpreter when lua_pcall
      * is called.  It is called by the Lua interpreter if a runtime
@@ -184,109 +470,351 @@ namespace {
     }
 
     /**
-     * Push a value onto the Lua stack based on the given Json::Value.
-     *
-     * @param[in] lua
-     *     This points to the Lua interpreter instance.
-     *
-     * @param[in] value
-     *     This is the value that will be unwrapped from the given JSON value.
+     * This identifies a key in the "path" through the table structure
+     * being compared by a TableComparison.
      */
-    void LuaValueFromJsonValue(lua_State* lua, const Json::Value& value) {
-        switch (value.GetType()) {
-            case Json::Value::Type::Array:
-            case Json::Value::Type::Object: {
-                auto returnValue = (Json::Value*)lua_newuserdata(lua, sizeof(Json::Value));
-                new (returnValue) Json::Value(value);
-                luaL_setmetatable(lua, "json");
-            } break;
-            case Json::Value::Type::Boolean: {
-                lua_pushboolean(lua, (bool)value ? 1 : 0);
-            } break;
-            case Json::Value::Type::FloatingPoint: {
-                lua_pushnumber(lua, (lua_Number)(double)value);
-            } break;
-            case Json::Value::Type::Integer: {
-                lua_pushinteger(lua, (lua_Integer)(int)value);
-            } break;
-            case Json::Value::Type::String: {
-                const auto valueAsString = (std::string)value;
-                lua_pushlstring(lua, valueAsString.c_str(), valueAsString.length());
-            } break;
-            case Json::Value::Type::Null:
-            case Json::Value::Type::Invalid:
-            default: {
-                lua_pushnil(lua);
-            }
-        }
-    }
+    struct TableComparisonKey {
+        /**
+         * If not zero, this is the index on the Lua stack
+         * where the key can be found.
+         */
+        int stackIndex = 0;
+
+        /**
+         * If the key isn't on the Lua stack, this is the key,
+         * which is an index into the array part of a table.
+         */
+        lua_Integer arrayIndex = 0;
+    };
 
     /**
-     * Construct a new Json::Value based on a value on the Lua stack.
-     *
-     * @param[in] lua
-     *     This points to the Lua interpreter instance.
+     * This holds the state of a "deep" comparison between two Lua tables.
      *
-     * @param[in] index
-     *     This is the index of the value on the Lua stack that will be wrapped.
-     *
-     * @return
-     *     The newly constructed Json::Value is returned.
+     * Array parts are compared index by index, hash parts are walked
+     * with lua_next and looked up with raw accesses, so no keys are copied
+     * out of the Lua interpreter.  Nothing is converted to a string unless
+     * a difference is found.
      */
-    Json::Value JsonValueFromLuaValue(
-        lua_State* lua,
-        int index
-    ) {
-        luaL_checkany(lua, index);
-        switch (lua_type(lua, index)) {
-            case LUA_TNIL: {
-                return Json::Value(nullptr);
-            } break;
-            case LUA_TNUMBER: {
-                if (lua_isinteger(lua, index)) {
-                    return Json::Value((int)lua_tointeger(lua, index));
-                } else {
-                    return Json::Value((double)lua_tonumber(lua, index));
+    struct TableComparison {
+        // Properties
+
+        /**
+         * This points to the Lua interpreter instance.
+         */
+        lua_State* lua = nullptr;
+
+        /**
+         * This flag indicates whether or not to find all differences
+         * between the tables, rather than stopping at the first one.
+         */
+        bool fullDiff = false;
+
+        /**
+         * These are the keys of the tables currently being compared,
+         * from the outermost tables inward.
+         */
+        std::vector< TableComparisonKey > keyChain;
+
+        /**
+         * These identify the pairs of tables currently being compared,
+         * so that tables which contain themselves are only compared once.
+         */
+        std::vector< std::pair< const void*, const void* > > tablesBeingCompared;
+
+        /**
+         * These are descriptions of the differences found so far.
+         */
+        std::vector< std::string > differences;
+
+        // Methods
+
+        /**
+         * Return a human-readable description of the given key.
+         *
+         * @param[in] key
+         *     This identifies the key to describe.
+         *
+         * @return
+         *     A human-readable description of the key is returned.
+         */
+        std::string DescribeKey(const TableComparisonKey& key) {
+            if (key.stackIndex == 0) {
+                return StringExtensions::sprintf("%lld", (long long)key.arrayIndex);
+            }
+            switch (lua_type(lua, key.stackIndex)) {
+                case LUA_TSTRING: {
+                    size_t length;
+                    const auto value = lua_tolstring(lua, key.stackIndex, &length);
+                    return Json::Value(std::string(value, length)).ToEncoding();
+                }
+
+                case LUA_TNUMBER: {
+                    if (lua_isinteger(lua, key.stackIndex)) {
+                        return StringExtensions::sprintf(
+                            "%lld",
+                            (long long)lua_tointeger(lua, key.stackIndex)
+                        );
+                    } else {
+                        return Json::Value((double)lua_tonumber(lua, key.stackIndex)).ToEncoding();
+                    }
+                }
+
+                default: {
+                    const std::string description = luaL_tolstring(lua, key.stackIndex, NULL);
+                    lua_pop(lua, 1);
+                    return description;
                 }
-            } break;
-            case LUA_TBOOLEAN: {
-                return Json::Value(lua_toboolean(lua, index) != 0);
-            } break;
-            case LUA_TSTRING: {
-                return Json::Value(lua_tostring(lua, index));
-            } break;
-            default: {
-                (void)luaL_error(lua, "cannot construct a JSON value from a %s", lua_typename(lua, lua_type(lua, index)));
             }
         }
-        return Json::Value();
-    }
 
-    /**
-     * Extract the set of keys from the table at the given position in the Lua
-     * stack.
-     *
-     * @param[in] lua
-     *     This points to the Lua interpreter instance.
-     *
-     * @param[in] tableIndex
-     *     This is the index on the Lua stack where the table can be found.
-     *
-     * @return
-     *     The set of the keys from the Lua table is returned.
-     */
-    std::set< Json::Value > EnumerateKeys(lua_State* lua, int tableIndex) {
-        std::set< Json::Value > keys;
-        if (tableIndex < 0) {
-            tableIndex = lua_gettop(lua) + tableIndex + 1;
+        /**
+         * Return a human-readable description of the value
+         * at the given position in the Lua stack.
+         *
+         * @param[in] index
+         *     This is the index of the value on the Lua stack.
+         *
+         * @return
+         *     A human-readable description of the value is returned.
+         */
+        std::string DescribeValue(int index) {
+            const std::string description = luaL_tolstring(lua, index, NULL);
+            lua_pop(lua, 1);
+            return description;
         }
-        lua_pushnil(lua);  // -1 = key
-        while (lua_next(lua, tableIndex) != 0) { // -1 = value, -2 = key
-            (void)keys.insert(JsonValueFromLuaValue(lua, -2));
-            lua_pop(lua, 1); // -1 = key
-        } // (stack empty)
-        return keys;
-    }
+
+        /**
+         * Record a difference found between the tables at the
+         * end of the current key chain.
+         *
+         * @param[in] description
+         *     This is a human-readable description of the difference.
+         */
+        void AddDifference(const std::string& description) {
+            std::vector< std::string > path;
+            path.reserve(keyChain.size());
+            for (const auto& key: keyChain) {
+                path.push_back(DescribeKey(key));
+            }
+            differences.push_back(
+                StringExtensions::sprintf(
+                    "(path: %s) -- %s",
+                    StringExtensions::Join(path, ".").c_str(),
+                    description.c_str()
+                )
+            );
+        }
+
+        /**
+         * Compare the values stored under the same key
+         * in the two tables currently being compared.
+         *
+         * @param[in] key
+         *     This identifies the key under which the values are stored.
+         *
+         * @param[in] lhsIndex
+         *     This is the absolute index of the first value on the Lua stack.
+         *
+         * @param[in] rhsIndex
+         *     This is the absolute index of the second value on the Lua stack.
+         *
+         * @return
+         *     An indication of whether or not the values are the same
+         *     is returned.
+         */
+        bool CompareEntries(
+            const TableComparisonKey& key,
+            int lhsIndex,
+            int rhsIndex
+        ) {
+            if (lua_isnil(lua, rhsIndex)) {
+                AddDifference(
+                    StringExtensions::sprintf(
+                        "Actual value missing key '%s'",
+                        DescribeKey(key).c_str()
+                    )
+                );
+                return false;
+            }
+            keyChain.push_back(key);
+            bool same = true;
+            if (
+                lua_istable(lua, lhsIndex)
+                && lua_istable(lua, rhsIndex)
+            ) {
+                same = CompareTables(lhsIndex, rhsIndex);
+            } else if (lua_compare(lua, lhsIndex, rhsIndex, LUA_OPEQ) == 0) {
+                AddDifference(
+                    StringExtensions::sprintf(
+                        "Expected '%s', actual was '%s'",
+                        DescribeValue(lhsIndex).c_str(),
+                        DescribeValue(rhsIndex).c_str()
+                    )
+                );
+                same = false;
+            }
+            keyChain.pop_back();
+            return same;
+        }
+
+        /**
+         * Look in the second table for any keys not in the first table,
+         * and record them as differences.
+         *
+         * @param[in] lhsIndex
+         *     This is the absolute index of the first table on the Lua stack.
+         *
+         * @param[in] rhsIndex
+         *     This is the absolute index of the second table on the Lua stack.
+         */
+        void FindExtraKeys(
+            int lhsIndex,
+            int rhsIndex
+        ) {
+            lua_pushnil(lua); // -1 = key
+            while (lua_next(lua, rhsIndex) != 0) { // -1 = value(rhs), -2 = key
+                lua_pop(lua, 1); // -1 = key
+                lua_pushvalue(lua, -1); // -1 = key, -2 = key
+                const auto extra = (lua_rawget(lua, lhsIndex) == LUA_TNIL); // -1 = value(lhs), -2 = key
+                lua_pop(lua, 1); // -1 = key
+                if (extra) {
+                    TableComparisonKey key;
+                    key.stackIndex = lua_gettop(lua);
+                    AddDifference(
+                        StringExtensions::sprintf(
+                            "Actual value has extra key '%s'",
+                            DescribeKey(key).c_str()
+                        )
+                    );
+                    if (!fullDiff) {
+                        lua_pop(lua, 1);
+                        break;
+                    }
+                }
+            }
+        }
+
+        /**
+         * Compare two Lua tables, including any tables they contain.
+         *
+         * @param[in] lhsIndex
+         *     This is the absolute index of the first table on the Lua stack.
+         *
+         * @param[in] rhsIndex
+         *     This is the absolute index of the second table on the Lua stack.
+         *
+         * @return
+         *     An indication of whether or not the tables are the same
+         *     is returned.
+         */
+        bool CompareTables(
+            int lhsIndex,
+            int rhsIndex
+        ) {
+            // A table is always the same as itself, and a pair of tables
+            // already being compared further out is assumed to be the same
+            // here, so that tables which contain themselves are supported.
+            const auto lhsTable = lua_topointer(lua, lhsIndex);
+            const auto rhsTable = lua_topointer(lua, rhsIndex);
+            if (lhsTable == rhsTable) {
+                return true;
+            }
+            for (const auto& tables: tablesBeingCompared) {
+                if (
+                    (tables.first == lhsTable)
+                    && (tables.second == rhsTable)
+                ) {
+                    return true;
+                }
+            }
+            if (!lua_checkstack(lua, 8)) {
+                (void)luaL_error(lua, "tables are nested too deeply to compare");
+            }
+            tablesBeingCompared.emplace_back(lhsTable, rhsTable);
+            bool same = true;
+
+            // Compare the array part first, by index.  There may be holes
+            // in it, which are skipped, since they aren't keys of the table.
+            const auto arrayLength = (lua_Integer)lua_rawlen(lua, lhsIndex);
+            size_t numKeys = 0;
+            size_t numMatchedKeys = 0;
+            for (lua_Integer i = 1; i <= arrayLength; ++i) {
+                if (lua_rawgeti(lua, lhsIndex, i) == LUA_TNIL) { // -1 = value(lhs)
+                    lua_pop(lua, 1);
+                    continue;
+                }
+                ++numKeys;
+                const auto rhsFound = (lua_rawgeti(lua, rhsIndex, i) != LUA_TNIL); // -1 = value(rhs), -2 = value(lhs)
+                if (rhsFound) {
+                    ++numMatchedKeys;
+                }
+                TableComparisonKey key;
+                key.arrayIndex = i;
+                const auto top = lua_gettop(lua);
+                const auto entriesSame = CompareEntries(key, top - 1, top);
+                lua_pop(lua, 2);
+                if (!entriesSame) {
+                    same = false;
+                    if (!fullDiff) {
+                        break;
+                    }
+                }
+            }
+
+            // Compare the rest of the first table by walking it,
+            // looking up each key in the second table.
+            if (same || fullDiff) {
+                lua_pushnil(lua); // -1 = key
+                while (lua_next(lua, lhsIndex) != 0) { // -1 = value(lhs), -2 = key
+                    const auto keyIndex = lua_gettop(lua) - 1;
+                    if (lua_isinteger(lua, keyIndex)) {
+                        const auto index = lua_tointeger(lua, keyIndex);
+                        if (
+                            (index >= 1)
+                            && (index <= arrayLength)
+                        ) {
+                            lua_pop(lua, 1); // -1 = key
+                            continue;
+                        }
+                    }
+                    ++numKeys;
+                    lua_pushvalue(lua, keyIndex); // -1 = key, -2 = value(lhs), -3 = key
+                    if (lua_rawget(lua, rhsIndex) != LUA_TNIL) { // -1 = value(rhs), -2 = value(lhs), -3 = key
+                        ++numMatchedKeys;
+                    }
+                    TableComparisonKey key;
+                    key.stackIndex = keyIndex;
+                    const auto entriesSame = CompareEntries(key, keyIndex + 1, keyIndex + 2);
+                    lua_pop(lua, 2); // -1 = key
+                    if (!entriesSame) {
+                        same = false;
+                        if (!fullDiff) {
+                            lua_pop(lua, 1);
+                            break;
+                        }
+                    }
+                }
+            }
+
+            // The second table has extra keys only if it has more keys
+            // than were matched with keys of the first table, so count its
+            // keys before looking for which ones are extra.
+            if (same || fullDiff) {
+                size_t numRhsKeys = 0;
+                lua_pushnil(lua); // -1 = key
+                while (lua_next(lua, rhsIndex) != 0) { // -1 = value(rhs), -2 = key
+                    ++numRhsKeys;
+                    lua_pop(lua, 1); // -1 = key
+                }
+                if (numRhsKeys > numMatchedKeys) {
+                    FindExtraKeys(lhsIndex, rhsIndex);
+                    same = false;
+                }
+            }
+            tablesBeingCompared.pop_back();
+            return same;
+        }
+    };
 
     /**
      * Perform a "deep" comparison between two Lua tables.
@@ -300,879 +828,4261 @@ namespace {
      * @param[in] rhsIndex
      *     This is the index of the second table on the Lua stack.
      *
-     * @param[in,out] keyChain
-     *     This is where the "path" through the table structure is
-     *     recorded, in the event that some difference is found.
+     * @param[in] fullDiff
+     *     This flag indicates whether or not to describe all differences
+     *     between the tables, rather than stopping at the first one.
      *
      * @return
      *     If the two tables are identical, an empty string is returned.
-     *     Otherwise, a human-readable description of the mismatch
+     *     Otherwise, a human-readable description of the mismatch,
+     *     including the "path" through the table structure to it,
      *     is returned.
      */
     std::string CompareLuaTables(
         lua_State* lua,
         int lhsIndex,
         int rhsIndex,
-        std::vector< Json::Value >& keyChain
+        bool fullDiff
     ) {
-        if (lhsIndex < 0) {
-            lhsIndex = lua_gettop(lua) + lhsIndex + 1;
-        }
-        if (rhsIndex < 0) {
-            rhsIndex = lua_gettop(lua) + rhsIndex + 1;
-        }
-        const auto lhsKeys = EnumerateKeys(lua, lhsIndex);
-        auto rhsKeys = EnumerateKeys(lua, rhsIndex);
-        for (const auto& lhsKey: lhsKeys) {
-            const auto rhsKeysEntry = rhsKeys.find(lhsKey);
-            if (rhsKeysEntry == rhsKeys.end()) {
-                return StringExtensions::sprintf(
-                    "Actual value missing key '%s'",
-                    lhsKey.ToEncoding().c_str()
-                );
-            } else {
-                /*
-                 * When using the keys to look up values in the two tables,
-                 * make sure to use the proper key types.  Keys for "array"
-                 * tables are numbers, not strings.  In other words, a
-                 * table that looks like this:
-                 *   { "a", "b", "c" }
-                 * Has these keys:  1, 2, 3
-                 * NOT these keys:  "1", "2", "3".
-                 */
-                LuaValueFromJsonValue(lua, lhsKey); // -1 = key
-                lua_pushvalue(lua, -1); // -1 = key, -2 = key
-                lua_gettable(lua, lhsIndex); // -1 = value(lhs), -2 = key
-                const auto lhsType = lua_typename(lua, -1);
-                lua_insert(lua, -2); // -1 = key, -2 = value(lhs)
-                lua_gettable(lua, rhsIndex); // -1 = value(rhs), -2 = value(lhs)
-                const auto rhsType = lua_typename(lua, -2);
-                std::string comparisonResult;
+        TableComparison comparison;
+        comparison.lua = lua;
+        comparison.fullDiff = fullDiff;
+        if (comparison.CompareTables(lua_absindex(lua, lhsIndex), lua_absindex(lua, rhsIndex))) {
+            return "";
+        }
+        if (comparison.differences.size() == 1) {
+            return StringExtensions::sprintf(
+                "Tables differ %s\n",
+                comparison.differences[0].c_str()
+            );
+        }
+        std::string description = StringExtensions::sprintf(
+            "Tables differ in %zu places:\n",
+            comparison.differences.size()
+        );
+        for (const auto& difference: comparison.differences) {
+            description += "  " + difference + "\n";
+        }
+        return description;
+    }
+
+    /**
+     * This collects the elements found to differ by a check
+     * made over whole arrays in one call.
+     */
+    struct ElementMismatches {
+        // Properties
+
+        /**
+         * This is the largest number of mismatched elements to describe.
+         */
+        size_t maxReported = 0;
+
+        /**
+         * This is the number of mismatched elements found so far.
+         */
+        size_t count = 0;
+
+        /**
+         * These are the descriptions of the mismatched elements,
+         * one per line.
+         */
+        std::string descriptions;
+
+        // Methods
+
+        /**
+         * Count another mismatched element.
+         *
+         * @return
+         *     An indication of whether or not the element
+         *     should be described is returned.
+         */
+        bool Count() {
+            ++count;
+            return (count <= maxReported);
+        }
+
+        /**
+         * Return a human-readable description of the mismatches found.
+         *
+         * @param[in] summary
+         *     This summarizes what kind of difference was found.
+         *
+         * @param[in] expectedLength
+         *     This is the length of the array expected.
+         *
+         * @param[in] actualLength
+         *     This is the length of the array checked.
+         *
+         * @return
+         *     If no mismatches were found and the lengths are the same,
+         *     an empty string is returned.  Otherwise, a human-readable
+         *     description of the mismatches is returned.
+         */
+        std::string Describe(
+            const char* summary,
+            lua_Integer expectedLength,
+            lua_Integer actualLength
+        ) const {
+            if (
+                (count == 0)
+                && (expectedLength == actualLength)
+            ) {
+                return "";
+            }
+            std::string description = summary;
+            if (expectedLength != actualLength) {
+                description += StringExtensions::sprintf(
+                    " (expected %lld elements, actual had %lld)",
+                    (long long)expectedLength,
+                    (long long)actualLength
+                );
+            }
+            if (count == 0) {
+                return description + "\n";
+            }
+            description += StringExtensions::sprintf(
+                " in %zu of %lld elements:\n",
+                count,
+                (long long)std::min(expectedLength, actualLength)
+            );
+            description += descriptions;
+            if (count > maxReported) {
+                description += StringExtensions::sprintf(
+                    "  ... and %zu more\n",
+                    count - maxReported
+                );
+            }
+            return description;
+        }
+    };
+
+    /**
+     * This holds the state of one task of an asynchronous test:
+     * a Lua coroutine run by an AsyncScheduler.
+     */
+    struct AsyncTask {
+        /**
+         * These are the reasons a task may be waiting to be resumed.
+         */
+        enum class State {
+            /**
+             * The task is ready to be resumed.
+             */
+            Ready,
+
+            /**
+             * The task is sleeping until its wake time.
+             */
+            Sleeping,
+
+            /**
+             * The task is waiting for a future to be resolved.
+             */
+            Waiting,
+        };
+
+        /**
+         * This is the Lua coroutine running the task.
+         */
+        lua_State* thread = nullptr;
+
+        /**
+         * This is the Lua registry reference keeping the coroutine alive.
+         */
+        int threadReference = LUA_NOREF;
+
+        /**
+         * This is what the task is waiting for, if anything.
+         */
+        State state = State::Ready;
+
+        /**
+         * If the task is sleeping, this is when it should be resumed.
+         */
+        std::chrono::steady_clock::time_point wakeTime;
+
+        /**
+         * If the task is waiting for a future, or was resumed
+         * because it was resolved, this is the Lua registry reference
+         * of the future.
+         */
+        int futureReference = LUA_NOREF;
+
+        /**
+         * If the task is waiting for a future, this identifies the future.
+         */
+        const void* future = nullptr;
+
+        /**
+         * This identifies the test to which the task belongs, when
+         * the tasks of more than one asynchronous test are run together.
+         */
+        size_t test = 0;
+    };
+
+    /**
+     * This runs the tasks of one or more asynchronous tests, resuming each
+     * in turn whenever it's ready, and sleeping whenever every task
+     * is sleeping.
+     */
+    struct AsyncScheduler {
+        /**
+         * These are the tasks which haven't finished yet.  A list is used
+         * so that tasks spawned while another task runs don't move it.
+         */
+        std::list< AsyncTask > tasks;
+
+        /**
+         * This points to the task currently running, if any.
+         */
+        AsyncTask* currentTask = nullptr;
+
+        /**
+         * If set, this is called just before a task is resumed, with the
+         * test to which the task belongs, to switch to the state kept
+         * for the test.
+         */
+        std::function< void(size_t test) > enterTest;
+
+        /**
+         * If set, this is called just after a task yields, finishes,
+         * or fails, with the test to which the task belongs, to save
+         * the state kept for the test.
+         */
+        std::function< void(size_t test) > leaveTest;
+
+        /**
+         * This is called once for each test whose tasks were run, when its
+         * last task finishes, or when the test fails, with the test,
+         * an indication of whether or not it failed, and if so,
+         * a description of why.
+         */
+        std::function<
+            void(
+                size_t test,
+                bool failed,
+                const std::string& errorMessage
+            )
+        > endTest;
+
+        /**
+         * Add a task which calls the function at the given position
+         * on the Lua stack.
+         *
+         * @param[in] lua
+         *     This points to the state of the Lua interpreter.
+         *
+         * @param[in] functionIndex
+         *     This is the position of the function on the Lua stack.
+         *
+         * @param[in] test
+         *     This identifies the test to which the task belongs.
+         */
+        void Spawn(
+            lua_State* lua,
+            int functionIndex,
+            size_t test
+        ) {
+            functionIndex = lua_absindex(lua, functionIndex);
+            AsyncTask task;
+            task.thread = lua_newthread(lua);
+            lua_pushvalue(lua, functionIndex);
+            lua_xmove(lua, task.thread, 1);
+            task.threadReference = luaL_ref(lua, LUA_REGISTRYINDEX);
+            task.test = test;
+            tasks.push_back(task);
+        }
+
+        /**
+         * Release the Lua registry references held by the given task.
+         *
+         * @param[in] lua
+         *     This points to the state of the Lua interpreter.
+         *
+         * @param[in,out] task
+         *     This is the task whose references to release.
+         */
+        static void Release(lua_State* lua, AsyncTask& task) {
+            luaL_unref(lua, LUA_REGISTRYINDEX, task.futureReference);
+            task.futureReference = LUA_NOREF;
+            luaL_unref(lua, LUA_REGISTRYINDEX, task.threadReference);
+            task.threadReference = LUA_NOREF;
+        }
+
+        /**
+         * Mark every task waiting for the given future as ready.
+         *
+         * @param[in] future
+         *     This identifies the future which was resolved.
+         */
+        void Wake(const void* future) {
+            for (auto& task: tasks) {
                 if (
-                    lua_istable(lua, -1)
-                    && lua_istable(lua, -2)
+                    (task.state == AsyncTask::State::Waiting)
+                    && (task.future == future)
                 ) {
-                    keyChain.push_back(lhsKey);
-                    comparisonResult = CompareLuaTables(lua, -2, -1, keyChain);
-                    if (comparisonResult.empty()) {
-                        keyChain.pop_back();
+                    task.state = AsyncTask::State::Ready;
+                    task.future = nullptr;
+                }
+            }
+        }
+
+        /**
+         * Push onto the stack of the given task the values with which
+         * the future it waited for was resolved.
+         *
+         * @param[in] lua
+         *     This points to the state of the Lua interpreter.
+         *
+         * @param[in,out] task
+         *     This is the task to be resumed.
+         *
+         * @return
+         *     The number of values pushed is returned.
+         */
+        static int PushFutureValues(lua_State* lua, AsyncTask& task) {
+            if (task.futureReference == LUA_NOREF) {
+                return 0;
+            }
+            const auto thread = task.thread;
+            (void)lua_rawgeti(thread, LUA_REGISTRYINDEX, task.futureReference);
+            const auto futureIndex = lua_gettop(thread);
+            lua_pushliteral(thread, "n");
+            (void)lua_rawget(thread, futureIndex);
+            const auto numValues = (int)lua_tointeger(thread, -1);
+            lua_pop(thread, 1);
+            luaL_checkstack(thread, numValues, "too many future values");
+            for (int i = 1; i <= numValues; ++i) {
+                (void)lua_rawgeti(thread, futureIndex, i);
+            }
+            lua_remove(thread, futureIndex);
+            luaL_unref(lua, LUA_REGISTRYINDEX, task.futureReference);
+            task.futureReference = LUA_NOREF;
+            return numValues;
+        }
+
+        /**
+         * Remove every task of the given test, releasing their
+         * Lua registry references.
+         *
+         * @param[in] lua
+         *     This points to the state of the Lua interpreter.
+         *
+         * @param[in] test
+         *     This identifies the test whose tasks to remove.
+         *
+         * @param[in] next
+         *     This is the position in the list of tasks
+         *     which the caller is about to visit.
+         *
+         * @return
+         *     The position in the list of tasks which the caller
+         *     should visit next is returned.
+         */
+        std::list< AsyncTask >::iterator RemoveTasks(
+            lua_State* lua,
+            size_t test,
+            std::list< AsyncTask >::iterator next
+        ) {
+            for (auto taskEntry = tasks.begin(); taskEntry != tasks.end();) {
+                if (taskEntry->test != test) {
+                    ++taskEntry;
+                    continue;
+                }
+                Release(lua, *taskEntry);
+                const auto removingNext = (taskEntry == next);
+                taskEntry = tasks.erase(taskEntry);
+                if (removingNext) {
+                    next = taskEntry;
+                }
+            }
+            return next;
+        }
+
+        /**
+         * Fail every test which still has tasks, for the given reason,
+         * removing all the tasks.
+         *
+         * @param[in] lua
+         *     This points to the state of the Lua interpreter.
+         *
+         * @param[in] errorMessage
+         *     This describes why the tests failed.
+         */
+        void FailRemainingTests(
+            lua_State* lua,
+            const std::string& errorMessage
+        ) {
+            while (!tasks.empty()) {
+                const auto test = tasks.front().test;
+                (void)RemoveTasks(lua, test, tasks.end());
+                endTest(test, true, errorMessage);
+            }
+        }
+
+        /**
+         * Run tasks until they've all finished, or failed.  Once a task
+         * fails, its test fails, and the other tasks of the test are
+         * abandoned, while the tasks of other tests carry on.
+         *
+         * @param[in] lua
+         *     This points to the state of the Lua interpreter.
+         *
+         * @param[in] hasDeadline
+         *     This indicates whether or not the tasks must finish
+         *     by the deadline.
+         *
+         * @param[in] deadline
+         *     If hasDeadline is set, this is the time by which
+         *     the tasks must finish.
+         *
+         * @return
+         *     An indication of whether or not every task finished
+         *     without failing is returned.
+         */
+        bool Run(
+            lua_State* lua,
+            bool hasDeadline,
+            std::chrono::steady_clock::time_point deadline
+        ) {
+            bool allFinished = true;
+            while (!tasks.empty()) {
+                bool ranTask = false;
+                auto now = std::chrono::steady_clock::now();
+                for (auto taskEntry = tasks.begin(); taskEntry != tasks.end();) {
+                    auto& task = *taskEntry;
+                    if (
+                        (task.state == AsyncTask::State::Sleeping)
+                        && (now >= task.wakeTime)
+                    ) {
+                        task.state = AsyncTask::State::Ready;
                     }
-                } else if (lua_compare(lua, -1, -2, LUA_OPEQ) == 0) {
-                    keyChain.push_back(lhsKey);
-                    comparisonResult = StringExtensions::sprintf(
-                        "Expected '%s', actual was '%s'\n",
-                        lua_tostring(lua, -2),
-                        lua_tostring(lua, -1)
-                    );
+                    if (task.state != AsyncTask::State::Ready) {
+                        ++taskEntry;
+                        continue;
+                    }
+                    if (
+                        hasDeadline
+                        && (now >= deadline)
+                    ) {
+                        FailRemainingTests(lua, "time limit exceeded");
+                        return false;
+                    }
+                    ranTask = true;
+                    const auto test = task.test;
+                    const auto numArguments = PushFutureValues(lua, task);
+                    if (enterTest != nullptr) {
+                        enterTest(test);
+                    }
+                    currentTask = &task;
+                    const auto status = lua_resume(task.thread, lua, numArguments);
+                    currentTask = nullptr;
+                    if (leaveTest != nullptr) {
+                        leaveTest(test);
+                    }
+                    if (status == LUA_YIELD) {
+                        lua_settop(task.thread, 0);
+                        ++taskEntry;
+                    } else if (status == LUA_OK) {
+                        Release(lua, task);
+                        taskEntry = tasks.erase(taskEntry);
+                        if (
+                            std::none_of(
+                                tasks.begin(), tasks.end(),
+                                [test](const AsyncTask& otherTask){
+                                    return (otherTask.test == test);
+                                }
+                            )
+                        ) {
+                            endTest(test, false, "");
+                        }
+                    } else {
+                        // The error is described the same way LuaTraceback
+                        // describes errors raised outside of tasks.
+                        std::string errorMessage;
+                        const char* message = lua_tostring(task.thread, -1);
+                        if (message == NULL) {
+                            lua_xmove(task.thread, lua, 1);
+                            if (luaL_callmeta(lua, -1, "__tostring")) {
+                                if (lua_isstring(lua, -1)) {
+                                    errorMessage = lua_tostring(lua, -1);
+                                }
+                                lua_pop(lua, 1);
+                            }
+                            lua_pop(lua, 1);
+                            if (errorMessage.empty()) {
+                                errorMessage = "(no error message)";
+                            }
+                        } else {
+                            luaL_traceback(lua, task.thread, message, 0);
+                            errorMessage = lua_tostring(lua, -1);
+                            lua_pop(lua, 1);
+                        }
+                        taskEntry = RemoveTasks(lua, test, taskEntry);
+                        endTest(test, true, errorMessage);
+                        allFinished = false;
+                    }
+                    now = std::chrono::steady_clock::now();
+                }
+                if (ranTask) {
+                    continue;
                 }
-                lua_pop(lua, 2); // (stack empty)
-                if (!comparisonResult.empty()) {
-                    return comparisonResult;
+
+                // No task is ready, so sleep until the first one wakes up.
+                bool anySleeping = false;
+                std::chrono::steady_clock::time_point wakeTime;
+                for (const auto& task: tasks) {
+                    if (
+                        (task.state == AsyncTask::State::Sleeping)
+                        && (
+                            !anySleeping
+                            || (task.wakeTime < wakeTime)
+                        )
+                    ) {
+                        anySleeping = true;
+                        wakeTime = task.wakeTime;
+                    }
+                }
+                if (!anySleeping) {
+                    FailRemainingTests(lua, "every task is waiting for a future which is never resolved");
+                    return false;
+                }
+                if (
+                    hasDeadline
+                    && (deadline < wakeTime)
+                ) {
+                    std::this_thread::sleep_until(deadline);
+                    FailRemainingTests(lua, "time limit exceeded");
+                    return false;
                 }
-                (void)rhsKeys.erase(rhsKeysEntry);
+                std::this_thread::sleep_until(wakeTime);
+            }
+            return allFinished;
+        }
+    };
+
+    /**
+     * Return the current time, in seconds since the UNIX epoch,
+     * as recorded in file stamps.
+     *
+     * @return
+     *     The current time, in seconds since the UNIX epoch,
+     *     is returned.
+     */
+    int64_t GetStampTime() {
+        return (int64_t)std::chrono::system_clock::to_time_t(
+            std::chrono::system_clock::now()
+        );
+    }
+
+    /**
+     * Look up the size, last modification time, and hash of the contents
+     * of the file at the given path.
+     *
+     * @param[in] filePath
+     *     This is the path of the file to look up.
+     *
+     * @param[out] stamp
+     *     This is where to store the size, last modification time,
+     *     and hash of the contents of the file.
+     *
+     * @return
+     *     An indication of whether or not the file could be examined
+     *     is returned.
+     */
+    bool GetFileStamp(
+        const std::string& filePath,
+        DiscoveryIndex::Stamp& stamp
+    ) {
+        SystemAbstractions::File file(filePath);
+        if (!file.OpenReadOnly()) {
+            return false;
+        }
+        SystemAbstractions::IFile::Buffer buffer(file.GetSize());
+        const auto amountRead = file.Read(buffer);
+        stamp.lastModifiedTime = (int64_t)file.GetLastModifiedTime();
+        file.Close();
+        if (amountRead != buffer.size()) {
+            return false;
+        }
+        stamp.size = buffer.size();
+        stamp.hash = DiscoveryIndex::Hash(buffer.data(), buffer.size());
+        stamp.recordedTime = GetStampTime();
+        return true;
+    }
+
+    /**
+     * Tell whether or not the file at the given path still has the
+     * contents recorded in the given stamp.
+     *
+     * The size and last modification time of the file are enough to tell,
+     * unless the file was last modified so soon before the stamp was
+     * recorded that it could have been modified again since without its
+     * last modification time changing.  In that case, or if the file was
+     * touched since the stamp was recorded, the hash of the file's
+     * contents is checked too.
+     *
+     * @param[in] filePath
+     *     This is the path of the file to check.
+     *
+     * @param[in,out] stamp
+     *     This holds the size, last modification time,
+     *     and hash of the contents the file is expected to have.
+     *     If the contents had to be checked and are unchanged,
+     *     the stamp is updated so that they don't have to be
+     *     checked the next time.
+     *
+     * @return
+     *     An indication of whether or not the file still has the contents
+     *     recorded in the given stamp is returned.
+     */
+    bool IsFileUnchanged(
+        const std::string& filePath,
+        DiscoveryIndex::Stamp& stamp
+    ) {
+        SystemAbstractions::File file(filePath);
+        if (
+            !file.OpenReadOnly()
+            || (file.GetSize() != stamp.size)
+        ) {
+            return false;
+        }
+        const auto lastModifiedTime = (int64_t)file.GetLastModifiedTime();
+        if (
+            (lastModifiedTime == stamp.lastModifiedTime)
+            && (stamp.recordedTime - lastModifiedTime >= racyStampSeconds)
+        ) {
+            return true;
+        }
+        const auto recordedTime = GetStampTime();
+        SystemAbstractions::IFile::Buffer buffer(stamp.size);
+        const auto amountRead = file.Read(buffer);
+        file.Close();
+        if (
+            (amountRead != buffer.size())
+            || (DiscoveryIndex::Hash(buffer.data(), buffer.size()) != stamp.hash)
+        ) {
+            return false;
+        }
+        stamp.lastModifiedTime = lastModifiedTime;
+        stamp.recordedTime = recordedTime;
+        return true;
+    }
+
+    /**
+     * Return the given path with any "." and ".." segments removed,
+     * so that different ways of spelling the path of a file can be
+     * compared with each other.
+     *
+     * @param[in] path
+     *     This is the path to normalize.
+     *
+     * @return
+     *     The normalized path is returned.
+     */
+    std::string NormalizePath(const std::string& path) {
+        std::vector< std::string > segmentsOut;
+        for (const auto& segment: StringExtensions::Split(path, '/')) {
+            if (
+                (segment == ".")
+                || (
+                    segment.empty()
+                    && !segmentsOut.empty()
+                )
+            ) {
+                continue;
+            }
+            if (
+                (segment == "..")
+                && (segmentsOut.size() > 1)
+                && (segmentsOut.back() != "..")
+            ) {
+                segmentsOut.pop_back();
+            } else {
+                segmentsOut.push_back(segment);
             }
         }
-        if (rhsKeys.empty()) {
-            return "";
+        return StringExtensions::Join(segmentsOut, "/");
+    }
+
+    /**
+     * Return the path to the parent folder containing the file or directory
+     * at the given path.
+     *
+     * @param[in] path
+     *     This is the path to the file or folder whose parent folder's
+     *     path is to be returned.
+     *
+     * @return
+     *     The path to the parent folder containing the file or directory
+     *     at the given path is returned.
+     */
+    std::string ParentFolderPath(const std::string& path) {
+        const auto delimiterIndex = path.find_last_of('/');
+        if (delimiterIndex == std::string::npos) {
+            return path;
+        } else {
+            return path.substr(0, delimiterIndex);
+        }
+    }
+
+    /**
+     * Return the given path, resolved against the given folder
+     * if the path is relative.
+     *
+     * @param[in] folderPath
+     *     This is the path of the folder against which to resolve
+     *     the given path.  If empty, the path is returned unchanged.
+     *
+     * @param[in] path
+     *     This is the path to resolve.
+     *
+     * @return
+     *     The given path, resolved against the given folder
+     *     if the path is relative, is returned.
+     */
+    std::string ResolvePath(
+        const std::string& folderPath,
+        const std::string& path
+    ) {
+        if (
+            folderPath.empty()
+            || path.empty()
+            || SystemAbstractions::File::IsAbsolutePath(path)
+        ) {
+            return path;
+        }
+        return folderPath + "/" + path;
+    }
+
+    /**
+     * Return the given Lua module search path (in the format of
+     * "package.path" or "package.cpath"), with every relative template
+     * resolved against the given folder.
+     *
+     * @param[in] folderPath
+     *     This is the path of the folder against which to resolve
+     *     relative templates.
+     *
+     * @param[in] searchPath
+     *     This is the module search path to resolve.
+     *
+     * @return
+     *     The resolved module search path is returned.
+     */
+    std::string ResolveSearchPath(
+        const std::string& folderPath,
+        const std::string& searchPath
+    ) {
+        auto templates = StringExtensions::Split(searchPath, ';');
+        for (auto& searchTemplate: templates) {
+            searchTemplate = ResolvePath(folderPath, searchTemplate);
+        }
+        return StringExtensions::Join(templates, ";");
+    }
+
+}
+
+/**
+ * This is the internal interface/implementation of the Runner class.
+ */
+struct Runner::Impl {
+    // Types
+
+    /**
+     * This holds the state of one Lua interpreter used by the runner,
+     * either to find tests or to run a single test.  Each thread
+     * running tests uses its own interpreter.
+     */
+    struct Interpreter {
+        /**
+         * This points to the Lua interpreter state.
+         */
+        lua_State* lua = nullptr;
+
+        /**
+         * This is the path to the folder containing the Lua script
+         * being executed.  Relative paths given to functions such as
+         * "require", "dofile", and "io.open" are resolved against this
+         * folder, rather than the working directory of the process.
+         */
+        std::string scriptDirectory;
+
+        /**
+         * These are the normalized paths of the Lua module files
+         * loaded through "require" by the scripts executed so far.
+         */
+        std::set< std::string > requiredFilePaths;
+
+        /**
+         * These are the normalized paths of the Lua module files loaded
+         * through "require" by the scripts executed so far, keyed by
+         * module name.  Modules implemented in C are not included.
+         */
+        std::map< std::string, std::string > requiredModules;
+
+        /**
+         * If a test or benchmark is being run, this is
+         * the Lua script which defines it.
+         */
+        const Script* script = nullptr;
+
+        /**
+         * If tests were loaded from a test pack, this points to the
+         * compiled Lua modules of the pack, keyed by file path.
+         */
+        const std::map< std::string, std::string >* packedModules = nullptr;
+
+        /**
+         * This is the Lua registry index of the table set up to hold Lua
+         * objects associated with this interpreter.
+         */
+        int luaRegistryIndex = 0;
+
+        /**
+         * This is the Lua registry index of the table set up to hold
+         * the benchmarks registered with this interpreter.
+         */
+        int luaBenchmarkRegistryIndex = 0;
+
+        /**
+         * This is the Lua registry index of the table set up to hold
+         * the suite setup and teardown functions registered with this
+         * interpreter, organized like the tests.
+         */
+        int luaSuiteFixtureRegistryIndex = 0;
+
+        /**
+         * This flag is set once the suite setup function of the test
+         * suite being run has returned successfully, until the suite
+         * teardown function is called.
+         */
+        bool suiteSetUp = false;
+
+        /**
+         * This flag is set if any test expectation check fails.
+         */
+        bool currentTestFailed = false;
+
+        /**
+         * This is the function to call to report any errors in the current
+         * test being run.
+         */
+        ErrorMessageDelegate errorMessageDelegate;
+
+        /**
+         * If not null, this is the arena from which the memory
+         * of the interpreter is allocated.  Otherwise, memory is
+         * allocated directly from the system.
+         */
+        Arena* arena = nullptr;
+
+        /**
+         * This is the number of bytes of memory currently allocated
+         * by the interpreter.
+         */
+        size_t memoryInUse = 0;
+
+        /**
+         * This is the largest number of bytes of memory which were
+         * allocated by the interpreter at any one time.
+         */
+        size_t peakMemory = 0;
+
+        /**
+         * This is the number of memory blocks allocated or reallocated
+         * by the interpreter.
+         */
+        size_t numAllocations = 0;
+
+        /**
+         * If not zero, this is the largest number of bytes of memory
+         * the interpreter is allowed to allocate at any one time.
+         * Any allocation which would exceed it fails.
+         */
+        size_t memoryLimit = 0;
+
+        /**
+         * This flag indicates whether or not to describe all differences
+         * found when comparing tables, rather than only the first one.
+         */
+        bool fullTableDiff = false;
+
+        /**
+         * This flag is set if an allocation failed because
+         * it would exceed the memory limit.
+         */
+        bool memoryLimitExceeded = false;
+
+        /**
+         * This is the number of Lua virtual machine instructions executed
+         * since the count hook was installed, accurate only to the
+         * interval at which the hook is called.
+         */
+        uint64_t instructionCount = 0;
+
+        /**
+         * This is the number of garbage collection cycles
+         * completed since the garbage collection sentinel was created.
+         */
+        size_t gcCycles = 0;
+
+        /**
+         * This flag indicates whether or not a new garbage collection
+         * sentinel should be made whenever the current one is collected.
+         */
+        bool gcSentinelActive = false;
+
+        /**
+         * This flag indicates whether or not a garbage collection
+         * sentinel exists which hasn't been collected yet.
+         */
+        bool gcSentinelAlive = false;
+
+        /**
+         * If not null, this is where to count the Lua call stacks sampled
+         * by the count hook, keyed by the stack in "folded" form (the
+         * names of the functions, outermost first, separated by semicolons).
+         */
+        std::unordered_map< std::string, size_t >* profileSamples = nullptr;
+
+        /**
+         * If not zero, this is the largest number of Lua virtual machine
+         * instructions the interpreter is allowed to execute.  The count
+         * hook raises an error once it's exceeded.
+         */
+        uint64_t instructionLimit = 0;
+
+        /**
+         * This flag indicates whether or not the count hook raises an
+         * error once the deadline passes.
+         */
+        bool hasDeadline = false;
+
+        /**
+         * If hasDeadline is set, this is the time by which
+         * the interpreter must stop running.
+         */
+        std::chrono::steady_clock::time_point deadline;
+
+        /**
+         * This flag is set once the instruction limit is exceeded.
+         */
+        bool instructionLimitExceeded = false;
+
+        /**
+         * This flag is set once the deadline passes.
+         */
+        bool deadlineExceeded = false;
+
+        /**
+         * If an asynchronous test is running, this points to the
+         * scheduler running its tasks.
+         */
+        AsyncScheduler* asyncScheduler = nullptr;
+    };
+
+    /**
+     * This holds the Lua interpreter kept by a thread for running the
+     * tests of a test suite, when the reuseStatePerSuite option is set.
+     */
+    struct SuiteState {
+        /**
+         * If not null, this is the interpreter kept for the test suite.
+         */
+        std::unique_ptr< Interpreter > interpreter;
+
+        /**
+         * This is the Lua script executed in the interpreter.
+         */
+        std::shared_ptr< Script > script;
+
+        /**
+         * This is the name of the test suite whose tests
+         * are run in the interpreter.
+         */
+        std::string testSuiteName;
+    };
+
+    /**
+     * This holds the state kept for one of a batch of asynchronous tests
+     * whose tasks are run together in one Lua interpreter.
+     */
+    struct AsyncBatchTest {
+        /**
+         * This identifies the test.
+         */
+        const TestTableEntry* testTableEntry = nullptr;
+
+        /**
+         * This is the function to call to report any error messages
+         * about the test.
+         */
+        ErrorMessageDelegate errorMessageDelegate;
+
+        /**
+         * This flag is set once the test has failed.
+         */
+        bool failed = false;
+
+        /**
+         * This flag is set once the last task of the test has finished,
+         * or the test has failed.
+         */
+        bool finished = false;
+
+        /**
+         * This is when the test finished.
+         */
+        std::chrono::steady_clock::time_point endTime;
+
+        /**
+         * This flag is set if the test exceeded the instruction limit.
+         */
+        bool instructionLimitExceeded = false;
+
+        /**
+         * This flag is set if the test was stopped because
+         * the deadline passed.
+         */
+        bool deadlineExceeded = false;
+
+        /**
+         * This is the number of Lua virtual machine instructions counted
+         * for the test, including those executed to load the test script
+         * and set up the test suite.
+         */
+        uint64_t instructionCount = 0;
+
+        /**
+         * This is the amount of processor time, in seconds, used while
+         * the tasks of the test ran.
+         */
+        double cpuTime = 0.0;
+
+        /**
+         * This is the number of garbage collection cycles completed
+         * while the tasks of the test ran.
+         */
+        size_t gcCycles = 0;
+
+        /**
+         * This is the processor time, in seconds, used by the thread
+         * when a task of the test was last resumed.
+         */
+        double resumeCpuTime = 0.0;
+
+        /**
+         * This is the number of garbage collection cycles completed
+         * in the interpreter when a task of the test was last resumed.
+         */
+        size_t resumeGcCycles = 0;
+    };
+
+    /**
+     * This holds a batch of asynchronous tests of the same test suite
+     * and script, whose tasks are run together in one Lua interpreter.
+     */
+    struct AsyncBatch {
+        /**
+         * These are the tests of the batch.
+         */
+        std::vector< AsyncBatchTest > tests;
+
+        /**
+         * This flag indicates whether or not to measure the processor
+         * time used, and count the garbage collection cycles completed,
+         * while the tasks of each test run.
+         */
+        bool collectMetrics = false;
+
+        /**
+         * This is the function to call to report error messages
+         * which concern every test of the batch, such as those raised
+         * while loading the test script.
+         */
+        ErrorMessageDelegate errorMessageDelegate;
+    };
+
+    // Properties
+
+    /**
+     * These are the settings which affect how the runner finds
+     * and runs tests.
+     */
+    Options options;
+
+    /**
+     * This is where information about the test suites located by the
+     * test runner are stored.
+     */
+    TestSuites testSuites;
+
+    /**
+     * This is the table of all the tests in the test suites, sorted by
+     * test suite name and then test name.  The position of each test
+     * in the table is its identifier.  It's rebuilt whenever
+     * the collection of test suites changes.
+     */
+    std::vector< TestTableEntry > testTable;
+
+    /**
+     * This is where information about the benchmark suites located by the
+     * test runner are stored.
+     */
+    TestSuites benchmarkSuites;
+
+    /**
+     * This remembers which tests were found in which Lua script files,
+     * so that unchanged files don't have to be executed again
+     * to find their tests.
+     */
+    DiscoveryIndex discoveryIndex;
+
+    /**
+     * These are the paths of the configuration files
+     * with which the runner was configured.
+     */
+    std::vector< std::string > configurationFilePaths;
+
+    /**
+     * This holds what was known about a Lua script file
+     * at the time tests were loaded from it.
+     */
+    struct TestFile {
+        /**
+         * This identifies the version of the file from which
+         * the tests were loaded.
+         */
+        DiscoveryIndex::Stamp stamp;
+
+        /**
+         * These are the other files which were loaded through "require"
+         * while finding the tests in the file.
+         */
+        std::vector< DiscoveryIndex::Dependency > dependencies;
+    };
+
+    /**
+     * These are the Lua script files from which tests were loaded,
+     * keyed by path.  They're used to tell which files changed since,
+     * and which tests depend on which files.
+     */
+    std::map< std::string, TestFile > testFiles;
+
+    /**
+     * If profiling, these are the number of times each Lua call stack
+     * was sampled, across all tests run, keyed by the stack in "folded" form.
+     */
+    std::map< std::string, size_t > profile;
+
+    /**
+     * This is used to synchronize access to the profile,
+     * since tests may be run at the same time.
+     */
+    std::mutex profileMutex;
+
+    /**
+     * If tests were loaded from a test pack, these are the compiled
+     * Lua modules of the pack, keyed by file path.
+     */
+    std::map< std::string, std::string > packedModules;
+
+    /**
+     * This flag indicates whether or not the tests were loaded
+     * from a test pack.
+     */
+    bool loadedFromPack = false;
+
+    /**
+     * These are the Lua interpreters kept for test suites, one for
+     * each thread running tests, when the reuseStatePerSuite option is set.
+     */
+    std::map< std::thread::id, SuiteState > suiteStates;
+
+    /**
+     * These are the errors raised by suite teardown functions,
+     * not yet reported by EndTestSuites.
+     */
+    std::vector< std::string > suiteTeardownErrorMessages;
+
+    /**
+     * This is used to synchronize access to the collection of Lua
+     * interpreters kept for test suites, and the errors raised by
+     * suite teardown functions, since tests may be run at the same time.
+     */
+    std::mutex suiteStatesMutex;
+
+    /**
+     * If not null, this is a Lua interpreter prepared ahead of time
+     * by PrepareInterpreter, for the next test run to use instead
+     * of making a fresh one.
+     */
+    std::unique_ptr< Interpreter > preparedInterpreter;
+
+    // Lifecycle
+
+    ~Impl() noexcept {
+        for (auto& suiteState: suiteStates) {
+            if (suiteState.second.interpreter != nullptr) {
+                CloseInterpreter(*suiteState.second.interpreter);
+            }
+        }
+        if (preparedInterpreter != nullptr) {
+            CloseInterpreter(*preparedInterpreter);
+        }
+    }
+    Impl(const Impl&) = delete;
+    Impl(Impl&&) = default;
+    Impl& operator=(const Impl&) = delete;
+    Impl& operator=(Impl&&) = default;
+
+    // Methods
+
+    /**
+     * This is the constructor of the class.
+     */
+    Impl() = default;
+
+    /**
+     * Collect information about the test suites and tests which are registered
+     * with the test runner via the moonunit.test (LuaTest) function, or
+     * the benchmark suites and benchmarks registered via the
+     * moonunit.benchmark (LuaBenchmark) function.
+     *
+     * @param[in] interpreter
+     *     This is the interpreter which executed the Lua script.
+     *
+     * @param[in] registryIndex
+     *     This is the Lua registry index of the table in which
+     *     the tests or benchmarks were registered.
+     *
+     * @param[in] script
+     *     This is the Lua script which was executed
+     *     in order to register the test suites and tests.
+     *
+     * @param[in,out] foundTestSuites
+     *     This is where to store information about the test suites
+     *     and tests found.
+     */
+    void FindTests(
+        Interpreter& interpreter,
+        int registryIndex,
+        const std::shared_ptr< Script >& script,
+        TestSuites& foundTestSuites
+    ) {
+        const auto lua = interpreter.lua;
+        lua_rawgeti(lua, LUA_REGISTRYINDEX, registryIndex);
+        lua_pushnil(lua);
+        while (lua_next(lua, -2) != 0) {
+            const std::string testSuiteName = luaL_checkstring(lua, -2);
+            auto& testSuite = foundTestSuites[testSuiteName];
+            lua_pushnil(lua);
+            while (lua_next(lua, -2) != 0) {
+                const std::string testName = luaL_checkstring(lua, -2);
+
+                // Asynchronous tests are registered wrapped in a closure,
+                // so look through it for where the test was defined.
+                Test test;
+                if (lua_tocfunction(lua, -1) == LuaRunAsyncTest) {
+                    (void)lua_getupvalue(lua, -1, 1);
+                    lua_remove(lua, -2);
+                    test.async = true;
+                }
+                lua_Debug debug;
+                lua_getinfo(lua, ">S", &debug);
+                test.script = script;
+                test.lineNumber = debug.linedefined;
+                testSuite.tests[testName] = std::move(test);
+            }
+            lua_pop(lua, 1);
+        }
+        lua_pop(lua, 1);
+    }
+
+    /**
+     * Call the given function after executing the given Lua script.
+     *
+     * @param[in] interpreter
+     *     This is the interpreter in which to execute the Lua script.
+     *
+     * @param[in] chunk
+     *     This is the Lua script to execute, either as source code
+     *     or compiled.
+     *
+     * @param[in] chunkSize
+     *     This is the size of the Lua script to execute.
+     *
+     * @param[in] mode
+     *     This is the mode passed to lua_load to indicate whether the
+     *     given chunk is source code ("t") or compiled ("b").
+     *
+     * @param[in] filePath
+     *     This is the path to the Lua script file to execute.
+     *
+     * @param[in] fn
+     *     This is the function to call after executing the Lua script.
+     *
+     * @param[out] bytecode
+     *     If not null, this is where to store the compiled Lua script,
+     *     in the binary chunk format produced by lua_dump, so that
+     *     it can be executed again later without parsing it again.
+     *
+     * @return
+     *     If any error occurs executing the Lua script, a human-readable
+     *     description of the error is returned.  Otherwise, an empty
+     *     string is returned.
+     */
+    std::string WithScript(
+        Interpreter& interpreter,
+        const char* chunk,
+        size_t chunkSize,
+        const char* mode,
+        const std::string& filePath,
+        std::function< void() > fn,
+        std::string* bytecode = nullptr
+    ) {
+        const auto lua = interpreter.lua;
+        interpreter.scriptDirectory = ParentFolderPath(filePath);
+        lua_settop(lua, 0);
+        lua_pushcfunction(lua, LuaTraceback);
+        LuaReaderState luaReaderState;
+        luaReaderState.chunk = chunk;
+        luaReaderState.chunkSize = chunkSize;
+        std::string errorMessage;
+        switch (const int luaLoadResult = lua_load(lua, LuaReader, &luaReaderState, ("=" + filePath).c_str(), mode)) {
+            case LUA_OK: {
+                if (bytecode != nullptr) {
+                    bytecode->clear();
+                    (void)lua_dump(lua, LuaWriter, bytecode, 0);
+                }
+                const int luaPCallResult = lua_pcall(lua, 0, 0, 1);
+                if (luaPCallResult == LUA_OK) {
+                    fn();
+                } else {
+                    if (!lua_isnil(lua, -1)) {
+                        errorMessage = lua_tostring(lua, -1);
+                    }
+                }
+            } break;
+            case LUA_ERRSYNTAX: {
+                errorMessage = lua_tostring(lua, -1);
+            } break;
+            case LUA_ERRMEM: {
+                errorMessage = "LUA_ERRMEM";
+            } break;
+            case LUA_ERRGCMM: {
+                errorMessage = "LUA_ERRGCMM";
+            } break;
+            default: {
+                errorMessage = StringExtensions::sprintf("(unexpected lua_load result: %d)", luaLoadResult);
+            } break;
+        }
+        lua_settop(lua, 0);
+        return errorMessage;
+    }
+
+    /**
+     * Execute the Lua script in the given file, and gather information
+     * about any test suites and tests registered by the script.
+     *
+     * @param[in,out] file
+     *     This is the file from which to load the Lua script.
+     *
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to deliver any error messages
+     *     generated while executing the Lua script.
+     *
+     * @param[in,out] loadedFile
+     *     This is where to store what was found in the file.
+     */
+    void LoadTestSuite(
+        SystemAbstractions::File& file,
+        ErrorMessageDelegate errorMessageDelegate,
+        LoadedFile& loadedFile
+    ) {
+        if (!file.OpenReadOnly()) {
+            errorMessageDelegate(
+                StringExtensions::sprintf(
+                    "ERROR: Unable to open Lua script file '%s'",
+                    file.GetPath().c_str()
+                )
+            );
+            return;
+        }
+        SystemAbstractions::IFile::Buffer buffer(file.GetSize());
+        const auto amountRead = file.Read(buffer);
+        file.Close();
+        if (amountRead != buffer.size()) {
+            errorMessageDelegate(
+                StringExtensions::sprintf(
+                    "ERROR: Unable to read Lua script file '%s'",
+                    file.GetPath().c_str()
+                )
+            );
+            return;
+        }
+        const auto script = std::make_shared< Script >();
+        script->filePath = file.GetPath();
+        WithLua([&](Interpreter& interpreter){
+            auto errorMessage = WithScript(
+                interpreter,
+                (const char*)buffer.data(),
+                buffer.size(),
+                "t",
+                script->filePath,
+                [&]{
+                    FindTests(interpreter, interpreter.luaRegistryIndex, script, loadedFile.testSuites);
+                    FindTests(interpreter, interpreter.luaBenchmarkRegistryIndex, script, loadedFile.benchmarkSuites);
+                    script->modules = interpreter.requiredModules;
+                },
+                &script->bytecode
+            );
+            if (!errorMessage.empty()) {
+                errorMessageDelegate(
+                    StringExtensions::sprintf(
+                        "ERROR: Unable to load Lua script file '%s': %s",
+                        file.GetPath().c_str(),
+                        errorMessage.c_str()
+                    )
+                );
+                return;
+            }
+            loadedFile.loaded = true;
+            auto& indexEntry = loadedFile.indexEntry;
+            indexEntry.stamp.size = buffer.size();
+            indexEntry.stamp.lastModifiedTime = (int64_t)file.GetLastModifiedTime();
+            indexEntry.stamp.hash = DiscoveryIndex::Hash(buffer.data(), buffer.size());
+            indexEntry.stamp.recordedTime = GetStampTime();
+            for (const auto benchmark: {false, true}) {
+                const auto& foundTestSuites = (
+                    benchmark
+                    ? loadedFile.benchmarkSuites
+                    : loadedFile.testSuites
+                );
+                for (const auto& testSuite: foundTestSuites) {
+                    for (const auto& test: testSuite.second.tests) {
+                        DiscoveryIndex::Test indexedTest;
+                        indexedTest.testSuiteName = testSuite.first;
+                        indexedTest.testName = test.first;
+                        indexedTest.lineNumber = test.second.lineNumber;
+                        indexedTest.benchmark = benchmark;
+                        indexedTest.async = test.second.async;
+                        indexEntry.tests.push_back(std::move(indexedTest));
+                    }
+                }
+            }
+            for (const auto& requiredFilePath: interpreter.requiredFilePaths) {
+                DiscoveryIndex::Dependency dependency;
+                dependency.filePath = requiredFilePath;
+                if (GetFileStamp(requiredFilePath, dependency.stamp)) {
+                    indexEntry.dependencies.push_back(std::move(dependency));
+                }
+            }
+            const auto delimiterIndex = file.GetPath().find_last_of('/');
+            auto name = (
+                (delimiterIndex == std::string::npos)
+                ? file.GetPath()
+                : file.GetPath().substr(delimiterIndex + 1)
+            );
+            if (name.length() >= luaFileExtensionLength) {
+                const auto nameLengthWithoutExtension = name.length() - luaFileExtensionLength;
+                if (name.substr(nameLengthWithoutExtension) == luaFileExtension) {
+                    name = name.substr(0, nameLengthWithoutExtension);
+                }
+            }
+        });
+    }
+
+    /**
+     * If the given Lua script file hasn't changed since it was recorded
+     * in the given discovery index entry, gather the information about
+     * its test suites and tests from the entry, rather than
+     * executing the script.
+     *
+     * The entry is looked up before any files are loaded, rather than
+     * here, because the index is updated as files finish loading, which
+     * may happen while other files are still being loaded.
+     *
+     * @param[in] filePath
+     *     This is the path of the Lua script file to look up.
+     *
+     * @param[in,out] loadedFile
+     *     This holds the discovery index entry of the file, and is where
+     *     to store what was found for the file.
+     *
+     * @return
+     *     An indication of whether or not the file's tests were found
+     *     in the discovery index is returned.
+     */
+    static bool FindTestsInIndex(
+        const std::string& filePath,
+        LoadedFile& loadedFile
+    ) {
+        auto& indexEntry = loadedFile.indexEntry;
+        if (!IsFileUnchanged(filePath, indexEntry.stamp)) {
+            return false;
+        }
+        for (auto& dependency: indexEntry.dependencies) {
+            if (!IsFileUnchanged(dependency.filePath, dependency.stamp)) {
+                return false;
+            }
+        }
+        const auto script = std::make_shared< Script >();
+        script->filePath = filePath;
+        for (const auto& indexedTest: indexEntry.tests) {
+            Test test;
+            test.script = script;
+            test.lineNumber = indexedTest.lineNumber;
+            test.async = indexedTest.async;
+            auto& foundTestSuites = (
+                indexedTest.benchmark
+                ? loadedFile.benchmarkSuites
+                : loadedFile.testSuites
+            );
+            foundTestSuites[indexedTest.testSuiteName].tests[indexedTest.testName] = std::move(test);
+        }
+        loadedFile.loaded = true;
+        return true;
+    }
+
+    /**
+     * Compile the given Lua script from its file, if it wasn't already
+     * compiled when its tests were found.
+     *
+     * @param[in,out] script
+     *     This is the Lua script to compile.
+     */
+    static void CompileScript(Script& script) {
+        if (!script.bytecode.empty()) {
+            return;
+        }
+        script.compileErrorMessage = CompileFile(
+            script.filePath,
+            "=" + script.filePath,
+            script.bytecode
+        );
+    }
+
+    /**
+     * Compile the Lua code in the file at the given path.
+     *
+     * @param[in] filePath
+     *     This is the path of the file to compile.
+     *
+     * @param[in] chunkName
+     *     This is the name to give the compiled code, which appears
+     *     in error messages and tracebacks.
+     *
+     * @param[out] bytecode
+     *     This is where to store the compiled code, in the binary chunk
+     *     format produced by lua_dump.
+     *
+     * @return
+     *     If the file could not be compiled, a human-readable description
+     *     of the problem is returned.  Otherwise, an empty string
+     *     is returned.
+     */
+    static std::string CompileFile(
+        const std::string& filePath,
+        const std::string& chunkName,
+        std::string& bytecode
+    ) {
+        SystemAbstractions::File file(filePath);
+        if (!file.OpenReadOnly()) {
+            return "unable to open file";
+        }
+        SystemAbstractions::IFile::Buffer buffer(file.GetSize());
+        const auto amountRead = file.Read(buffer);
+        file.Close();
+        if (amountRead != buffer.size()) {
+            return "unable to read file";
+        }
+        const auto lua = lua_newstate(LuaAllocator, NULL);
+        LuaReaderState luaReaderState;
+        luaReaderState.chunk = (const char*)buffer.data();
+        luaReaderState.chunkSize = buffer.size();
+        std::string errorMessage;
+        switch (const int luaLoadResult = lua_load(lua, LuaReader, &luaReaderState, chunkName.c_str(), "t")) {
+            case LUA_OK: {
+                bytecode.clear();
+                (void)lua_dump(lua, LuaWriter, &bytecode, 0);
+            } break;
+            case LUA_ERRSYNTAX: {
+                errorMessage = lua_tostring(lua, -1);
+            } break;
+            case LUA_ERRMEM: {
+                errorMessage = "LUA_ERRMEM";
+            } break;
+            case LUA_ERRGCMM: {
+                errorMessage = "LUA_ERRGCMM";
+            } break;
+            default: {
+                errorMessage = StringExtensions::sprintf("(unexpected lua_load result: %d)", luaLoadResult);
+            } break;
+        }
+        lua_close(lua);
+        return errorMessage;
+    }
+
+    /**
+     * Make sure the given Lua script is compiled, compiling it if this
+     * is the first time one of its tests is run.
+     *
+     * @param[in,out] script
+     *     This is the Lua script to prepare.
+     *
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to report any error messages.
+     *
+     * @return
+     *     An indication of whether or not the script is compiled
+     *     and ready to run is returned.
+     */
+    static bool PrepareScript(
+        Script& script,
+        ErrorMessageDelegate errorMessageDelegate
+    ) {
+        std::call_once(
+            script.compileOnce,
+            [&]{
+                CompileScript(script);
+            }
+        );
+        if (!script.compileErrorMessage.empty()) {
+            errorMessageDelegate(
+                StringExtensions::sprintf(
+                    "ERROR: Unable to load Lua script file '%s': %s",
+                    script.filePath.c_str(),
+                    script.compileErrorMessage.c_str()
+                )
+            );
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Read the given MoonUnit configuration file, and collect the paths
+     * of all Lua script files it specifies, either directly or through
+     * the directories and other configuration files it specifies.
+     *
+     * @param[in,out] configurationFile
+     *     This is the MoonUnit configuration file to read.
+     *
+     * @param[in,out] testFilePaths
+     *     This is where to add the paths of the Lua script files found,
+     *     in the order in which they should be loaded.
+     */
+    void FindTestFiles(
+        SystemAbstractions::File& configurationFile,
+        std::vector< std::string >& testFilePaths
+    ) {
+        if (!configurationFile.OpenReadOnly()) {
+            return;
+        }
+        SystemAbstractions::IFile::Buffer buffer(configurationFile.GetSize());
+        const auto amountRead = configurationFile.Read(buffer);
+        configurationFile.Close();
+        if (amountRead != buffer.size()) {
+            return;
+        }
+        const std::string configuration(buffer.begin(), buffer.end());
+        for (const auto& line: StringExtensions::Split(configuration, '\n')) {
+            auto searchPath = StringExtensions::Trim(line);
+            if (!SystemAbstractions::File::IsAbsolutePath(searchPath)) {
+                searchPath = (
+                    ParentFolderPath(configurationFile.GetPath())
+                    + "/"
+                    + searchPath
+                );
+            }
+            SystemAbstractions::File possibleTestFile(searchPath);
+            if (!possibleTestFile.IsExisting()) {
+                continue;
+            }
+            if (possibleTestFile.IsDirectory()) {
+                SystemAbstractions::File possibleOtherConfigurationFile(searchPath + "/.moonunit");
+                if (possibleOtherConfigurationFile.IsExisting()) {
+                    FindTestFiles(possibleOtherConfigurationFile, testFilePaths);
+                } else {
+                    std::vector< std::string > filePaths;
+                    SystemAbstractions::File::ListDirectory(searchPath, filePaths);
+                    for (const auto& filePath: filePaths) {
+                        if (
+                            (filePath.length() >= luaFileExtensionLength)
+                            && (filePath.substr(filePath.length() - luaFileExtensionLength) == luaFileExtension)
+                        ) {
+                            testFilePaths.push_back(filePath);
+                        }
+                    }
+                }
+            } else {
+                testFilePaths.push_back(searchPath);
+            }
+        }
+    }
+
+    /**
+     * Execute the Lua scripts in the given files, and gather information
+     * about any test suites and tests registered by the scripts.
+     *
+     * The files are loaded at the same time, each in its own Lua
+     * interpreter, according to the runner options, but the tests found
+     * and errors reported are merged in the order the files are given,
+     * so the outcome is the same as loading the files one at a time.
+     *
+     * Files which haven't changed since they were recorded in the
+     * discovery index, and whose required modules haven't changed either,
+     * are not executed; their tests are taken from the index instead.
+     *
+     * @param[in] filePaths
+     *     These are the paths of the files from which to load Lua scripts.
+     *
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to deliver any error messages
+     *     generated while executing the Lua scripts.
+     */
+    void LoadTestSuites(
+        const std::vector< std::string >& filePaths,
+        ErrorMessageDelegate errorMessageDelegate
+    ) {
+        std::vector< LoadedFile > loadedFiles(filePaths.size());
+        std::vector< bool > indexed(filePaths.size());
+        for (size_t i = 0; i < filePaths.size(); ++i) {
+            indexed[i] = discoveryIndex.Find(filePaths[i], loadedFiles[i].indexEntry);
+        }
+        WorkerPool workerPool(options.jobs);
+        workerPool.Run(
+            filePaths.size(),
+            [&](size_t job, size_t worker){
+                auto& loadedFile = loadedFiles[job];
+                if (
+                    indexed[job]
+                    && FindTestsInIndex(filePaths[job], loadedFile)
+                ) {
+                    return;
+                }
+                loadedFile = LoadedFile();
+                SystemAbstractions::File file(filePaths[job]);
+                LoadTestSuite(
+                    file,
+                    [&](const std::string& message){
+                        loadedFile.errorMessages.push_back(message);
+                    },
+                    loadedFile
+                );
+            },
+            [&](size_t job){
+                auto& loadedFile = loadedFiles[job];
+                for (const auto& message: loadedFile.errorMessages) {
+                    errorMessageDelegate(message);
+                }
+                auto& testFile = testFiles[filePaths[job]];
+                if (loadedFile.loaded) {
+                    discoveryIndex.Update(filePaths[job], loadedFile.indexEntry);
+                    testFile.stamp = loadedFile.indexEntry.stamp;
+                    testFile.dependencies = std::move(loadedFile.indexEntry.dependencies);
+                } else {
+                    if (!GetFileStamp(filePaths[job], testFile.stamp)) {
+                        testFile.stamp = DiscoveryIndex::Stamp();
+                    }
+                    testFile.dependencies.clear();
+                }
+                for (auto& loadedTestSuite: loadedFile.testSuites) {
+                    auto& testSuite = testSuites[loadedTestSuite.first];
+                    for (auto& loadedTest: loadedTestSuite.second.tests) {
+                        testSuite.tests[loadedTest.first] = std::move(loadedTest.second);
+                    }
+                }
+                for (auto& loadedBenchmarkSuite: loadedFile.benchmarkSuites) {
+                    auto& benchmarkSuite = benchmarkSuites[loadedBenchmarkSuite.first];
+                    for (auto& loadedBenchmark: loadedBenchmarkSuite.second.tests) {
+                        benchmarkSuite.tests[loadedBenchmark.first] = std::move(loadedBenchmark.second);
+                    }
+                }
+                loadedFile = LoadedFile();
+            }
+        );
+    }
+
+    /**
+     * Forget all tests and benchmarks which were loaded from the Lua script
+     * file at the given path.
+     *
+     * @param[in] filePath
+     *     This is the path of the file whose tests should be forgotten.
+     */
+    void RemoveTestsFromFile(const std::string& filePath) {
+        RemoveTestsFromFile(filePath, testSuites);
+        RemoveTestsFromFile(filePath, benchmarkSuites);
+    }
+
+    /**
+     * Forget all tests in the given collection which were loaded
+     * from the Lua script file at the given path.
+     *
+     * @param[in] filePath
+     *     This is the path of the file whose tests should be forgotten.
+     *
+     * @param[in,out] testSuites
+     *     This is the collection of test suites from which to remove
+     *     the tests.
+     */
+    static void RemoveTestsFromFile(
+        const std::string& filePath,
+        TestSuites& testSuites
+    ) {
+        for (auto testSuite = testSuites.begin(); testSuite != testSuites.end();) {
+            auto& tests = testSuite->second.tests;
+            for (auto test = tests.begin(); test != tests.end();) {
+                if (test->second.script->filePath == filePath) {
+                    test = tests.erase(test);
+                } else {
+                    ++test;
+                }
+            }
+            if (tests.empty()) {
+                testSuite = testSuites.erase(testSuite);
+            } else {
+                ++testSuite;
+            }
+        }
+    }
+
+    /**
+     * Rebuild the table of all tests from the collection of test suites.
+     * This must be done whenever tests are added or removed, since the
+     * table refers to the tests and their names in the collection.
+     */
+    void BuildTestTable() {
+        testTable.clear();
+        for (auto& testSuite: testSuites) {
+            for (auto& test: testSuite.second.tests) {
+                TestTableEntry entry;
+                entry.testSuiteName = &testSuite.first;
+                entry.testName = &test.first;
+                entry.test = &test.second;
+                testTable.push_back(entry);
+            }
+        }
+        std::sort(testTable.begin(), testTable.end(), TestTableEntryLess);
+    }
+
+    /**
+     * Return the interpreter whose "moonunit" singleton was given as the
+     * first argument to the method of the singleton being called.
+     *
+     * Each method has the singleton as its first upvalue, so checking the
+     * first argument is the singleton takes a single comparison, rather
+     * than looking up the metatable of the singleton in the registry.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The interpreter is returned.
+     */
+    static Interpreter* GetSelf(lua_State* lua) {
+        if (!lua_rawequal(lua, 1, lua_upvalueindex(1))) {
+            (void)luaL_checkudata(lua, 1, "moonunit");
+        }
+        return *(Interpreter**)lua_touserdata(lua, lua_upvalueindex(1));
+    }
+
+    /**
+     * Return a human-readable description of the value at the given
+     * position in the Lua stack, to include in a failure message.
+     *
+     * This is only called once a check has failed, so that checks
+     * which pass don't convert or allocate anything.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] index
+     *     This is the index of the value on the Lua stack.
+     *
+     * @return
+     *     A human-readable description of the value is returned.
+     */
+    static std::string DescribeOperand(lua_State* lua, int index) {
+        const std::string description = luaL_tolstring(lua, index, NULL);
+        lua_pop(lua, 1);
+        return description;
+    }
+
+    /**
+     * Mark the current test as failed, and report the given message
+     * along with a traceback of where the failed expectation was checked.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] self
+     *     This is the interpreter running the test.
+     *
+     * @param[in] message
+     *     This describes the failed expectation.
+     */
+    static void FailExpectation(
+        lua_State* lua,
+        Interpreter* self,
+        const std::string& message
+    ) {
+        self->currentTestFailed = true;
+        luaL_traceback(lua, lua, NULL, 1);
+        self->errorMessageDelegate(
+            StringExtensions::sprintf(
+                "%s%s\n",
+                message.c_str(),
+                lua_tostring(lua, -1)
+            )
+        );
+        lua_pop(lua, 1);
+    }
+
+    /**
+     * Return a description of how the two values at the top of the
+     * Lua stack were expected to compare, for a failed comparison.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] relation
+     *     This is the operator expected to hold between the values.
+     *
+     * @return
+     *     A description of the failed comparison is returned.
+     */
+    static std::string DescribeFailedComparison(
+        lua_State* lua,
+        const char* relation
+    ) {
+        return StringExtensions::sprintf(
+            "expected '%s' %s '%s'\n",
+            DescribeOperand(lua, 2).c_str(),
+            relation,
+            DescribeOperand(lua, 3).c_str()
+        );
+    }
+
+    /**
+     * Compare the two values at the top of the Lua stack and throw an error if
+     * they are not equal.
+     *
+     * This is registered as the "assert_eq" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaAssertEq(lua_State* lua) {
+        auto self = GetSelf(lua);
+        if (
+            lua_istable(lua, 2)
+            && lua_istable(lua, 3)
+        ) {
+            const auto comparisonResult = CompareLuaTables(lua, 2, 3, self->fullTableDiff);
+            if (!comparisonResult.empty()) {
+                luaL_error(lua, "%s", comparisonResult.c_str());
+            }
+        } else if (!lua_compare(lua, 2, 3, LUA_OPEQ)) {
+            luaL_error(
+                lua,
+                "Expected '%s', actual was '%s'\n",
+                DescribeOperand(lua, 2).c_str(),
+                DescribeOperand(lua, 3).c_str()
+            );
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the value at the top of the Lua stack and throw an error if
+     * it is not considered "falsey".
+     *
+     * This is registered as the "assert_false" method of the "moonunit"
+     * singleton provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaAssertFalse(lua_State* lua) {
+        (void)GetSelf(lua);
+        if (lua_toboolean(lua, 2)) {
+            luaL_error(
+                lua,
+                "Expected '%s' to be false\n",
+                DescribeOperand(lua, 2).c_str()
+            );
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the two values at the top of the Lua stack and throw an error if
+     * the first is not greater than or equal to the second.
+     *
+     * This is registered as the "assert_ge" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaAssertGe(lua_State* lua) {
+        (void)GetSelf(lua);
+        if (lua_compare(lua, 2, 3, LUA_OPLT)) {
+            luaL_error(lua, "%s", DescribeFailedComparison(lua, ">=").c_str());
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the two values at the top of the Lua stack and throw an error if
+     * the first is not greater than the second.
+     *
+     * This is registered as the "assert_gt" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaAssertGt(lua_State* lua) {
+        (void)GetSelf(lua);
+        if (lua_compare(lua, 2, 3, LUA_OPLE)) {
+            luaL_error(lua, "%s", DescribeFailedComparison(lua, ">").c_str());
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the two values at the top of the Lua stack and throw an error if
+     * the first is not less than or equal to the second.
+     *
+     * This is registered as the "assert_le" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaAssertLe(lua_State* lua) {
+        (void)GetSelf(lua);
+        if (!lua_compare(lua, 2, 3, LUA_OPLE)) {
+            luaL_error(lua, "%s", DescribeFailedComparison(lua, "<=").c_str());
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the two values at the top of the Lua stack and throw an error if
+     * the first is not less than the second.
+     *
+     * This is registered as the "assert_lt" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaAssertLt(lua_State* lua) {
+        (void)GetSelf(lua);
+        if (!lua_compare(lua, 2, 3, LUA_OPLT)) {
+            luaL_error(lua, "%s", DescribeFailedComparison(lua, "<").c_str());
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the two values at the top of the Lua stack and throw an error if
+     * they are equal.
+     *
+     * This is registered as the "assert_ne" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaAssertNe(lua_State* lua) {
+        (void)GetSelf(lua);
+        if (
+            lua_istable(lua, 2)
+            && lua_istable(lua, 3)
+        ) {
+            if (CompareLuaTables(lua, 2, 3, false).empty()) {
+                luaL_error(
+                    lua,
+                    "Tables should differ but are the same\n"
+                );
+            }
+        } else if (lua_compare(lua, 2, 3, LUA_OPEQ)) {
+            luaL_error(
+                lua,
+                "Expected not '%s', actual was '%s'\n",
+                DescribeOperand(lua, 2).c_str(),
+                DescribeOperand(lua, 3).c_str()
+            );
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the value at the top of the Lua stack and throw an error if
+     * it is not considered "truthy".
+     *
+     * This is registered as the "assert_true" method of the "moonunit"
+     * singleton provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaAssertTrue(lua_State* lua) {
+        (void)GetSelf(lua);
+        if (!lua_toboolean(lua, 2)) {
+            luaL_error(
+                lua,
+                "Expected '%s' to be true\n",
+                DescribeOperand(lua, 2).c_str()
+            );
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the two values at the top of the Lua stack and mark the current
+     * test as failed if the two values are not equal.
+     *
+     * This is registered as the "expect_eq" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaExpectEq(lua_State* lua) {
+        auto self = GetSelf(lua);
+        if (
+            lua_istable(lua, 2)
+            && lua_istable(lua, 3)
+        ) {
+            const auto comparisonResult = CompareLuaTables(lua, 2, 3, self->fullTableDiff);
+            if (!comparisonResult.empty()) {
+                FailExpectation(lua, self, comparisonResult);
+            }
+        } else if (!lua_compare(lua, 2, 3, LUA_OPEQ)) {
+            FailExpectation(
+                lua,
+                self,
+                StringExtensions::sprintf(
+                    "Expected '%s' (%s), actual was '%s' (%s)\n",
+                    DescribeOperand(lua, 2).c_str(),
+                    luaL_typename(lua, 2),
+                    DescribeOperand(lua, 3).c_str(),
+                    luaL_typename(lua, 3)
+                )
+            );
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the value at the top of the Lua stack and mark the current test
+     * as failed if it is not considered "falsey".
+     *
+     * This is registered as the "expect_false" method of the "moonunit"
+     * singleton provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaExpectFalse(lua_State* lua) {
+        auto self = GetSelf(lua);
+        if (lua_toboolean(lua, 2)) {
+            FailExpectation(
+                lua,
+                self,
+                StringExtensions::sprintf(
+                    "Expected '%s' to be false\n",
+                    DescribeOperand(lua, 2).c_str()
+                )
+            );
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the two values at the top of the Lua stack and mark the current
+     * test as failed if the first is not greater than or equal to the second.
+     *
+     * This is registered as the "expect_ge" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaExpectGe(lua_State* lua) {
+        auto self = GetSelf(lua);
+        if (lua_compare(lua, 2, 3, LUA_OPLT)) {
+            FailExpectation(lua, self, DescribeFailedComparison(lua, ">="));
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the two values at the top of the Lua stack and mark the current
+     * test as failed if the first is not greater than the second.
+     *
+     * This is registered as the "expect_gt" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaExpectGt(lua_State* lua) {
+        auto self = GetSelf(lua);
+        if (lua_compare(lua, 2, 3, LUA_OPLE)) {
+            FailExpectation(lua, self, DescribeFailedComparison(lua, ">"));
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the two values at the top of the Lua stack and mark the current
+     * test as failed if the first is not less than or equal to the second.
+     *
+     * This is registered as the "expect_le" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaExpectLe(lua_State* lua) {
+        auto self = GetSelf(lua);
+        if (!lua_compare(lua, 2, 3, LUA_OPLE)) {
+            FailExpectation(lua, self, DescribeFailedComparison(lua, "<="));
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the two values at the top of the Lua stack and mark the current
+     * test as failed if the first is not less than the second.
+     *
+     * This is registered as the "expect_lt" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaExpectLt(lua_State* lua) {
+        auto self = GetSelf(lua);
+        if (!lua_compare(lua, 2, 3, LUA_OPLT)) {
+            FailExpectation(lua, self, DescribeFailedComparison(lua, "<"));
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the two values at the top of the Lua stack and mark the current
+     * test as failed if they are equal.
+     *
+     * This is registered as the "expect_ne" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaExpectNe(lua_State* lua) {
+        auto self = GetSelf(lua);
+        if (
+            lua_istable(lua, 2)
+            && lua_istable(lua, 3)
+        ) {
+            if (CompareLuaTables(lua, 2, 3, false).empty()) {
+                FailExpectation(lua, self, "Tables should differ but are the same\n");
+            }
+        } else if (lua_compare(lua, 2, 3, LUA_OPEQ)) {
+            FailExpectation(
+                lua,
+                self,
+                StringExtensions::sprintf(
+                    "Expected not '%s', actual was '%s'\n",
+                    DescribeOperand(lua, 2).c_str(),
+                    DescribeOperand(lua, 3).c_str()
+                )
+            );
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the value at the top of the Lua stack and mark the current test
+     * as failed if it is not considered "truthy".
+     *
+     * This is registered as the "expect_true" method of the "moonunit"
+     * singleton provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaExpectTrue(lua_State* lua) {
+        auto self = GetSelf(lua);
+        if (!lua_toboolean(lua, 2)) {
+            FailExpectation(
+                lua,
+                self,
+                StringExtensions::sprintf(
+                    "Expected '%s' to be true\n",
+                    DescribeOperand(lua, 2).c_str()
+                )
+            );
+        }
+        return 0;
+    }
+
+    /**
+     * Return the largest number of mismatched elements a check made over
+     * whole arrays should describe, given by the optional argument
+     * at the given position on the Lua stack.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] index
+     *     This is the position on the Lua stack of the optional argument.
+     *
+     * @return
+     *     The largest number of mismatched elements to describe is returned.
+     */
+    static size_t CheckMaxReportedMismatches(lua_State* lua, int index) {
+        const auto maxReported = luaL_optinteger(lua, index, defaultMaxReportedMismatches);
+        luaL_argcheck(lua, maxReported >= 0, index, "must not be negative");
+        return (size_t)maxReported;
+    }
+
+    /**
+     * Compare the arrays given as the second and third arguments, element by
+     * element, for equality.  Elements which are both tables are compared
+     * "deeply".  The optional fourth argument is the largest number of
+     * mismatched elements to describe.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     If the arrays are the same, an empty string is returned.
+     *     Otherwise, a human-readable description of the mismatches
+     *     is returned.
+     */
+    static std::string CheckAllEq(lua_State* lua) {
+        luaL_checktype(lua, 2, LUA_TTABLE);
+        luaL_checktype(lua, 3, LUA_TTABLE);
+        ElementMismatches mismatches;
+        mismatches.maxReported = CheckMaxReportedMismatches(lua, 4);
+        const auto expectedLength = (lua_Integer)lua_rawlen(lua, 2);
+        const auto actualLength = (lua_Integer)lua_rawlen(lua, 3);
+        const auto length = std::min(expectedLength, actualLength);
+        for (lua_Integer i = 1; i <= length; ++i) {
+            (void)lua_rawgeti(lua, 2, i); // -1 = expected
+            (void)lua_rawgeti(lua, 3, i); // -1 = actual, -2 = expected
+            if (
+                lua_istable(lua, -2)
+                && lua_istable(lua, -1)
+            ) {
+                const auto comparisonResult = CompareLuaTables(lua, -2, -1, false);
+                if (
+                    !comparisonResult.empty()
+                    && mismatches.Count()
+                ) {
+                    mismatches.descriptions += StringExtensions::sprintf(
+                        "  element %lld: %s",
+                        (long long)i,
+                        comparisonResult.c_str()
+                    );
+                }
+            } else if (
+                !lua_compare(lua, -2, -1, LUA_OPEQ)
+                && mismatches.Count()
+            ) {
+                mismatches.descriptions += StringExtensions::sprintf(
+                    "  element %lld: expected '%s', actual was '%s'\n",
+                    (long long)i,
+                    DescribeOperand(lua, -2).c_str(),
+                    DescribeOperand(lua, -1).c_str()
+                );
+            }
+            lua_pop(lua, 2);
+        }
+        return mismatches.Describe("Arrays differ", expectedLength, actualLength);
+    }
+
+    /**
+     * Compare the arrays of numbers given as the second and third arguments,
+     * element by element, for equality within the tolerance given as the
+     * fourth argument.  The optional fifth argument is the largest number of
+     * mismatched elements to describe.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     If the arrays are the same, within the tolerance, an empty string is
+     *     returned.  Otherwise, a human-readable description of the
+     *     mismatches is returned.
+     */
+    static std::string CheckAllNear(lua_State* lua) {
+        luaL_checktype(lua, 2, LUA_TTABLE);
+        luaL_checktype(lua, 3, LUA_TTABLE);
+        const auto tolerance = luaL_checknumber(lua, 4);
+        luaL_argcheck(lua, tolerance >= 0, 4, "must not be negative");
+        ElementMismatches mismatches;
+        mismatches.maxReported = CheckMaxReportedMismatches(lua, 5);
+        const auto expectedLength = (lua_Integer)lua_rawlen(lua, 2);
+        const auto actualLength = (lua_Integer)lua_rawlen(lua, 3);
+        const auto length = std::min(expectedLength, actualLength);
+        for (lua_Integer i = 1; i <= length; ++i) {
+            (void)lua_rawgeti(lua, 2, i); // -1 = expected
+            (void)lua_rawgeti(lua, 3, i); // -1 = actual, -2 = expected
+            int expectedIsNumber = 0;
+            int actualIsNumber = 0;
+            const auto expected = lua_tonumberx(lua, -2, &expectedIsNumber);
+            const auto actual = lua_tonumberx(lua, -1, &actualIsNumber);
+            const auto near = (
+                expectedIsNumber
+                && actualIsNumber
+                && (fabs(expected - actual) <= tolerance)
+            );
+            if (
+                !near
+                && mismatches.Count()
+            ) {
+                mismatches.descriptions += StringExtensions::sprintf(
+                    "  element %lld: expected '%s', actual was '%s'\n",
+                    (long long)i,
+                    DescribeOperand(lua, -2).c_str(),
+                    DescribeOperand(lua, -1).c_str()
+                );
+            }
+            lua_pop(lua, 2);
+        }
+        return mismatches.Describe(
+            StringExtensions::sprintf(
+                "Arrays differ by more than %g",
+                (double)tolerance
+            ).c_str(),
+            expectedLength,
+            actualLength
+        );
+    }
+
+    /**
+     * Check that the elements of the array given as the second argument are
+     * in order, with none less than the element before it.  The optional
+     * third argument is the largest number of out-of-order elements
+     * to describe.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     If the array is sorted, an empty string is returned.  Otherwise,
+     *     a human-readable description of the elements out of order
+     *     is returned.
+     */
+    static std::string CheckSorted(lua_State* lua) {
+        luaL_checktype(lua, 2, LUA_TTABLE);
+        ElementMismatches mismatches;
+        mismatches.maxReported = CheckMaxReportedMismatches(lua, 3);
+        const auto length = (lua_Integer)lua_rawlen(lua, 2);
+        if (length > 0) {
+            (void)lua_rawgeti(lua, 2, 1); // -1 = previous
+        }
+        for (lua_Integer i = 2; i <= length; ++i) {
+            (void)lua_rawgeti(lua, 2, i); // -1 = element, -2 = previous
+            if (
+                lua_compare(lua, -1, -2, LUA_OPLT)
+                && mismatches.Count()
+            ) {
+                mismatches.descriptions += StringExtensions::sprintf(
+                    "  element %lld ('%s') is less than element %lld ('%s')\n",
+                    (long long)i,
+                    DescribeOperand(lua, -1).c_str(),
+                    (long long)(i - 1),
+                    DescribeOperand(lua, -2).c_str()
+                );
+            }
+            lua_remove(lua, -2); // -1 = previous
+        }
+        if (length > 0) {
+            lua_pop(lua, 1);
+        }
+        return mismatches.Describe("Array is not sorted", length, length);
+    }
+
+    /**
+     * Compare the arrays given as the first two arguments element by element,
+     * and throw an error if they differ.
+     *
+     * This is registered as the "assert_all_eq" method of the "moonunit"
+     * singleton provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaAssertAllEq(lua_State* lua) {
+        (void)GetSelf(lua);
+        const auto failure = CheckAllEq(lua);
+        if (!failure.empty()) {
+            luaL_error(lua, "%s", failure.c_str());
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the arrays of numbers given as the first two arguments element
+     * by element, and throw an error if they differ by more than the
+     * given tolerance.
+     *
+     * This is registered as the "assert_all_near" method of the "moonunit"
+     * singleton provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaAssertAllNear(lua_State* lua) {
+        (void)GetSelf(lua);
+        const auto failure = CheckAllNear(lua);
+        if (!failure.empty()) {
+            luaL_error(lua, "%s", failure.c_str());
+        }
+        return 0;
+    }
+
+    /**
+     * Check the order of the elements of the given array, and throw an
+     * error if it is not sorted.
+     *
+     * This is registered as the "assert_sorted" method of the "moonunit"
+     * singleton provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaAssertSorted(lua_State* lua) {
+        (void)GetSelf(lua);
+        const auto failure = CheckSorted(lua);
+        if (!failure.empty()) {
+            luaL_error(lua, "%s", failure.c_str());
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the arrays given as the first two arguments element by element,
+     * and mark the current test as failed if they differ.
+     *
+     * This is registered as the "expect_all_eq" method of the "moonunit"
+     * singleton provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaExpectAllEq(lua_State* lua) {
+        auto self = GetSelf(lua);
+        const auto failure = CheckAllEq(lua);
+        if (!failure.empty()) {
+            FailExpectation(lua, self, failure);
+        }
+        return 0;
+    }
+
+    /**
+     * Compare the arrays of numbers given as the first two arguments element
+     * by element, and mark the current test as failed if they differ by more
+     * than the given tolerance.
+     *
+     * This is registered as the "expect_all_near" method of the "moonunit"
+     * singleton provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaExpectAllNear(lua_State* lua) {
+        auto self = GetSelf(lua);
+        const auto failure = CheckAllNear(lua);
+        if (!failure.empty()) {
+            FailExpectation(lua, self, failure);
+        }
+        return 0;
+    }
+
+    /**
+     * Check the order of the elements of the given array, and mark the
+     * current test as failed if it is not sorted.
+     *
+     * This is registered as the "expect_sorted" method of the "moonunit"
+     * singleton provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaExpectSorted(lua_State* lua) {
+        auto self = GetSelf(lua);
+        const auto failure = CheckSorted(lua);
+        if (!failure.empty()) {
+            FailExpectation(lua, self, failure);
+        }
+        return 0;
+    }
+
+    /**
+     * Call the original Lua function, given as the first upvalue, after
+     * resolving the leading path argument(s) against the script directory
+     * of the interpreter given as the second upvalue.  The number of
+     * leading path arguments is given as the third upvalue.
+     *
+     * This wraps functions such as "dofile" and "io.open" so that relative
+     * paths given to them are relative to the folder of the script,
+     * without changing the working directory of the process.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int LuaCallWithResolvedPaths(lua_State* lua) {
+        const auto self = (Interpreter*)lua_touserdata(lua, lua_upvalueindex(2));
+        const auto numPathArguments = (int)lua_tointeger(lua, lua_upvalueindex(3));
+        const auto numArguments = lua_gettop(lua);
+        for (int i = 1; (i <= numPathArguments) && (i <= numArguments); ++i) {
+            if (lua_type(lua, i) == LUA_TSTRING) {
+                const auto path = ResolvePath(self->scriptDirectory, lua_tostring(lua, i));
+                lua_pushlstring(lua, path.data(), path.length());
+                lua_replace(lua, i);
+            }
+        }
+        lua_pushvalue(lua, lua_upvalueindex(1));
+        lua_insert(lua, 1);
+
+        // The original function may yield (as "dofile" does if the file it
+        // runs yields, such as from a task of an asynchronous test), so it's
+        // called with a continuation which finishes the call when resumed.
+        lua_callk(lua, numArguments, LUA_MULTRET, 0, LuaCallWithResolvedPathsContinue);
+        return LuaCallWithResolvedPathsContinue(lua, LUA_OK, 0);
+    }
+
+    /**
+     * Finish a call made by LuaCallWithResolvedPaths, once the original
+     * Lua function returns, either directly or after yielding, by
+     * returning everything it returned.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] status
+     *     This is the status of the call being finished.
+     *
+     * @param[in] context
+     *     This is the context passed to lua_callk.  It isn't used.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int LuaCallWithResolvedPathsContinue(
+        lua_State* lua,
+        int status,
+        lua_KContext context
+    ) {
+        return lua_gettop(lua);
+    }
+
+    /**
+     * Call the original package searcher, given as the first upvalue, with
+     * the module search path field (given by name as the third upvalue) of
+     * the "package" table temporarily resolved against the script directory
+     * of the interpreter given as the second upvalue.
+     *
+     * This wraps the standard Lua and C module searchers so that modules
+     * are found relative to the folder of the script, as they would be if
+     * the working directory was the folder of the script.  The files in
+     * which modules are found are also recorded in the interpreter,
+     * so that it's known which files the script depends on.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int LuaSearchFromScriptDirectory(lua_State* lua) {
+        const auto self = (Interpreter*)lua_touserdata(lua, lua_upvalueindex(2));
+        const auto searchPathField = lua_tostring(lua, lua_upvalueindex(3));
+        lua_settop(lua, 1); // 1 = name
+        lua_getglobal(lua, "package"); // 2 = package
+        lua_getfield(lua, 2, searchPathField); // 3 = original search path
+        const auto resolveSearchPath = (
+            !self->scriptDirectory.empty()
+            && (lua_type(lua, 3) == LUA_TSTRING)
+        );
+        if (resolveSearchPath) {
+            const auto searchPath = ResolveSearchPath(
+                self->scriptDirectory,
+                lua_tostring(lua, 3)
+            );
+            lua_pushlstring(lua, searchPath.data(), searchPath.length());
+            lua_setfield(lua, 2, searchPathField);
+        }
+        lua_pushvalue(lua, lua_upvalueindex(1));
+        lua_pushvalue(lua, 1);
+        const auto luaPCallResult = lua_pcall(lua, 1, 2, 0); // 4, 5 = results, or 4 = error
+        if (resolveSearchPath) {
+            lua_pushvalue(lua, 3);
+            lua_setfield(lua, 2, searchPathField);
+        }
+        if (luaPCallResult != LUA_OK) {
+            return lua_error(lua);
+        }
+        if (
+            (lua_type(lua, 4) == LUA_TFUNCTION)
+            && (lua_type(lua, 5) == LUA_TSTRING)
+        ) {
+            // The searcher found the module, and reported which file
+            // it's in, so remember the file as a dependency of the script.
+            const auto filePath = NormalizePath(lua_tostring(lua, 5));
+            (void)self->requiredFilePaths.insert(filePath);
+            if (strcmp(searchPathField, "path") == 0) {
+                self->requiredModules[lua_tostring(lua, 1)] = filePath;
+            }
+        }
+        return 2;
+    }
+
+    /**
+     * Look for the Lua module with the given name among the modules
+     * of the test pack given by the interpreter given as the first
+     * upvalue, recorded as having been loaded by the Lua script
+     * of the test or benchmark being run.
+     *
+     * This replaces the package searcher which looks for Lua modules
+     * in files, when tests are loaded from a test pack, so that the Lua
+     * files from which the pack was made aren't used, even if they're
+     * still around.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int LuaSearchTestPack(lua_State* lua) {
+        const auto self = (Interpreter*)lua_touserdata(lua, lua_upvalueindex(1));
+        const std::string name = luaL_checkstring(lua, 1);
+        if (self->script == nullptr) {
+            lua_pushliteral(lua, "\n\tno test being run to look up modules for");
+            return 1;
+        }
+        const auto modulesEntry = self->script->modules.find(name);
+        if (modulesEntry == self->script->modules.end()) {
+            lua_pushfstring(
+                lua,
+                "\n\tno module '%s' in test pack (only modules required while finding tests are packed)",
+                name.c_str()
+            );
+            return 1;
+        }
+        const auto& filePath = modulesEntry->second;
+        const auto packedModulesEntry = self->packedModules->find(filePath);
+        if (packedModulesEntry == self->packedModules->end()) {
+            lua_pushfstring(lua, "\n\tno file '%s' in test pack", filePath.c_str());
+            return 1;
+        }
+        const auto& bytecode = packedModulesEntry->second;
+        LuaReaderState luaReaderState;
+        luaReaderState.chunk = bytecode.data();
+        luaReaderState.chunkSize = bytecode.length();
+        if (lua_load(lua, LuaReader, &luaReaderState, ("@" + filePath).c_str(), "b") != LUA_OK) {
+            return luaL_error(
+                lua,
+                "error loading module '%s' from test pack:\n\t%s",
+                name.c_str(),
+                lua_tostring(lua, -1)
+            );
+        }
+        lua_pushlstring(lua, filePath.data(), filePath.length());
+        return 2;
+    }
+
+    /**
+     * Arrange for relative paths given to "require", "dofile", "loadfile",
+     * and the file functions of the "io" and "os" libraries to be resolved
+     * against the script directory of the given interpreter.
+     *
+     * @param[in] interpreter
+     *     This is the interpreter to set up.
+     */
+    static void ResolvePathsFromScriptDirectory(Interpreter& interpreter) {
+        const auto lua = interpreter.lua;
+        struct PathFunction {
+            const char* library;
+            const char* name;
+            int numPathArguments;
+        };
+        static const PathFunction pathFunctions[] = {
+            {NULL, "dofile", 1},
+            {NULL, "loadfile", 1},
+            {"io", "input", 1},
+            {"io", "lines", 1},
+            {"io", "open", 1},
+            {"io", "output", 1},
+            {"os", "remove", 1},
+            {"os", "rename", 2},
+            {"package", "loadlib", 1},
+        };
+        for (const auto& pathFunction: pathFunctions) {
+            if (pathFunction.library == NULL) {
+                lua_pushglobaltable(lua);
+            } else {
+                lua_getglobal(lua, pathFunction.library);
+            }
+            lua_getfield(lua, -1, pathFunction.name);
+            lua_pushlightuserdata(lua, &interpreter);
+            lua_pushinteger(lua, pathFunction.numPathArguments);
+            lua_pushcclosure(lua, LuaCallWithResolvedPaths, 3);
+            lua_setfield(lua, -2, pathFunction.name);
+            lua_pop(lua, 1);
+        }
+        struct Searcher {
+            int index;
+            const char* searchPathField;
+        };
+        static const Searcher searchers[] = {
+            {2, "path"},
+            {3, "cpath"},
+            {4, "cpath"},
+        };
+        lua_getglobal(lua, "package");
+        lua_getfield(lua, -1, "searchers");
+        for (const auto& searcher: searchers) {
+            lua_rawgeti(lua, -1, searcher.index);
+            lua_pushlightuserdata(lua, &interpreter);
+            lua_pushstring(lua, searcher.searchPathField);
+            lua_pushcclosure(lua, LuaSearchFromScriptDirectory, 3);
+            lua_rawseti(lua, -2, searcher.index);
+        }
+        lua_pop(lua, 2);
+    }
+
+    /**
+     * This function is provided to the Lua interpreter for use in
+     * allocating memory.  It keeps track of how much memory the interpreter
+     * uses, enforces the interpreter's memory limit, and allocates from
+     * the interpreter's arena if it has one, or from the system otherwise.
+     *
+     * @param[in] ud
+     *     This is the "ud" opaque pointer given to lua_newstate when
+     *     the Lua interpreter state was created.  It points to the
+     *     interpreter.
+     *
+     * @param[in] ptr
+     *     If not NULL, this points to the memory block to be
+     *     freed or reallocated.
+     *
+     * @param[in] osize
+     *     This is the size of the memory block pointed to by "ptr".
+     *
+     * @param[in] nsize
+     *     This is the number of bytes of memory to allocate or reallocate,
+     *     or zero if the given block should be freed instead.
+     *
+     * @return
+     *     A pointer to the allocated or reallocated memory block is
+     *     returned, or NULL is returned if the given memory block was freed,
+     *     or if the memory could not be allocated.
+     */
+    static void* LuaInterpreterAllocator(void* ud, void* ptr, size_t osize, size_t nsize) {
+        const auto self = (Interpreter*)ud;
+        if (ptr == NULL) {
+            osize = 0;
+        }
+        if (
+            (self->memoryLimit != 0)
+            && (nsize > osize)
+            && (self->memoryInUse + (nsize - osize) > self->memoryLimit)
+        ) {
+            self->memoryLimitExceeded = true;
+            return NULL;
+        }
+        void* newPtr;
+        if (self->arena == nullptr) {
+            newPtr = LuaAllocator(NULL, ptr, osize, nsize);
         } else {
-            return StringExtensions::sprintf(
-                "Actual value has extra key '%s'",
-                rhsKeys.begin()->ToEncoding().c_str()
-            );
+            newPtr = self->arena->Reallocate(ptr, osize, nsize);
+        }
+        if (
+            (newPtr == NULL)
+            && (nsize != 0)
+        ) {
+            return NULL;
+        }
+        self->memoryInUse = self->memoryInUse - osize + nsize;
+        if (nsize != 0) {
+            ++self->numAllocations;
+            if (self->memoryInUse > self->peakMemory) {
+                self->peakMemory = self->memoryInUse;
+            }
         }
+        return newPtr;
     }
 
     /**
-     * Return the path to the parent folder containing the file or directory
-     * at the given path.
+     * Record one sample of the current Lua call stack of the given
+     * Lua thread.
      *
-     * @param[in] path
-     *     This is the path to the file or folder whose parent folder's
-     *     path is to be returned.
+     * @param[in] lua
+     *     This points to the state of the Lua thread to sample.
      *
-     * @return
-     *     The path to the parent folder containing the file or directory
-     *     at the given path is returned.
+     * @param[in,out] profileSamples
+     *     This is where to count the sample, keyed by the stack in
+     *     "folded" form (the names of the functions, outermost first,
+     *     separated by semicolons).
      */
-    std::string ParentFolderPath(const std::string& path) {
-        const auto delimiterIndex = path.find_last_of('/');
-        if (delimiterIndex == std::string::npos) {
-            return path;
-        } else {
-            return path.substr(0, delimiterIndex);
+    static void SampleCallStack(
+        lua_State* lua,
+        std::unordered_map< std::string, size_t >& profileSamples
+    ) {
+        std::vector< std::string > frames;
+        lua_Debug debug;
+        for (int level = 0; lua_getstack(lua, level, &debug) == 1; ++level) {
+            if (lua_getinfo(lua, "Sn", &debug) == 0) {
+                break;
+            }
+            std::string frame;
+            if (strcmp(debug.what, "C") == 0) {
+                frame = (debug.name == NULL) ? "?" : debug.name;
+                frame += " [C]";
+            } else if (strcmp(debug.what, "main") == 0) {
+                frame = std::string(debug.short_src) + ":main";
+            } else {
+                frame = StringExtensions::sprintf(
+                    "%s:%d",
+                    debug.short_src,
+                    debug.linedefined
+                );
+                if (debug.name != NULL) {
+                    frame += " (";
+                    frame += debug.name;
+                    frame += ")";
+                }
+            }
+            for (auto& c: frame) {
+                if (c == ';') {
+                    c = ':';
+                }
+            }
+            frames.push_back(std::move(frame));
         }
+        if (frames.empty()) {
+            return;
+        }
+        std::string stack;
+        for (auto frame = frames.rbegin(); frame != frames.rend(); ++frame) {
+            if (!stack.empty()) {
+                stack += ';';
+            }
+            stack += *frame;
+        }
+        ++profileSamples[stack];
     }
 
-}
-
-/**
- * This is the internal interface/implementation of the Runner class.
- */
-struct Runner::Impl {
-    // Properties
-
     /**
-     * This points to the Lua interpreter that the runner is encapsulating.
-     * This interpreter is used to execute the Lua test scripts.
+     * This function is called by the Lua interpreter periodically,
+     * after a number of virtual machine instructions are executed,
+     * once the count hook is installed.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] debug
+     *     This holds information about the event which caused the hook
+     *     to be called.
      */
-    lua_State* lua = nullptr;
+    static void LuaCountHook(lua_State* lua, lua_Debug* debug) {
+        void* ud;
+        (void)lua_getallocf(lua, &ud);
+        const auto self = (Interpreter*)ud;
+        self->instructionCount += instructionCountHookInterval;
+        if (self->profileSamples != nullptr) {
+            SampleCallStack(lua, *self->profileSamples);
+        }
+        if (
+            (self->instructionLimit != 0)
+            && (self->instructionCount > self->instructionLimit)
+        ) {
+            self->instructionLimitExceeded = true;
+        }
+        if (
+            self->hasDeadline
+            && (std::chrono::steady_clock::now() >= self->deadline)
+        ) {
+            self->deadlineExceeded = true;
+        }
+
+        // Once a limit is exceeded, the error is raised again every time
+        // the hook is called, in case the test catches it with pcall.
+        if (self->instructionLimitExceeded) {
+            (void)luaL_error(lua, "instruction limit exceeded");
+        }
+        if (self->deadlineExceeded) {
+            (void)luaL_error(lua, "time limit exceeded");
+        }
+    }
 
     /**
-     * This is where information about the test suites located by the
-     * test runner are stored.
+     * This is the "__gc" metamethod of the garbage collection sentinel,
+     * an otherwise unreferenced object which is collected during each
+     * garbage collection cycle.  It counts the cycle, and replaces itself
+     * with a new sentinel, to be collected in the next cycle.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
      */
-    TestSuites testSuites;
+    static int LuaGcSentinel(lua_State* lua) {
+        const auto self = (Interpreter*)lua_touserdata(lua, lua_upvalueindex(1));
+        if (!self->gcSentinelActive) {
+            self->gcSentinelAlive = false;
+            return 0;
+        }
+        ++self->gcCycles;
+        (void)lua_newuserdata(lua, 0);
+        (void)lua_getmetatable(lua, 1);
+        (void)lua_setmetatable(lua, -2);
+        lua_pop(lua, 1);
+        return 0;
+    }
 
     /**
-     * This flag is set if any test expectation check fails.
+     * Begin collecting the garbage collection counts
+     * of the given interpreter.
+     *
+     * @param[in,out] interpreter
+     *     This is the interpreter for which to collect metrics.
      */
-    bool currentTestFailed = false;
+    static void StartCollectingMetrics(Interpreter& interpreter) {
+        const auto lua = interpreter.lua;
+        interpreter.gcCycles = 0;
+        interpreter.gcSentinelActive = true;
+
+        // An interpreter kept for a test suite may still have the
+        // sentinel made for an earlier test, which carries on.
+        if (interpreter.gcSentinelAlive) {
+            return;
+        }
+        interpreter.gcSentinelAlive = true;
+        (void)lua_newuserdata(lua, 0);
+        lua_createtable(lua, 0, 1);
+        lua_pushlightuserdata(lua, &interpreter);
+        lua_pushcclosure(lua, LuaGcSentinel, 1);
+        lua_setfield(lua, -2, "__gc");
+        (void)lua_setmetatable(lua, -2);
+        lua_pop(lua, 1);
+    }
 
     /**
-     * This is the function to call to report any errors in the current
-     * test being run.
+     * Stop collecting the garbage collection counts
+     * of the given interpreter.
+     *
+     * @param[in,out] interpreter
+     *     This is the interpreter for which metrics were being collected.
      */
-    ErrorMessageDelegate errorMessageDelegate;
+    static void StopCollectingMetrics(Interpreter& interpreter) {
+        interpreter.gcSentinelActive = false;
+    }
 
     /**
-     * This is the Lua registry index of the table set up to hold Lua
-     * objects associated with this instance.
+     * Call the function given as the first argument the number of times
+     * given as the second argument.  This is used to run one batch
+     * of benchmark iterations.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
      */
-    int luaRegistryIndex = 0;
-
-    // Lifecycle
-
-    ~Impl() = default;
-    Impl(const Impl&) = delete;
-    Impl(Impl&&) = default;
-    Impl& operator=(const Impl&) = delete;
-    Impl& operator=(Impl&&) = default;
-
-    // Methods
+    static int LuaRunBenchmarkBatch(lua_State* lua) {
+        const auto iterations = lua_tointeger(lua, 2);
+        for (lua_Integer i = 0; i < iterations; ++i) {
+            lua_pushvalue(lua, 1);
+            lua_call(lua, 0, 0);
+        }
+        return 0;
+    }
 
     /**
-     * This is the constructor of the class.
+     * Register the given function as the test with the given name under the
+     * test suite with the given name.
+     *
+     * This is registered as the "test" method of the "moonunit" singleton
+     * provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
      */
-    Impl() = default;
+    static int LuaTest(lua_State* lua) {
+        auto self = GetSelf(lua);
+        return RegisterTestFunction(lua, self->luaRegistryIndex);
+    }
 
     /**
-     * Collect information about the test suites and tests which are registered
-     * with the test runner via the moonunit.test (LuaTest) function.
+     * Register the given function as the benchmark with the given name
+     * under the benchmark suite with the given name.
      *
-     * @param[in] file
-     *     This is the contents of the Lua script file which was executed
-     *     in order to register the test suites and tests.
+     * This is registered as the "benchmark" method of the "moonunit"
+     * singleton provided to Lua scripts.
      *
-     * @param[in] filePath
-     *     This is the path to the Lua script file which was executed
-     *     in order to register the test suites and tests.
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
      */
-    void FindTests(
-        const std::string& file,
-        const std::string& filePath
-    ) {
-        lua_rawgeti(lua, LUA_REGISTRYINDEX, luaRegistryIndex);
-        lua_pushnil(lua);
-        while (lua_next(lua, -2) != 0) {
-            const std::string testSuiteName = luaL_checkstring(lua, -2);
-            auto& testSuite = testSuites[testSuiteName];
-            lua_pushnil(lua);
-            while (lua_next(lua, -2) != 0) {
-                const std::string testName = luaL_checkstring(lua, -2);
-                lua_Debug debug;
-                lua_getinfo(lua, ">S", &debug);
-                Test test;
-                test.file = file;
-                test.filePath = filePath;
-                test.lineNumber = debug.linedefined;
-                testSuite.tests[testName] = std::move(test);
-            }
-            lua_pop(lua, 1);
-        }
-        lua_pop(lua, 1);
+    static int LuaBenchmark(lua_State* lua) {
+        auto self = GetSelf(lua);
+        return RegisterTestFunction(lua, self->luaBenchmarkRegistryIndex);
     }
 
     /**
-     * Call the given function after executing the given Lua script.
+     * Register the given function as an asynchronous test with the given
+     * name under the test suite with the given name.  The function is
+     * wrapped in a closure which runs it as the first task of an
+     * AsyncScheduler when the test is run.
      *
-     * @param[in] file
-     *     This is the contents of the Lua script file to execute.
+     * This is registered as the "async_test" method of the "moonunit"
+     * singleton provided to Lua scripts.
      *
-     * @param[in] filePath
-     *     This is the path to the Lua script file to execute.
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaAsyncTest(lua_State* lua) {
+        auto self = GetSelf(lua);
+        luaL_checktype(lua, 4, LUA_TFUNCTION);
+        lua_pushvalue(lua, 4);
+        lua_pushcclosure(lua, LuaRunAsyncTest, 1);
+        lua_replace(lua, 4);
+        return RegisterTestFunction(lua, self->luaRegistryIndex);
+    }
+
+    /**
+     * Run the function given as the first upvalue as the first task of an
+     * asynchronous test, along with any tasks it spawns, until they've
+     * all finished.
      *
-     * @param[in] fn
-     *     This is the function to call after executing the Lua script.
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
      *
      * @return
-     *     If any error occurs executing the Lua script, a human-readable
-     *     description of the error is returned.  Otherwise, an empty
-     *     string is returned.
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
      */
-    std::string WithScript(
-        const std::string& file,
-        const std::string& filePath,
-        std::function< void() > fn
-    ) {
-        const auto originalWorkingDirectory = SystemAbstractions::File::GetWorkingDirectory();
-        SystemAbstractions::File::SetWorkingDirectory(ParentFolderPath(filePath));
-        lua_settop(lua, 0);
-        lua_pushcfunction(lua, LuaTraceback);
-        LuaReaderState luaReaderState;
-        luaReaderState.chunk = &file;
-        std::string errorMessage;
-        switch (const int luaLoadResult = lua_load(lua, LuaReader, &luaReaderState, ("=" + filePath).c_str(), "t")) {
-            case LUA_OK: {
-                const int luaPCallResult = lua_pcall(lua, 0, 0, 1);
-                if (luaPCallResult == LUA_OK) {
-                    fn();
-                } else {
-                    if (!lua_isnil(lua, -1)) {
-                        errorMessage = lua_tostring(lua, -1);
-                    }
-                }
-            } break;
-            case LUA_ERRSYNTAX: {
-                errorMessage = lua_tostring(lua, -1);
-            } break;
-            case LUA_ERRMEM: {
-                errorMessage = "LUA_ERRMEM";
-            } break;
-            case LUA_ERRGCMM: {
-                errorMessage = "LUA_ERRGCMM";
-            } break;
-            default: {
-                errorMessage = StringExtensions::sprintf("(unexpected lua_load result: %d)", luaLoadResult);
-            } break;
+    static int LuaRunAsyncTest(lua_State* lua) {
+        void* ud;
+        (void)lua_getallocf(lua, &ud);
+        const auto self = (Interpreter*)ud;
+        if (self->asyncScheduler != nullptr) {
+            return luaL_error(lua, "asynchronous tests can't be nested");
         }
-        lua_settop(lua, 0);
-        SystemAbstractions::File::SetWorkingDirectory(originalWorkingDirectory);
-        return errorMessage;
+        if (!RunAsyncTasks(lua, *self)) {
+            return lua_error(lua);
+        }
+        return 0;
     }
 
     /**
-     * Execute the Lua script in the given file, and gather information
-     * about any test suites and tests registered by the script.
+     * Run the function given as the first upvalue of the calling closure
+     * as the first task of an asynchronous test, along with any tasks it
+     * spawns, until they've all finished.
      *
-     * @param[in,out] file
-     *     This is the file from which to load the Lua script.
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
      *
-     * @param[in] errorMessageDelegate
-     *     This is the function to call to deliver any error messages
-     *     generated while executing the Lua script.
+     * @param[in,out] interpreter
+     *     This is the interpreter running the test.
+     *
+     * @return
+     *     An indication of whether or not every task finished without
+     *     failing is returned.  If not, a description of why is left
+     *     on the Lua stack.
      */
-    void LoadTestSuite(
-        SystemAbstractions::File& file,
-        ErrorMessageDelegate errorMessageDelegate
-    ) {
-        if (!file.OpenReadOnly()) {
-            errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "ERROR: Unable to open Lua script file '%s'",
-                    file.GetPath().c_str()
-                )
-            );
-            return;
+    static bool RunAsyncTasks(lua_State* lua, Interpreter& interpreter) {
+        AsyncScheduler scheduler;
+        std::string errorMessage;
+        scheduler.endTest = [&](size_t, bool, const std::string& testErrorMessage){
+            errorMessage = testErrorMessage;
+        };
+        scheduler.Spawn(lua, lua_upvalueindex(1), 0);
+        interpreter.asyncScheduler = &scheduler;
+        const auto finished = scheduler.Run(
+            lua,
+            interpreter.hasDeadline,
+            interpreter.deadline
+        );
+        interpreter.asyncScheduler = nullptr;
+        for (auto& task: scheduler.tasks) {
+            AsyncScheduler::Release(lua, task);
         }
-        SystemAbstractions::IFile::Buffer buffer(file.GetSize());
-        const auto amountRead = file.Read(buffer);
-        file.Close();
-        if (amountRead != buffer.size()) {
-            errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "ERROR: Unable to read Lua script file '%s'",
-                    file.GetPath().c_str()
-                )
-            );
-            return;
+        if (!finished) {
+            if (
+                interpreter.hasDeadline
+                && (std::chrono::steady_clock::now() >= interpreter.deadline)
+            ) {
+                interpreter.deadlineExceeded = true;
+            }
+            lua_pushlstring(lua, errorMessage.data(), errorMessage.length());
         }
-        const std::string script(
-            buffer.begin(),
-            buffer.end()
-        );
-        WithLua([&]{
-            auto errorMessage = WithScript(
-                script,
-                file.GetPath(),
-                std::bind(&Impl::FindTests, this, script, file.GetPath())
-            );
-            if (!errorMessage.empty()) {
-                errorMessageDelegate(
-                    StringExtensions::sprintf(
-                        "ERROR: Unable to load Lua script file '%s': %s",
-                        file.GetPath().c_str(),
-                        errorMessage.c_str()
-                    )
-                );
+        return finished;
+    }
+
+    /**
+     * Run the tasks of the batch of asynchronous tests given as the first
+     * argument (a light userdata pointing to the batch) together, starting
+     * with the function each test registered, until they've all finished
+     * or failed.  Each test is charged only for what its own tasks do.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int LuaRunAsyncBatch(lua_State* lua) {
+        auto& batch = *(AsyncBatch*)lua_touserdata(lua, 1);
+        void* ud;
+        (void)lua_getallocf(lua, &ud);
+        const auto self = (Interpreter*)ud;
+        auto& tests = batch.tests;
+        AsyncScheduler scheduler;
+        scheduler.enterTest = [&](size_t test){
+            auto& batchTest = tests[test];
+            self->errorMessageDelegate = batchTest.errorMessageDelegate;
+            self->currentTestFailed = batchTest.failed;
+            self->instructionCount = batchTest.instructionCount;
+            if (batch.collectMetrics) {
+                batchTest.resumeCpuTime = GetThreadCpuTime();
+                batchTest.resumeGcCycles = self->gcCycles;
+            }
+        };
+        scheduler.leaveTest = [&](size_t test){
+            auto& batchTest = tests[test];
+            batchTest.failed = self->currentTestFailed;
+            batchTest.instructionCount = self->instructionCount;
+            if (self->instructionLimitExceeded) {
+                batchTest.instructionLimitExceeded = true;
+                self->instructionLimitExceeded = false;
+            }
+            if (batch.collectMetrics) {
+                batchTest.cpuTime += GetThreadCpuTime() - batchTest.resumeCpuTime;
+                batchTest.gcCycles += self->gcCycles - batchTest.resumeGcCycles;
+            }
+            self->errorMessageDelegate = batch.errorMessageDelegate;
+            self->currentTestFailed = false;
+        };
+        scheduler.endTest = [&](size_t test, bool failed, const std::string& errorMessage){
+            auto& batchTest = tests[test];
+            batchTest.finished = true;
+            batchTest.endTime = std::chrono::steady_clock::now();
+            if (!failed) {
                 return;
             }
-            const auto delimiterIndex = file.GetPath().find_last_of('/');
-            auto name = (
-                (delimiterIndex == std::string::npos)
-                ? file.GetPath()
-                : file.GetPath().substr(delimiterIndex + 1)
+            batchTest.failed = true;
+            if (
+                self->hasDeadline
+                && (batchTest.endTime >= self->deadline)
+            ) {
+                batchTest.deadlineExceeded = true;
+            }
+            batchTest.errorMessageDelegate(
+                StringExtensions::sprintf(
+                    "ERROR: %s\n",
+                    errorMessage.c_str()
+                )
             );
-            if (name.length() >= luaFileExtensionLength) {
-                const auto nameLengthWithoutExtension = name.length() - luaFileExtensionLength;
-                if (name.substr(nameLengthWithoutExtension) == luaFileExtension) {
-                    name = name.substr(0, nameLengthWithoutExtension);
-                }
+        };
+        for (size_t i = 0; i < tests.size(); ++i) {
+            const auto& testTableEntry = *tests[i].testTableEntry;
+            lua_rawgeti(lua, LUA_REGISTRYINDEX, self->luaRegistryIndex);
+            lua_pushstring(lua, testTableEntry.testSuiteName->c_str());
+            (void)lua_rawget(lua, -2);
+            if (lua_istable(lua, -1)) {
+                lua_pushstring(lua, testTableEntry.testName->c_str());
+                (void)lua_rawget(lua, -2);
+            } else {
+                lua_pushnil(lua);
             }
-        });
+            if (lua_tocfunction(lua, -1) == LuaRunAsyncTest) {
+                (void)lua_getupvalue(lua, -1, 1);
+                scheduler.Spawn(lua, -1, i);
+            } else {
+                scheduler.endTest(i, true, "test is no longer an asynchronous test of the script");
+            }
+            lua_settop(lua, 1);
+        }
+        self->asyncScheduler = &scheduler;
+        (void)scheduler.Run(lua, self->hasDeadline, self->deadline);
+        self->asyncScheduler = nullptr;
+        return 0;
     }
 
     /**
-     * Compare the two values at the top of the Lua stack and throw an error if
-     * they are not equal.
-     *
-     * This is registered as the "assert_eq" method of the "moonunit" singleton
-     * provided to Lua scripts.
+     * Return the task of an asynchronous test running on the given
+     * Lua coroutine, raising an error if there is none.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] self
+     *     This is the interpreter running the test.
+     *
+     * @param[in] method
+     *     This is the name of the method which needs the task.
+     *
+     * @return
+     *     The task running on the given Lua coroutine is returned.
      */
-    static int LuaAssertEq(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
+    static AsyncTask* GetCurrentTask(
+        lua_State* lua,
+        Interpreter* self,
+        const char* method
+    ) {
+        const auto scheduler = self->asyncScheduler;
         if (
-            lua_istable(lua, 2)
-            && lua_istable(lua, 3)
+            (scheduler == nullptr)
+            || (scheduler->currentTask == nullptr)
+            || (scheduler->currentTask->thread != lua)
         ) {
-            std::vector< Json::Value > keyChain;
-            const auto comparisonResult = CompareLuaTables(lua, 2, 3, keyChain);
-            if (!comparisonResult.empty()) {
-                std::vector< std::string > keyChainAsStrings;
-                for (const auto& key: keyChain) {
-                    keyChainAsStrings.push_back(key.ToEncoding());
-                }
-                luaL_error(
-                    lua,
-                    "Tables differ (path: %s) -- %s\n",
-                    StringExtensions::Join(keyChainAsStrings, ".").c_str(),
-                    comparisonResult.c_str()
-                );
-            }
-        } else if (!lua_compare(lua, 2, 3, LUA_OPEQ)) {
-            luaL_error(
-                lua,
-                "Expected '%s', actual was '%s'\n",
-                lua_tostring(lua, 2),
-                lua_tostring(lua, 3)
-            );
+            (void)luaL_error(lua, "moonunit:%s may only be called by a task of an asynchronous test", method);
         }
-        return 0;
+        return scheduler->currentTask;
     }
 
     /**
-     * Compare the value at the top of the Lua stack and throw an error if
-     * it is not considered "falsey".
+     * Add the given function as another task of the asynchronous test
+     * currently running.
      *
-     * This is registered as the "assert_false" method of the "moonunit"
+     * This is registered as the "spawn" method of the "moonunit"
      * singleton provided to Lua scripts.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
      */
-    static int LuaAssertFalse(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (lua_toboolean(lua, 2)) {
-            const std::string actual = luaL_tolstring(lua, 2, NULL);
-            lua_pop(lua, 1);
-            luaL_error(
-                lua,
-                "Expected '%s' to be false\n",
-                actual.c_str()
-            );
-        }
+    static int LuaSpawn(lua_State* lua) {
+        auto self = GetSelf(lua);
+        luaL_checktype(lua, 2, LUA_TFUNCTION);
+        const auto task = GetCurrentTask(lua, self, "spawn");
+        self->asyncScheduler->Spawn(lua, 2, task->test);
         return 0;
     }
 
     /**
-     * Compare the two values at the top of the Lua stack and throw an error if
-     * the first is not greater than or equal to the second.
+     * Suspend the current task of the asynchronous test currently running
+     * for the given number of seconds, letting other tasks run meanwhile.
      *
-     * This is registered as the "assert_ge" method of the "moonunit" singleton
-     * provided to Lua scripts.
+     * This is registered as the "sleep" method of the "moonunit"
+     * singleton provided to Lua scripts.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
      */
-    static int LuaAssertGe(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (lua_compare(lua, 2, 3, LUA_OPLT)) {
-            luaL_error(
-                lua,
-                "expected '%s' >= '%s'\n",
-                lua_tostring(lua, 2),
-                lua_tostring(lua, 3)
-            );
-        }
-        return 0;
+    static int LuaSleep(lua_State* lua) {
+        auto self = GetSelf(lua);
+        const auto seconds = luaL_checknumber(lua, 2);
+        const auto task = GetCurrentTask(lua, self, "sleep");
+        task->state = AsyncTask::State::Sleeping;
+        task->wakeTime = std::chrono::steady_clock::now() + std::chrono::duration_cast< std::chrono::steady_clock::duration >(
+            std::chrono::duration< double >((seconds > 0) ? seconds : 0)
+        );
+        return lua_yield(lua, 0);
     }
 
     /**
-     * Compare the two values at the top of the Lua stack and throw an error if
-     * the first is not greater than the second.
-     *
-     * This is registered as the "assert_gt" method of the "moonunit" singleton
-     * provided to Lua scripts.
+     * Check that the value at the given position on the Lua stack
+     * is a future made by moonunit:future.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] index
+     *     This is the position of the value on the Lua stack.
      */
-    static int LuaAssertGt(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (lua_compare(lua, 2, 3, LUA_OPLE)) {
-            luaL_error(
-                lua,
-                "expected '%s' > '%s'\n",
-                lua_tostring(lua, 2),
-                lua_tostring(lua, 3)
-            );
+    static void CheckFuture(lua_State* lua, int index) {
+        luaL_checktype(lua, index, LUA_TTABLE);
+        bool isFuture = false;
+        if (lua_getmetatable(lua, index)) {
+            luaL_getmetatable(lua, "moonunit.future");
+            isFuture = lua_rawequal(lua, -1, -2);
+            lua_pop(lua, 2);
         }
-        return 0;
+        luaL_argcheck(lua, isFuture, index, "future expected");
     }
 
     /**
-     * Compare the two values at the top of the Lua stack and throw an error if
-     * the first is not less than or equal to the second.
-     *
-     * This is registered as the "assert_le" method of the "moonunit" singleton
-     * provided to Lua scripts.
+     * Return whether or not the future at the given position
+     * on the Lua stack has been resolved.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] index
+     *     This is the position of the future on the Lua stack.
+     *
+     * @return
+     *     An indication of whether or not the future
+     *     has been resolved is returned.
      */
-    static int LuaAssertLe(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (!lua_compare(lua, 2, 3, LUA_OPLE)) {
-            luaL_error(
-                lua,
-                "expected '%s' <= '%s'\n",
-                lua_tostring(lua, 2),
-                lua_tostring(lua, 3)
-            );
-        }
-        return 0;
+    static bool IsFutureResolved(lua_State* lua, int index) {
+        lua_pushliteral(lua, "resolved");
+        (void)lua_rawget(lua, index);
+        const auto resolved = (lua_toboolean(lua, -1) != 0);
+        lua_pop(lua, 1);
+        return resolved;
     }
 
     /**
-     * Compare the two values at the top of the Lua stack and throw an error if
-     * the first is not less than the second.
+     * Make a new future, a value for which tasks of an asynchronous test
+     * can wait with moonunit:await, until it's resolved by calling its
+     * "resolve" method.
      *
-     * This is registered as the "assert_lt" method of the "moonunit" singleton
-     * provided to Lua scripts.
+     * This is registered as the "future" method of the "moonunit"
+     * singleton provided to Lua scripts.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
      */
-    static int LuaAssertLt(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (!lua_compare(lua, 2, 3, LUA_OPLT)) {
-            luaL_error(
-                lua,
-                "expected '%s' < '%s'\n",
-                lua_tostring(lua, 2),
-                lua_tostring(lua, 3)
-            );
+    static int LuaFuture(lua_State* lua) {
+        (void)GetSelf(lua);
+        lua_createtable(lua, 1, 2);
+        if (luaL_newmetatable(lua, "moonunit.future")) {
+            lua_createtable(lua, 0, 1);
+            lua_pushcfunction(lua, LuaFutureResolve);
+            lua_setfield(lua, -2, "resolve");
+            lua_setfield(lua, -2, "__index");
         }
-        return 0;
+        (void)lua_setmetatable(lua, -2);
+        return 1;
     }
 
     /**
-     * Compare the two values at the top of the Lua stack and throw an error if
-     * they are equal.
+     * Resolve the given future with the values given after it, resuming
+     * any tasks waiting for it with those values.
      *
-     * This is registered as the "assert_ne" method of the "moonunit" singleton
-     * provided to Lua scripts.
+     * This is registered as the "resolve" method of futures.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
      */
-    static int LuaAssertNe(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (
-            lua_istable(lua, 2)
-            && lua_istable(lua, 3)
-        ) {
-            std::vector< Json::Value > keyChain;
-            const auto comparisonResult = CompareLuaTables(lua, 2, 3, keyChain);
-            if (comparisonResult.empty()) {
-                luaL_error(
-                    lua,
-                    "Tables should differ but are the same\n"
-                );
-            }
-        } else if (lua_compare(lua, 2, 3, LUA_OPEQ)) {
-            luaL_error(
-                lua,
-                "Expected not '%s', actual was '%s'\n",
-                lua_tostring(lua, 2),
-                lua_tostring(lua, 3)
-            );
+    static int LuaFutureResolve(lua_State* lua) {
+        CheckFuture(lua, 1);
+        if (IsFutureResolved(lua, 1)) {
+            return luaL_error(lua, "future already resolved");
+        }
+        const auto numValues = lua_gettop(lua) - 1;
+        for (int i = numValues; i >= 1; --i) {
+            lua_rawseti(lua, 1, i);
+        }
+        lua_pushliteral(lua, "n");
+        lua_pushinteger(lua, numValues);
+        lua_rawset(lua, 1);
+        lua_pushliteral(lua, "resolved");
+        lua_pushboolean(lua, 1);
+        lua_rawset(lua, 1);
+        void* ud;
+        (void)lua_getallocf(lua, &ud);
+        const auto self = (Interpreter*)ud;
+        if (self->asyncScheduler != nullptr) {
+            self->asyncScheduler->Wake(lua_topointer(lua, 1));
         }
         return 0;
     }
 
     /**
-     * Compare the value at the top of the Lua stack and throw an error if
-     * it is not considered "truthy".
+     * Return the values with which the given future is resolved,
+     * suspending the current task of the asynchronous test currently
+     * running until it is, letting other tasks run meanwhile.
      *
-     * This is registered as the "assert_true" method of the "moonunit"
+     * This is registered as the "await" method of the "moonunit"
      * singleton provided to Lua scripts.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
      */
-    static int LuaAssertTrue(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (!lua_toboolean(lua, 2)) {
-            const std::string actual = luaL_tolstring(lua, 2, NULL);
+    static int LuaAwait(lua_State* lua) {
+        auto self = GetSelf(lua);
+        CheckFuture(lua, 2);
+        if (IsFutureResolved(lua, 2)) {
+            lua_pushliteral(lua, "n");
+            (void)lua_rawget(lua, 2);
+            const auto numValues = (int)lua_tointeger(lua, -1);
             lua_pop(lua, 1);
-            luaL_error(
-                lua,
-                "Expected '%s' to be true\n",
-                actual.c_str()
-            );
+            luaL_checkstack(lua, numValues, "too many future values");
+            for (int i = 1; i <= numValues; ++i) {
+                (void)lua_rawgeti(lua, 2, i);
+            }
+            return numValues;
         }
-        return 0;
+        const auto task = GetCurrentTask(lua, self, "await");
+        task->state = AsyncTask::State::Waiting;
+        task->future = lua_topointer(lua, 2);
+        lua_pushvalue(lua, 2);
+        task->futureReference = luaL_ref(lua, LUA_REGISTRYINDEX);
+        return lua_yield(lua, 0);
     }
 
     /**
-     * Compare the two values at the top of the Lua stack and mark the current
-     * test as failed if the two values are not equal.
-     *
-     * This is registered as the "expect_eq" method of the "moonunit" singleton
-     * provided to Lua scripts.
+     * Register the function given as the fourth argument under the suite
+     * and name given as the second and third arguments, in the table
+     * at the given Lua registry index.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] registryIndex
+     *     This is the Lua registry index of the table
+     *     in which to register the function.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
      */
-    static int LuaExpectEq(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        bool expectationFailed = false;
-        if (
-            lua_istable(lua, 2)
-            && lua_istable(lua, 3)
-        ) {
-            std::vector< Json::Value > keyChain;
-            const auto comparisonResult = CompareLuaTables(lua, 2, 3, keyChain);
-            if (!comparisonResult.empty()) {
-                expectationFailed = true;
-                std::vector< std::string > keyChainAsStrings;
-                for (const auto& key: keyChain) {
-                    keyChainAsStrings.push_back(key.ToEncoding());
-                }
-                self->errorMessageDelegate(
-                    StringExtensions::sprintf(
-                        "Tables differ (path: %s) -- %s\n",
-                        StringExtensions::Join(keyChainAsStrings, ".").c_str(),
-                        comparisonResult.c_str()
-                    )
-                );
-            }
-        } else if (!lua_compare(lua, 2, 3, LUA_OPEQ)) {
-            expectationFailed = true;
-            self->errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "Expected '%s' (%s), actual was '%s' (%s)\n",
-                    lua_tostring(lua, 2),
-                    luaL_typename(lua, 2),
-                    lua_tostring(lua, 3),
-                    luaL_typename(lua, 3)
-                )
-            );
-        }
-        if (expectationFailed) {
-            self->currentTestFailed = true;
-            luaL_traceback(lua, lua, NULL, 1);
-            self->errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "%s\n",
-                    lua_tostring(lua, -1)
-                )
-            );
+    static int RegisterTestFunction(lua_State* lua, int registryIndex) {
+        const std::string testSuiteName = luaL_checkstring(lua, 2);
+        const std::string testName = luaL_checkstring(lua, 3);
+        luaL_checktype(lua, 4, LUA_TFUNCTION);
+        lua_rawgeti(lua, LUA_REGISTRYINDEX, registryIndex);
+        lua_pushvalue(lua, 2);
+        lua_rawget(lua, -2);
+        if (lua_isnil(lua, -1)) {
             lua_pop(lua, 1);
+            lua_newtable(lua);
+            lua_pushvalue(lua, 2);
+            lua_pushvalue(lua, -2);
+            lua_rawset(lua, -4);
         }
+        lua_pushvalue(lua, 3);
+        lua_pushvalue(lua, 4);
+        lua_rawset(lua, -3);
+        lua_pop(lua, 2);
         return 0;
     }
 
     /**
-     * Compare the value at the top of the Lua stack and mark the current test
-     * as failed if it is not considered "falsey".
+     * Register the given function as the suite setup function of the
+     * test suite with the given name.  The function is called before
+     * the tests of the suite are run in a Lua interpreter, after the test
+     * script is executed.
      *
-     * This is registered as the "expect_false" method of the "moonunit"
+     * This is registered as the "suite_setup" method of the "moonunit"
      * singleton provided to Lua scripts.
      *
      * @param[in] lua
      *     This points to the state of the Lua interpreter.
      */
-    static int LuaExpectFalse(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (lua_toboolean(lua, 2)) {
-            self->currentTestFailed = true;
-            const std::string actual = luaL_tolstring(lua, 2, NULL);
-            lua_pop(lua, 1);
-            self->errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "Expected '%s' to be false\n",
-                    actual.c_str()
-                )
-            );
-            luaL_traceback(lua, lua, NULL, 1);
-            self->errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "%s\n",
-                    lua_tostring(lua, -1)
-                )
-            );
-            lua_pop(lua, 1);
-        }
-        return 0;
+    static int LuaSuiteSetup(lua_State* lua) {
+        auto self = GetSelf(lua);
+        return RegisterSuiteFixture(lua, self, "setup");
+    }
+
+    /**
+     * Register the given function as the suite teardown function of the
+     * test suite with the given name.  The function is called after the
+     * tests of the suite are run in a Lua interpreter, before the
+     * interpreter is destroyed.
+     *
+     * This is registered as the "suite_teardown" method of the "moonunit"
+     * singleton provided to Lua scripts.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     */
+    static int LuaSuiteTeardown(lua_State* lua) {
+        auto self = GetSelf(lua);
+        return RegisterSuiteFixture(lua, self, "teardown");
+    }
+
+    /**
+     * Register the function given as the second argument under the given
+     * name, for the test suite whose name is given as the first argument,
+     * in the table of suite fixtures of the given interpreter.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] self
+     *     This is the interpreter in which to register the function.
+     *
+     * @param[in] fixtureName
+     *     This is the name under which to register the function.
+     *
+     * @return
+     *     The number of return values that have been pushed onto the
+     *     Lua stack by the function as return values of the function
+     *     is returned.
+     */
+    static int RegisterSuiteFixture(
+        lua_State* lua,
+        Interpreter* self,
+        const char* fixtureName
+    ) {
+        (void)luaL_checkstring(lua, 2);
+        luaL_checktype(lua, 3, LUA_TFUNCTION);
+        lua_settop(lua, 3);
+        lua_pushstring(lua, fixtureName);
+        lua_insert(lua, 3);
+        return RegisterTestFunction(lua, self->luaSuiteFixtureRegistryIndex);
     }
 
     /**
-     * Compare the two values at the top of the Lua stack and mark the current
-     * test as failed if the first is not greater than or equal to the second.
+     * Call the function registered with the given name under the given
+     * test suite in the given table of the given interpreter, if there
+     * is one, reporting any error it raises to the error message
+     * delegate of the interpreter, and marking the current test as failed.
      *
-     * This is registered as the "expect_ge" method of the "moonunit" singleton
-     * provided to Lua scripts.
+     * @param[in,out] interpreter
+     *     This is the interpreter in which to call the function.
      *
-     * @param[in] lua
-     *     This points to the state of the Lua interpreter.
+     * @param[in] registryIndex
+     *     This is the Lua registry index of the table in which
+     *     the function was registered.
+     *
+     * @param[in] testSuiteName
+     *     This is the name of the test suite under which
+     *     the function was registered.
+     *
+     * @param[in] functionName
+     *     This is the name with which the function was registered.
+     *
+     * @param[in] errorPrefix
+     *     This is put in front of any error raised by the function,
+     *     when it's reported.
+     *
+     * @return
+     *     An indication of whether or not the function (if there is one)
+     *     returned without raising an error is returned.
      */
-    static int LuaExpectGe(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (lua_compare(lua, 2, 3, LUA_OPLT)) {
-            self->currentTestFailed = true;
-            self->errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "expected '%s' >= '%s'\n",
-                    lua_tostring(lua, 2),
-                    lua_tostring(lua, 3)
-                )
-            );
-            luaL_traceback(lua, lua, NULL, 1);
-            self->errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "%s\n",
-                    lua_tostring(lua, -1)
-                )
-            );
-            lua_pop(lua, 1);
+    static bool CallRegisteredFunction(
+        Interpreter& interpreter,
+        int registryIndex,
+        const std::string& testSuiteName,
+        const std::string& functionName,
+        const char* errorPrefix
+    ) {
+        const auto lua = interpreter.lua;
+        lua_pushcfunction(lua, LuaTraceback);
+        const auto messageHandlerIndex = lua_gettop(lua);
+        lua_rawgeti(lua, LUA_REGISTRYINDEX, registryIndex);
+        lua_pushstring(lua, testSuiteName.c_str());
+        lua_rawget(lua, -2);
+        lua_remove(lua, -2);
+        if (!lua_istable(lua, -1)) {
+            lua_settop(lua, messageHandlerIndex - 1);
+            return true;
         }
-        return 0;
+        lua_pushstring(lua, functionName.c_str());
+        lua_rawget(lua, -2);
+        lua_remove(lua, -2);
+        if (lua_isnil(lua, -1)) {
+            lua_settop(lua, messageHandlerIndex - 1);
+            return true;
+        }
+        const int luaPCallResult = lua_pcall(lua, 0, 0, messageHandlerIndex);
+        if (luaPCallResult != LUA_OK) {
+            if (!lua_isnil(lua, -1)) {
+                interpreter.errorMessageDelegate(
+                    StringExtensions::sprintf(
+                        "ERROR: %s%s\n",
+                        errorPrefix,
+                        lua_tostring(lua, -1)
+                    )
+                );
+            }
+            interpreter.currentTestFailed = true;
+        }
+        lua_settop(lua, messageHandlerIndex - 1);
+        return (luaPCallResult == LUA_OK);
     }
 
     /**
-     * Compare the two values at the top of the Lua stack and mark the current
-     * test as failed if the first is not greater than the second.
+     * Run the given test in the given interpreter, with the limits
+     * and measurements selected by the options.
      *
-     * This is registered as the "expect_gt" method of the "moonunit" singleton
-     * provided to Lua scripts.
+     * @param[in,out] interpreter
+     *     This is the interpreter in which to run the test.
      *
-     * @param[in] lua
-     *     This points to the state of the Lua interpreter.
+     * @param[in] testTableEntry
+     *     This identifies the test to run.
+     *
+     * @param[in] loadScript
+     *     This indicates whether or not to execute the test script,
+     *     and then call the suite setup function, before running the
+     *     test.  Otherwise, they were done earlier in the interpreter.
+     *
+     * @param[in] tearDownSuite
+     *     This indicates whether or not to call the suite teardown
+     *     function after running the test.
+     *
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to report any error messages.
+     *
+     * @param[in] startTime
+     *     This is when the test was started.
+     *
+     * @param[in,out] profileSamples
+     *     If profiling, this is where to count the Lua call stacks sampled.
+     *
+     * @param[out] testMetrics
+     *     This is where to store the measurements taken
+     *     while running the test.
+     *
+     * @return
+     *     An indication of whether or not the test passed is returned.
      */
-    static int LuaExpectGt(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (lua_compare(lua, 2, 3, LUA_OPLE)) {
-            self->currentTestFailed = true;
-            self->errorMessageDelegate(
+    bool RunTestInInterpreter(
+        Interpreter& interpreter,
+        const TestTableEntry& testTableEntry,
+        bool loadScript,
+        bool tearDownSuite,
+        ErrorMessageDelegate errorMessageDelegate,
+        std::chrono::steady_clock::time_point startTime,
+        std::unordered_map< std::string, size_t >& profileSamples,
+        TestMetrics& testMetrics
+    ) {
+        const auto lua = interpreter.lua;
+        const auto& testSuiteName = *testTableEntry.testSuiteName;
+        const auto& testName = *testTableEntry.testName;
+        const auto& script = *testTableEntry.test->script;
+        double cpuTime = 0.0;
+        interpreter.script = &script;
+        interpreter.memoryLimit = options.maxTestMemory;
+        interpreter.fullTableDiff = options.fullTableDiff;
+
+        // The interpreter may have been kept from earlier tests of the suite,
+        // so the instruction count and limits start over for every test.
+        interpreter.instructionCount = 0;
+        interpreter.instructionLimitExceeded = false;
+        interpreter.deadlineExceeded = false;
+        if (options.collectMetrics) {
+            cpuTime = GetThreadCpuTime();
+            StartCollectingMetrics(interpreter);
+        }
+        if (options.profile) {
+            interpreter.profileSamples = &profileSamples;
+        }
+        interpreter.instructionLimit = options.testInstructionLimit;
+        if (options.testTimeout > 0.0) {
+            interpreter.hasDeadline = true;
+            interpreter.deadline = startTime + std::chrono::duration_cast< std::chrono::steady_clock::duration >(
+                std::chrono::duration< double >(options.testTimeout)
+            );
+        }
+        const auto installCountHook = (
+            options.collectMetrics
+            || options.profile
+            || (interpreter.instructionLimit != 0)
+            || interpreter.hasDeadline
+        );
+        if (installCountHook) {
+            lua_sethook(lua, LuaCountHook, LUA_MASKCOUNT, instructionCountHookInterval);
+        }
+        const auto runTest = [&]{
+            interpreter.errorMessageDelegate = errorMessageDelegate;
+            if (loadScript) {
+                interpreter.suiteSetUp = (
+                    CallRegisteredFunction(
+                        interpreter,
+                        interpreter.luaSuiteFixtureRegistryIndex,
+                        testSuiteName,
+                        "setup",
+                        "suite setup failed: "
+                    )
+                    && !interpreter.currentTestFailed
+                );
+            }
+            if (interpreter.suiteSetUp) {
+                (void)CallRegisteredFunction(
+                    interpreter,
+                    interpreter.luaRegistryIndex,
+                    testSuiteName,
+                    testName,
+                    ""
+                );
+                if (tearDownSuite) {
+                    (void)CallRegisteredFunction(
+                        interpreter,
+                        interpreter.luaSuiteFixtureRegistryIndex,
+                        testSuiteName,
+                        "teardown",
+                        "suite teardown failed: "
+                    );
+                    interpreter.suiteSetUp = false;
+                }
+            } else {
+                interpreter.currentTestFailed = true;
+            }
+            interpreter.errorMessageDelegate = nullptr;
+        };
+        std::string errorMessage;
+        if (loadScript) {
+            errorMessage = WithScript(
+                interpreter,
+                script.bytecode.data(),
+                script.bytecode.length(),
+                "b",
+                script.filePath,
+                runTest
+            );
+        } else {
+            runTest();
+            lua_settop(lua, 0);
+        }
+        if (!errorMessage.empty()) {
+            interpreter.currentTestFailed = true;
+            errorMessageDelegate(
                 StringExtensions::sprintf(
-                    "expected '%s' > '%s'\n",
-                    lua_tostring(lua, 2),
-                    lua_tostring(lua, 3)
+                    "ERROR: Unable to load Lua script file '%s': %s",
+                    script.filePath.c_str(),
+                    errorMessage.c_str()
                 )
             );
-            luaL_traceback(lua, lua, NULL, 1);
-            self->errorMessageDelegate(
+        }
+        // Lua retries a failed allocation after collecting garbage, so
+        // reaching the limit only matters if the test failed because of it.
+        if (
+            interpreter.memoryLimitExceeded
+            && interpreter.currentTestFailed
+        ) {
+            errorMessageDelegate(
                 StringExtensions::sprintf(
-                    "%s\n",
-                    lua_tostring(lua, -1)
+                    "ERROR: Test reached the memory limit of %zu bytes\n",
+                    interpreter.memoryLimit
                 )
             );
-            lua_pop(lua, 1);
         }
-        return 0;
-    }
-
-    /**
-     * Compare the two values at the top of the Lua stack and mark the current
-     * test as failed if the first is not less than or equal to the second.
-     *
-     * This is registered as the "expect_le" method of the "moonunit" singleton
-     * provided to Lua scripts.
-     *
-     * @param[in] lua
-     *     This points to the state of the Lua interpreter.
-     */
-    static int LuaExpectLe(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (!lua_compare(lua, 2, 3, LUA_OPLE)) {
-            self->currentTestFailed = true;
-            self->errorMessageDelegate(
+        if (interpreter.instructionLimitExceeded) {
+            interpreter.currentTestFailed = true;
+            errorMessageDelegate(
                 StringExtensions::sprintf(
-                    "expected '%s' <= '%s'\n",
-                    lua_tostring(lua, 2),
-                    lua_tostring(lua, 3)
+                    "ERROR: Test exceeded the limit of %llu instructions\n",
+                    (unsigned long long)interpreter.instructionLimit
                 )
             );
-            luaL_traceback(lua, lua, NULL, 1);
-            self->errorMessageDelegate(
+        }
+        if (interpreter.deadlineExceeded) {
+            interpreter.currentTestFailed = true;
+            errorMessageDelegate(
                 StringExtensions::sprintf(
-                    "%s\n",
-                    lua_tostring(lua, -1)
+                    "ERROR: Test exceeded the time limit of %g seconds (stopped after %.3f seconds)\n",
+                    options.testTimeout,
+                    std::chrono::duration< double >(
+                        std::chrono::steady_clock::now() - startTime
+                    ).count()
                 )
             );
-            lua_pop(lua, 1);
         }
-        return 0;
+        interpreter.memoryLimit = 0;
+        interpreter.fullTableDiff = false;
+        interpreter.instructionLimit = 0;
+        interpreter.hasDeadline = false;
+        if (installCountHook) {
+            lua_sethook(lua, NULL, 0, 0);
+        }
+        interpreter.profileSamples = nullptr;
+        if (options.collectMetrics) {
+            StopCollectingMetrics(interpreter);
+            testMetrics.cpuTime = GetThreadCpuTime() - cpuTime;
+            testMetrics.gcCycles = interpreter.gcCycles;
+            testMetrics.instructionCount = interpreter.instructionCount;
+        }
+        testMetrics.memoryInUse = interpreter.memoryInUse;
+        testMetrics.peakMemory = interpreter.peakMemory;
+        testMetrics.numAllocations = interpreter.numAllocations;
+        return !interpreter.currentTestFailed;
     }
 
     /**
-     * Compare the two values at the top of the Lua stack and mark the current
-     * test as failed if the first is not less than the second.
+     * Run the given batch of asynchronous tests together in the given
+     * fresh interpreter, executing the test script and calling the suite
+     * setup function once for all of them, interleaving the tasks of the
+     * tests, and then calling the suite teardown function, with the limits
+     * and measurements selected by the options applied to each test.
      *
-     * This is registered as the "expect_lt" method of the "moonunit" singleton
-     * provided to Lua scripts.
+     * @param[in,out] interpreter
+     *     This is the interpreter in which to run the tests.
      *
-     * @param[in] lua
-     *     This points to the state of the Lua interpreter.
+     * @param[in,out] batch
+     *     These are the tests to run.  The results of running
+     *     each test are stored here.
+     *
+     * @param[in] startTime
+     *     This is when the tests were started.
+     *
+     * @param[in,out] profileSamples
+     *     If profiling, this is where to count the Lua call stacks sampled.
+     *
+     * @param[out] testMetrics
+     *     This is where to store the measurements taken
+     *     while running each test.
      */
-    static int LuaExpectLt(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (!lua_compare(lua, 2, 3, LUA_OPLT)) {
-            self->currentTestFailed = true;
-            self->errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "expected '%s' < '%s'\n",
-                    lua_tostring(lua, 2),
-                    lua_tostring(lua, 3)
+    void RunAsyncTestBatch(
+        Interpreter& interpreter,
+        AsyncBatch& batch,
+        std::chrono::steady_clock::time_point startTime,
+        std::unordered_map< std::string, size_t >& profileSamples,
+        std::vector< TestMetrics >& testMetrics
+    ) {
+        const auto lua = interpreter.lua;
+        auto& tests = batch.tests;
+        const auto& testSuiteName = *tests.front().testTableEntry->testSuiteName;
+        const auto& script = *tests.front().testTableEntry->test->script;
+        double cpuTime = 0.0;
+        double sharedCpuTime = 0.0;
+        size_t sharedGcCycles = 0;
+        interpreter.script = &script;
+        interpreter.memoryLimit = options.maxTestMemory;
+        interpreter.fullTableDiff = options.fullTableDiff;
+        batch.collectMetrics = options.collectMetrics;
+        batch.errorMessageDelegate = [&](const std::string& message){
+            for (const auto& test: tests) {
+                test.errorMessageDelegate(message);
+            }
+        };
+        if (options.collectMetrics) {
+            cpuTime = GetThreadCpuTime();
+            StartCollectingMetrics(interpreter);
+        }
+        if (options.profile) {
+            interpreter.profileSamples = &profileSamples;
+        }
+        interpreter.instructionLimit = options.testInstructionLimit;
+        if (options.testTimeout > 0.0) {
+            interpreter.hasDeadline = true;
+            interpreter.deadline = startTime + std::chrono::duration_cast< std::chrono::steady_clock::duration >(
+                std::chrono::duration< double >(options.testTimeout)
+            );
+        }
+        const auto installCountHook = (
+            options.collectMetrics
+            || options.profile
+            || (interpreter.instructionLimit != 0)
+            || interpreter.hasDeadline
+        );
+        if (installCountHook) {
+            lua_sethook(lua, LuaCountHook, LUA_MASKCOUNT, instructionCountHookInterval);
+        }
+        const auto failAll = [&]{
+            for (auto& test: tests) {
+                test.failed = true;
+            }
+        };
+        const auto runTests = [&]{
+            interpreter.errorMessageDelegate = batch.errorMessageDelegate;
+            const auto suiteSetUp = (
+                CallRegisteredFunction(
+                    interpreter,
+                    interpreter.luaSuiteFixtureRegistryIndex,
+                    testSuiteName,
+                    "setup",
+                    "suite setup failed: "
                 )
+                && !interpreter.currentTestFailed
+            );
+            if (!suiteSetUp) {
+                failAll();
+                interpreter.errorMessageDelegate = nullptr;
+                return;
+            }
+
+            // Loading the test script and setting up the suite is done
+            // once for all the tests, but counted for each of them,
+            // as if each had done it on its own.
+            if (options.collectMetrics) {
+                sharedCpuTime = GetThreadCpuTime() - cpuTime;
+                sharedGcCycles = interpreter.gcCycles;
+            }
+            for (auto& test: tests) {
+                test.instructionCount = interpreter.instructionCount;
+            }
+            lua_pushcfunction(lua, LuaTraceback);
+            const auto messageHandlerIndex = lua_gettop(lua);
+            lua_pushcfunction(lua, LuaRunAsyncBatch);
+            lua_pushlightuserdata(lua, &batch);
+            if (lua_pcall(lua, 1, 0, messageHandlerIndex) != LUA_OK) {
+                const std::string errorMessage = (
+                    lua_isnil(lua, -1)
+                    ? "(no error message)"
+                    : lua_tostring(lua, -1)
+                );
+                for (auto& test: tests) {
+                    if (test.finished) {
+                        continue;
+                    }
+                    test.finished = true;
+                    test.failed = true;
+                    test.endTime = std::chrono::steady_clock::now();
+                    test.errorMessageDelegate(
+                        StringExtensions::sprintf(
+                            "ERROR: %s\n",
+                            errorMessage.c_str()
+                        )
+                    );
+                }
+            }
+            lua_settop(lua, messageHandlerIndex - 1);
+            interpreter.asyncScheduler = nullptr;
+            interpreter.errorMessageDelegate = batch.errorMessageDelegate;
+            interpreter.currentTestFailed = false;
+            (void)CallRegisteredFunction(
+                interpreter,
+                interpreter.luaSuiteFixtureRegistryIndex,
+                testSuiteName,
+                "teardown",
+                "suite teardown failed: "
             );
-            luaL_traceback(lua, lua, NULL, 1);
-            self->errorMessageDelegate(
+            if (interpreter.currentTestFailed) {
+                failAll();
+            }
+            interpreter.errorMessageDelegate = nullptr;
+        };
+        const auto errorMessage = WithScript(
+            interpreter,
+            script.bytecode.data(),
+            script.bytecode.length(),
+            "b",
+            script.filePath,
+            runTests
+        );
+        if (!errorMessage.empty()) {
+            failAll();
+            batch.errorMessageDelegate(
                 StringExtensions::sprintf(
-                    "%s\n",
-                    lua_tostring(lua, -1)
+                    "ERROR: Unable to load Lua script file '%s': %s",
+                    script.filePath.c_str(),
+                    errorMessage.c_str()
                 )
             );
-            lua_pop(lua, 1);
         }
-        return 0;
-    }
+        const auto endTime = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < tests.size(); ++i) {
+            auto& test = tests[i];
+            if (!test.finished) {
+                test.finished = true;
+                test.endTime = endTime;
+            }
 
-    /**
-     * Compare the two values at the top of the Lua stack and mark the current
-     * test as failed if they are equal.
-     *
-     * This is registered as the "expect_ne" method of the "moonunit" singleton
-     * provided to Lua scripts.
-     *
-     * @param[in] lua
-     *     This points to the state of the Lua interpreter.
-     */
-    static int LuaExpectNe(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (
-            lua_istable(lua, 2)
-            && lua_istable(lua, 3)
-        ) {
-            std::vector< Json::Value > keyChain;
-            const auto comparisonResult = CompareLuaTables(lua, 2, 3, keyChain);
-            if (comparisonResult.empty()) {
-                self->currentTestFailed = true;
-                self->errorMessageDelegate(
+            // The memory limit applies to the interpreter, which the tests
+            // share, so it's reported for any test which failed.
+            if (
+                interpreter.memoryLimitExceeded
+                && test.failed
+            ) {
+                test.errorMessageDelegate(
                     StringExtensions::sprintf(
-                        "Tables should differ but are the same\n"
+                        "ERROR: Test reached the memory limit of %zu bytes\n",
+                        interpreter.memoryLimit
                     )
                 );
             }
-        } else if (lua_compare(lua, 2, 3, LUA_OPEQ)) {
-            self->currentTestFailed = true;
-            self->errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "Expected not '%s', actual was '%s'\n",
-                    lua_tostring(lua, 2),
-                    lua_tostring(lua, 3)
-                )
-            );
-            luaL_traceback(lua, lua, NULL, 1);
-            self->errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "%s\n",
-                    lua_tostring(lua, -1)
-                )
-            );
-            lua_pop(lua, 1);
+            if (test.instructionLimitExceeded) {
+                test.failed = true;
+                test.errorMessageDelegate(
+                    StringExtensions::sprintf(
+                        "ERROR: Test exceeded the limit of %llu instructions\n",
+                        (unsigned long long)interpreter.instructionLimit
+                    )
+                );
+            }
+            if (test.deadlineExceeded) {
+                test.failed = true;
+                test.errorMessageDelegate(
+                    StringExtensions::sprintf(
+                        "ERROR: Test exceeded the time limit of %g seconds (stopped after %.3f seconds)\n",
+                        options.testTimeout,
+                        std::chrono::duration< double >(
+                            test.endTime - startTime
+                        ).count()
+                    )
+                );
+            }
+            auto& metrics = testMetrics[i];
+            if (options.collectMetrics) {
+                metrics.cpuTime = sharedCpuTime + test.cpuTime;
+                metrics.gcCycles = sharedGcCycles + test.gcCycles;
+                metrics.instructionCount = test.instructionCount;
+            }
+            metrics.memoryInUse = interpreter.memoryInUse;
+            metrics.peakMemory = interpreter.peakMemory;
+            metrics.numAllocations = interpreter.numAllocations;
+            metrics.duration = std::chrono::duration< double >(
+                test.endTime - startTime
+            ).count();
+        }
+        interpreter.memoryLimit = 0;
+        interpreter.fullTableDiff = false;
+        interpreter.instructionLimit = 0;
+        interpreter.hasDeadline = false;
+        if (installCountHook) {
+            lua_sethook(lua, NULL, 0, 0);
+        }
+        interpreter.profileSamples = nullptr;
+        if (options.collectMetrics) {
+            StopCollectingMetrics(interpreter);
         }
-        return 0;
     }
 
     /**
-     * Compare the value at the top of the Lua stack and mark the current test
-     * as failed if it is not considered "truthy".
+     * Run the given test in the Lua interpreter kept by the calling
+     * thread for the test suite of the test, making a new one first
+     * (and finishing the one kept for any other suite) if necessary.
      *
-     * This is registered as the "expect_true" method of the "moonunit"
-     * singleton provided to Lua scripts.
+     * @param[in] testTableEntry
+     *     This identifies the test to run.
      *
-     * @param[in] lua
-     *     This points to the state of the Lua interpreter.
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to report any error messages.
+     *
+     * @param[in] startTime
+     *     This is when the test was started.
+     *
+     * @param[in,out] profileSamples
+     *     If profiling, this is where to count the Lua call stacks sampled.
+     *
+     * @param[out] testMetrics
+     *     This is where to store the measurements taken
+     *     while running the test.
+     *
+     * @return
+     *     An indication of whether or not the test passed is returned.
      */
-    static int LuaExpectTrue(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        if (!lua_toboolean(lua, 2)) {
-            self->currentTestFailed = true;
-            const std::string actual = luaL_tolstring(lua, 2, NULL);
-            lua_pop(lua, 1);
-            self->errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "Expected '%s' to be true\n",
-                    actual.c_str()
-                )
-            );
-            luaL_traceback(lua, lua, NULL, 1);
-            self->errorMessageDelegate(
-                StringExtensions::sprintf(
-                    "%s\n",
-                    lua_tostring(lua, -1)
-                )
-            );
-            lua_pop(lua, 1);
+    bool RunTestWithSuiteState(
+        const TestTableEntry& testTableEntry,
+        ErrorMessageDelegate errorMessageDelegate,
+        std::chrono::steady_clock::time_point startTime,
+        std::unordered_map< std::string, size_t >& profileSamples,
+        TestMetrics& testMetrics
+    ) {
+        SuiteState* suiteState;
+        {
+            std::lock_guard< decltype(suiteStatesMutex) > lock(suiteStatesMutex);
+            suiteState = &suiteStates[std::this_thread::get_id()];
         }
-        return 0;
+        const auto& testSuiteName = *testTableEntry.testSuiteName;
+        const auto& script = testTableEntry.test->script;
+        if (
+            (suiteState->interpreter != nullptr)
+            && (
+                (suiteState->script != script)
+                || (suiteState->testSuiteName != testSuiteName)
+            )
+        ) {
+            EndSuite(*suiteState);
+        }
+        const bool loadScript = (suiteState->interpreter == nullptr);
+        if (loadScript) {
+            // The interpreter outlives any others the thread makes while
+            // it's kept, so it can't use the arena of the thread, which
+            // is reset whenever one of them is destroyed.
+            suiteState->interpreter.reset(new Interpreter());
+            OpenInterpreter(*suiteState->interpreter, false);
+            suiteState->script = script;
+            suiteState->testSuiteName = testSuiteName;
+        }
+        auto& interpreter = *suiteState->interpreter;
+        interpreter.currentTestFailed = false;
+        interpreter.memoryLimitExceeded = false;
+        interpreter.peakMemory = interpreter.memoryInUse;
+        interpreter.numAllocations = 0;
+        const auto passed = RunTestInInterpreter(
+            interpreter,
+            testTableEntry,
+            loadScript,
+            false,
+            errorMessageDelegate,
+            startTime,
+            profileSamples,
+            testMetrics
+        );
+
+        // A test stopped by a limit may have been stopped anywhere,
+        // so the interpreter isn't trusted with any more tests.  If the
+        // suite couldn't be set up, it's tried again for the next test.
+        if (
+            !interpreter.suiteSetUp
+            || interpreter.instructionLimitExceeded
+            || interpreter.deadlineExceeded
+            || (
+                interpreter.memoryLimitExceeded
+                && !passed
+            )
+        ) {
+            EndSuite(*suiteState);
+        }
+        return passed;
     }
 
     /**
-     * Register the given function as the test with the given name under the
-     * test suite with the given name.
-     *
-     * This is registered as the "test" method of the "moonunit" singleton
-     * provided to Lua scripts.
+     * Call the suite teardown function in the given Lua interpreter kept
+     * for a test suite, if the suite was set up, and then destroy it.
+     * Any errors raised by the teardown function are kept, to be
+     * reported by EndTestSuites.
      *
-     * @param[in] lua
-     *     This points to the state of the Lua interpreter.
+     * @param[in,out] suiteState
+     *     This holds the Lua interpreter kept for the test suite.
      */
-    static int LuaTest(lua_State* lua) {
-        auto self = *(Impl**)luaL_checkudata(lua, 1, "moonunit");
-        const std::string testSuiteName = luaL_checkstring(lua, 2);
-        const std::string testName = luaL_checkstring(lua, 3);
-        luaL_checktype(lua, 4, LUA_TFUNCTION);
-        lua_rawgeti(lua, LUA_REGISTRYINDEX, self->luaRegistryIndex);
-        lua_pushvalue(lua, 2);
-        lua_rawget(lua, -2);
-        if (lua_isnil(lua, -1)) {
-            lua_pop(lua, 1);
-            lua_newtable(lua);
-            lua_pushvalue(lua, 2);
-            lua_pushvalue(lua, -2);
-            lua_rawset(lua, -4);
+    void EndSuite(SuiteState& suiteState) {
+        auto& interpreter = *suiteState.interpreter;
+        if (interpreter.suiteSetUp) {
+            std::string errorMessage;
+            interpreter.errorMessageDelegate = [&](const std::string& message){
+                errorMessage += message;
+            };
+            (void)CallRegisteredFunction(
+                interpreter,
+                interpreter.luaSuiteFixtureRegistryIndex,
+                suiteState.testSuiteName,
+                "teardown",
+                "suite teardown failed: "
+            );
+            interpreter.errorMessageDelegate = nullptr;
+            interpreter.suiteSetUp = false;
+            if (!errorMessage.empty()) {
+                std::lock_guard< decltype(suiteStatesMutex) > lock(suiteStatesMutex);
+                suiteTeardownErrorMessages.push_back(
+                    StringExtensions::sprintf(
+                        "ERROR: Test suite '%s' failed to tear down:\n%s",
+                        suiteState.testSuiteName.c_str(),
+                        errorMessage.c_str()
+                    )
+                );
+            }
         }
-        lua_pushvalue(lua, 3);
-        lua_pushvalue(lua, 4);
-        lua_rawset(lua, -3);
-        lua_pop(lua, 2);
-        return 0;
+        CloseInterpreter(interpreter);
+        suiteState.interpreter.reset();
+        suiteState.script.reset();
+        suiteState.testSuiteName.clear();
     }
 
     /**
@@ -1180,102 +5090,168 @@ struct Runner::Impl {
      * equipped with a "moonunit" singleton used to interact with the test
      * runner.
      *
-     * @param[in] fn
-     *     This is the function to call within the context of a fresh Lua
-     *     interpreter equipped with a "moonunit" singleton used to interact
-     *     with the test runner.
+     * @param[in] fn
+     *     This is the function to call within the context of a fresh Lua
+     *     interpreter equipped with a "moonunit" singleton used to interact
+     *     with the test runner.
+     */
+    void WithLua(std::function< void(Interpreter& interpreter) > fn) {
+        Interpreter interpreter;
+        OpenInterpreter(interpreter, true);
+        fn(interpreter);
+        CloseInterpreter(interpreter);
+    }
+
+    /**
+     * Make a fresh Lua interpreter for the given interpreter, equipped
+     * with a "moonunit" singleton used to interact with the test runner.
+     *
+     * @param[in,out] interpreter
+     *     This is the interpreter for which to make the Lua interpreter.
+     *
+     * @param[in] useArena
+     *     This indicates whether or not the memory of the interpreter
+     *     may be allocated from the arena of the calling thread,
+     *     if that allocator is selected.
      */
-    void WithLua(std::function< void() > fn) {
-        // Create the Lua interpreter.
-        lua = lua_newstate(LuaAllocator, NULL);
+    void OpenInterpreter(
+        Interpreter& interpreter,
+        bool useArena
+    ) {
+        // Create the Lua interpreter.  If selected, memory is allocated
+        // from an arena kept by each thread, which is reset all at once
+        // when the interpreter is destroyed, so that the same memory
+        // is reused by the next interpreter on the thread.
+        if (
+            useArena
+            && (options.allocator == Allocator::Arena)
+        ) {
+            static thread_local Arena threadArena;
+            interpreter.arena = &threadArena;
+        }
+        const auto lua = lua_newstate(LuaInterpreterAllocator, &interpreter);
+        interpreter.lua = lua;
 
-        // Load standard Lua libraries.
-        //
-        // Temporarily disable the garbage collector as we load the
-        // libraries, to improve performance
+        // Temporarily disable the garbage collector while the interpreter
+        // is prepared, to improve performance, since nothing created
+        // here becomes garbage
         // (http://lua-users.org/lists/lua-l/2008-07/msg00690.html).
         lua_gc(lua, LUA_GCSTOP, 0);
+
+        // Load standard Lua libraries.
         luaL_openlibs(lua);
-        lua_gc(lua, LUA_GCRESTART, 0);
 
-        // Initialize wrapper types.
-        luaL_newmetatable(lua, "moonunit");
-        lua_pushstring(lua, "__index");
-        lua_pushvalue(lua, -2);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "assert_eq");
-        lua_pushcfunction(lua, Impl::LuaAssertEq);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "assert_false");
-        lua_pushcfunction(lua, Impl::LuaAssertFalse);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "assert_ge");
-        lua_pushcfunction(lua, Impl::LuaAssertGe);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "assert_gt");
-        lua_pushcfunction(lua, Impl::LuaAssertGt);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "assert_le");
-        lua_pushcfunction(lua, Impl::LuaAssertLe);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "assert_lt");
-        lua_pushcfunction(lua, Impl::LuaAssertLt);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "assert_ne");
-        lua_pushcfunction(lua, Impl::LuaAssertNe);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "assert_true");
-        lua_pushcfunction(lua, Impl::LuaAssertTrue);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "expect_eq");
-        lua_pushcfunction(lua, Impl::LuaExpectEq);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "expect_false");
-        lua_pushcfunction(lua, Impl::LuaExpectFalse);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "expect_ge");
-        lua_pushcfunction(lua, Impl::LuaExpectGe);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "expect_gt");
-        lua_pushcfunction(lua, Impl::LuaExpectGt);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "expect_le");
-        lua_pushcfunction(lua, Impl::LuaExpectLe);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "expect_lt");
-        lua_pushcfunction(lua, Impl::LuaExpectLt);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "expect_ne");
-        lua_pushcfunction(lua, Impl::LuaExpectNe);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "expect_true");
-        lua_pushcfunction(lua, Impl::LuaExpectTrue);
-        lua_settable(lua, -3);
-        lua_pushstring(lua, "test");
-        lua_pushcfunction(lua, Impl::LuaTest);
-        lua_settable(lua, -3);
-        lua_pop(lua, 1);
+        // Resolve relative paths against the folder of the script
+        // being executed rather than the working directory, which is
+        // shared by every interpreter in the process.
+        ResolvePathsFromScriptDirectory(interpreter);
+
+        // If tests were loaded from a test pack, look for Lua modules
+        // only in the pack, rather than in files, so that a module
+        // missing from the pack fails to load instead of being loaded
+        // from whatever files happen to be around.
+        if (loadedFromPack) {
+            interpreter.packedModules = &packedModules;
+            lua_getglobal(lua, "package");
+            lua_getfield(lua, -1, "searchers");
+            lua_pushlightuserdata(lua, &interpreter);
+            lua_pushcclosure(lua, LuaSearchTestPack, 1);
+            lua_rawseti(lua, -2, 2);
+            lua_pop(lua, 2);
+        }
 
         // Construct the "moonunit" singleton representing the runner.
-        auto self = (Impl**)lua_newuserdata(lua, sizeof(Impl**));
-        *self = this;
+        auto self = (Interpreter**)lua_newuserdata(lua, sizeof(Interpreter**));
+        *self = &interpreter;
+
+        // Initialize wrapper types.
+        //
+        // The metatable is created with room for all its fields up front,
+        // and registered the same way luaL_newmetatable would, so
+        // that it isn't rehashed repeatedly as the methods are added.
+        // Each method gets the singleton as an upvalue (see GetSelf).
+        static const luaL_Reg moonunitMethods[] = {
+            {"assert_all_eq", Impl::LuaAssertAllEq},
+            {"assert_all_near", Impl::LuaAssertAllNear},
+            {"assert_eq", Impl::LuaAssertEq},
+            {"assert_false", Impl::LuaAssertFalse},
+            {"assert_ge", Impl::LuaAssertGe},
+            {"assert_gt", Impl::LuaAssertGt},
+            {"assert_le", Impl::LuaAssertLe},
+            {"assert_lt", Impl::LuaAssertLt},
+            {"assert_ne", Impl::LuaAssertNe},
+            {"assert_sorted", Impl::LuaAssertSorted},
+            {"assert_true", Impl::LuaAssertTrue},
+            {"async_test", Impl::LuaAsyncTest},
+            {"await", Impl::LuaAwait},
+            {"benchmark", Impl::LuaBenchmark},
+            {"expect_all_eq", Impl::LuaExpectAllEq},
+            {"expect_all_near", Impl::LuaExpectAllNear},
+            {"expect_eq", Impl::LuaExpectEq},
+            {"expect_false", Impl::LuaExpectFalse},
+            {"expect_ge", Impl::LuaExpectGe},
+            {"expect_gt", Impl::LuaExpectGt},
+            {"expect_le", Impl::LuaExpectLe},
+            {"expect_lt", Impl::LuaExpectLt},
+            {"expect_ne", Impl::LuaExpectNe},
+            {"expect_sorted", Impl::LuaExpectSorted},
+            {"expect_true", Impl::LuaExpectTrue},
+            {"future", Impl::LuaFuture},
+            {"sleep", Impl::LuaSleep},
+            {"spawn", Impl::LuaSpawn},
+            {"suite_setup", Impl::LuaSuiteSetup},
+            {"suite_teardown", Impl::LuaSuiteTeardown},
+            {"test", Impl::LuaTest},
+            {NULL, NULL}
+        };
+        static const int numMoonunitMethods = (int)(
+            sizeof(moonunitMethods) / sizeof(moonunitMethods[0]) - 1
+        );
+        lua_createtable(lua, 0, numMoonunitMethods + 2);
+        lua_pushliteral(lua, "moonunit");
+        lua_setfield(lua, -2, "__name");
+        lua_pushvalue(lua, -1);
+        lua_setfield(lua, -2, "__index");
+        lua_pushvalue(lua, -2);
+        luaL_setfuncs(lua, moonunitMethods, 1);
+        lua_setfield(lua, LUA_REGISTRYINDEX, "moonunit");
         luaL_setmetatable(lua, "moonunit");
         lua_setglobal(lua, "moonunit");
 
-        // Make a table for organizing test and test suites.
+        // Make tables for organizing tests and test suites,
+        // suite fixtures, and benchmarks and benchmark suites.
+        lua_newtable(lua);
+        interpreter.luaRegistryIndex = luaL_ref(lua, LUA_REGISTRYINDEX);
         lua_newtable(lua);
-        luaRegistryIndex = luaL_ref(lua, LUA_REGISTRYINDEX);
+        interpreter.luaSuiteFixtureRegistryIndex = luaL_ref(lua, LUA_REGISTRYINDEX);
+        lua_newtable(lua);
+        interpreter.luaBenchmarkRegistryIndex = luaL_ref(lua, LUA_REGISTRYINDEX);
+        lua_gc(lua, LUA_GCRESTART, 0);
+    }
 
-        // Perform the requested operation.
-        fn();
+    /**
+     * Destroy the Lua interpreter of the given interpreter.
+     *
+     * @param[in,out] interpreter
+     *     This is the interpreter whose Lua interpreter to destroy.
+     */
+    void CloseInterpreter(Interpreter& interpreter) {
+        const auto lua = interpreter.lua;
 
-        // Release table used for organizing test and test suites.
-        luaL_unref(lua, LUA_REGISTRYINDEX, luaRegistryIndex);
-        luaRegistryIndex = 0;
+        // Release tables used for organizing tests and benchmarks.
+        luaL_unref(lua, LUA_REGISTRYINDEX, interpreter.luaBenchmarkRegistryIndex);
+        interpreter.luaBenchmarkRegistryIndex = 0;
+        luaL_unref(lua, LUA_REGISTRYINDEX, interpreter.luaSuiteFixtureRegistryIndex);
+        interpreter.luaSuiteFixtureRegistryIndex = 0;
+        luaL_unref(lua, LUA_REGISTRYINDEX, interpreter.luaRegistryIndex);
+        interpreter.luaRegistryIndex = 0;
 
         // Destroy the Lua interpreter.
         lua_close(lua);
-        lua = nullptr;
+        interpreter.lua = nullptr;
+        if (interpreter.arena != nullptr) {
+            interpreter.arena->Reset();
+        }
     }
 };
 
@@ -1288,181 +5264,758 @@ Runner::Runner()
 {
 }
 
+void Runner::SetOptions(const Options& options) {
+    impl_->options = options;
+}
+
 void Runner::Configure(
     SystemAbstractions::File& configurationFile,
     ErrorMessageDelegate errorMessageDelegate
 ) {
-    if (!configurationFile.OpenReadOnly()) {
-        return;
-    }
-    SystemAbstractions::IFile::Buffer buffer(configurationFile.GetSize());
-    const auto amountRead = configurationFile.Read(buffer);
-    configurationFile.Close();
-    if (amountRead != buffer.size()) {
-        return;
+    impl_->configurationFilePaths.push_back(configurationFile.GetPath());
+    std::vector< std::string > testFilePaths;
+    impl_->FindTestFiles(configurationFile, testFilePaths);
+    impl_->LoadTestSuites(testFilePaths, errorMessageDelegate);
+    impl_->BuildTestTable();
+}
+
+std::vector< std::pair< std::string, std::string > > Runner::Refresh(
+    ErrorMessageDelegate errorMessageDelegate
+) {
+    // Walk the configuration files again to find out which Lua script
+    // files should now be providing tests.
+    std::vector< std::string > testFilePaths;
+    for (const auto& configurationFilePath: impl_->configurationFilePaths) {
+        SystemAbstractions::File configurationFile(configurationFilePath);
+        impl_->FindTestFiles(configurationFile, testFilePaths);
     }
-    const std::string configuration(buffer.begin(), buffer.end());
-    for (const auto& line: StringExtensions::Split(configuration, '\n')) {
-        auto searchPath = StringExtensions::Trim(line);
-        if (!SystemAbstractions::File::IsAbsolutePath(searchPath)) {
-            searchPath = (
-                ParentFolderPath(configurationFile.GetPath())
-                + "/"
-                + searchPath
-            );
+    const std::set< std::string > currentTestFilePaths(
+        testFilePaths.begin(),
+        testFilePaths.end()
+    );
+
+    // Forget any tests from files which are no longer configured.
+    for (auto testFile = impl_->testFiles.begin(); testFile != impl_->testFiles.end();) {
+        if (currentTestFilePaths.find(testFile->first) == currentTestFilePaths.end()) {
+            impl_->RemoveTestsFromFile(testFile->first);
+            testFile = impl_->testFiles.erase(testFile);
+        } else {
+            ++testFile;
         }
-        SystemAbstractions::File possibleTestFile(searchPath);
-        if (!possibleTestFile.IsExisting()) {
+    }
+
+    // Find the files which are new or which changed (or required modules
+    // which changed) since they were loaded, and load them again.
+    std::vector< std::string > changedTestFilePaths;
+    std::set< std::string > changedTestFilePathSet;
+    for (const auto& testFilePath: testFilePaths) {
+        if (changedTestFilePathSet.find(testFilePath) != changedTestFilePathSet.end()) {
             continue;
         }
-        if (possibleTestFile.IsDirectory()) {
-            SystemAbstractions::File possibleOtherConfigurationFile(searchPath + "/.moonunit");
-            if (possibleOtherConfigurationFile.IsExisting()) {
-                Configure(possibleOtherConfigurationFile, errorMessageDelegate);
-            } else {
-                std::vector< std::string > filePaths;
-                SystemAbstractions::File::ListDirectory(searchPath, filePaths);
-                bool success = true;
-                for (const auto& filePath: filePaths) {
-                    if (
-                        (filePath.length() >= luaFileExtensionLength)
-                        && (filePath.substr(filePath.length() - luaFileExtensionLength) == luaFileExtension)
-                    ) {
-                        SystemAbstractions::File testSuiteFile(filePath);
-                        impl_->LoadTestSuite(
-                            testSuiteFile,
-                            errorMessageDelegate
-                        );
+        const auto testFilesEntry = impl_->testFiles.find(testFilePath);
+        if (
+            (testFilesEntry != impl_->testFiles.end())
+            && IsFileUnchanged(testFilePath, testFilesEntry->second.stamp)
+        ) {
+            bool dependenciesUnchanged = true;
+            for (auto& dependency: testFilesEntry->second.dependencies) {
+                if (!IsFileUnchanged(dependency.filePath, dependency.stamp)) {
+                    dependenciesUnchanged = false;
+                    break;
+                }
+            }
+            if (dependenciesUnchanged) {
+                continue;
+            }
+        }
+        impl_->RemoveTestsFromFile(testFilePath);
+        changedTestFilePaths.push_back(testFilePath);
+        (void)changedTestFilePathSet.insert(testFilePath);
+    }
+    std::vector< std::pair< std::string, std::string > > affectedTests;
+    if (changedTestFilePaths.empty()) {
+        impl_->BuildTestTable();
+        return affectedTests;
+    }
+    impl_->LoadTestSuites(changedTestFilePaths, errorMessageDelegate);
+    impl_->BuildTestTable();
+    std::set< std::pair< std::string, std::string > > affectedTestSet;
+    for (const auto& testSuite: impl_->testSuites) {
+        for (const auto& test: testSuite.second.tests) {
+            if (changedTestFilePathSet.find(test.second.script->filePath) != changedTestFilePathSet.end()) {
+                (void)affectedTestSet.emplace(testSuite.first, test.first);
+            }
+        }
+    }
+    affectedTests.assign(affectedTestSet.begin(), affectedTestSet.end());
+    return affectedTests;
+}
+
+void Runner::LoadDiscoveryIndex(const std::string& path) {
+    (void)impl_->discoveryIndex.Load(path);
+}
+
+bool Runner::SaveDiscoveryIndex(const std::string& path) const {
+    return impl_->discoveryIndex.Save(path);
+}
+
+bool Runner::SavePack(
+    const std::string& path,
+    ErrorMessageDelegate errorMessageDelegate
+) const {
+    TestPack pack;
+    std::map< const Script*, size_t > scriptIndexes;
+    std::set< std::string > moduleFilePaths;
+    bool packed = true;
+    for (const auto benchmark: {false, true}) {
+        const auto& foundTestSuites = (
+            benchmark
+            ? impl_->benchmarkSuites
+            : impl_->testSuites
+        );
+        for (const auto& testSuite: foundTestSuites) {
+            for (const auto& test: testSuite.second.tests) {
+                auto& script = *test.second.script;
+                auto scriptIndexesEntry = scriptIndexes.find(&script);
+                if (scriptIndexesEntry == scriptIndexes.end()) {
+                    if (!Impl::PrepareScript(script, errorMessageDelegate)) {
+                        packed = false;
+                        continue;
                     }
+                    TestPack::Script packedScript;
+                    packedScript.filePath = script.filePath;
+                    packedScript.bytecode = script.bytecode;
+                    packedScript.modules.assign(script.modules.begin(), script.modules.end());
+                    for (const auto& module: script.modules) {
+                        (void)moduleFilePaths.insert(module.second);
+                    }
+                    scriptIndexesEntry = scriptIndexes.insert(
+                        std::make_pair(&script, pack.AddScript(std::move(packedScript)))
+                    ).first;
                 }
+                TestPack::Test packedTest;
+                packedTest.testSuiteName = testSuite.first;
+                packedTest.testName = test.first;
+                packedTest.scriptIndex = scriptIndexesEntry->second;
+                packedTest.lineNumber = test.second.lineNumber;
+                packedTest.benchmark = benchmark;
+                packedTest.async = test.second.async;
+                pack.AddTest(std::move(packedTest));
             }
-        } else {
-            impl_->LoadTestSuite(
-                possibleTestFile,
-                errorMessageDelegate
+        }
+    }
+    for (const auto& moduleFilePath: moduleFilePaths) {
+        TestPack::Module module;
+        module.filePath = moduleFilePath;
+        const auto errorMessage = Impl::CompileFile(
+            moduleFilePath,
+            "@" + moduleFilePath,
+            module.bytecode
+        );
+        if (!errorMessage.empty()) {
+            errorMessageDelegate(
+                StringExtensions::sprintf(
+                    "ERROR: Unable to pack Lua module file '%s': %s",
+                    moduleFilePath.c_str(),
+                    errorMessage.c_str()
+                )
             );
+            packed = false;
+            continue;
         }
+        pack.AddModule(std::move(module));
+    }
+    if (!packed) {
+        return false;
+    }
+    if (!pack.Save(path)) {
+        errorMessageDelegate(
+            StringExtensions::sprintf(
+                "ERROR: Unable to save test pack '%s'",
+                path.c_str()
+            )
+        );
+        return false;
     }
+    return true;
 }
 
-std::string Runner::GetReport() const {
-    std::ostringstream buffer;
-    size_t numTests = 0;
-    for (const auto& testSuite: impl_->testSuites) {
-        numTests += testSuite.second.tests.size();
+bool Runner::LoadPack(
+    const std::string& path,
+    ErrorMessageDelegate errorMessageDelegate
+) {
+    TestPack pack;
+    if (!pack.Load(path)) {
+        errorMessageDelegate(
+            StringExtensions::sprintf(
+                "ERROR: Unable to load test pack '%s'",
+                path.c_str()
+            )
+        );
+        return false;
+    }
+    impl_->testSuites.clear();
+    impl_->benchmarkSuites.clear();
+    impl_->testFiles.clear();
+    impl_->configurationFilePaths.clear();
+    impl_->packedModules.clear();
+    impl_->loadedFromPack = true;
+    std::vector< std::shared_ptr< Script > > scripts;
+    scripts.reserve(pack.GetScripts().size());
+    for (const auto& packedScript: pack.GetScripts()) {
+        const auto script = std::make_shared< Script >();
+        script->filePath = packedScript.filePath;
+        script->bytecode = packedScript.bytecode;
+        script->modules.insert(packedScript.modules.begin(), packedScript.modules.end());
+        scripts.push_back(script);
+    }
+    for (const auto& packedModule: pack.GetModules()) {
+        impl_->packedModules[packedModule.filePath] = packedModule.bytecode;
+    }
+    for (const auto& packedTest: pack.GetTests()) {
+        Test test;
+        test.script = scripts[packedTest.scriptIndex];
+        test.lineNumber = packedTest.lineNumber;
+        test.async = packedTest.async;
+        auto& foundTestSuites = (
+            packedTest.benchmark
+            ? impl_->benchmarkSuites
+            : impl_->testSuites
+        );
+        foundTestSuites[packedTest.testSuiteName].tests[packedTest.testName] = std::move(test);
+    }
+    impl_->BuildTestTable();
+    return true;
+}
+
+std::vector< std::pair< std::string, std::string > > Runner::GetTestsAffectedBy(
+    const std::vector< std::string >& changedFilePaths
+) const {
+    std::set< std::string > changedFilePathSet;
+    for (const auto& changedFilePath: changedFilePaths) {
+        (void)changedFilePathSet.insert(NormalizePath(changedFilePath));
+    }
+    std::set< std::string > affectedTestFilePaths;
+    for (const auto& testFile: impl_->testFiles) {
+        bool affected = (changedFilePathSet.find(NormalizePath(testFile.first)) != changedFilePathSet.end());
+        for (const auto& dependency: testFile.second.dependencies) {
+            if (affected) {
+                break;
+            }
+            affected = (changedFilePathSet.find(dependency.filePath) != changedFilePathSet.end());
+        }
+        if (affected) {
+            (void)affectedTestFilePaths.insert(testFile.first);
+        }
     }
-    buffer
-        << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" << std::endl
-        << "<testsuites tests=\"" << numTests << "\" name=\"AllTests\">" << std::endl;
+    std::set< std::pair< std::string, std::string > > affectedTestSet;
     for (const auto& testSuite: impl_->testSuites) {
-        buffer
-            << "  <testsuite name=\"" << testSuite.first
-            << "\" tests=\"" << testSuite.second.tests.size()
-            << "\">" << std::endl;
         for (const auto& test: testSuite.second.tests) {
-            buffer
-                << "    <testcase name=\"" << test.first << "\""
-                << " file=\"" << test.second.filePath << "\""
-                << " line=\"" << test.second.lineNumber << "\" />" << std::endl;
+            if (affectedTestFilePaths.find(test.second.script->filePath) != affectedTestFilePaths.end()) {
+                (void)affectedTestSet.emplace(testSuite.first, test.first);
+            }
         }
-        buffer << "  </testsuite>" << std::endl;
     }
-    buffer << "</testsuites>" << std::endl;
-    return buffer.str();
+    return std::vector< std::pair< std::string, std::string > >(
+        affectedTestSet.begin(),
+        affectedTestSet.end()
+    );
 }
 
-std::vector< std::string > Runner::GetTestNames(const std::string& testSuiteName) const {
-    const auto testSuitesEntry = impl_->testSuites.find(testSuiteName);
-    if (testSuitesEntry == impl_->testSuites.end()) {
+std::string Runner::GetDependencyGraph() const {
+    Json::Value graph(Json::Value::Type::Object);
+    for (const auto& testFile: impl_->testFiles) {
+        Json::Value dependencies(Json::Value::Type::Array);
+        for (const auto& dependency: testFile.second.dependencies) {
+            dependencies.Add(dependency.filePath);
+        }
+        graph.Set(testFile.first, dependencies);
+    }
+    return graph.ToEncoding();
+}
+
+std::vector< std::string > Runner::GetBenchmarkNames(const std::string& benchmarkSuiteName) const {
+    const auto benchmarkSuitesEntry = impl_->benchmarkSuites.find(benchmarkSuiteName);
+    if (benchmarkSuitesEntry == impl_->benchmarkSuites.end()) {
         return {};
     }
-    const auto& testSuite = testSuitesEntry->second;
-    std::vector< std::string > testNames;
-    for (const auto& test: testSuite.tests) {
-        testNames.push_back(test.first);
+    const auto& benchmarkSuite = benchmarkSuitesEntry->second;
+    std::vector< std::string > benchmarkNames;
+    for (const auto& benchmark: benchmarkSuite.tests) {
+        benchmarkNames.push_back(benchmark.first);
     }
-    return testNames;
+    std::sort(benchmarkNames.begin(), benchmarkNames.end());
+    return benchmarkNames;
 }
 
-std::vector< std::string > Runner::GetTestSuiteNames() const {
-    std::vector< std::string > testSuiteNames;
-    for (const auto& testSuite: impl_->testSuites) {
-        testSuiteNames.push_back(testSuite.first);
+std::vector< std::string > Runner::GetBenchmarkSuiteNames() const {
+    std::vector< std::string > benchmarkSuiteNames;
+    for (const auto& benchmarkSuite: impl_->benchmarkSuites) {
+        benchmarkSuiteNames.push_back(benchmarkSuite.first);
     }
-    return testSuiteNames;
+    std::sort(benchmarkSuiteNames.begin(), benchmarkSuiteNames.end());
+    return benchmarkSuiteNames;
 }
 
-bool Runner::RunTest(
-    const std::string& testSuiteName,
-    const std::string& testName,
-    ErrorMessageDelegate errorMessageDelegate
+bool Runner::RunBenchmark(
+    const std::string& benchmarkSuiteName,
+    const std::string& benchmarkName,
+    ErrorMessageDelegate errorMessageDelegate,
+    BenchmarkResult& result
 ) {
-    const auto testSuitesEntry = impl_->testSuites.find(testSuiteName);
-    if (testSuitesEntry == impl_->testSuites.end()) {
+    result = BenchmarkResult();
+    const auto benchmarkSuitesEntry = impl_->benchmarkSuites.find(benchmarkSuiteName);
+    if (benchmarkSuitesEntry == impl_->benchmarkSuites.end()) {
         errorMessageDelegate(
             StringExtensions::sprintf(
-                "ERROR: No test suite '%s' found",
-                testSuiteName.c_str()
+                "ERROR: No benchmark suite '%s' found",
+                benchmarkSuiteName.c_str()
             )
         );
         return false;
     }
-    const auto& testSuite = testSuitesEntry->second;
-    const auto testsEntry = testSuite.tests.find(testName);
-    if (testsEntry == testSuite.tests.end()) {
+    const auto& benchmarkSuite = benchmarkSuitesEntry->second;
+    const auto benchmarksEntry = benchmarkSuite.tests.find(benchmarkName);
+    if (benchmarksEntry == benchmarkSuite.tests.end()) {
         errorMessageDelegate(
             StringExtensions::sprintf(
-                "ERROR: No test '%s' found in test suite '%s'",
-                testName.c_str(),
-                testSuiteName.c_str()
+                "ERROR: No benchmark '%s' found in benchmark suite '%s'",
+                benchmarkName.c_str(),
+                benchmarkSuiteName.c_str()
             )
         );
         return false;
     }
-    const auto& test = testsEntry->second;
-    impl_->currentTestFailed = false;
-    impl_->WithLua([&]{
+    auto& script = *benchmarksEntry->second.script;
+    if (!Impl::PrepareScript(script, errorMessageDelegate)) {
+        return false;
+    }
+    bool benchmarkFailed = false;
+    impl_->WithLua([&](Impl::Interpreter& interpreter){
+        const auto lua = interpreter.lua;
+        interpreter.script = &script;
         auto errorMessage = impl_->WithScript(
-            test.file,
-            test.filePath,
+            interpreter,
+            script.bytecode.data(),
+            script.bytecode.length(),
+            "b",
+            script.filePath,
             [&]{
-                impl_->errorMessageDelegate = errorMessageDelegate;
-                lua_pushcfunction(impl_->lua, LuaTraceback);
-                lua_rawgeti(impl_->lua, LUA_REGISTRYINDEX, impl_->luaRegistryIndex);
-                lua_pushstring(impl_->lua, testSuiteName.c_str());
-                lua_rawget(impl_->lua, -2);
-                lua_remove(impl_->lua, -2);
-                lua_pushstring(impl_->lua, testName.c_str());
-                lua_rawget(impl_->lua, -2);
-                lua_remove(impl_->lua, -2);
-                const int luaPCallResult = lua_pcall(impl_->lua, 0, 0, 1);
-                std::string errorMessage;
-                if (luaPCallResult != LUA_OK) {
-                    if (!lua_isnil(impl_->lua, -1)) {
-                        errorMessageDelegate(
-                            StringExtensions::sprintf(
-                                "ERROR: %s\n",
-                                lua_tostring(impl_->lua, -1)
-                            )
-                        );
+                interpreter.errorMessageDelegate = errorMessageDelegate;
+                lua_pushcfunction(lua, LuaTraceback);
+                const auto tracebackIndex = lua_gettop(lua);
+                lua_rawgeti(lua, LUA_REGISTRYINDEX, interpreter.luaBenchmarkRegistryIndex);
+                lua_pushstring(lua, benchmarkSuiteName.c_str());
+                lua_rawget(lua, -2);
+                lua_remove(lua, -2);
+                lua_pushstring(lua, benchmarkName.c_str());
+                lua_rawget(lua, -2);
+                lua_remove(lua, -2);
+                const auto benchmarkIndex = lua_gettop(lua);
+
+                // Run one batch of iterations, returning how long it took,
+                // or a negative number if the benchmark failed.
+                const auto runBatch = [&](size_t iterations) -> double {
+                    lua_pushcfunction(lua, Impl::LuaRunBenchmarkBatch);
+                    lua_pushvalue(lua, benchmarkIndex);
+                    lua_pushinteger(lua, (lua_Integer)iterations);
+                    const auto startTime = std::chrono::steady_clock::now();
+                    const int luaPCallResult = lua_pcall(lua, 2, 0, tracebackIndex);
+                    const auto elapsed = std::chrono::duration< double >(
+                        std::chrono::steady_clock::now() - startTime
+                    ).count();
+                    if (luaPCallResult != LUA_OK) {
+                        if (!lua_isnil(lua, -1)) {
+                            errorMessageDelegate(
+                                StringExtensions::sprintf(
+                                    "ERROR: %s\n",
+                                    lua_tostring(lua, -1)
+                                )
+                            );
+                        }
+                        lua_pop(lua, 1);
+                        interpreter.currentTestFailed = true;
+                    }
+                    return (interpreter.currentTestFailed ? -1.0 : elapsed);
+                };
+
+                // Calibrate the number of iterations per batch, so that
+                // each batch takes long enough to measure accurately,
+                // and keep going until the benchmark has warmed up.
+                size_t iterations = 1;
+                double totalTime = 0.0;
+                for (;;) {
+                    const auto elapsed = runBatch(iterations);
+                    if (elapsed < 0.0) {
+                        break;
+                    }
+                    totalTime += elapsed;
+                    if (
+                        (elapsed >= benchmarkBatchTime)
+                        || (iterations >= maxBenchmarkIterations)
+                    ) {
+                        if (totalTime >= benchmarkWarmUpTime) {
+                            break;
+                        }
+                        continue;
+                    }
+                    size_t multiplier = 10;
+                    if (elapsed > 0.0) {
+                        multiplier = (size_t)ceil(benchmarkBatchTime * 1.2 / elapsed);
+                        if (multiplier < 2) {
+                            multiplier = 2;
+                        } else if (multiplier > 10) {
+                            multiplier = 10;
+                        }
+                    }
+                    iterations = std::min(iterations * multiplier, maxBenchmarkIterations);
+                }
+
+                // Measure the benchmark.
+                result.iterations = iterations;
+                for (size_t i = 0; i < benchmarkRepetitions; ++i) {
+                    if (interpreter.currentTestFailed) {
+                        break;
+                    }
+                    const auto elapsed = runBatch(iterations);
+                    if (elapsed >= 0.0) {
+                        result.samples.push_back(elapsed * 1000000000.0 / (double)iterations);
                     }
-                    lua_pop(impl_->lua, 1);
-                    impl_->currentTestFailed = true;
                 }
-                impl_->errorMessageDelegate = nullptr;
+                lua_settop(lua, tracebackIndex - 1);
+                interpreter.errorMessageDelegate = nullptr;
             }
         );
         if (!errorMessage.empty()) {
-            impl_->currentTestFailed = true;
+            interpreter.currentTestFailed = true;
             errorMessageDelegate(
                 StringExtensions::sprintf(
                     "ERROR: Unable to load Lua script file '%s': %s",
-                    test.filePath.c_str(),
+                    script.filePath.c_str(),
                     errorMessage.c_str()
                 )
             );
-            return;
         }
+        benchmarkFailed = interpreter.currentTestFailed;
     });
-    return !impl_->currentTestFailed;
+    if (benchmarkFailed) {
+        result.samples.clear();
+        return false;
+    }
+    ComputeBenchmarkStatistics(result);
+    return true;
+}
+
+std::string Runner::GetProfile() const {
+    std::lock_guard< decltype(impl_->profileMutex) > lock(impl_->profileMutex);
+    std::ostringstream buffer;
+    for (const auto& profileSample: impl_->profile) {
+        buffer << profileSample.first << ' ' << profileSample.second << '\n';
+    }
+    return buffer.str();
+}
+
+size_t Runner::GetNumTests() const {
+    return impl_->testTable.size();
+}
+
+void Runner::VisitTests(TestVisitor visitor) const {
+    const auto& testTable = impl_->testTable;
+    for (size_t i = 0; i < testTable.size(); ++i) {
+        visitor(i, *testTable[i].testSuiteName, *testTable[i].testName);
+    }
+}
+
+bool Runner::FindTest(
+    const std::string& testSuiteName,
+    const std::string& testName,
+    TestId& testId
+) const {
+    TestTableEntry key;
+    key.testSuiteName = &testSuiteName;
+    key.testName = &testName;
+    const auto& testTable = impl_->testTable;
+    const auto entry = std::lower_bound(
+        testTable.begin(),
+        testTable.end(),
+        key,
+        TestTableEntryLess
+    );
+    if (
+        (entry == testTable.end())
+        || (*entry->testSuiteName != testSuiteName)
+        || (*entry->testName != testName)
+    ) {
+        return false;
+    }
+    testId = (TestId)(entry - testTable.begin());
+    return true;
+}
+
+bool Runner::GetTestLocation(
+    TestId testId,
+    std::string& filePath,
+    int& lineNumber
+) const {
+    if (testId >= impl_->testTable.size()) {
+        return false;
+    }
+    const auto& test = *impl_->testTable[testId].test;
+    filePath = test.script->filePath;
+    lineNumber = test.lineNumber;
+    return true;
+}
+
+bool Runner::IsAsyncTest(TestId testId) const {
+    return (
+        (testId < impl_->testTable.size())
+        && impl_->testTable[testId].test->async
+    );
+}
+
+std::vector< std::string > Runner::GetTestNames(const std::string& testSuiteName) const {
+    const std::string noTestName;
+    TestTableEntry key;
+    key.testSuiteName = &testSuiteName;
+    key.testName = &noTestName;
+    const auto& testTable = impl_->testTable;
+    std::vector< std::string > testNames;
+    for (
+        auto entry = std::lower_bound(testTable.begin(), testTable.end(), key, TestTableEntryLess);
+        (
+            (entry != testTable.end())
+            && (*entry->testSuiteName == testSuiteName)
+        );
+        ++entry
+    ) {
+        testNames.push_back(*entry->testName);
+    }
+    return testNames;
+}
+
+std::vector< std::string > Runner::GetTestSuiteNames() const {
+    std::vector< std::string > testSuiteNames;
+    VisitTests(
+        [&](TestId, const std::string& testSuiteName, const std::string&){
+            if (
+                testSuiteNames.empty()
+                || (testSuiteNames.back() != testSuiteName)
+            ) {
+                testSuiteNames.push_back(testSuiteName);
+            }
+        }
+    );
+    return testSuiteNames;
+}
+
+bool Runner::RunTest(
+    const std::string& testSuiteName,
+    const std::string& testName,
+    ErrorMessageDelegate errorMessageDelegate,
+    TestMetrics* metrics
+) {
+    TestId testId;
+    if (!FindTest(testSuiteName, testName, testId)) {
+        if (impl_->testSuites.find(testSuiteName) == impl_->testSuites.end()) {
+            errorMessageDelegate(
+                StringExtensions::sprintf(
+                    "ERROR: No test suite '%s' found",
+                    testSuiteName.c_str()
+                )
+            );
+        } else {
+            errorMessageDelegate(
+                StringExtensions::sprintf(
+                    "ERROR: No test '%s' found in test suite '%s'",
+                    testName.c_str(),
+                    testSuiteName.c_str()
+                )
+            );
+        }
+        return false;
+    }
+    return RunTest(testId, errorMessageDelegate, metrics);
+}
+
+bool Runner::RunTest(
+    TestId testId,
+    ErrorMessageDelegate errorMessageDelegate,
+    TestMetrics* metrics
+) {
+    if (testId >= impl_->testTable.size()) {
+        errorMessageDelegate(
+            StringExtensions::sprintf(
+                "ERROR: No test with identifier %zu found",
+                testId
+            )
+        );
+        return false;
+    }
+    const auto& testTableEntry = impl_->testTable[testId];
+    auto& script = *testTableEntry.test->script;
+    if (!Impl::PrepareScript(script, errorMessageDelegate)) {
+        return false;
+    }
+    bool testFailed = false;
+    TestMetrics testMetrics;
+    const auto startTime = std::chrono::steady_clock::now();
+    std::unordered_map< std::string, size_t > profileSamples;
+    if (impl_->options.reuseStatePerSuite) {
+        testFailed = !impl_->RunTestWithSuiteState(
+            testTableEntry,
+            errorMessageDelegate,
+            startTime,
+            profileSamples,
+            testMetrics
+        );
+    } else if (impl_->preparedInterpreter != nullptr) {
+        const auto interpreter = std::move(impl_->preparedInterpreter);
+        testFailed = !impl_->RunTestInInterpreter(
+            *interpreter,
+            testTableEntry,
+            true,
+            true,
+            errorMessageDelegate,
+            startTime,
+            profileSamples,
+            testMetrics
+        );
+        impl_->CloseInterpreter(*interpreter);
+    } else {
+        impl_->WithLua([&](Impl::Interpreter& interpreter){
+            testFailed = !impl_->RunTestInInterpreter(
+                interpreter,
+                testTableEntry,
+                true,
+                true,
+                errorMessageDelegate,
+                startTime,
+                profileSamples,
+                testMetrics
+            );
+        });
+    }
+    testMetrics.duration = std::chrono::duration< double >(
+        std::chrono::steady_clock::now() - startTime
+    ).count();
+    if (!profileSamples.empty()) {
+        std::lock_guard< decltype(impl_->profileMutex) > lock(impl_->profileMutex);
+        for (const auto& profileSample: profileSamples) {
+            impl_->profile[profileSample.first] += profileSample.second;
+        }
+    }
+    if (metrics != nullptr) {
+        *metrics = testMetrics;
+    }
+    return !testFailed;
+}
+
+void Runner::PrepareInterpreter() {
+    if (impl_->preparedInterpreter != nullptr) {
+        return;
+    }
+    impl_->preparedInterpreter.reset(new Impl::Interpreter());
+    impl_->OpenInterpreter(*impl_->preparedInterpreter, true);
+}
+
+void Runner::PrepareTest(TestId testId) {
+    if (testId >= impl_->testTable.size()) {
+        return;
+    }
+    (void)Impl::PrepareScript(
+        *impl_->testTable[testId].test->script,
+        [](const std::string& message){}
+    );
+}
+
+std::vector< bool > Runner::RunAsyncTests(
+    const std::vector< TestId >& testIds,
+    const std::vector< ErrorMessageDelegate >& errorMessageDelegates,
+    std::vector< TestMetrics >* metrics
+) {
+    std::vector< bool > passed(testIds.size(), false);
+    std::vector< TestMetrics > testMetrics(testIds.size());
+    bool together = !impl_->options.reuseStatePerSuite;
+    for (const auto testId: testIds) {
+        if (
+            !together
+            || !IsAsyncTest(testId)
+        ) {
+            together = false;
+            break;
+        }
+        const auto& testTableEntry = impl_->testTable[testId];
+        const auto& firstTestTableEntry = impl_->testTable[testIds.front()];
+        if (
+            (testTableEntry.test->script != firstTestTableEntry.test->script)
+            || (*testTableEntry.testSuiteName != *firstTestTableEntry.testSuiteName)
+        ) {
+            together = false;
+        }
+    }
+    if (
+        !together
+        || (testIds.size() < 2)
+    ) {
+        for (size_t i = 0; i < testIds.size(); ++i) {
+            passed[i] = RunTest(testIds[i], errorMessageDelegates[i], &testMetrics[i]);
+        }
+    } else {
+        Impl::AsyncBatch batch;
+        batch.tests.resize(testIds.size());
+        for (size_t i = 0; i < testIds.size(); ++i) {
+            batch.tests[i].testTableEntry = &impl_->testTable[testIds[i]];
+            batch.tests[i].errorMessageDelegate = errorMessageDelegates[i];
+        }
+        auto& script = *batch.tests.front().testTableEntry->test->script;
+        const auto scriptPrepared = Impl::PrepareScript(
+            script,
+            [&](const std::string& message){
+                for (const auto& errorMessageDelegate: errorMessageDelegates) {
+                    errorMessageDelegate(message);
+                }
+            }
+        );
+        if (scriptPrepared) {
+            const auto startTime = std::chrono::steady_clock::now();
+            std::unordered_map< std::string, size_t > profileSamples;
+            impl_->WithLua([&](Impl::Interpreter& interpreter){
+                impl_->RunAsyncTestBatch(
+                    interpreter,
+                    batch,
+                    startTime,
+                    profileSamples,
+                    testMetrics
+                );
+            });
+            if (!profileSamples.empty()) {
+                std::lock_guard< decltype(impl_->profileMutex) > lock(impl_->profileMutex);
+                for (const auto& profileSample: profileSamples) {
+                    impl_->profile[profileSample.first] += profileSample.second;
+                }
+            }
+            for (size_t i = 0; i < testIds.size(); ++i) {
+                passed[i] = !batch.tests[i].failed;
+            }
+        }
+    }
+    if (metrics != nullptr) {
+        *metrics = std::move(testMetrics);
+    }
+    return passed;
+}
+
+bool Runner::EndTestSuites(ErrorMessageDelegate errorMessageDelegate) {
+    for (auto& suiteState: impl_->suiteStates) {
+        if (suiteState.second.interpreter != nullptr) {
+            impl_->EndSuite(suiteState.second);
+        }
+    }
+    impl_->suiteStates.clear();
+    std::vector< std::string > errorMessages;
+    errorMessages.swap(impl_->suiteTeardownErrorMessages);
+    for (const auto& errorMessage: errorMessages) {
+        errorMessageDelegate(errorMessage);
+    }
+    return errorMessages.empty();
 }
@@ -1,3 +1,6 @@
+#ifndef MOON_UNIT_RUNNER_HPP
+#define MOON_UNIT_RUNNER_HPP
+
 /**
  * @file Runner.hpp
  *
@@ -8,7 +11,9 @@
 
 #include <functional>
 #include <memory>
+#include <stdint.h>
 #include <string>
+#include <utility>
 #include <SystemAbstractions/File.hpp>
 #include <vector>
 
@@ -21,6 +26,207 @@ class Runner {
 public:
     using ErrorMessageDelegate = std::function< void(const std::string& message) >;
 
+    /**
+     * This identifies one of the tests found by the runner.  It's the
+     * position of the test in the order of all tests, sorted by test
+     * suite name and then test name, and is only valid until the runner
+     * next finds tests (when it's configured or refreshed).
+     */
+    using TestId = size_t;
+
+    /**
+     * This is the type of function called for each test found,
+     * when visiting the tests.
+     *
+     * @param[in] testId
+     *     This identifies the test.
+     *
+     * @param[in] testSuiteName
+     *     This is the name of the test suite containing the test.
+     *
+     * @param[in] testName
+     *     This is the name of the test.
+     */
+    using TestVisitor = std::function<
+        void(
+            TestId testId,
+            const std::string& testSuiteName,
+            const std::string& testName
+        )
+    >;
+
+    /**
+     * These are the ways the memory of Lua interpreters can be allocated.
+     */
+    enum class Allocator {
+        /**
+         * Allocate memory directly from the system.
+         */
+        System,
+
+        /**
+         * Allocate memory from an arena kept by each thread, which is
+         * released all at once and reused after each Lua interpreter
+         * is destroyed.
+         */
+        Arena,
+    };
+
+    /**
+     * This holds settings which affect how the runner finds and runs tests.
+     */
+    struct Options {
+        /**
+         * This is the number of Lua script files to load at the same time,
+         * each in its own Lua interpreter, while finding tests.
+         */
+        size_t jobs = 1;
+
+        /**
+         * This selects how the memory of Lua interpreters is allocated.
+         */
+        Allocator allocator = Allocator::System;
+
+        /**
+         * If not zero, this is the largest number of bytes of memory the
+         * Lua interpreter running a test is allowed to allocate at any
+         * one time.  Any test exceeding it fails.
+         */
+        size_t maxTestMemory = 0;
+
+        /**
+         * If not zero, this is the longest time, in seconds, a test is
+         * allowed to run.  Any test running longer is stopped and fails.
+         */
+        double testTimeout = 0.0;
+
+        /**
+         * If not zero, this is the largest number of Lua virtual machine
+         * instructions a test is allowed to execute, to the nearest
+         * thousand.  Any test executing more is stopped and fails.
+         */
+        uint64_t testInstructionLimit = 0;
+
+        /**
+         * This flag indicates whether or not to measure the processor
+         * time used by each test, and count the garbage collection cycles
+         * and Lua virtual machine instructions executed by each test.
+         * Counting instructions slows tests down slightly.
+         */
+        bool collectMetrics = false;
+
+        /**
+         * This flag indicates whether or not to profile the tests,
+         * by sampling the Lua call stack periodically while they run.
+         */
+        bool profile = false;
+
+        /**
+         * This flag indicates whether or not to describe all differences
+         * found when tests compare tables, rather than only the first one.
+         */
+        bool fullTableDiff = false;
+
+        /**
+         * This flag indicates whether or not to run all the tests of
+         * each test suite which a thread runs in a row in one Lua
+         * interpreter, executing the test script and the suite setup
+         * function once, rather than giving each test its own fresh
+         * interpreter.  The interpreter is kept until the thread runs
+         * a test from another suite or script, or until EndTestSuites
+         * is called, and then the suite teardown function is called.
+         */
+        bool reuseStatePerSuite = false;
+    };
+
+    /**
+     * This holds measurements taken while running a test.
+     */
+    struct TestMetrics {
+        /**
+         * This is the number of bytes of memory still allocated by the Lua
+         * interpreter running the test when the test finished.
+         */
+        size_t memoryInUse = 0;
+
+        /**
+         * This is the largest number of bytes of memory allocated at any one
+         * time by the Lua interpreter running the test, including the memory
+         * used for the standard libraries and for loading the test script.
+         */
+        size_t peakMemory = 0;
+
+        /**
+         * This is the number of memory blocks allocated or reallocated
+         * by the Lua interpreter running the test.
+         */
+        size_t numAllocations = 0;
+
+        /**
+         * This is the amount of time, in seconds, it took
+         * to prepare and run the test.
+         */
+        double duration = 0.0;
+
+        /**
+         * If metrics are collected, this is the amount of processor time,
+         * in seconds, used by the thread running the test while the test
+         * script and the test were run.
+         */
+        double cpuTime = 0.0;
+
+        /**
+         * If metrics are collected, this is the number of garbage collection
+         * cycles completed while the test script and the test were run.
+         */
+        size_t gcCycles = 0;
+
+        /**
+         * If metrics are collected, this is the number of Lua virtual
+         * machine instructions executed while the test script and the test
+         * were run, to the nearest thousand.
+         */
+        uint64_t instructionCount = 0;
+    };
+
+    /**
+     * This holds the measurements taken while running a benchmark.
+     */
+    struct BenchmarkResult {
+        /**
+         * This is the number of times the benchmark function was called
+         * in each batch measured.
+         */
+        size_t iterations = 0;
+
+        /**
+         * These are the average times, in nanoseconds, of one iteration
+         * of the benchmark function, in each batch measured.
+         */
+        std::vector< double > samples;
+
+        /**
+         * This is the mean of the samples, in nanoseconds per iteration.
+         */
+        double mean = 0.0;
+
+        /**
+         * This is the median of the samples, in nanoseconds per iteration.
+         */
+        double median = 0.0;
+
+        /**
+         * This is the standard deviation of the samples,
+         * in nanoseconds per iteration.
+         */
+        double standardDeviation = 0.0;
+
+        /**
+         * This is the smallest of the samples, in nanoseconds per iteration.
+         */
+        double minimum = 0.0;
+    };
+
     // Lifecycle Methods
 public:
     ~Runner() noexcept;
@@ -36,23 +242,298 @@ public:
      */
     Runner();
 
+    /**
+     * Change the settings which affect how the runner finds and runs tests.
+     *
+     * @param[in] options
+     *     These are the settings to use.
+     */
+    void SetOptions(const Options& options);
+
+    /**
+     * Read the given MoonUnit configuration file, and find all the Lua
+     * tests in the Lua script files it specifies, either directly or
+     * through the directories and other configuration files it specifies.
+     *
+     * @param[in,out] configurationFile
+     *     This is the MoonUnit configuration file to read.
+     *
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to report any error messages.
+     */
     void Configure(
         SystemAbstractions::File& configurationFile,
         ErrorMessageDelegate errorMessageDelegate
     );
 
     /**
-     * Return a report, conforming to the report output of Google Test,
-     * that provides details about the tests found and/or run.
+     * Check the configuration files with which the runner was configured,
+     * and the Lua script files they reach, for changes since the tests
+     * were found.  Any Lua script files which are new or have changed are
+     * loaded again, and the tests of any which are no longer reached
+     * are forgotten.
+     *
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to report any error messages.
+     *
+     * @return
+     *     The test suite and test names of all the tests found in the
+     *     Lua script files which were loaded again are returned,
+     *     sorted by test suite name and then test name.
+     */
+    std::vector< std::pair< std::string, std::string > > Refresh(
+        ErrorMessageDelegate errorMessageDelegate
+    );
+
+    /**
+     * Return the names of the tests which could be affected by changes
+     * to the files at the given paths.  These are the tests found in any
+     * of the given files, along with the tests found in Lua script files
+     * which loaded any of the given files, directly or indirectly,
+     * through "require" while their tests were being found.
+     *
+     * @param[in] changedFilePaths
+     *     These are the absolute paths of the files which changed.
      *
      * @return
-     *     A report, conforming to the report output of Google Test,
-     *     that provides details about the tests found and/or run is returned.
+     *     The test suite and test names of all the tests which could be
+     *     affected by the changes are returned, sorted by test suite name
+     *     and then test name.
      */
-    std::string GetReport() const;
+    std::vector< std::pair< std::string, std::string > > GetTestsAffectedBy(
+        const std::vector< std::string >& changedFilePaths
+    ) const;
 
     /**
-     * Return the names of all tests in the given Lua test suite.
+     * Return a JSON object whose keys are the paths of the Lua script files
+     * from which tests were found, each with the value being an array
+     * of the paths of the files loaded through "require" (directly or
+     * indirectly) while finding the tests.
+     *
+     * @return
+     *     The encoding of the dependency graph of the Lua script files
+     *     is returned.
+     */
+    std::string GetDependencyGraph() const;
+
+    /**
+     * Load the discovery index from the file at the given path.  The index
+     * remembers which tests were found in which Lua script files, so that
+     * Lua script files which haven't changed since are not executed again
+     * by Configure in order to find their tests.
+     *
+     * If the file doesn't exist or can't be used, the runner starts
+     * with an empty index.
+     *
+     * @param[in] path
+     *     This is the path of the file from which to load the index.
+     */
+    void LoadDiscoveryIndex(const std::string& path);
+
+    /**
+     * Save the discovery index to the file at the given path.  Only the Lua
+     * script files found since the runner was constructed are saved.
+     *
+     * @param[in] path
+     *     This is the path of the file in which to save the index.
+     *
+     * @return
+     *     An indication of whether or not the index was saved is returned.
+     */
+    bool SaveDiscoveryIndex(const std::string& path) const;
+
+    /**
+     * Save a test pack to the file at the given path, holding the
+     * compiled Lua script files from which tests and benchmarks were
+     * found, the compiled Lua modules they loaded through "require" while
+     * they were being found, and the tests and benchmarks themselves,
+     * so that another runner can run them with LoadPack, without the
+     * Lua script files or configuration files.
+     *
+     * Modules loaded by Lua script files whose tests were found in the
+     * discovery index, rather than by executing the files, aren't known,
+     * so the discovery index shouldn't be used when making a pack.
+     *
+     * @param[in] path
+     *     This is the path of the file in which to save the pack.
+     *
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to report any error messages.
+     *
+     * @return
+     *     An indication of whether or not the pack was saved is returned.
+     */
+    bool SavePack(
+        const std::string& path,
+        ErrorMessageDelegate errorMessageDelegate
+    ) const;
+
+    /**
+     * Load the tests and benchmarks from the test pack saved by SavePack
+     * in the file at the given path, in place of any found before.
+     * Lua modules in the pack are loaded from there, rather than from
+     * the files in which they were found, when tests "require" them.
+     *
+     * @param[in] path
+     *     This is the path of the file from which to load the pack.
+     *
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to report any error messages.
+     *
+     * @return
+     *     An indication of whether or not the pack was loaded is returned.
+     */
+    bool LoadPack(
+        const std::string& path,
+        ErrorMessageDelegate errorMessageDelegate
+    );
+
+    /**
+     * Return the names of all benchmarks in the given Lua benchmark suite,
+     * in sorted order.
+     *
+     * @param[in] benchmarkSuiteName
+     *     This is the name of the benchmark suite for which to return
+     *     the list of benchmarks.
+     *
+     * @return
+     *     The collection of names of benchmarks found in the Lua benchmark
+     *     suite with the given name is returned.
+     */
+    std::vector< std::string > GetBenchmarkNames(const std::string& benchmarkSuiteName) const;
+
+    /**
+     * Return the names of all Lua benchmark suites found, in sorted order.
+     *
+     * @return
+     *     The collection of names of Lua benchmark suites found is returned.
+     */
+    std::vector< std::string > GetBenchmarkSuiteNames() const;
+
+    /**
+     * Measure the Lua benchmark with the given name in the given suite.
+     *
+     * The Lua script defining the benchmark is executed in a fresh Lua
+     * interpreter, and then the benchmark function is called in batches,
+     * with the number of calls per batch calibrated so that each batch
+     * takes long enough to be measured accurately.  After warming up,
+     * a number of batches are timed, giving one sample each.
+     *
+     * Any problems with the benchmark, including failed expectations,
+     * will be reported to the given error message delegate.
+     *
+     * @param[in] benchmarkSuiteName
+     *     This is the name of the benchmark suite containing
+     *     the Lua benchmark to measure.
+     *
+     * @param[in] benchmarkName
+     *     This is the name of the Lua benchmark to measure.
+     *
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to report any error messages.
+     *
+     * @param[out] result
+     *     This is where to store the measurements of the benchmark.
+     *
+     * @return
+     *     An indication of whether or not the benchmark ran without
+     *     any problems is returned.
+     */
+    bool RunBenchmark(
+        const std::string& benchmarkSuiteName,
+        const std::string& benchmarkName,
+        ErrorMessageDelegate errorMessageDelegate,
+        BenchmarkResult& result
+    );
+
+    /**
+     * Return the profile of the tests run so far, if profiling.  This is
+     * in the "folded stack" format understood by flame graph tools: one
+     * line for each distinct Lua call stack sampled, listing the functions
+     * of the stack (outermost first, separated by semicolons), followed
+     * by a space and the number of times the stack was sampled.
+     *
+     * @return
+     *     The profile of the tests run so far is returned.
+     */
+    std::string GetProfile() const;
+
+    /**
+     * Return the number of tests found.
+     *
+     * @return
+     *     The number of tests found is returned.
+     */
+    size_t GetNumTests() const;
+
+    /**
+     * Call the given function for each test found, in order of test
+     * suite name and then test name, without copying any names.
+     *
+     * @param[in] visitor
+     *     This is the function to call for each test.
+     */
+    void VisitTests(TestVisitor visitor) const;
+
+    /**
+     * Look up the test with the given name in the given suite.
+     *
+     * @param[in] testSuiteName
+     *     This is the name of the test suite containing the test.
+     *
+     * @param[in] testName
+     *     This is the name of the test.
+     *
+     * @param[out] testId
+     *     This is where to store the identifier of the test, if found.
+     *
+     * @return
+     *     An indication of whether or not the test was found is returned.
+     */
+    bool FindTest(
+        const std::string& testSuiteName,
+        const std::string& testName,
+        TestId& testId
+    ) const;
+
+    /**
+     * Look up where the given Lua test was defined.
+     *
+     * @param[in] testId
+     *     This identifies the test.
+     *
+     * @param[out] filePath
+     *     This is where to store the path of the Lua script file
+     *     which defined the test.
+     *
+     * @param[out] lineNumber
+     *     This is where to store the line number where the test
+     *     was defined in the Lua script file.
+     *
+     * @return
+     *     An indication of whether or not the test was found is returned.
+     */
+    bool GetTestLocation(
+        TestId testId,
+        std::string& filePath,
+        int& lineNumber
+    ) const;
+
+    /**
+     * Return whether or not the given test is an asynchronous test,
+     * registered with "async_test".
+     *
+     * @param[in] testId
+     *     This identifies the test.
+     *
+     * @return
+     *     An indication of whether or not the test was found
+     *     and is an asynchronous test is returned.
+     */
+    bool IsAsyncTest(TestId testId) const;
+
+    /**
+     * Return the names of all tests in the given Lua test suite, sorted.
      *
      * @param[in] testSuiteName
      *     This is the name of the test suite for which to return the list
@@ -65,7 +546,7 @@ public:
     std::vector< std::string > GetTestNames(const std::string& testSuiteName) const;
 
     /**
-     * Return the names of all Lua test suites found.
+     * Return the names of all Lua test suites found, sorted.
      *
      * @return
      *     The collection of names of Lua test suites found is returned.
@@ -78,6 +559,11 @@ public:
      * Any problems with the test will be reported to the given
      * error message delegate.
      *
+     * Each test is run in its own fresh Lua interpreter (or one kept by
+     * the calling thread for the test suite, if the reuseStatePerSuite
+     * option is set), so this method may be called from multiple threads
+     * at the same time, once the runner has been configured.
+     *
      * @param[in] testSuiteName
      *     This is the name of the test suite containing
      *     the Lua test to execute.
@@ -88,15 +574,122 @@ public:
      * @param[in] errorMessageDelegate
      *     This is the function to call to report any error messages.
      *
+     * @param[out] metrics
+     *     If not null, this is where to store the measurements
+     *     taken while running the test.
+     *
      * @return
      *     An indication of whether or not the test passed is returned.
      */
     bool RunTest(
         const std::string& testSuiteName,
         const std::string& testName,
-        ErrorMessageDelegate errorMessageDelegate
+        ErrorMessageDelegate errorMessageDelegate,
+        TestMetrics* metrics = nullptr
+    );
+
+    /**
+     * Execute the given Lua test, just like the other overload of this
+     * method, but without having to look up the test by its names.
+     *
+     * @param[in] testId
+     *     This identifies the Lua test to execute.
+     *
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to report any error messages.
+     *
+     * @param[out] metrics
+     *     If not null, this is where to store the measurements
+     *     taken while running the test.
+     *
+     * @return
+     *     An indication of whether or not the test passed is returned.
+     */
+    bool RunTest(
+        TestId testId,
+        ErrorMessageDelegate errorMessageDelegate,
+        TestMetrics* metrics = nullptr
+    );
+
+    /**
+     * Prepare a fresh Lua interpreter, equipped just like the ones tests
+     * are run in, for the next test run by RunTest to use instead of
+     * making one, unless the reuseStatePerSuite option is set.
+     *
+     * This is meant for a process which forks a copy of itself to run
+     * each test: the interpreter is prepared once, before forking, and
+     * each copy runs its test in its own copy of the interpreter, which
+     * is just as fresh as one made for the test, without the cost of
+     * making it.  Tests must not be running at the same time.
+     */
+    void PrepareInterpreter();
+
+    /**
+     * Make sure the Lua script of the given test is compiled, so that
+     * running the test doesn't have to compile it.
+     *
+     * This is meant for a process which forks a copy of itself to run
+     * each test: the script is compiled before forking, so that it's
+     * kept for later tests, rather than thrown away along with the copy.
+     * Any errors compiling the script are reported when the test is run.
+     *
+     * @param[in] testId
+     *     This identifies the test whose script to compile.
+     */
+    void PrepareTest(TestId testId);
+
+    /**
+     * Execute the given asynchronous Lua tests together, in one fresh
+     * Lua interpreter, so that while the tasks of one test sleep or wait,
+     * the tasks of the others run.  The test script is executed, and the
+     * suite setup and teardown functions are called, once for all of the
+     * tests.  Each test is still reported on its own, and has the time,
+     * instruction, and memory limits applied to it as if it were run
+     * alone, except that the memory limit applies to the interpreter the
+     * tests share.  The duration of each test is measured from when the
+     * tests were started until the test finished.
+     *
+     * The tests must all be asynchronous tests of the same test suite
+     * and Lua script.  Otherwise, or if the reuseStatePerSuite option
+     * is set, each test is run on its own, as if by RunTest.
+     *
+     * @param[in] testIds
+     *     These identify the Lua tests to execute.
+     *
+     * @param[in] errorMessageDelegates
+     *     These are the functions to call to report any error messages
+     *     about each test.
+     *
+     * @param[out] metrics
+     *     If not null, this is where to store the measurements
+     *     taken while running each test.
+     *
+     * @return
+     *     An indication of whether or not each test passed is returned.
+     */
+    std::vector< bool > RunAsyncTests(
+        const std::vector< TestId >& testIds,
+        const std::vector< ErrorMessageDelegate >& errorMessageDelegates,
+        std::vector< TestMetrics >* metrics = nullptr
     );
 
+    /**
+     * Finish every test suite whose Lua interpreter is still kept
+     * for its tests, when the reuseStatePerSuite option is set,
+     * calling its suite teardown function and destroying the interpreter.
+     * Tests must not be running at the same time.
+     *
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to report any errors raised by
+     *     suite teardown functions, including those of any test suites
+     *     finished earlier, when a thread moved on to another suite.
+     *
+     * @return
+     *     An indication of whether or not every suite teardown function
+     *     called since this was last called succeeded is returned.
+     */
+    bool EndTestSuites(ErrorMessageDelegate errorMessageDelegate);
+
     // Private properties
 private:
     /**
@@ -111,3 +704,5 @@ private:
      */
     std::unique_ptr< Impl > impl_;
 };
+
+#endif /* MOON_UNIT_RUNNER_HPP */
@@ -0,0 +1,452 @@
+/**
+ * @file StatusFile.cpp
+ *
+ * This module contains the implementation of the StatusFile class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "StatusFile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <StringExtensions/StringExtensions.hpp>
+#include <thread>
+#include <tuple>
+
+namespace {
+
+    /**
+     * This is how often the status file is rewritten while tests are run.
+     */
+    constexpr auto statusFileInterval = std::chrono::seconds(1);
+
+    /**
+     * This is the most tests still running which are listed in the
+     * status file, starting with those which have been running longest.
+     */
+    constexpr size_t maxRunningTestsListed = 10;
+
+    /**
+     * This is stored as the test a worker is running
+     * when it isn't running any test.
+     */
+    constexpr size_t noTest = (size_t)-1;
+
+    /**
+     * This holds the counters kept for one worker.  They are written by
+     * the thread using the worker and read by the thread writing the
+     * status file.
+     */
+    struct WorkerStatus {
+        /**
+         * This is the position of the test the worker is running,
+         * or noTest if it isn't running a test.
+         */
+        std::atomic< size_t > test{noTest};
+
+        /**
+         * This is the time, in nanoseconds since the run started,
+         * when the worker started running its current test.
+         */
+        std::atomic< int64_t > testStartTime{0};
+
+        /**
+         * This is the total time, in nanoseconds, the worker has spent
+         * running tests which have finished.
+         */
+        std::atomic< int64_t > busyTime{0};
+
+        /**
+         * This is the number of tests the worker has finished running.
+         */
+        std::atomic< size_t > testsRun{0};
+    };
+
+    /**
+     * This holds information about a test still running,
+     * as listed in the status file.
+     */
+    struct RunningTest {
+        /**
+         * This is how long, in nanoseconds, the test has been running.
+         */
+        int64_t elapsed = 0;
+
+        /**
+         * This is the index of the worker running the test.
+         */
+        size_t worker = 0;
+
+        /**
+         * This is the position of the test among the tests of the run.
+         */
+        size_t test = 0;
+    };
+
+    /**
+     * Return the given string, with the characters which have special
+     * meaning in a label value of the Prometheus text exposition format
+     * escaped.
+     *
+     * @param[in] value
+     *     This is the string to escape.
+     *
+     * @return
+     *     The escaped string is returned.
+     */
+    std::string EscapeLabelValue(const std::string& value) {
+        std::string escaped;
+        escaped.reserve(value.length());
+        for (const auto c: value) {
+            switch (c) {
+                case '\\': escaped += "\\\\"; break;
+                case '"': escaped += "\\\""; break;
+                case '\n': escaped += "\\n"; break;
+                default: escaped += c; break;
+            }
+        }
+        return escaped;
+    }
+
+    /**
+     * Append the help and type lines which precede
+     * the samples of a metric.
+     *
+     * @param[in,out] output
+     *     This is the status file contents to which to append the lines.
+     *
+     * @param[in] name
+     *     This is the name of the metric.
+     *
+     * @param[in] type
+     *     This is the type of the metric.
+     *
+     * @param[in] help
+     *     This describes the metric.
+     */
+    void AppendMetricHeader(
+        std::string& output,
+        const char* name,
+        const char* type,
+        const char* help
+    ) {
+        output += StringExtensions::sprintf(
+            "# HELP %s %s\n# TYPE %s %s\n",
+            name, help,
+            name, type
+        );
+    }
+
+}
+
+/**
+ * This is the internal interface/implementation of the StatusFile class.
+ */
+struct StatusFile::Impl {
+    /**
+     * This is the path of the file to keep up to date.
+     */
+    std::string path;
+
+    /**
+     * These are the names of the tests of the run.
+     */
+    std::vector< std::string > testNames;
+
+    /**
+     * This is the number of workers running the tests.
+     */
+    size_t numWorkers = 0;
+
+    /**
+     * These are the counters kept for each worker.
+     */
+    std::unique_ptr< WorkerStatus[] > workers;
+
+    /**
+     * This is the number of tests which have passed.
+     */
+    std::atomic< size_t > numPassed{0};
+
+    /**
+     * This is the number of tests which have failed.
+     */
+    std::atomic< size_t > numFailed{0};
+
+    /**
+     * This is when the run started.
+     */
+    std::chrono::steady_clock::time_point startTime;
+
+    /**
+     * This is the thread which rewrites the status file periodically.
+     */
+    std::thread writer;
+
+    /**
+     * This is used to wake the writer thread when it's time to stop.
+     */
+    std::condition_variable writerWakeCondition;
+
+    /**
+     * This is used to synchronize access to the stopWriter flag.
+     */
+    std::mutex writerMutex;
+
+    /**
+     * This flag indicates whether or not the writer thread should stop.
+     */
+    bool stopWriter = false;
+
+    /**
+     * Return the time, in nanoseconds, since the run started.
+     *
+     * @return
+     *     The time, in nanoseconds, since the run started is returned.
+     */
+    int64_t Now() const {
+        return std::chrono::duration_cast< std::chrono::nanoseconds >(
+            std::chrono::steady_clock::now() - startTime
+        ).count();
+    }
+
+    /**
+     * Rewrite the status file with the current progress of the run.
+     *
+     * @param[in] finished
+     *     This indicates whether or not the run has finished.
+     *
+     * @return
+     *     An indication of whether or not the file was written
+     *     is returned.
+     */
+    bool Write(bool finished) {
+        const auto now = Now();
+        const double elapsed = (double)now / 1e9;
+        const auto passed = numPassed.load(std::memory_order_relaxed);
+        const auto failed = numFailed.load(std::memory_order_relaxed);
+        const auto completed = passed + failed;
+        std::string output;
+        AppendMetricHeader(output, "moonunit_tests", "gauge", "Number of tests selected to run.");
+        output += StringExtensions::sprintf("moonunit_tests %zu\n", testNames.size());
+        AppendMetricHeader(output, "moonunit_tests_completed", "counter", "Number of tests which have finished, by result.");
+        output += StringExtensions::sprintf("moonunit_tests_completed{result=\"passed\"} %zu\n", passed);
+        output += StringExtensions::sprintf("moonunit_tests_completed{result=\"failed\"} %zu\n", failed);
+        AppendMetricHeader(output, "moonunit_tests_remaining", "gauge", "Number of tests which haven't finished.");
+        output += StringExtensions::sprintf(
+            "moonunit_tests_remaining %zu\n",
+            ((completed < testNames.size()) ? (testNames.size() - completed) : 0)
+        );
+        AppendMetricHeader(output, "moonunit_elapsed_seconds", "gauge", "Time since the run started.");
+        output += StringExtensions::sprintf("moonunit_elapsed_seconds %.3f\n", elapsed);
+        AppendMetricHeader(output, "moonunit_throughput_tests_per_second", "gauge", "Average rate at which tests have finished.");
+        output += StringExtensions::sprintf(
+            "moonunit_throughput_tests_per_second %.3f\n",
+            ((elapsed > 0.0) ? ((double)completed / elapsed) : 0.0)
+        );
+        AppendMetricHeader(output, "moonunit_finished", "gauge", "Whether or not the run has finished.");
+        output += StringExtensions::sprintf("moonunit_finished %d\n", (finished ? 1 : 0));
+
+        // Worker utilization includes the time spent so far on the tests
+        // still running, so that a worker stuck on a long test doesn't
+        // look idle.
+        std::vector< RunningTest > runningTests;
+        std::string utilization, testsRun;
+        for (size_t i = 0; i < numWorkers; ++i) {
+            const auto& worker = workers[i];
+            auto busyTime = worker.busyTime.load(std::memory_order_relaxed);
+
+            // The test is cleared when it finishes, before the start time
+            // of the next test is stored, so reading the same test again
+            // after the start time means the start time belongs to it.
+            const auto test = worker.test.load(std::memory_order_acquire);
+            if (test != noTest) {
+                const auto testStartTime = worker.testStartTime.load(std::memory_order_acquire);
+                if (worker.test.load(std::memory_order_relaxed) == test) {
+                    RunningTest runningTest;
+                    runningTest.elapsed = std::max(now - testStartTime, (int64_t)0);
+                    runningTest.worker = i;
+                    runningTest.test = test;
+                    runningTests.push_back(runningTest);
+                    busyTime += runningTest.elapsed;
+                }
+            }
+            const auto label = StringExtensions::sprintf("{worker=\"%zu\"}", i);
+            utilization += StringExtensions::sprintf(
+                "moonunit_worker_utilization%s %.3f\n",
+                label.c_str(),
+                ((now > 0) ? std::min((double)busyTime / (double)now, 1.0) : 0.0)
+            );
+            testsRun += StringExtensions::sprintf(
+                "moonunit_worker_tests_completed%s %zu\n",
+                label.c_str(),
+                worker.testsRun.load(std::memory_order_relaxed)
+            );
+        }
+        AppendMetricHeader(output, "moonunit_worker_utilization", "gauge", "Fraction of the run each worker has spent running tests.");
+        output += utilization;
+        AppendMetricHeader(output, "moonunit_worker_tests_completed", "counter", "Number of tests each worker has finished.");
+        output += testsRun;
+        std::sort(
+            runningTests.begin(),
+            runningTests.end(),
+            [](const RunningTest& lhs, const RunningTest& rhs){
+                return (
+                    std::tie(rhs.elapsed, lhs.worker)
+                    < std::tie(lhs.elapsed, rhs.worker)
+                );
+            }
+        );
+        if (runningTests.size() > maxRunningTestsListed) {
+            runningTests.resize(maxRunningTestsListed);
+        }
+        AppendMetricHeader(output, "moonunit_test_running_seconds", "gauge", "Time spent so far on the longest-running tests which haven't finished.");
+        for (const auto& runningTest: runningTests) {
+            output += StringExtensions::sprintf(
+                "moonunit_test_running_seconds{worker=\"%zu\",test=\"%s\"} %.3f\n",
+                runningTest.worker,
+                EscapeLabelValue(testNames[runningTest.test]).c_str(),
+                (double)runningTest.elapsed / 1e9
+            );
+        }
+
+        // Write the status to a temporary file first and then move it into
+        // place, so that a partially-written status is never seen.
+        const auto temporaryPath = path + ".tmp";
+        FILE* statusFile = fopen(temporaryPath.c_str(), "wb");
+        if (statusFile == NULL) {
+            return false;
+        }
+        const auto written = (fwrite(output.data(), output.length(), 1, statusFile) == 1);
+        if (
+            (fclose(statusFile) != 0)
+            || !written
+        ) {
+            (void)remove(temporaryPath.c_str());
+            return false;
+        }
+#ifdef _WIN32
+        (void)remove(path.c_str());
+#endif /* _WIN32 */
+        if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            (void)remove(temporaryPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * This is the body of the writer thread, which rewrites the status
+     * file periodically until told to stop.
+     */
+    void Writer() {
+        std::unique_lock< decltype(writerMutex) > lock(writerMutex);
+        while (
+            !writerWakeCondition.wait_for(
+                lock,
+                statusFileInterval,
+                [this]{ return stopWriter; }
+            )
+        ) {
+            lock.unlock();
+            (void)Write(false);
+            lock.lock();
+        }
+    }
+};
+
+StatusFile::~StatusFile() noexcept {
+    if (impl_ != nullptr) {
+        Stop();
+    }
+}
+StatusFile::StatusFile(StatusFile&&) noexcept = default;
+StatusFile& StatusFile::operator=(StatusFile&&) noexcept = default;
+
+StatusFile::StatusFile()
+    : impl_(new Impl())
+{
+}
+
+bool StatusFile::Start(
+    const std::string& path,
+    const std::vector< std::string >& testNames,
+    size_t numWorkers
+) {
+    Stop();
+    impl_->path = path;
+    impl_->testNames = testNames;
+    impl_->numWorkers = numWorkers;
+    impl_->workers.reset(new WorkerStatus[numWorkers]);
+    impl_->numPassed = 0;
+    impl_->numFailed = 0;
+    impl_->startTime = std::chrono::steady_clock::now();
+    if (!impl_->Write(false)) {
+        impl_->workers.reset();
+        return false;
+    }
+    impl_->stopWriter = false;
+    impl_->writer = std::thread(&Impl::Writer, impl_.get());
+    return true;
+}
+
+void StatusFile::Stop() {
+    if (!impl_->writer.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard< decltype(impl_->writerMutex) > lock(impl_->writerMutex);
+        impl_->stopWriter = true;
+        impl_->writerWakeCondition.notify_all();
+    }
+    impl_->writer.join();
+    (void)impl_->Write(true);
+    impl_->workers.reset();
+}
+
+void StatusFile::BeginTest(
+    size_t worker,
+    size_t test
+) {
+    if (
+        (impl_->workers == nullptr)
+        || (worker >= impl_->numWorkers)
+    ) {
+        return;
+    }
+    auto& workerStatus = impl_->workers[worker];
+    workerStatus.testStartTime.store(impl_->Now(), std::memory_order_release);
+    workerStatus.test.store(test, std::memory_order_release);
+}
+
+void StatusFile::EndTest(
+    size_t worker,
+    bool passed
+) {
+    if (
+        (impl_->workers == nullptr)
+        || (worker >= impl_->numWorkers)
+    ) {
+        return;
+    }
+    auto& workerStatus = impl_->workers[worker];
+    const auto testStartTime = workerStatus.testStartTime.load(std::memory_order_relaxed);
+
+    // Tests run together are all ended after being begun as one,
+    // so the time spent on them is only counted once.
+    if (workerStatus.test.exchange(noTest, std::memory_order_acq_rel) != noTest) {
+        workerStatus.busyTime.fetch_add(impl_->Now() - testStartTime, std::memory_order_relaxed);
+    }
+    workerStatus.testsRun.fetch_add(1, std::memory_order_relaxed);
+    if (passed) {
+        impl_->numPassed.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        impl_->numFailed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef MOON_UNIT_STATUS_FILE_HPP
+#define MOON_UNIT_STATUS_FILE_HPP
+
+/**
+ * @file StatusFile.hpp
+ *
+ * This module declares the StatusFile class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/**
+ * This class keeps a file up to date with the progress of a run of tests,
+ * so that long runs can be watched, or scraped by a monitoring system,
+ * while they're still going.  The file is rewritten periodically by a
+ * thread of its own, in the Prometheus text exposition format, and is
+ * replaced all at once each time, so that it's never seen half-written.
+ *
+ * Workers report the tests they start and finish by updating counters
+ * which the writing thread reads, without taking any locks, so that
+ * reporting adds no contention between workers.  Each worker may be
+ * used by only one thread at a time.
+ */
+class StatusFile {
+    // Lifecycle Methods
+public:
+    ~StatusFile() noexcept;
+    StatusFile(const StatusFile&) = delete;
+    StatusFile(StatusFile&&) noexcept;
+    StatusFile& operator=(const StatusFile&) = delete;
+    StatusFile& operator=(StatusFile&&) noexcept;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     */
+    StatusFile();
+
+    /**
+     * Start keeping the file at the given path up to date with the
+     * progress of running the given tests.  If the file was already
+     * being kept up to date for a previous run, that is stopped first.
+     *
+     * @param[in] path
+     *     This is the path of the file to keep up to date.
+     *
+     * @param[in] testNames
+     *     These are the names of the tests to be run, in the order
+     *     in which they're identified when started.
+     *
+     * @param[in] numWorkers
+     *     This is the number of workers which run the tests.
+     *
+     * @return
+     *     An indication of whether or not the file was written
+     *     is returned.
+     */
+    bool Start(
+        const std::string& path,
+        const std::vector< std::string >& testNames,
+        size_t numWorkers
+    );
+
+    /**
+     * Stop keeping the file up to date, after writing it one last time
+     * with the final results of the run.
+     */
+    void Stop();
+
+    /**
+     * Record that the given worker started running the given test.
+     *
+     * @param[in] worker
+     *     This is the index of the worker which started running the test.
+     *
+     * @param[in] test
+     *     This is the position of the test among the names given
+     *     when the file was started.
+     */
+    void BeginTest(
+        size_t worker,
+        size_t test
+    );
+
+    /**
+     * Record that the test the given worker was running has finished.
+     * When a worker runs several tests together, it begins once,
+     * with the first of them, and ends once for each of them.
+     *
+     * @param[in] worker
+     *     This is the index of the worker which finished running a test.
+     *
+     * @param[in] passed
+     *     This indicates whether or not the test passed.
+     */
+    void EndTest(
+        size_t worker,
+        bool passed
+    );
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
+
+#endif /* MOON_UNIT_STATUS_FILE_HPP */
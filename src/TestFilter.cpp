@@ -0,0 +1,202 @@
+/**
+ * @file TestFilter.cpp
+ *
+ * This module contains the implementation of the TestFilter class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "TestFilter.hpp"
+
+#include <stddef.h>
+#include <StringExtensions/StringExtensions.hpp>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+    /**
+     * Determine whether or not the given name matches the given pattern,
+     * where '*' in the pattern matches any string, and '?' matches
+     * any single character.
+     *
+     * @param[in] name
+     *     This is the name to check.
+     *
+     * @param[in] pattern
+     *     This is the pattern to match.
+     *
+     * @return
+     *     An indication of whether or not the name matches
+     *     the pattern is returned.
+     */
+    bool MatchesWildcards(
+        const std::string& name,
+        const std::string& pattern
+    ) {
+        // Only the most recent '*' ever needs to be revisited: when
+        // a later part of the pattern fails to match, let that '*'
+        // take one more character and try again from there.
+        size_t n = 0;
+        size_t p = 0;
+        size_t starPattern = std::string::npos;
+        size_t starName = 0;
+        while (n < name.length()) {
+            if (
+                (p < pattern.length())
+                && (
+                    (pattern[p] == '?')
+                    || (pattern[p] == name[n])
+                )
+            ) {
+                ++n;
+                ++p;
+            } else if (
+                (p < pattern.length())
+                && (pattern[p] == '*')
+            ) {
+                starPattern = p++;
+                starName = n;
+            } else if (starPattern != std::string::npos) {
+                p = starPattern + 1;
+                n = ++starName;
+            } else {
+                return false;
+            }
+        }
+        while (
+            (p < pattern.length())
+            && (pattern[p] == '*')
+        ) {
+            ++p;
+        }
+        return (p == pattern.length());
+    }
+
+    /**
+     * This holds one side (positive or negative) of a filter.
+     */
+    struct Patterns {
+        /**
+         * These are the full names of tests matched
+         * by patterns without wildcards.
+         */
+        std::unordered_set< std::string > names;
+
+        /**
+         * These are the patterns which have wildcards.
+         */
+        std::vector< std::string > wildcardPatterns;
+
+        /**
+         * Add the patterns in the given colon-delimited list.
+         *
+         * @param[in] patterns
+         *     This is the list of patterns to add.
+         */
+        void Add(const std::string& patterns) {
+            for (const auto& pattern: StringExtensions::Split(patterns, ':')) {
+                if (pattern.empty()) {
+                    continue;
+                }
+                if (pattern.find_first_of("*?") == std::string::npos) {
+                    (void)names.insert(pattern);
+                } else {
+                    wildcardPatterns.push_back(pattern);
+                }
+            }
+        }
+
+        /**
+         * Determine whether or not there are any patterns.
+         *
+         * @return
+         *     An indication of whether or not there are any patterns
+         *     is returned.
+         */
+        bool IsEmpty() const {
+            return (
+                names.empty()
+                && wildcardPatterns.empty()
+            );
+        }
+
+        /**
+         * Determine whether or not any of the patterns
+         * matches the given full name of a test.
+         *
+         * @param[in] fullName
+         *     This is the full name of the test to check.
+         *
+         * @return
+         *     An indication of whether or not any of the patterns
+         *     matches the given full name is returned.
+         */
+        bool Matches(const std::string& fullName) const {
+            if (names.find(fullName) != names.end()) {
+                return true;
+            }
+            for (const auto& pattern: wildcardPatterns) {
+                if (MatchesWildcards(fullName, pattern)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+}
+
+/**
+ * This is the internal interface/implementation of the TestFilter class.
+ */
+struct TestFilter::Impl {
+    /**
+     * These are the patterns selecting the tests to include.
+     * If there are none, all tests are included.
+     */
+    Patterns positive;
+
+    /**
+     * These are the patterns selecting the tests to leave out.
+     */
+    Patterns negative;
+};
+
+TestFilter::~TestFilter() noexcept = default;
+TestFilter::TestFilter(TestFilter&&) noexcept = default;
+TestFilter& TestFilter::operator=(TestFilter&&) noexcept = default;
+
+TestFilter::TestFilter(const std::string& filter)
+    : impl_(new Impl())
+{
+    const auto negativeDelimiter = filter.find('-');
+    impl_->positive.Add(filter.substr(0, negativeDelimiter));
+    if (negativeDelimiter != std::string::npos) {
+        impl_->negative.Add(filter.substr(negativeDelimiter + 1));
+    }
+}
+
+bool TestFilter::Matches(
+    const std::string& testSuiteName,
+    const std::string& testName
+) const {
+    if (
+        impl_->positive.IsEmpty()
+        && impl_->negative.IsEmpty()
+    ) {
+        return true;
+    }
+    std::string fullName;
+    fullName.reserve(testSuiteName.length() + 1 + testName.length());
+    fullName += testSuiteName;
+    fullName += '.';
+    fullName += testName;
+    return (
+        (
+            impl_->positive.IsEmpty()
+            || impl_->positive.Matches(fullName)
+        )
+        && !impl_->negative.Matches(fullName)
+    );
+}
@@ -0,0 +1,80 @@
+#ifndef MOON_UNIT_TEST_FILTER_HPP
+#define MOON_UNIT_TEST_FILTER_HPP
+
+/**
+ * @file TestFilter.hpp
+ *
+ * This module declares the TestFilter class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <string>
+
+/**
+ * This class selects tests by their full names ("SUITE.NAME"), using
+ * the same filter syntax as the "--gtest_filter" option of Google Test:
+ * one or more patterns separated by colons, optionally followed by
+ * a dash and more patterns for tests to leave out.  In patterns, '*'
+ * matches any string and '?' matches any single character.
+ *
+ * The filter is parsed once, when constructed.  Patterns without
+ * wildcards are kept in a hash set, so that filters which list
+ * many tests by name (such as those generated by IDEs) are matched
+ * without comparing each test against each pattern.
+ */
+class TestFilter {
+    // Lifecycle Methods
+public:
+    ~TestFilter() noexcept;
+    TestFilter(const TestFilter&) = delete;
+    TestFilter(TestFilter&&) noexcept;
+    TestFilter& operator=(const TestFilter&) = delete;
+    TestFilter& operator=(TestFilter&&) noexcept;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     *
+     * @param[in] filter
+     *     This is the filter to use.  If empty, all tests are selected.
+     */
+    explicit TestFilter(const std::string& filter);
+
+    /**
+     * Determine whether or not the filter selects the test
+     * with the given name in the given suite.
+     *
+     * @param[in] testSuiteName
+     *     This is the name of the test suite containing the test.
+     *
+     * @param[in] testName
+     *     This is the name of the test.
+     *
+     * @return
+     *     An indication of whether or not the filter selects
+     *     the test is returned.
+     */
+    bool Matches(
+        const std::string& testSuiteName,
+        const std::string& testName
+    ) const;
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
+
+#endif /* MOON_UNIT_TEST_FILTER_HPP */
@@ -0,0 +1,407 @@
+/**
+ * @file TestPack.cpp
+ *
+ * This module contains the implementation of the TestPack class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "TestPack.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <SystemAbstractions/File.hpp>
+
+namespace {
+
+    /**
+     * This is written at the start of every pack file, to identify it.
+     */
+    constexpr char packSignature[] = "MoonUnitPack";
+
+    /**
+     * This is the length of the pack signature, in bytes.
+     */
+    constexpr size_t packSignatureLength = sizeof(packSignature) - 1;
+
+    /**
+     * This identifies the format of the saved pack.  It should be changed
+     * whenever the format changes, so that packs saved by other versions
+     * are not used.
+     */
+    constexpr uint64_t testPackVersion = 1;
+
+    /**
+     * This flag is set in the flags of a test in a pack
+     * if the test is a benchmark.
+     */
+    constexpr uint64_t testFlagBenchmark = 1;
+
+    /**
+     * This flag is set in the flags of a test in a pack
+     * if the test is an asynchronous test.
+     */
+    constexpr uint64_t testFlagAsync = 2;
+
+    /**
+     * Append the given unsigned integer to the given pack encoding,
+     * as the given number of bytes, least significant byte first,
+     * so that packs can be read on machines of either byte order.
+     *
+     * @param[in,out] encoding
+     *     This is the pack encoding to which to append the value.
+     *
+     * @param[in] value
+     *     This is the value to append.
+     *
+     * @param[in] numBytes
+     *     This is the number of bytes in which to encode the value.
+     */
+    void AppendUnsigned(
+        std::string& encoding,
+        uint64_t value,
+        size_t numBytes
+    ) {
+        for (size_t i = 0; i < numBytes; ++i) {
+            encoding += (char)(uint8_t)(value >> (i * 8));
+        }
+    }
+
+    /**
+     * Append the given string to the given pack encoding,
+     * preceded by its length.
+     *
+     * @param[in,out] encoding
+     *     This is the pack encoding to which to append the string.
+     *
+     * @param[in] value
+     *     This is the string to append.
+     */
+    void AppendString(
+        std::string& encoding,
+        const std::string& value
+    ) {
+        AppendUnsigned(encoding, value.length(), 4);
+        encoding += value;
+    }
+
+    /**
+     * This is used to read the values of a pack encoding in order.
+     */
+    struct PackReader {
+        /**
+         * This points to the pack encoding.
+         */
+        const uint8_t* data = nullptr;
+
+        /**
+         * This is the size of the pack encoding, in bytes.
+         */
+        size_t size = 0;
+
+        /**
+         * This is the position of the next value to read.
+         */
+        size_t offset = 0;
+
+        /**
+         * Read an unsigned integer encoded by AppendUnsigned.
+         *
+         * @param[out] value
+         *     This is where to store the value read.
+         *
+         * @param[in] numBytes
+         *     This is the number of bytes in which the value is encoded.
+         *
+         * @return
+         *     An indication of whether or not the value was read
+         *     is returned.
+         */
+        bool ReadUnsigned(
+            uint64_t& value,
+            size_t numBytes
+        ) {
+            if (size - offset < numBytes) {
+                return false;
+            }
+            value = 0;
+            for (size_t i = 0; i < numBytes; ++i) {
+                value |= ((uint64_t)data[offset + i] << (i * 8));
+            }
+            offset += numBytes;
+            return true;
+        }
+
+        /**
+         * Read a count of things encoded by AppendUnsigned.  Each thing
+         * takes at least one byte, which catches counts too large for
+         * what's left of the pack before anything is allocated for them.
+         *
+         * @param[out] count
+         *     This is where to store the count read.
+         *
+         * @return
+         *     An indication of whether or not the count was read
+         *     is returned.
+         */
+        bool ReadCount(size_t& count) {
+            uint64_t value;
+            if (
+                !ReadUnsigned(value, 4)
+                || (value > size - offset)
+            ) {
+                return false;
+            }
+            count = (size_t)value;
+            return true;
+        }
+
+        /**
+         * Read a string encoded by AppendString.
+         *
+         * @param[out] value
+         *     This is where to store the string read.
+         *
+         * @return
+         *     An indication of whether or not the string was read
+         *     is returned.
+         */
+        bool ReadString(std::string& value) {
+            size_t length;
+            if (!ReadCount(length)) {
+                return false;
+            }
+            value.assign((const char*)data + offset, length);
+            offset += length;
+            return true;
+        }
+    };
+
+}
+
+/**
+ * This is the internal interface/implementation of the TestPack class.
+ */
+struct TestPack::Impl {
+    /**
+     * These are the scripts in the pack.
+     */
+    std::vector< Script > scripts;
+
+    /**
+     * These are the modules in the pack.
+     */
+    std::vector< Module > modules;
+
+    /**
+     * These are the tests in the pack.
+     */
+    std::vector< Test > tests;
+
+    /**
+     * Replace the contents of the pack with what's in the given encoding.
+     *
+     * @param[in,out] reader
+     *     This is used to read the encoding of the pack.
+     *
+     * @return
+     *     An indication of whether or not the encoding was valid
+     *     is returned.
+     */
+    bool Decode(PackReader& reader) {
+        uint64_t version;
+        if (
+            (reader.size < packSignatureLength)
+            || (memcmp(reader.data, packSignature, packSignatureLength) != 0)
+        ) {
+            return false;
+        }
+        reader.offset = packSignatureLength;
+        if (
+            !reader.ReadUnsigned(version, 4)
+            || (version != testPackVersion)
+        ) {
+            return false;
+        }
+        size_t numScripts;
+        if (!reader.ReadCount(numScripts)) {
+            return false;
+        }
+        scripts.resize(numScripts);
+        for (auto& script: scripts) {
+            size_t numModules;
+            if (
+                !reader.ReadString(script.filePath)
+                || !reader.ReadString(script.bytecode)
+                || !reader.ReadCount(numModules)
+            ) {
+                return false;
+            }
+            script.modules.resize(numModules);
+            for (auto& module: script.modules) {
+                if (
+                    !reader.ReadString(module.first)
+                    || !reader.ReadString(module.second)
+                ) {
+                    return false;
+                }
+            }
+        }
+        size_t numModules;
+        if (!reader.ReadCount(numModules)) {
+            return false;
+        }
+        modules.resize(numModules);
+        for (auto& module: modules) {
+            if (
+                !reader.ReadString(module.filePath)
+                || !reader.ReadString(module.bytecode)
+            ) {
+                return false;
+            }
+        }
+        size_t numTests;
+        if (!reader.ReadCount(numTests)) {
+            return false;
+        }
+        tests.resize(numTests);
+        for (auto& test: tests) {
+            uint64_t scriptIndex, lineNumber, flags;
+            if (
+                !reader.ReadString(test.testSuiteName)
+                || !reader.ReadString(test.testName)
+                || !reader.ReadUnsigned(scriptIndex, 4)
+                || (scriptIndex >= scripts.size())
+                || !reader.ReadUnsigned(lineNumber, 4)
+                || !reader.ReadUnsigned(flags, 1)
+            ) {
+                return false;
+            }
+            test.scriptIndex = (size_t)scriptIndex;
+            test.lineNumber = (int)(int32_t)(uint32_t)lineNumber;
+            test.benchmark = ((flags & testFlagBenchmark) != 0);
+            test.async = ((flags & testFlagAsync) != 0);
+        }
+        return (reader.offset == reader.size);
+    }
+};
+
+TestPack::~TestPack() noexcept = default;
+TestPack::TestPack(TestPack&&) noexcept = default;
+TestPack& TestPack::operator=(TestPack&&) noexcept = default;
+
+TestPack::TestPack()
+    : impl_(new Impl())
+{
+}
+
+bool TestPack::Load(const std::string& path) {
+    impl_->scripts.clear();
+    impl_->modules.clear();
+    impl_->tests.clear();
+    SystemAbstractions::File file(path);
+    if (!file.OpenReadOnly()) {
+        return false;
+    }
+    SystemAbstractions::IFile::Buffer buffer(file.GetSize());
+    const auto amountRead = file.Read(buffer);
+    file.Close();
+    if (amountRead != buffer.size()) {
+        return false;
+    }
+    PackReader reader;
+    reader.data = buffer.data();
+    reader.size = buffer.size();
+    if (!impl_->Decode(reader)) {
+        impl_->scripts.clear();
+        impl_->modules.clear();
+        impl_->tests.clear();
+        return false;
+    }
+    return true;
+}
+
+bool TestPack::Save(const std::string& path) const {
+    std::string encoding(packSignature, packSignatureLength);
+    AppendUnsigned(encoding, testPackVersion, 4);
+    AppendUnsigned(encoding, impl_->scripts.size(), 4);
+    for (const auto& script: impl_->scripts) {
+        AppendString(encoding, script.filePath);
+        AppendString(encoding, script.bytecode);
+        AppendUnsigned(encoding, script.modules.size(), 4);
+        for (const auto& module: script.modules) {
+            AppendString(encoding, module.first);
+            AppendString(encoding, module.second);
+        }
+    }
+    AppendUnsigned(encoding, impl_->modules.size(), 4);
+    for (const auto& module: impl_->modules) {
+        AppendString(encoding, module.filePath);
+        AppendString(encoding, module.bytecode);
+    }
+    AppendUnsigned(encoding, impl_->tests.size(), 4);
+    for (const auto& test: impl_->tests) {
+        AppendString(encoding, test.testSuiteName);
+        AppendString(encoding, test.testName);
+        AppendUnsigned(encoding, test.scriptIndex, 4);
+        AppendUnsigned(encoding, (uint32_t)(int32_t)test.lineNumber, 4);
+        AppendUnsigned(
+            encoding,
+            (
+                (test.benchmark ? testFlagBenchmark : 0)
+                | (test.async ? testFlagAsync : 0)
+            ),
+            1
+        );
+    }
+
+    // Write the pack to a temporary file first and then move it into
+    // place, so that a partially-written pack is never used.
+    const auto temporaryPath = path + ".tmp";
+    FILE* packFile = fopen(temporaryPath.c_str(), "wb");
+    if (packFile == NULL) {
+        return false;
+    }
+    const auto written = (fwrite(encoding.data(), encoding.length(), 1, packFile) == 1);
+    if (
+        (fclose(packFile) != 0)
+        || !written
+    ) {
+        (void)remove(temporaryPath.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    (void)remove(path.c_str());
+#endif /* _WIN32 */
+    if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        (void)remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+size_t TestPack::AddScript(Script&& script) {
+    impl_->scripts.push_back(std::move(script));
+    return impl_->scripts.size() - 1;
+}
+
+void TestPack::AddModule(Module&& module) {
+    impl_->modules.push_back(std::move(module));
+}
+
+void TestPack::AddTest(Test&& test) {
+    impl_->tests.push_back(std::move(test));
+}
+
+const std::vector< TestPack::Script >& TestPack::GetScripts() const {
+    return impl_->scripts;
+}
+
+const std::vector< TestPack::Module >& TestPack::GetModules() const {
+    return impl_->modules;
+}
+
+const std::vector< TestPack::Test >& TestPack::GetTests() const {
+    return impl_->tests;
+}
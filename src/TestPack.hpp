@@ -0,0 +1,216 @@
+#ifndef MOON_UNIT_TEST_PACK_HPP
+#define MOON_UNIT_TEST_PACK_HPP
+
+/**
+ * @file TestPack.hpp
+ *
+ * This module declares the TestPack class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * This class holds everything needed to run a set of Lua tests without
+ * the Lua script files or MoonUnit configuration files from which they
+ * were found: the compiled Lua script files, the compiled Lua modules
+ * they load through "require", and the tests found in them.  A pack can
+ * be saved to and loaded from a single file, so that it can be copied
+ * to other machines.
+ *
+ * Compiled Lua code can only be loaded by the same version of Lua
+ * on machines with the same kind of processor.
+ */
+class TestPack {
+    // Types
+public:
+    /**
+     * This holds a compiled Lua script file from which tests were found.
+     */
+    struct Script {
+        /**
+         * This is the path of the file from which the script was compiled.
+         */
+        std::string filePath;
+
+        /**
+         * This is the compiled script, in the binary chunk format
+         * produced by lua_dump.
+         */
+        std::string bytecode;
+
+        /**
+         * These are the names of the Lua modules loaded through "require"
+         * by the script, each with the path of the file in which
+         * the module was found.
+         */
+        std::vector< std::pair< std::string, std::string > > modules;
+    };
+
+    /**
+     * This holds a compiled Lua module loaded by one or more scripts.
+     */
+    struct Module {
+        /**
+         * This is the path of the file from which the module was compiled.
+         */
+        std::string filePath;
+
+        /**
+         * This is the compiled module, in the binary chunk format
+         * produced by lua_dump.
+         */
+        std::string bytecode;
+    };
+
+    /**
+     * This holds information about a test found in a script.
+     */
+    struct Test {
+        /**
+         * This is the name of the test suite containing the test.
+         */
+        std::string testSuiteName;
+
+        /**
+         * This is the name of the test.
+         */
+        std::string testName;
+
+        /**
+         * This is the position, among the scripts of the pack,
+         * of the script which defines the test.
+         */
+        size_t scriptIndex = 0;
+
+        /**
+         * This is the line number where the test was defined in the script.
+         */
+        int lineNumber = 0;
+
+        /**
+         * This flag indicates whether the test is a benchmark
+         * rather than a regular test.
+         */
+        bool benchmark = false;
+
+        /**
+         * This flag indicates whether the test is an asynchronous test,
+         * registered with "async_test".
+         */
+        bool async = false;
+    };
+
+    // Lifecycle Methods
+public:
+    ~TestPack() noexcept;
+    TestPack(const TestPack&) = delete;
+    TestPack(TestPack&&) noexcept;
+    TestPack& operator=(const TestPack&) = delete;
+    TestPack& operator=(TestPack&&) noexcept;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     */
+    TestPack();
+
+    /**
+     * Replace the contents of the pack with what was saved
+     * in the file at the given path.
+     *
+     * @param[in] path
+     *     This is the path of the file from which to load the pack.
+     *
+     * @return
+     *     An indication of whether or not the pack was loaded
+     *     is returned.  If the file doesn't exist, or wasn't saved
+     *     by a compatible version of the program, the pack is left empty.
+     */
+    bool Load(const std::string& path);
+
+    /**
+     * Save the pack to the file at the given path.
+     *
+     * @param[in] path
+     *     This is the path of the file in which to save the pack.
+     *
+     * @return
+     *     An indication of whether or not the pack was saved is returned.
+     */
+    bool Save(const std::string& path) const;
+
+    /**
+     * Add the given script to the pack.
+     *
+     * @param[in] script
+     *     This is the script to add.
+     *
+     * @return
+     *     The position of the script among the scripts
+     *     of the pack is returned.
+     */
+    size_t AddScript(Script&& script);
+
+    /**
+     * Add the given module to the pack.
+     *
+     * @param[in] module
+     *     This is the module to add.
+     */
+    void AddModule(Module&& module);
+
+    /**
+     * Add the given test to the pack.
+     *
+     * @param[in] test
+     *     This is the test to add.
+     */
+    void AddTest(Test&& test);
+
+    /**
+     * Return the scripts in the pack.
+     *
+     * @return
+     *     The scripts in the pack are returned.
+     */
+    const std::vector< Script >& GetScripts() const;
+
+    /**
+     * Return the modules in the pack.
+     *
+     * @return
+     *     The modules in the pack are returned.
+     */
+    const std::vector< Module >& GetModules() const;
+
+    /**
+     * Return the tests in the pack.
+     *
+     * @return
+     *     The tests in the pack are returned.
+     */
+    const std::vector< Test >& GetTests() const;
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
+
+#endif /* MOON_UNIT_TEST_PACK_HPP */
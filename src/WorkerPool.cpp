@@ -0,0 +1,167 @@
+/**
+ * @file WorkerPool.cpp
+ *
+ * This module contains the implementation of the WorkerPool class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "WorkerPool.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * This is the internal interface/implementation of the WorkerPool class.
+ */
+struct WorkerPool::Impl {
+    // Properties
+
+    /**
+     * These are the worker threads of the pool.
+     */
+    std::vector< std::thread > workers;
+
+    /**
+     * This is used to synchronize access to the state of the pool.
+     */
+    std::mutex mutex;
+
+    /**
+     * This is used to wake up worker threads when there are jobs
+     * to perform or when the pool is being torn down.
+     */
+    std::condition_variable wakeWorkers;
+
+    /**
+     * This is used to wake up the thread which submitted jobs
+     * whenever a job has been performed.
+     */
+    std::condition_variable wakeSubmitter;
+
+    /**
+     * This flag is set when worker threads should exit.
+     */
+    bool stop = false;
+
+    /**
+     * This is the function to call to perform each job.
+     */
+    JobDelegate job;
+
+    /**
+     * This is the number of jobs currently submitted.
+     */
+    size_t numJobs = 0;
+
+    /**
+     * This is the index of the next job to be taken by a worker.
+     */
+    size_t nextJob = 0;
+
+    /**
+     * This indicates, for each job submitted, whether or not
+     * the job has been performed.
+     */
+    std::vector< bool > jobsPerformed;
+
+    // Methods
+
+    /**
+     * This is the function run by each worker thread.  It takes and
+     * performs jobs until the pool is torn down.
+     *
+     * @param[in] worker
+     *     This is the index of the worker.
+     */
+    void Worker(size_t worker) {
+        std::unique_lock< decltype(mutex) > lock(mutex);
+        for (;;) {
+            wakeWorkers.wait(
+                lock,
+                [this]{
+                    return (
+                        stop
+                        || (nextJob < numJobs)
+                    );
+                }
+            );
+            if (stop) {
+                break;
+            }
+            const auto jobIndex = nextJob++;
+            lock.unlock();
+            job(jobIndex, worker);
+            lock.lock();
+            jobsPerformed[jobIndex] = true;
+            wakeSubmitter.notify_one();
+        }
+    }
+};
+
+WorkerPool::~WorkerPool() noexcept {
+    if (impl_ == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->stop = true;
+        impl_->wakeWorkers.notify_all();
+    }
+    for (auto& worker: impl_->workers) {
+        worker.join();
+    }
+}
+WorkerPool::WorkerPool(WorkerPool&&) noexcept = default;
+WorkerPool& WorkerPool::operator=(WorkerPool&&) noexcept = default;
+
+WorkerPool::WorkerPool(size_t numWorkers)
+    : impl_(new Impl())
+{
+    if (numWorkers < 2) {
+        return;
+    }
+    for (size_t i = 0; i < numWorkers; ++i) {
+        impl_->workers.emplace_back(&Impl::Worker, impl_.get(), i);
+    }
+}
+
+size_t WorkerPool::GetNumWorkers() const {
+    return impl_->workers.empty() ? 1 : impl_->workers.size();
+}
+
+void WorkerPool::Run(
+    size_t numJobs,
+    JobDelegate job,
+    CompletionDelegate completion
+) {
+    if (impl_->workers.empty()) {
+        for (size_t i = 0; i < numJobs; ++i) {
+            job(i, 0);
+            completion(i);
+        }
+        return;
+    }
+    std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
+    impl_->job = job;
+    impl_->jobsPerformed.assign(numJobs, false);
+    impl_->nextJob = 0;
+    impl_->numJobs = numJobs;
+    impl_->wakeWorkers.notify_all();
+    for (size_t i = 0; i < numJobs; ++i) {
+        impl_->wakeSubmitter.wait(
+            lock,
+            [this, i]{
+                return impl_->jobsPerformed[i];
+            }
+        );
+        lock.unlock();
+        completion(i);
+        lock.lock();
+    }
+    impl_->numJobs = 0;
+    impl_->nextJob = 0;
+    impl_->job = nullptr;
+}
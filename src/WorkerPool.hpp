@@ -0,0 +1,110 @@
+#ifndef MOON_UNIT_WORKER_POOL_HPP
+#define MOON_UNIT_WORKER_POOL_HPP
+
+/**
+ * @file WorkerPool.hpp
+ *
+ * This module declares the WorkerPool class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <functional>
+#include <memory>
+#include <stddef.h>
+
+/**
+ * This class runs collections of jobs on a set of worker threads,
+ * while delivering notice of each job's completion, in the order
+ * in which the jobs were given, on the thread which submitted them.
+ */
+class WorkerPool {
+    // Types
+public:
+    /**
+     * This is the type of function called by a worker thread
+     * to perform a job.
+     *
+     * @param[in] job
+     *     This is the index of the job to perform.
+     *
+     * @param[in] worker
+     *     This is the index of the worker performing the job.
+     */
+    using JobDelegate = std::function< void(size_t job, size_t worker) >;
+
+    /**
+     * This is the type of function called on the thread which submitted
+     * a collection of jobs, once for each job, in order, after the job
+     * has been performed.
+     *
+     * @param[in] job
+     *     This is the index of the job which was performed.
+     */
+    using CompletionDelegate = std::function< void(size_t job) >;
+
+    // Lifecycle Methods
+public:
+    ~WorkerPool() noexcept;
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool(WorkerPool&&) noexcept;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    WorkerPool& operator=(WorkerPool&&) noexcept;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     *
+     * @param[in] numWorkers
+     *     This is the number of worker threads to use.  If this is
+     *     zero or one, jobs are performed on the submitting thread
+     *     rather than on separate worker threads.
+     */
+    explicit WorkerPool(size_t numWorkers);
+
+    /**
+     * Return the number of workers which perform jobs in the pool.
+     *
+     * @return
+     *     The number of workers which perform jobs in the pool is returned.
+     */
+    size_t GetNumWorkers() const;
+
+    /**
+     * Perform the given number of jobs, blocking until they are all
+     * performed and their completion has been delivered.
+     *
+     * @param[in] numJobs
+     *     This is the number of jobs to perform.
+     *
+     * @param[in] job
+     *     This is the function to call, from any worker thread,
+     *     to perform each job.
+     *
+     * @param[in] completion
+     *     This is the function to call, from the calling thread,
+     *     once for each job in order, after the job is performed.
+     */
+    void Run(
+        size_t numJobs,
+        JobDelegate job,
+        CompletionDelegate completion
+    );
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
+
+#endif /* MOON_UNIT_WORKER_POOL_HPP */
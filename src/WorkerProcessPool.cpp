@@ -0,0 +1,774 @@
+/**
+ * @file WorkerProcessPool.cpp
+ *
+ * This module contains the implementation of the WorkerProcessPool class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "WorkerProcessPool.hpp"
+
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <string.h>
+#include <StringExtensions/StringExtensions.hpp>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <stdio_ext.h>
+#endif /* __GLIBC__ */
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif /* __linux__ */
+#endif /* _WIN32 */
+
+namespace {
+
+#ifndef _WIN32
+
+    /**
+     * This is how long, in seconds, past the test timeout a worker
+     * process is given to finish a test before it's killed.  A test
+     * running Lua code is normally stopped by the runner when it times
+     * out, so a worker is only killed if it's stuck somewhere else.
+     */
+    constexpr double workerKillGracePeriod = 1.0;
+
+    /**
+     * These are the possible outcomes of reading from a worker pipe.
+     */
+    enum class ReadResult {
+        /**
+         * Everything asked for was read.
+         */
+        Ok,
+
+        /**
+         * The other end of the pipe was closed, or reading failed.
+         */
+        Closed,
+
+        /**
+         * The deadline passed before everything asked for was read.
+         */
+        TimedOut,
+    };
+
+    /**
+     * Write all the given data to the given file descriptor.
+     *
+     * @param[in] fd
+     *     This is the file descriptor to which to write.
+     *
+     * @param[in] data
+     *     This points to the data to write.
+     *
+     * @param[in] size
+     *     This is the number of bytes to write.
+     *
+     * @return
+     *     An indication of whether or not all the data
+     *     was written is returned.
+     */
+    bool WriteAll(
+        int fd,
+        const void* data,
+        size_t size
+    ) {
+        auto bytes = (const char*)data;
+        while (size > 0) {
+            const auto amountWritten = write(fd, bytes, size);
+            if (amountWritten < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            bytes += amountWritten;
+            size -= (size_t)amountWritten;
+        }
+        return true;
+    }
+
+    /**
+     * Read the given amount of data from the given file descriptor,
+     * optionally giving up once the given deadline passes.
+     *
+     * @param[in] fd
+     *     This is the file descriptor from which to read.
+     *
+     * @param[out] data
+     *     This is where to store the data read.
+     *
+     * @param[in] size
+     *     This is the number of bytes to read.
+     *
+     * @param[in] hasDeadline
+     *     This indicates whether or not to give up once
+     *     the deadline passes.
+     *
+     * @param[in] deadline
+     *     If hasDeadline is set, this is the time by which
+     *     all the data must be read.
+     *
+     * @return
+     *     The outcome of reading is returned.
+     */
+    ReadResult ReadAll(
+        int fd,
+        void* data,
+        size_t size,
+        bool hasDeadline,
+        std::chrono::steady_clock::time_point deadline
+    ) {
+        auto bytes = (char*)data;
+        while (size > 0) {
+            if (hasDeadline) {
+                const auto remaining = std::chrono::duration_cast< std::chrono::milliseconds >(
+                    deadline - std::chrono::steady_clock::now()
+                ).count();
+                if (remaining <= 0) {
+                    return ReadResult::TimedOut;
+                }
+                struct pollfd pollFd;
+                pollFd.fd = fd;
+                pollFd.events = POLLIN;
+                pollFd.revents = 0;
+                const auto pollResult = poll(&pollFd, 1, (int)remaining);
+                if (pollResult < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return ReadResult::Closed;
+                } else if (pollResult == 0) {
+                    return ReadResult::TimedOut;
+                }
+            }
+            const auto amountRead = read(fd, bytes, size);
+            if (amountRead < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return ReadResult::Closed;
+            } else if (amountRead == 0) {
+                return ReadResult::Closed;
+            }
+            bytes += amountRead;
+            size -= (size_t)amountRead;
+        }
+        return ReadResult::Ok;
+    }
+
+    /**
+     * Append the given value, as it's laid out in memory, to the given
+     * buffer.  Both ends of each pipe are the same program, so values
+     * are sent as they are, without conversion.
+     *
+     * @param[in,out] buffer
+     *     This is the buffer to which to append the value.
+     *
+     * @param[in] value
+     *     This is the value to append.
+     */
+    template< typename T > void AppendValue(
+        std::string& buffer,
+        const T& value
+    ) {
+        buffer.append((const char*)&value, sizeof(value));
+    }
+
+    /**
+     * Extract a value, appended by AppendValue, from the given buffer.
+     *
+     * @param[in] buffer
+     *     This is the buffer from which to extract the value.
+     *
+     * @param[in,out] offset
+     *     This is the position in the buffer of the value.  It's advanced
+     *     past the value if the value is extracted.
+     *
+     * @param[out] value
+     *     This is where to store the value.
+     *
+     * @return
+     *     An indication of whether or not the value
+     *     was extracted is returned.
+     */
+    template< typename T > bool ExtractValue(
+        const std::string& buffer,
+        size_t& offset,
+        T& value
+    ) {
+        if (buffer.length() - offset < sizeof(value)) {
+            return false;
+        }
+        (void)memcpy(&value, buffer.data() + offset, sizeof(value));
+        offset += sizeof(value);
+        return true;
+    }
+
+    /**
+     * Mark the given file descriptor to be closed if the process
+     * executes another program, so that processes started by tests
+     * don't hold worker pipes open.
+     *
+     * @param[in] fd
+     *     This is the file descriptor to mark.
+     */
+    void SetCloseOnExec(int fd) {
+        const auto flags = fcntl(fd, F_GETFD);
+        if (flags >= 0) {
+            (void)fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+        }
+    }
+
+    /**
+     * Encode the given results of a test as a response from a worker
+     * process: its length followed by whether or not the test passed,
+     * its measurements, and its error messages.
+     *
+     * @param[in] passed
+     *     This indicates whether or not the test passed.
+     *
+     * @param[in] metrics
+     *     These are the measurements taken while running the test.
+     *
+     * @param[in] errorMessages
+     *     These are the error messages reported while running the test.
+     *
+     * @param[out] response
+     *     This is where to store the encoded response.
+     */
+    void EncodeResponse(
+        bool passed,
+        const Runner::TestMetrics& metrics,
+        const std::vector< std::string >& errorMessages,
+        std::string& response
+    ) {
+        response.assign(sizeof(uint32_t), '\0');
+        AppendValue(response, (uint8_t)(passed ? 1 : 0));
+        AppendValue(response, metrics);
+        AppendValue(response, (uint32_t)errorMessages.size());
+        for (const auto& errorMessage: errorMessages) {
+            AppendValue(response, (uint32_t)errorMessage.length());
+            response += errorMessage;
+        }
+        const auto length = (uint32_t)(response.length() - sizeof(uint32_t));
+        (void)memcpy(&response[0], &length, sizeof(length));
+    }
+
+#endif /* _WIN32 */
+
+}
+
+/**
+ * This is the internal interface/implementation of the WorkerProcessPool
+ * class.
+ */
+struct WorkerProcessPool::Impl {
+    // Types
+
+    /**
+     * This holds what the pool knows about one worker process.
+     */
+    struct Worker {
+        /**
+         * This is the process identifier of the worker,
+         * or -1 if it isn't running.
+         */
+        int pid = -1;
+
+        /**
+         * This is the file descriptor of the pipe used to send the
+         * identifiers of tests to run to the worker, or -1 if none.
+         */
+        int requestFd = -1;
+
+        /**
+         * This is the file descriptor of the pipe used to receive the
+         * results of tests from the worker, or -1 if none.
+         */
+        int responseFd = -1;
+    };
+
+    // Properties
+
+    /**
+     * This is the runner whose tests the worker processes run.
+     */
+    Runner* runner = nullptr;
+
+    /**
+     * These are the worker processes of the pool.
+     */
+    std::vector< Worker > workers;
+
+    /**
+     * If not zero, this is the longest time, in seconds,
+     * a test is expected to run.
+     */
+    double testTimeout = 0.0;
+
+    /**
+     * This flag indicates whether or not each worker process prepares
+     * a Lua interpreter as a template, and forks a copy of itself
+     * to run each test in its copy of the template.
+     */
+    bool forkPerTest = false;
+
+    /**
+     * This is used to make sure only one worker process is started
+     * or stopped at a time, so that every worker process is forked
+     * knowing exactly which pipes belong to the other workers.
+     */
+    std::mutex mutex;
+
+    // Methods
+
+#ifndef _WIN32
+
+    /**
+     * Run tests, as a worker process, until the pipe
+     * used to send requests is closed.
+     *
+     * @param[in] requestFd
+     *     This is the file descriptor from which to read the
+     *     identifiers of tests to run.
+     *
+     * @param[in] responseFd
+     *     This is the file descriptor to which to write
+     *     the results of tests.
+     */
+    void Serve(
+        int requestFd,
+        int responseFd
+    ) {
+        if (forkPerTest) {
+            runner->PrepareInterpreter();
+        }
+        std::vector< std::string > errorMessages;
+        std::string response;
+        for (;;) {
+            uint64_t testId;
+            if (
+                ReadAll(
+                    requestFd,
+                    &testId,
+                    sizeof(testId),
+                    false,
+                    std::chrono::steady_clock::time_point()
+                ) != ReadResult::Ok
+            ) {
+                break;
+            }
+            if (forkPerTest) {
+                // The test script is compiled here, rather than in the
+                // copy, so that later tests of the same script don't
+                // have to compile it again.
+                runner->PrepareTest((Runner::TestId)testId);
+                RunTestInCopy((Runner::TestId)testId, response);
+            } else {
+                errorMessages.clear();
+                Runner::TestMetrics metrics;
+                const auto passed = runner->RunTest(
+                    (Runner::TestId)testId,
+                    [&](const std::string& message){
+                        errorMessages.push_back(message);
+                    },
+                    &metrics
+                );
+                EncodeResponse(passed, metrics, errorMessages, response);
+            }
+            (void)fflush(stdout);
+            if (!WriteAll(responseFd, response.data(), response.length())) {
+                break;
+            }
+        }
+
+        // Finish any test suites whose Lua interpreters were kept for
+        // their tests.  There's no test left to blame for any errors
+        // raised by their teardown functions, so they're printed.
+        (void)runner->EndTestSuites(
+            [](const std::string& message){
+                (void)fwrite(
+                    message.data(),
+                    message.length(), 1,
+                    stderr
+                );
+            }
+        );
+        (void)fflush(stdout);
+        _exit(0);
+    }
+
+    /**
+     * Run the test with the given identifier, as a worker process,
+     * in a copy of this process forked for the test, so that the test
+     * runs in its copy of the Lua interpreter prepared as a template.
+     *
+     * @param[in] testId
+     *     This identifies the test to run.
+     *
+     * @param[out] response
+     *     This is where to store the response to send about the test.
+     */
+    void RunTestInCopy(
+        Runner::TestId testId,
+        std::string& response
+    ) {
+        std::vector< std::string > errorMessages;
+        int resultPipe[2];
+        if (pipe(resultPipe) != 0) {
+            errorMessages.push_back("ERROR: Unable to make a pipe for the test process\n");
+            EncodeResponse(false, Runner::TestMetrics(), errorMessages, response);
+            return;
+        }
+        for (const auto fd: {resultPipe[0], resultPipe[1]}) {
+            SetCloseOnExec(fd);
+        }
+        (void)fflush(stdout);
+        (void)fflush(stderr);
+        const auto pid = fork();
+        if (pid < 0) {
+            (void)close(resultPipe[0]);
+            (void)close(resultPipe[1]);
+            errorMessages.push_back("ERROR: Unable to start a process for the test\n");
+            EncodeResponse(false, Runner::TestMetrics(), errorMessages, response);
+            return;
+        }
+        if (pid == 0) {
+            (void)close(resultPipe[0]);
+#ifdef __linux__
+            // If the worker process is killed for taking too long,
+            // the copy running the test shouldn't carry on without it.
+            (void)prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif /* __linux__ */
+            Runner::TestMetrics metrics;
+            const auto passed = runner->RunTest(
+                testId,
+                [&](const std::string& message){
+                    errorMessages.push_back(message);
+                },
+                &metrics
+            );
+            EncodeResponse(passed, metrics, errorMessages, response);
+            (void)fflush(stdout);
+            (void)WriteAll(resultPipe[1], response.data(), response.length());
+            _exit(0);
+        }
+
+        // The copy closes its end of the pipe when it exits,
+        // whether or not it sent the whole response.
+        (void)close(resultPipe[1]);
+        response.clear();
+        char buffer[4096];
+        for (;;) {
+            const auto amountRead = read(resultPipe[0], buffer, sizeof(buffer));
+            if (amountRead < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            } else if (amountRead == 0) {
+                break;
+            }
+            response.append(buffer, (size_t)amountRead);
+        }
+        (void)close(resultPipe[0]);
+        int status = 0;
+        while (
+            (waitpid(pid, &status, 0) < 0)
+            && (errno == EINTR)
+        ) {
+        }
+        uint32_t length;
+        size_t offset = 0;
+        if (
+            ExtractValue(response, offset, length)
+            && (response.length() - offset == length)
+        ) {
+            return;
+        }
+        if (WIFSIGNALED(status)) {
+            errorMessages.push_back(
+                StringExtensions::sprintf(
+                    "ERROR: Test process crashed running the test (%s)\n",
+                    strsignal(WTERMSIG(status))
+                )
+            );
+        } else if (WIFEXITED(status)) {
+            errorMessages.push_back(
+                StringExtensions::sprintf(
+                    "ERROR: Test process exited with status %d running the test\n",
+                    WEXITSTATUS(status)
+                )
+            );
+        } else {
+            errorMessages.push_back("ERROR: Test process stopped running the test\n");
+        }
+        EncodeResponse(false, Runner::TestMetrics(), errorMessages, response);
+    }
+
+    /**
+     * Start a new process for the given worker.
+     *
+     * @param[in] worker
+     *     This is the index of the worker for which to start a process.
+     *
+     * @return
+     *     An indication of whether or not the process
+     *     was started is returned.
+     */
+    bool Spawn(size_t worker) {
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        int requestPipe[2];
+        int responsePipe[2];
+        if (pipe(requestPipe) != 0) {
+            return false;
+        }
+        if (pipe(responsePipe) != 0) {
+            (void)close(requestPipe[0]);
+            (void)close(requestPipe[1]);
+            return false;
+        }
+        for (const auto fd: {requestPipe[0], requestPipe[1], responsePipe[0], responsePipe[1]}) {
+            SetCloseOnExec(fd);
+        }
+
+        // Anything buffered to be written must be written before forking,
+        // or the worker would write it again.
+        (void)fflush(stdout);
+        (void)fflush(stderr);
+        const auto pid = fork();
+        if (pid < 0) {
+            for (const auto fd: {requestPipe[0], requestPipe[1], responsePipe[0], responsePipe[1]}) {
+                (void)close(fd);
+            }
+            return false;
+        }
+        if (pid == 0) {
+            (void)close(requestPipe[1]);
+            (void)close(responsePipe[0]);
+            for (const auto& otherWorker: workers) {
+                if (otherWorker.requestFd >= 0) {
+                    (void)close(otherWorker.requestFd);
+                }
+                if (otherWorker.responseFd >= 0) {
+                    (void)close(otherWorker.responseFd);
+                }
+            }
+#ifdef __GLIBC__
+            // Another thread may have buffered output after the flush
+            // above, which the program will write itself.
+            __fpurge(stdout);
+#endif /* __GLIBC__ */
+            Serve(requestPipe[0], responsePipe[1]);
+        }
+        (void)close(requestPipe[0]);
+        (void)close(responsePipe[1]);
+        auto& workerProcess = workers[worker];
+        workerProcess.pid = (int)pid;
+        workerProcess.requestFd = requestPipe[1];
+        workerProcess.responseFd = responsePipe[0];
+        return true;
+    }
+
+    /**
+     * Close the pipes of the process of the given worker, and wait
+     * for the process to exit.
+     *
+     * @param[in] worker
+     *     This is the index of the worker whose process to reap.
+     *
+     * @param[in] kill
+     *     This indicates whether or not to kill the process first.
+     *
+     * @return
+     *     The status of the process, as reported by waitpid,
+     *     is returned.
+     */
+    int Reap(
+        size_t worker,
+        bool kill
+    ) {
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        auto& workerProcess = workers[worker];
+        int status = 0;
+        if (workerProcess.pid >= 0) {
+            if (kill) {
+                (void)::kill((pid_t)workerProcess.pid, SIGKILL);
+            }
+            (void)close(workerProcess.requestFd);
+            while (
+                (waitpid((pid_t)workerProcess.pid, &status, 0) < 0)
+                && (errno == EINTR)
+            ) {
+            }
+            (void)close(workerProcess.responseFd);
+        }
+        workerProcess = Worker();
+        return status;
+    }
+
+#endif /* _WIN32 */
+};
+
+WorkerProcessPool::~WorkerProcessPool() noexcept {
+    if (impl_ != nullptr) {
+        Stop();
+    }
+}
+WorkerProcessPool::WorkerProcessPool(WorkerProcessPool&&) noexcept = default;
+WorkerProcessPool& WorkerProcessPool::operator=(WorkerProcessPool&&) noexcept = default;
+
+WorkerProcessPool::WorkerProcessPool(Runner& runner)
+    : impl_(new Impl())
+{
+    impl_->runner = &runner;
+}
+
+bool WorkerProcessPool::Start(
+    size_t numWorkers,
+    double testTimeout,
+    bool forkPerTest
+) {
+#ifdef _WIN32
+    return false;
+#else /* POSIX */
+    Stop();
+    impl_->testTimeout = testTimeout;
+    impl_->forkPerTest = forkPerTest;
+
+    // A worker which crashes closes its pipes, which must not
+    // stop this process when it tries to write to them.
+    (void)signal(SIGPIPE, SIG_IGN);
+    impl_->workers.resize((numWorkers == 0) ? 1 : numWorkers);
+    for (size_t worker = 0; worker < impl_->workers.size(); ++worker) {
+        if (!impl_->Spawn(worker)) {
+            Stop();
+            return false;
+        }
+    }
+    return true;
+#endif /* _WIN32 or POSIX */
+}
+
+void WorkerProcessPool::Stop() {
+#ifndef _WIN32
+    for (size_t worker = 0; worker < impl_->workers.size(); ++worker) {
+        (void)impl_->Reap(worker, false);
+    }
+#endif /* _WIN32 */
+    impl_->workers.clear();
+}
+
+bool WorkerProcessPool::RunTest(
+    size_t worker,
+    Runner::TestId testId,
+    Runner::ErrorMessageDelegate errorMessageDelegate,
+    Runner::TestMetrics* metrics
+) {
+#ifdef _WIN32
+    errorMessageDelegate("ERROR: Worker processes are not supported on this system\n");
+    return false;
+#else /* POSIX */
+    if (
+        (impl_->workers[worker].pid < 0)
+        && !impl_->Spawn(worker)
+    ) {
+        errorMessageDelegate("ERROR: Unable to start a worker process\n");
+        return false;
+    }
+    const auto& workerProcess = impl_->workers[worker];
+    const auto startTime = std::chrono::steady_clock::now();
+    const auto hasDeadline = (impl_->testTimeout > 0.0);
+    const auto deadline = startTime + std::chrono::duration_cast< std::chrono::steady_clock::duration >(
+        std::chrono::duration< double >(impl_->testTimeout + workerKillGracePeriod)
+    );
+    const auto request = (uint64_t)testId;
+    auto readResult = ReadResult::Closed;
+    std::string response;
+    if (WriteAll(workerProcess.requestFd, &request, sizeof(request))) {
+        uint32_t length;
+        readResult = ReadAll(workerProcess.responseFd, &length, sizeof(length), hasDeadline, deadline);
+        if (readResult == ReadResult::Ok) {
+            response.resize(length);
+            readResult = ReadAll(workerProcess.responseFd, &response[0], length, hasDeadline, deadline);
+        }
+    }
+
+    // Decode the response, if one was received.
+    size_t offset = 0;
+    uint8_t passed = 0;
+    Runner::TestMetrics testMetrics;
+    uint32_t numErrorMessages = 0;
+    bool decoded = (
+        (readResult == ReadResult::Ok)
+        && ExtractValue(response, offset, passed)
+        && ExtractValue(response, offset, testMetrics)
+        && ExtractValue(response, offset, numErrorMessages)
+    );
+    for (uint32_t i = 0; decoded && (i < numErrorMessages); ++i) {
+        uint32_t length;
+        decoded = (
+            ExtractValue(response, offset, length)
+            && (response.length() - offset >= length)
+        );
+        if (decoded) {
+            errorMessageDelegate(response.substr(offset, length));
+            offset += length;
+        }
+    }
+    if (decoded) {
+        if (metrics != nullptr) {
+            *metrics = testMetrics;
+        }
+        return (passed != 0);
+    }
+
+    // The worker process crashed, got stuck, or sent something which
+    // doesn't make sense, so replace it with a new one.
+    const auto status = impl_->Reap(worker, (readResult != ReadResult::Closed));
+    if (readResult == ReadResult::TimedOut) {
+        errorMessageDelegate(
+            StringExtensions::sprintf(
+                "ERROR: Worker process killed after the test ran for %.3f seconds\n",
+                std::chrono::duration< double >(
+                    std::chrono::steady_clock::now() - startTime
+                ).count()
+            )
+        );
+    } else if (readResult == ReadResult::Ok) {
+        errorMessageDelegate("ERROR: Worker process sent a result which couldn't be decoded\n");
+    } else if (WIFSIGNALED(status)) {
+        errorMessageDelegate(
+            StringExtensions::sprintf(
+                "ERROR: Worker process crashed running the test (%s)\n",
+                strsignal(WTERMSIG(status))
+            )
+        );
+    } else if (WIFEXITED(status)) {
+        errorMessageDelegate(
+            StringExtensions::sprintf(
+                "ERROR: Worker process exited with status %d running the test\n",
+                WEXITSTATUS(status)
+            )
+        );
+    } else {
+        errorMessageDelegate("ERROR: Worker process stopped running the test\n");
+    }
+    (void)impl_->Spawn(worker);
+    return false;
+#endif /* _WIN32 or POSIX */
+}
@@ -0,0 +1,133 @@
+#ifndef MOON_UNIT_WORKER_PROCESS_POOL_HPP
+#define MOON_UNIT_WORKER_PROCESS_POOL_HPP
+
+/**
+ * @file WorkerProcessPool.hpp
+ *
+ * This module declares the WorkerProcessPool class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Runner.hpp"
+
+#include <memory>
+#include <stddef.h>
+
+/**
+ * This class runs tests in a set of long-lived worker processes, so
+ * that a test which crashes, or corrupts the state of its process,
+ * doesn't take down the process running the other tests.
+ *
+ * Each worker process is forked from the process which owns the pool,
+ * after tests are found, so it starts with everything the runner
+ * already knows, such as the compiled test scripts, and keeps what
+ * it learns while running tests, such as scripts it compiles.
+ * Tests are handed to the workers, and their results collected, over
+ * pipes.  A worker which crashes is replaced automatically.
+ *
+ * Optionally, each worker process instead prepares a Lua interpreter
+ * once, as a template, and forks a copy of itself for each test, which
+ * runs the test in its copy of the template and then exits.  Each test
+ * then starts from an identical fresh interpreter without paying to make
+ * one, and a test which crashes only takes down its own copy.
+ *
+ * Each worker may be used by only one thread at a time.  Worker processes
+ * are only supported on systems which provide POSIX processes.
+ */
+class WorkerProcessPool {
+    // Lifecycle Methods
+public:
+    ~WorkerProcessPool() noexcept;
+    WorkerProcessPool(const WorkerProcessPool&) = delete;
+    WorkerProcessPool(WorkerProcessPool&&) noexcept;
+    WorkerProcessPool& operator=(const WorkerProcessPool&) = delete;
+    WorkerProcessPool& operator=(WorkerProcessPool&&) noexcept;
+
+    // Public Methods
+public:
+    /**
+     * This is the constructor of the class.
+     *
+     * @param[in,out] runner
+     *     This is the runner whose tests the worker processes run.
+     */
+    explicit WorkerProcessPool(Runner& runner);
+
+    /**
+     * Start the given number of worker processes.  Any worker processes
+     * already running are stopped first, so that the new ones start with
+     * what the runner knows now.
+     *
+     * @param[in] numWorkers
+     *     This is the number of worker processes to start.
+     *
+     * @param[in] testTimeout
+     *     If not zero, this is the longest time, in seconds, a test is
+     *     expected to run.  A worker process still running a test a
+     *     while after this is killed and replaced.
+     *
+     * @param[in] forkPerTest
+     *     This indicates whether or not each worker process prepares
+     *     a Lua interpreter as a template, and forks a copy of itself
+     *     to run each test in its copy of the template.
+     *
+     * @return
+     *     An indication of whether or not the worker processes
+     *     were started is returned.
+     */
+    bool Start(
+        size_t numWorkers,
+        double testTimeout,
+        bool forkPerTest = false
+    );
+
+    /**
+     * Stop all worker processes, waiting for them to exit.
+     */
+    void Stop();
+
+    /**
+     * Run the test with the given identifier on the given worker.
+     *
+     * @param[in] worker
+     *     This is the index of the worker process on which to run the test.
+     *
+     * @param[in] testId
+     *     This identifies the test to run.
+     *
+     * @param[in] errorMessageDelegate
+     *     This is the function to call to deliver any error messages
+     *     reported while running the test, including any about the
+     *     worker process crashing or being killed.
+     *
+     * @param[out] metrics
+     *     If not null, this is where to store the measurements
+     *     taken while running the test.
+     *
+     * @return
+     *     An indication of whether or not the test passed is returned.
+     */
+    bool RunTest(
+        size_t worker,
+        Runner::TestId testId,
+        Runner::ErrorMessageDelegate errorMessageDelegate,
+        Runner::TestMetrics* metrics = nullptr
+    );
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
+
+#endif /* MOON_UNIT_WORKER_PROCESS_POOL_HPP */
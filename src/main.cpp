@@ -7,21 +7,58 @@
  * © 2019 by Richard Walters
  */
 
+#include "BenchmarkBaseline.hpp"
+#include "Reporter.hpp"
 #include "Runner.hpp"
+#include "StatusFile.hpp"
+#include "TestFilter.hpp"
+#include "WorkerPool.hpp"
+#include "WorkerProcessPool.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <Json/Value.hpp>
+#include <map>
 #include <math.h>
+#include <regex>
+#include <set>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string>
 #include <StringExtensions/StringExtensions.hpp>
 #include <SystemAbstractions/File.hpp>
 #include <SystemAbstractions/Time.hpp>
-#include <unordered_map>
-#include <unordered_set>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#ifdef _WIN32
+#include <io.h>
+#else /* POSIX */
+#include <unistd.h>
+#endif /* _WIN32 / POSIX */
+
 namespace {
 
+    /**
+     * This is the size, in bytes, of the buffer used to collect what
+     * is printed before it's written out, when output isn't going
+     * to a terminal.
+     */
+    constexpr size_t outputBufferSize = 65536;
+
+    /**
+     * This is the amount of time, in milliseconds, to wait between checks
+     * for changes to Lua test files, when watching for changes.
+     */
+    constexpr int watchPollIntervalMilliseconds = 250;
+
+    /**
+     * This is the largest p-value at which a benchmark's slowdown compared
+     * to the baseline is considered statistically significant.
+     */
+    constexpr double benchmarkSignificanceLevel = 0.05;
+
     /**
      * Replace all backslashes with forward slashes
      * in the given string.
@@ -109,6 +146,908 @@ namespace {
         );
     }
 
+    /**
+     * Run the given command through the shell, and return
+     * what it writes to its standard output stream.
+     *
+     * @param[in] command
+     *     This is the command to run.
+     *
+     * @param[out] output
+     *     This is where to store the output of the command.
+     *
+     * @return
+     *     An indication of whether or not the command ran
+     *     and completed successfully is returned.
+     */
+    bool RunCommand(
+        const std::string& command,
+        std::string& output
+    ) {
+#ifdef _WIN32
+        FILE* pipe = _popen(command.c_str(), "rt");
+#else /* POSIX */
+        FILE* pipe = popen(command.c_str(), "r");
+#endif /* _WIN32 / POSIX */
+        if (pipe == NULL) {
+            return false;
+        }
+        char buffer[4096];
+        for (;;) {
+            const auto amountRead = fread(buffer, 1, sizeof(buffer), pipe);
+            if (amountRead == 0) {
+                break;
+            }
+            output.append(buffer, amountRead);
+        }
+#ifdef _WIN32
+        return (_pclose(pipe) == 0);
+#else /* POSIX */
+        return (pclose(pipe) == 0);
+#endif /* _WIN32 / POSIX */
+    }
+
+    /**
+     * Determine the absolute paths of the files which changed, according
+     * to the given argument of the "--changed_since" option.  This is
+     * either the path to a file listing the paths of the changed files,
+     * one per line, relative to the current working directory, or the
+     * name of a git revision to compare with the working tree.  Files
+     * not yet tracked by git (and not ignored) count as changed too.
+     *
+     * @param[in] changedSince
+     *     This is the argument of the "--changed_since" option.
+     *
+     * @param[in] searchPath
+     *     This is the path to the folder in which tests are found,
+     *     whose git working tree is compared with the git revision.
+     *
+     * @param[out] changedFilePaths
+     *     This is where to store the absolute paths of the changed files.
+     *
+     * @return
+     *     An indication of whether or not the changed files
+     *     could be determined is returned.
+     */
+    bool FindChangedFiles(
+        const std::string& changedSince,
+        const std::string& searchPath,
+        std::vector< std::string >& changedFilePaths
+    ) {
+        SystemAbstractions::File changedFileList(changedSince);
+        if (
+            changedFileList.IsExisting()
+            && !changedFileList.IsDirectory()
+        ) {
+            for (const auto& line: StringExtensions::Split(ReadFile(changedFileList), '\n')) {
+                const auto changedFilePath = StringExtensions::Trim(line);
+                if (!changedFilePath.empty()) {
+                    changedFilePaths.push_back(CanonicalPath(changedFilePath));
+                }
+            }
+            return true;
+        }
+        const auto workingTree = CanonicalPath(searchPath);
+        if (
+            (changedSince.find_first_of("\"'`$") != std::string::npos)
+            || (workingTree.find_first_of("\"'`$") != std::string::npos)
+        ) {
+            return false;
+        }
+        const auto git = "git -C \"" + workingTree + "\" ";
+        std::string topLevel;
+        if (!RunCommand(git + "rev-parse --show-toplevel", topLevel)) {
+            return false;
+        }
+        topLevel = FixPathDelimiters(StringExtensions::Trim(topLevel));
+
+        // Both commands list paths relative to the top of the working tree.
+        std::string changes;
+        if (
+            !RunCommand(git + "diff --name-only \"" + changedSince + "\" --", changes)
+            || !RunCommand(git + "ls-files --others --exclude-standard --full-name", changes)
+        ) {
+            return false;
+        }
+        for (const auto& line: StringExtensions::Split(changes, '\n')) {
+            const auto changedFilePath = StringExtensions::Trim(line);
+            if (!changedFilePath.empty()) {
+                changedFilePaths.push_back(CanonicalPath(topLevel + "/" + changedFilePath));
+            }
+        }
+        return true;
+    }
+
+    /**
+     * This holds information about a test selected to be run,
+     * along with the results of running it.
+     */
+    struct SelectedTest {
+        /**
+         * This identifies the test to the runner.
+         */
+        Runner::TestId testId = 0;
+
+        /**
+         * This is the name of the test suite containing the test.
+         */
+        std::string testSuiteName;
+
+        /**
+         * This is the name of the test.
+         */
+        std::string testName;
+
+        /**
+         * This indicates whether or not the test passed.
+         */
+        bool passed = false;
+
+        /**
+         * These are the error messages reported while running the test.
+         */
+        std::vector< std::string > errorMessages;
+
+        /**
+         * This is the amount of time, in seconds, it took to run the test.
+         */
+        double duration = 0.0;
+
+        /**
+         * These are the measurements taken while running the test.
+         */
+        Runner::TestMetrics metrics;
+
+        /**
+         * This is what to print about the test once it has finished.
+         * It's formatted by the worker which ran the test, so that the
+         * thread printing the results only has to write it out.
+         */
+        std::string output;
+    };
+
+    /**
+     * This holds information about a benchmark selected to be run,
+     * along with the results of running it.
+     */
+    struct SelectedBenchmark {
+        /**
+         * This is the name of the benchmark suite containing the benchmark.
+         */
+        std::string benchmarkSuiteName;
+
+        /**
+         * This is the name of the benchmark.
+         */
+        std::string benchmarkName;
+
+        /**
+         * This indicates whether or not the benchmark ran without problems.
+         */
+        bool passed = false;
+
+        /**
+         * These are the measurements taken while running the benchmark.
+         */
+        Runner::BenchmarkResult result;
+    };
+
+    /**
+     * Return the encoding of the results of the given benchmarks,
+     * as a JSON object.
+     *
+     * @param[in] benchmarks
+     *     These are the benchmarks whose results should be encoded.
+     *
+     * @return
+     *     The encoding of the results of the given benchmarks is returned.
+     */
+    std::string EncodeBenchmarkResults(const std::vector< SelectedBenchmark >& benchmarks) {
+        Json::Value results(Json::Value::Type::Array);
+        for (const auto& benchmark: benchmarks) {
+            if (!benchmark.passed) {
+                continue;
+            }
+            const auto& result = benchmark.result;
+            Json::Value encodedResult(Json::Value::Type::Object);
+            encodedResult.Set("suite", benchmark.benchmarkSuiteName);
+            encodedResult.Set("name", benchmark.benchmarkName);
+            encodedResult.Set("iterations", result.iterations);
+            encodedResult.Set("time_unit", "ns");
+            encodedResult.Set("mean", result.mean);
+            encodedResult.Set("median", result.median);
+            encodedResult.Set("stddev", result.standardDeviation);
+            encodedResult.Set("min", result.minimum);
+            Json::Value samples(Json::Value::Type::Array);
+            for (const auto sample: result.samples) {
+                samples.Add(sample);
+            }
+            encodedResult.Set("samples", samples);
+            results.Add(encodedResult);
+        }
+        Json::Value encoding(Json::Value::Type::Object);
+        encoding.Set("benchmarks", results);
+        return encoding.ToEncoding();
+    }
+
+    /**
+     * This is the type used to hold the amount of time, in seconds,
+     * that tests took to run, keyed by test suite name and test name.
+     */
+    using TestDurations = std::map< std::pair< std::string, std::string >, double >;
+
+    /**
+     * Read the amount of time each test took to run from the report
+     * at the given path, previously generated with "--gtest_output=json:".
+     *
+     * @param[in] reportPath
+     *     This is the path to the report to read.
+     *
+     * @param[out] durations
+     *     This is where to store the amount of time each test took to run.
+     *
+     * @return
+     *     An indication of whether or not the report was read is returned.
+     */
+    bool LoadTestDurations(
+        const std::string& reportPath,
+        TestDurations& durations
+    ) {
+        SystemAbstractions::File reportFile(reportPath);
+        const auto report = Json::Value::FromEncoding(ReadFile(reportFile));
+        if (
+            (report.GetType() != Json::Value::Type::Object)
+            || !report.Has("testsuites")
+        ) {
+            return false;
+        }
+        const auto& testSuites = report["testsuites"];
+        for (size_t i = 0; i < testSuites.GetSize(); ++i) {
+            const auto& testSuite = testSuites[i];
+            const std::string testSuiteName = testSuite["name"];
+            const auto& tests = testSuite["testsuite"];
+            for (size_t j = 0; j < tests.GetSize(); ++j) {
+                const auto& test = tests[j];
+                if (!test.Has("time")) {
+                    continue;
+                }
+                const std::string time = test["time"];
+                durations[std::make_pair(testSuiteName, (std::string)test["name"])] = strtod(time.c_str(), NULL);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Keep only the given selected tests which belong to the given shard,
+     * when the tests are split into the given number of shards.
+     *
+     * Without durations, tests are dealt out to the shards in turn,
+     * as Google Test does.  With durations, the longest tests are placed
+     * first, each in the shard with the least total duration so far, so
+     * that all shards take about the same amount of time.  Tests without
+     * a known duration are assumed to take the average duration.  Every
+     * shard makes the same choices given the same tests and durations,
+     * so each test is run by exactly one shard.
+     *
+     * @param[in,out] tests
+     *     These are the tests selected to be run.  Tests not in the
+     *     shard are removed, and the rest are kept in the same order.
+     *
+     * @param[in] totalShards
+     *     This is the number of shards into which to split the tests.
+     *
+     * @param[in] shardIndex
+     *     This is the index of the shard whose tests to keep.
+     *
+     * @param[in] durations
+     *     These are the amounts of time tests took to run previously.
+     */
+    void SelectShard(
+        std::vector< SelectedTest >& tests,
+        size_t totalShards,
+        size_t shardIndex,
+        const TestDurations& durations
+    ) {
+        std::vector< bool > inShard(tests.size(), false);
+        if (durations.empty()) {
+            for (size_t i = 0; i < tests.size(); ++i) {
+                inShard[i] = ((i % totalShards) == shardIndex);
+            }
+        } else {
+            std::vector< double > testDurations(tests.size(), -1.0);
+            double knownDurationsSum = 0.0;
+            size_t numKnownDurations = 0;
+            for (size_t i = 0; i < tests.size(); ++i) {
+                const auto durationsEntry = durations.find(
+                    std::make_pair(tests[i].testSuiteName, tests[i].testName)
+                );
+                if (durationsEntry != durations.end()) {
+                    testDurations[i] = durationsEntry->second;
+                    knownDurationsSum += durationsEntry->second;
+                    ++numKnownDurations;
+                }
+            }
+            const auto averageDuration = (
+                (numKnownDurations == 0)
+                ? 0.0
+                : knownDurationsSum / (double)numKnownDurations
+            );
+            std::vector< size_t > order;
+            for (size_t i = 0; i < tests.size(); ++i) {
+                if (testDurations[i] < 0.0) {
+                    testDurations[i] = averageDuration;
+                }
+                order.push_back(i);
+            }
+            std::stable_sort(
+                order.begin(),
+                order.end(),
+                [&](size_t lhs, size_t rhs){
+                    return testDurations[lhs] > testDurations[rhs];
+                }
+            );
+            std::vector< double > shardDurations(totalShards, 0.0);
+            for (const auto index: order) {
+                const auto shard = (size_t)(
+                    std::min_element(shardDurations.begin(), shardDurations.end())
+                    - shardDurations.begin()
+                );
+                shardDurations[shard] += testDurations[index];
+                inShard[index] = (shard == shardIndex);
+            }
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < tests.size(); ++i) {
+            if (inShard[i]) {
+                if (kept != i) {
+                    tests[kept] = std::move(tests[i]);
+                }
+                ++kept;
+            }
+        }
+        tests.resize(kept);
+    }
+
+    /**
+     * If the given selected test is the first of its test suite,
+     * and test suite headers are enabled, print the header line
+     * announcing the tests of the test suite.
+     *
+     * @param[in] tests
+     *     These are all the tests selected to be run,
+     *     grouped by test suite.
+     *
+     * @param[in] index
+     *     This is the index of the test about to be reported.
+     *
+     * @param[in] enabled
+     *     This indicates whether or not test suite headers are printed.
+     */
+    void PrintTestSuiteHeader(
+        const std::vector< SelectedTest >& tests,
+        size_t index,
+        bool enabled
+    ) {
+        const auto& testSuiteName = tests[index].testSuiteName;
+        if (
+            !enabled
+            || (
+                (index > 0)
+                && (tests[index - 1].testSuiteName == testSuiteName)
+            )
+        ) {
+            return;
+        }
+        size_t testSuiteSize = 0;
+        while (
+            (index + testSuiteSize < tests.size())
+            && (tests[index + testSuiteSize].testSuiteName == testSuiteName)
+        ) {
+            ++testSuiteSize;
+        }
+        printf(
+            "[----------] %zu test%s from %s\n",
+            testSuiteSize,
+            ((testSuiteSize == 1) ? "" : "s"),
+            testSuiteName.c_str()
+        );
+    }
+
+    /**
+     * Add the given selected test to the given report, beginning and
+     * ending the test suite in the report around the first and last
+     * tests of each test suite.
+     *
+     * @param[in] runner
+     *     This is the runner which found the tests.
+     *
+     * @param[in,out] reporter
+     *     This is the reporter writing the report.
+     *
+     * @param[in] tests
+     *     These are all the tests selected, grouped by test suite.
+     *
+     * @param[in] index
+     *     This is the index of the test to report.
+     *
+     * @param[in] ran
+     *     This indicates whether or not the test was run, in which
+     *     case its results are included in the report.
+     */
+    void ReportSelectedTest(
+        const Runner& runner,
+        Reporter& reporter,
+        const std::vector< SelectedTest >& tests,
+        size_t index,
+        bool ran
+    ) {
+        const auto& test = tests[index];
+        if (
+            (index == 0)
+            || (tests[index - 1].testSuiteName != test.testSuiteName)
+        ) {
+            size_t testSuiteSize = 0;
+            while (
+                (index + testSuiteSize < tests.size())
+                && (tests[index + testSuiteSize].testSuiteName == test.testSuiteName)
+            ) {
+                ++testSuiteSize;
+            }
+            reporter.BeginTestSuite(test.testSuiteName, testSuiteSize);
+        }
+        Reporter::TestResult result;
+        result.testName = test.testName;
+        (void)runner.GetTestLocation(
+            test.testId,
+            result.filePath,
+            result.lineNumber
+        );
+        if (ran) {
+            result.ran = true;
+            result.passed = test.passed;
+            result.duration = test.duration;
+            result.failureMessages = test.errorMessages;
+            result.metrics = test.metrics;
+        }
+        reporter.ReportTest(result);
+        if (
+            (index + 1 == tests.size())
+            || (tests[index + 1].testSuiteName != test.testSuiteName)
+        ) {
+            reporter.EndTestSuite();
+        }
+    }
+
+    /**
+     * Format what to print about the given test once it has finished.
+     *
+     * @param[in] test
+     *     This is the test which has finished.
+     *
+     * @param[in] printRunLine
+     *     This indicates whether or not to start with the line
+     *     announcing that the test was run.
+     *
+     * @param[in] verbose
+     *     This indicates whether or not to include the memory
+     *     measurements taken while running the test.
+     *
+     * @param[in] collectMetrics
+     *     This indicates whether or not to include the timing, garbage
+     *     collection, and instruction count measurements taken
+     *     while running the test.
+     *
+     * @return
+     *     What to print about the test is returned.
+     */
+    std::string FormatTestResult(
+        const SelectedTest& test,
+        bool printRunLine,
+        bool verbose,
+        bool collectMetrics
+    ) {
+        std::string output;
+        if (printRunLine) {
+            output += StringExtensions::sprintf(
+                "[ RUN      ] %s.%s\n",
+                test.testSuiteName.c_str(),
+                test.testName.c_str()
+            );
+        }
+        if (test.passed) {
+            output += StringExtensions::sprintf(
+                "[       OK ] %s.%s (%d ms)\n",
+                test.testSuiteName.c_str(),
+                test.testName.c_str(),
+                (int)ceil(test.duration * 1000.0)
+            );
+        } else {
+            for (const auto& line: test.errorMessages) {
+                output += line;
+            }
+            output += StringExtensions::sprintf(
+                "[  FAILED  ] %s.%s (%d ms)\n",
+                test.testSuiteName.c_str(),
+                test.testName.c_str(),
+                (int)ceil(test.duration * 1000.0)
+            );
+        }
+        if (collectMetrics) {
+            output += StringExtensions::sprintf(
+                "[ METRICS  ] %s.%s: %.3f us wall, %.3f us CPU, %zu GC cycle%s, %llu instructions\n",
+                test.testSuiteName.c_str(),
+                test.testName.c_str(),
+                test.duration * 1000000.0,
+                test.metrics.cpuTime * 1000000.0,
+                test.metrics.gcCycles,
+                ((test.metrics.gcCycles == 1) ? "" : "s"),
+                (unsigned long long)test.metrics.instructionCount
+            );
+        }
+        if (verbose) {
+            output += StringExtensions::sprintf(
+                "[  MEMORY  ] %s.%s: peak %zu bytes, %zu allocations, %zu bytes in use at end\n",
+                test.testSuiteName.c_str(),
+                test.testName.c_str(),
+                test.metrics.peakMemory,
+                test.metrics.numAllocations,
+                test.metrics.memoryInUse
+            );
+        }
+        return output;
+    }
+
+    /**
+     * Start keeping the given status file up to date with the progress
+     * of running the given tests.
+     *
+     * @param[in,out] statusFile
+     *     This is the status file to start.
+     *
+     * @param[in] path
+     *     This is the path of the file to keep up to date.
+     *
+     * @param[in] tests
+     *     These are the tests to be run.
+     *
+     * @param[in] numWorkers
+     *     This is the number of workers which run the tests.
+     *
+     * @return
+     *     An indication of whether or not the status file
+     *     was started is returned.
+     */
+    bool StartStatusFile(
+        StatusFile& statusFile,
+        const std::string& path,
+        const std::vector< SelectedTest >& tests,
+        size_t numWorkers
+    ) {
+        std::vector< std::string > testNames;
+        testNames.reserve(tests.size());
+        for (const auto& test: tests) {
+            testNames.push_back(test.testSuiteName + "." + test.testName);
+        }
+        if (!statusFile.Start(path, testNames, numWorkers)) {
+            fprintf(
+                stderr,
+                "ERROR: Unable to write status file '%s'\n",
+                path.c_str()
+            );
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Split the given tests into the groups which are each run by one
+     * job.  Each test is a group of its own, except that asynchronous
+     * tests of the same test suite and Lua script file, found one after
+     * another, are grouped together, up to the given number of tests
+     * per group, to be run together in one Lua interpreter.
+     *
+     * @param[in] runner
+     *     This is the runner which found the tests.
+     *
+     * @param[in] tests
+     *     These are the tests to group.
+     *
+     * @param[in] asyncBatch
+     *     This is the largest number of asynchronous tests to group
+     *     together.
+     *
+     * @return
+     *     The position of the first test of each group is returned.
+     */
+    std::vector< size_t > GroupSelectedTests(
+        const Runner& runner,
+        const std::vector< SelectedTest >& tests,
+        size_t asyncBatch
+    ) {
+        std::vector< size_t > groupStarts;
+        std::string groupFilePath;
+        for (size_t i = 0; i < tests.size(); ++i) {
+            const auto& test = tests[i];
+            std::string filePath;
+            int lineNumber;
+            const auto async = (
+                (asyncBatch > 1)
+                && runner.IsAsyncTest(test.testId)
+                && runner.GetTestLocation(test.testId, filePath, lineNumber)
+            );
+            if (
+                !groupStarts.empty()
+                && async
+                && (i - groupStarts.back() < asyncBatch)
+                && (tests[i - 1].testSuiteName == test.testSuiteName)
+                && (filePath == groupFilePath)
+            ) {
+                continue;
+            }
+            groupStarts.push_back(i);
+            groupFilePath = (async ? filePath : "");
+        }
+        return groupStarts;
+    }
+
+    /**
+     * Run the given tests, reporting the progress and results
+     * of each test as it's run.
+     *
+     * @param[in,out] runner
+     *     This is the runner to use to run the tests.
+     *
+     * @param[in,out] workerPool
+     *     This is the pool of workers on which to run the tests.
+     *
+     * @param[in,out] processPool
+     *     If not null, this is the pool of worker processes in which to
+     *     run the tests, one for each worker of the worker pool.
+     *
+     * @param[in] asyncBatch
+     *     This is the largest number of asynchronous tests of the same
+     *     test suite and Lua script file, found one after another,
+     *     to run together in one Lua interpreter.  It must be 1
+     *     if a pool of worker processes is given.
+     *
+     * @param[in,out] tests
+     *     These are the tests to run, grouped by test suite.  The results
+     *     of running each test are stored here.
+     *
+     * @param[in] printTestSuiteHeaders
+     *     This indicates whether or not to print a header and footer
+     *     for each test suite.
+     *
+     * @param[in] brief
+     *     This indicates whether or not to print only about tests
+     *     which fail.
+     *
+     * @param[in] verbose
+     *     This indicates whether or not to print the memory measurements
+     *     taken while running each test.
+     *
+     * @param[in] collectMetrics
+     *     This indicates whether or not to print the timing, garbage
+     *     collection, and instruction count measurements taken
+     *     while running each test.
+     *
+     * @param[in,out] passed
+     *     This is incremented for each test which passes.
+     *
+     * @param[in,out] failed
+     *     The name of each test which fails is appended here.
+     *
+     * @param[in,out] reporter
+     *     If not null, this is the reporter to which to add
+     *     the results of each test as it finishes.
+     *
+     * @param[in,out] statusFile
+     *     If not null, this is the status file to keep informed
+     *     of the tests each worker starts and finishes.
+     *
+     * @return
+     *     An indication of whether or not every test suite whose Lua
+     *     interpreter was kept for its tests was torn down successfully
+     *     is returned.
+     */
+    bool RunSelectedTests(
+        Runner& runner,
+        WorkerPool& workerPool,
+        WorkerProcessPool* processPool,
+        size_t asyncBatch,
+        std::vector< SelectedTest >& tests,
+        bool printTestSuiteHeaders,
+        bool brief,
+        bool verbose,
+        bool collectMetrics,
+        size_t& passed,
+        std::vector< std::string >& failed,
+        Reporter* reporter,
+        StatusFile* statusFile
+    ) {
+        std::vector< SystemAbstractions::Time > workerTimers(workerPool.GetNumWorkers());
+        const auto groupStarts = GroupSelectedTests(runner, tests, asyncBatch);
+        const auto groupEnd = [&](size_t group){
+            return (
+                (group + 1 == groupStarts.size())
+                ? tests.size()
+                : groupStarts[group + 1]
+            );
+        };
+
+        // Tests run together finish out of order, so the line announcing
+        // each is printed along with its results rather than before it.
+        const bool printRunLinesBeforeTests = (
+            !brief
+            && (workerPool.GetNumWorkers() == 1)
+            && (groupStarts.size() == tests.size())
+        );
+        double testSuiteDuration = 0.0;
+        size_t testSuiteSize = 0;
+        const auto formatTestResult = [&](SelectedTest& test){
+            if (
+                !brief
+                || !test.passed
+            ) {
+                test.output = FormatTestResult(
+                    test,
+                    (!brief && !printRunLinesBeforeTests),
+                    verbose,
+                    collectMetrics
+                );
+            }
+        };
+        const auto finishTest = [&](size_t index){
+            auto& test = tests[index];
+            if (!printRunLinesBeforeTests) {
+                PrintTestSuiteHeader(tests, index, printTestSuiteHeaders);
+            }
+            if (
+                (index == 0)
+                || (tests[index - 1].testSuiteName != test.testSuiteName)
+            ) {
+                testSuiteDuration = 0.0;
+                testSuiteSize = 0;
+            }
+            testSuiteDuration += test.duration;
+            ++testSuiteSize;
+            if (test.passed) {
+                ++passed;
+            } else {
+                failed.push_back(
+                    StringExtensions::sprintf(
+                        "%s.%s",
+                        test.testSuiteName.c_str(),
+                        test.testName.c_str()
+                    )
+                );
+            }
+
+            // Everything printed about the test goes out in one write,
+            // and is then let go, since it's no longer needed.
+            (void)fwrite(
+                test.output.data(),
+                test.output.length(), 1,
+                stdout
+            );
+            std::string().swap(test.output);
+            if (reporter != nullptr) {
+                ReportSelectedTest(runner, *reporter, tests, index, true);
+            }
+            if (
+                printTestSuiteHeaders
+                && (
+                    (index + 1 == tests.size())
+                    || (tests[index + 1].testSuiteName != test.testSuiteName)
+                )
+            ) {
+                printf(
+                    "[----------] %zu test%s from %s (%d ms total)\n\n",
+                    testSuiteSize,
+                    ((testSuiteSize == 1) ? "" : "s"),
+                    test.testSuiteName.c_str(),
+                    (int)ceil(testSuiteDuration * 1000.0)
+                );
+            }
+        };
+        workerPool.Run(
+            groupStarts.size(),
+            [&](size_t job, size_t worker){
+                const auto first = groupStarts[job];
+                const auto end = groupEnd(job);
+                if (statusFile != nullptr) {
+                    statusFile->BeginTest(worker, first);
+                }
+                if (end - first > 1) {
+                    std::vector< Runner::TestId > testIds;
+                    std::vector< Runner::ErrorMessageDelegate > errorMessageDelegates;
+                    for (size_t i = first; i < end; ++i) {
+                        auto& test = tests[i];
+                        testIds.push_back(test.testId);
+                        errorMessageDelegates.push_back(
+                            [&test](const std::string& message){
+                                test.errorMessages.push_back(message);
+                            }
+                        );
+                    }
+                    std::vector< Runner::TestMetrics > metrics;
+                    const auto testsPassed = runner.RunAsyncTests(
+                        testIds,
+                        errorMessageDelegates,
+                        &metrics
+                    );
+                    for (size_t i = first; i < end; ++i) {
+                        auto& test = tests[i];
+                        test.passed = testsPassed[i - first];
+                        test.metrics = metrics[i - first];
+                        test.duration = test.metrics.duration;
+                        if (statusFile != nullptr) {
+                            statusFile->EndTest(worker, test.passed);
+                        }
+                        formatTestResult(test);
+                    }
+                    return;
+                }
+                auto& test = tests[first];
+                if (printRunLinesBeforeTests) {
+                    PrintTestSuiteHeader(tests, first, printTestSuiteHeaders);
+                    printf(
+                        "[ RUN      ] %s.%s\n",
+                        test.testSuiteName.c_str(),
+                        test.testName.c_str()
+                    );
+
+                    // If the test crashes or hangs the program, this line
+                    // is the only clue about which test did it, so it
+                    // shouldn't be left waiting in a buffer.
+                    (void)fflush(stdout);
+                }
+                auto& workerTimer = workerTimers[worker];
+                const auto testStartTime = workerTimer.GetTime();
+                const auto errorMessageDelegate = [&](const std::string& message){
+                    test.errorMessages.push_back(message);
+                };
+                if (processPool == nullptr) {
+                    test.passed = runner.RunTest(
+                        test.testId,
+                        errorMessageDelegate,
+                        &test.metrics
+                    );
+                } else {
+                    test.passed = processPool->RunTest(
+                        worker,
+                        test.testId,
+                        errorMessageDelegate,
+                        &test.metrics
+                    );
+                }
+                test.duration = workerTimer.GetTime() - testStartTime;
+                if (statusFile != nullptr) {
+                    statusFile->EndTest(worker, test.passed);
+                }
+                formatTestResult(test);
+            },
+            [&](size_t job){
+                for (size_t i = groupStarts[job]; i < groupEnd(job); ++i) {
+                    finishTest(i);
+                }
+            }
+        );
+
+        // Finish any test suites whose Lua interpreters were kept
+        // for their tests, so that their teardown functions are called.
+        return runner.EndTestSuites(
+            [](const std::string& message){
+                (void)fwrite(
+                    message.data(),
+                    message.length(), 1,
+                    stdout
+                );
+            }
+        );
+    }
+
     /**
      * This function prints to the standard error stream information
      * about how to use this program.
@@ -116,9 +1055,35 @@ namespace {
     void PrintUsageInformation() {
         printf(
             "Usage: MoonUnit [--path=PATH]\n"
+            "                [--jobs=JOBS]\n"
+            "                [--allocator=ALLOCATOR]\n"
+            "                [--isolate=ISOLATION]\n"
+            "                [--reuse_state_per_suite]\n"
+            "                [--async_batch=BATCH]\n"
+            "                [--max_test_memory=BYTES]\n"
+            "                [--test_timeout=SECONDS]\n"
+            "                [--test_instruction_limit=INSTRUCTIONS]\n"
+            "                [--verbose]\n"
+            "                [--test_metrics]\n"
+            "                [--full_table_diff]\n"
+            "                [--profile=PROFILE]\n"
+            "                [--run_benchmarks]\n"
+            "                [--benchmark_filter=BENCHMARKS]\n"
+            "                [--benchmark_out=RESULTS]\n"
+            "                [--benchmark_baseline=BASELINE]\n"
+            "                [--benchmark_threshold=PERCENT]\n"
+            "                [--no_discovery_cache]\n"
+            "                [--watch]\n"
+            "                [--changed_since=CHANGES]\n"
+            "                [--dependency_graph=GRAPH]\n"
+            "                [--pack=PACK]\n"
+            "                [--from_pack=PACK]\n"
+            "                [--status_file=STATUS]\n"
+            "                [--shard_timings=TIMINGS]\n"
             "                [--gtest_list_tests]\n"
             "                [--gtest_filter=FILTER]\n"
-            "                [--gtest_output=xml:REPORT]\n"
+            "                [--gtest_brief]\n"
+            "                [--gtest_output=FORMAT:REPORT]\n"
             "\n"
             "   or: MoonUnit --help\n"
             "\n"
@@ -130,13 +1095,196 @@ namespace {
             "            (or other '.moonunit' files) or individual Lua test files to run.\n"
             "            If not specified, the current working directory is used instead.\n"
             "\n"
-            "    FILTER  One or more test names separated by colons, which selects\n"
-            "            just the named tests to be run.\n"
+            "    JOBS    The number of tests to run (and Lua test files to load while\n"
+            "            finding tests) at the same time, each on its own thread with\n"
+            "            its own Lua interpreter.  Tests are still found and reported\n"
+            "            in the same order as when running one at a time.\n"
+            "            If not specified, tests are run one at a time.\n"
+            "\n"
+            "    ALLOCATOR\n"
+            "            How to allocate the memory of each Lua interpreter, either\n"
+            "            'system' (directly from the system) or 'arena' (from an arena\n"
+            "            kept by each thread, released all at once and reused after\n"
+            "            each test, which is faster).\n"
+            "            If not specified, 'system' is used.\n"
+            "\n"
+            "    ISOLATION\n"
+            "            How to keep tests from affecting each other, either\n"
+            "            'thread' (each test gets its own Lua interpreter), 'process'\n"
+            "            (tests are also run in a pool of long-lived worker processes,\n"
+            "            one for each job, so that a test which crashes only takes\n"
+            "            down its worker, which is replaced), or 'fork' (like 'process',\n"
+            "            but each worker prepares a Lua interpreter once, as a template,\n"
+            "            and forks a copy of itself for each test, which runs the test\n"
+            "            in its copy of the template, so that no test pays to prepare\n"
+            "            its interpreter, and a test which crashes only takes down its\n"
+            "            copy).  Worker processes are not profiled, and\n"
+            "            '--reuse_state_per_suite' has no effect with 'fork'.\n"
+            "            If not specified, 'thread' is used.\n"
+            "\n"
+            "    --reuse_state_per_suite\n"
+            "            Run the tests of each test suite which a job runs in a row\n"
+            "            in one Lua interpreter, executing the test script and the\n"
+            "            suite setup function once, rather than giving each test its\n"
+            "            own fresh interpreter.  This is much faster for test scripts\n"
+            "            with expensive setup, but tests can affect each other.\n"
+            "\n"
+            "    BATCH   The largest number of asynchronous tests (registered with\n"
+            "            'moonunit:async_test') of the same test suite and Lua test file,\n"
+            "            found one after another, which a job runs together in one\n"
+            "            Lua interpreter, so that while the tasks of one test sleep or\n"
+            "            wait, the tasks of the others run.  The test script and suite\n"
+            "            setup function run once for the batch, tests can affect each\n"
+            "            other, and the memory limit applies to the whole batch.\n"
+            "            This is ignored with '--isolate=process', '--isolate=fork',\n"
+            "            or '--reuse_state_per_suite'.\n"
+            "            If not specified, each test is run on its own.\n"
+            "\n"
+            "    BYTES   The largest amount of memory, in bytes, the Lua interpreter\n"
+            "            running a test may use at any one time, including the memory\n"
+            "            used by the standard libraries and the test script itself.\n"
+            "            Any test which fails to allocate memory beyond this is failed.\n"
+            "            If not specified, tests may use any amount of memory.\n"
+            "\n"
+            "    SECONDS The longest time, in seconds, each test may run, including\n"
+            "            the time to load the test script.  Any test still running\n"
+            "            after this is stopped and failed.  Tests are only stopped\n"
+            "            while running Lua code.\n"
+            "            If not specified, tests may run for any amount of time.\n"
+            "\n"
+            "    INSTRUCTIONS\n"
+            "            The largest number of Lua instructions, to the nearest\n"
+            "            thousand, each test may run, including the test script\n"
+            "            itself.  Any test running more is stopped and failed.\n"
+            "            If not specified, tests may run any number of instructions.\n"
+            "\n"
+            "    --verbose\n"
+            "            After each test, print the peak memory used, the number of\n"
+            "            memory allocations made, and the memory still in use\n"
+            "            at the end of the test.\n"
+            "\n"
+            "    --test_metrics\n"
+            "            After each test, print the time it took (in microseconds),\n"
+            "            the processor time it used, and the number of garbage\n"
+            "            collection cycles and Lua instructions (to the nearest\n"
+            "            thousand) it ran, and add them to the report.  Counting\n"
+            "            instructions slows tests down slightly.\n"
+            "\n"
+            "    --full_table_diff\n"
+            "            When tests compare tables which differ, describe every\n"
+            "            difference found, rather than only the first one.\n"
+            "\n"
+            "    PROFILE The relative or absolute path to a file to be generated\n"
+            "            containing a profile of the Lua code run by the tests,\n"
+            "            made by sampling the Lua call stack every thousand Lua\n"
+            "            instructions, in the \"folded stack\" format used by\n"
+            "            flame graph tools.\n"
+            "            Unless this is specified, tests are not profiled.\n"
+            "\n"
+            "    --run_benchmarks\n"
+            "            After running the tests, also run the benchmarks registered\n"
+            "            with 'moonunit:benchmark', one at a time, and report how long\n"
+            "            each iteration takes (mean, median, standard deviation,\n"
+            "            and minimum, in nanoseconds).\n"
+            "\n"
+            "    BENCHMARKS\n"
+            "            A regular expression which selects just the benchmarks,\n"
+            "            named 'SUITE.NAME', which match it to be run.\n"
+            "            If not specified, all discovered benchmarks will be run.\n"
+            "\n"
+            "    RESULTS The relative or absolute path to a JSON file to be generated\n"
+            "            containing the results of the benchmarks run.\n"
+            "            Unless this is specified, no results file will be generated.\n"
+            "\n"
+            "    BASELINE\n"
+            "            The relative or absolute path to a JSON file, generated\n"
+            "            earlier with '--benchmark_out', containing results to compare\n"
+            "            against the results of the benchmarks run.  Any benchmark\n"
+            "            which got slower than in the baseline by more than PERCENT,\n"
+            "            with statistical significance (Welch's t-test, p < 0.05),\n"
+            "            is reported as a regression, and the program fails.\n"
+            "            Unless this is specified, benchmark results are not compared.\n"
+            "\n"
+            "    PERCENT The smallest slowdown, as a percentage of the mean time\n"
+            "            of a benchmark in the baseline, reported as a regression.\n"
+            "            If not specified, 5 is used.\n"
+            "\n"
+            "    --no_discovery_cache\n"
+            "            Always execute every Lua test file to find its tests.\n"
+            "            Normally, the tests found are remembered in a '.moonunit-cache'\n"
+            "            file next to the top-level '.moonunit' file, and Lua test files\n"
+            "            which haven't changed since are not executed again to find\n"
+            "            their tests.\n"
+            "\n"
+            "    --watch After running the tests, keep watching the '.moonunit' files\n"
+            "            and the folders and Lua test files they list.  Whenever\n"
+            "            a Lua test file is added or changed, find its tests again\n"
+            "            and run just those tests.  Press Ctrl+C to stop.\n"
+            "            A Lua test file is also considered changed whenever any\n"
+            "            module it loaded through 'require' changes.\n"
+            "\n"
+            "    CHANGES Either the path to a file listing the paths of changed files\n"
+            "            (one per line, relative to the current working directory),\n"
+            "            or a git revision (such as 'origin/master') against which\n"
+            "            to compare the working tree containing PATH to find the\n"
+            "            changed files, which include files git doesn't track yet.\n"
+            "            Only the tests found in changed Lua test files, or in Lua test\n"
+            "            files which loaded any changed file (directly or indirectly)\n"
+            "            through 'require' while finding their tests, are run.\n"
+            "            If not specified, all discovered tests are run.\n"
+            "\n"
+            "    GRAPH   The relative or absolute path to a JSON file to be generated\n"
+            "            listing, for each Lua test file, the files it loaded\n"
+            "            (directly or indirectly) through 'require' while finding\n"
+            "            its tests.\n"
+            "            Unless this is specified, no graph will be generated.\n"
+            "\n"
+            "    PACK    The relative or absolute path to a test pack file.  With\n"
+            "            '--pack', the Lua test files found are compiled into the pack,\n"
+            "            along with the Lua modules they load through 'require' and\n"
+            "            the tests found in them, and the program exits without\n"
+            "            running any tests.  With '--from_pack', the tests are loaded\n"
+            "            from a pack made earlier, rather than found through\n"
+            "            '.moonunit' files, and run without the Lua test files.\n"
+            "            A pack can only be used with the same version of Lua on\n"
+            "            the same kind of processor as it was made with.\n"
+            "\n"
+            "    STATUS  The relative or absolute path to a file to be kept up to date,\n"
+            "            while tests are run, with how many tests have finished,\n"
+            "            passed, and failed, how many remain, how many finish each\n"
+            "            second, how busy each worker has been, and which tests\n"
+            "            have been running longest.  The file is rewritten every\n"
+            "            second, in the Prometheus text exposition format.\n"
+            "            Unless this is specified, no status file will be kept.\n"
+            "\n"
+            "    TIMINGS The relative or absolute path to a report, generated\n"
+            "            earlier with '--gtest_output=json:', holding how long each\n"
+            "            test took.  When the tests are split into shards (using the\n"
+            "            GTEST_TOTAL_SHARDS and GTEST_SHARD_INDEX environment variables,\n"
+            "            as with Google Test), they are balanced so that all shards\n"
+            "            take about the same time, rather than dealt out in turn.\n"
+            "\n"
+            "    FILTER  One or more test name patterns ('SUITE.NAME') separated by\n"
+            "            colons, which selects just the matching tests to be run,\n"
+            "            optionally followed by a dash ('-') and more patterns\n"
+            "            selecting tests to leave out.  In patterns, '*' matches\n"
+            "            any string and '?' matches any single character.\n"
             "            If not specified, all discovered tests will be run.\n"
             "\n"
-            "    REPORT  The relative or absolute path to an XML file to be generated\n"
+            "    --gtest_brief\n"
+            "            Print only about tests which fail, and the summary at the end,\n"
+            "            rather than about every test run.  When output isn't going to\n"
+            "            a terminal, it's always collected and written in large pieces,\n"
+            "            rather than a line at a time.\n"
+            "\n"
+            "    FORMAT  The format of the report to generate, either 'xml' or 'json'.\n"
+            "\n"
+            "    REPORT  The relative or absolute path to a file to be generated\n"
             "            containing a report about the tests discovered by the test runner,\n"
-            "            in a format compatible with Google Test.\n"
+            "            in a format compatible with Google Test.  When tests are run,\n"
+            "            the report includes whether each test passed, how long it\n"
+            "            took, and why it failed, and each test suite is written to\n"
+            "            the file as soon as all its tests have finished.\n"
             "            Unless this is specified, no report will be generated.\n"
             "\n"
             "NOTE: The block below is required to fool 'C++ TestMate' -- DO NOT TOUCH\n"
@@ -167,24 +1315,209 @@ namespace {
         );
     }
 
-    /**
-     * This contains variables set through the operating system environment
-     * or the command-line arguments.
-     */
-    struct Environment {
+    /**
+     * This contains variables set through the operating system environment
+     * or the command-line arguments.
+     */
+    struct Environment {
+        /**
+         * This is the path to the folder used as a starting point
+         * for locating MoonUnit configuration files (".moonunit") which
+         * specify which directories and files to search for Lua tests.
+         */
+        std::string searchPath = ".";
+
+        /**
+         * This is the number of tests to run at the same time.
+         */
+        size_t jobs = 1;
+
+        /**
+         * This selects how the memory of Lua interpreters is allocated.
+         */
+        Runner::Allocator allocator = Runner::Allocator::System;
+
+        /**
+         * This flag indicates whether or not to run tests
+         * in separate worker processes.
+         */
+        bool isolateProcesses = false;
+
+        /**
+         * This flag indicates whether or not each worker process forks
+         * a copy of itself, along with a Lua interpreter it prepared as
+         * a template, to run each test.
+         */
+        bool forkPerTest = false;
+
+        /**
+         * This is the largest number of asynchronous tests of the same
+         * test suite and script which a job runs together
+         * in one Lua interpreter.
+         */
+        size_t asyncBatch = 1;
+
+        /**
+         * If not zero, this is the largest number of bytes of memory
+         * each test is allowed to use at any one time.
+         */
+        size_t maxTestMemory = 0;
+
+        /**
+         * If not zero, this is the longest time, in seconds,
+         * each test is allowed to run.
+         */
+        double testTimeout = 0.0;
+
+        /**
+         * If not zero, this is the largest number of Lua instructions
+         * each test is allowed to run.
+         */
+        uint64_t testInstructionLimit = 0;
+
+        /**
+         * This flag indicates whether or not the program will print
+         * the measurements taken while running each test.
+         */
+        bool verbose = false;
+
+        /**
+         * This flag indicates whether or not the program will measure
+         * the processor time used by each test, and count the garbage
+         * collection cycles and Lua instructions each test runs.
+         */
+        bool collectMetrics = false;
+
+        /**
+         * This flag indicates whether or not to describe all differences
+         * found when tests compare tables, rather than only the first one.
+         */
+        bool fullTableDiff = false;
+
+        /**
+         * This flag indicates whether or not to run all the tests of each
+         * test suite which a job runs in a row in one Lua interpreter.
+         */
+        bool reuseStatePerSuite = false;
+
+        /**
+         * If not empty, the program will profile the tests, and write
+         * the profile to the file at this path.
+         */
+        std::string profilePath;
+
+        /**
+         * This flag indicates whether or not the program will run
+         * benchmarks after running tests.
+         */
+        bool runBenchmarks = false;
+
+        /**
+         * If not empty, this is a regular expression which selects
+         * the benchmarks to run, by matching their full names.
+         */
+        std::string benchmarkFilter;
+
+        /**
+         * If not empty, the program will write the results of
+         * the benchmarks run to the file at this path.
+         */
+        std::string benchmarkResultsPath;
+
+        /**
+         * If not empty, the program will compare the results of the
+         * benchmarks run with the results in the file at this path,
+         * and fail if any benchmark got significantly slower.
+         */
+        std::string benchmarkBaselinePath;
+
+        /**
+         * This is the smallest relative slowdown of a benchmark,
+         * compared to the baseline, considered a regression.
+         */
+        double benchmarkThreshold = 0.05;
+
+        /**
+         * This flag indicates whether or not the program will remember
+         * which tests were found in which Lua test files, so that it
+         * doesn't have to execute unchanged files again to find their tests.
+         */
+        bool useDiscoveryCache = true;
+
         /**
-         * This is the path to the folder used as a starting point
-         * for locating MoonUnit configuration files (".moonunit") which
-         * specify which directories and files to search for Lua tests.
+         * This flag indicates whether or not the program will keep
+         * watching for changes to the Lua test files after running
+         * the tests, running again the tests of any files which change.
          */
-        std::string searchPath = ".";
+        bool watch = false;
+
+        /**
+         * If not empty, this is either the path to a file listing the
+         * paths of changed files, or a git revision against which to compare
+         * the working tree, and the program will run only the tests
+         * which could be affected by the changed files.
+         */
+        std::string changedSince;
+
+        /**
+         * If not empty, the program will write the graph of which
+         * Lua test files require which other files to the file at this path.
+         */
+        std::string dependencyGraphPath;
+
+        /**
+         * If not empty, the program will save the tests found to a test
+         * pack at this path, rather than running them.
+         */
+        std::string packPath;
+
+        /**
+         * If not empty, the program will load the tests from the test pack
+         * at this path, rather than finding them through configuration files.
+         */
+        std::string fromPackPath;
+
+        /**
+         * If not empty, the program will keep the file at this path
+         * up to date with the progress of running the tests.
+         */
+        std::string statusFilePath;
+
+        /**
+         * This is the number of shards into which the tests are split,
+         * so that they can be run by separate instances of the program.
+         */
+        size_t totalShards = 1;
+
+        /**
+         * This is the index of the shard whose tests this instance
+         * of the program runs.
+         */
+        size_t shardIndex = 0;
+
+        /**
+         * If not empty, the program will read how long each test took
+         * from the report at this path, to balance the shards.
+         */
+        std::string shardTimingsPath;
+
+        /**
+         * If not empty, the program will create a file at this path
+         * to indicate that it supports sharding.
+         */
+        std::string shardStatusPath;
 
         /**
-         * If not empty, the program will generate an XML report
+         * If not empty, the program will generate a report
          * to the file at this path.
          */
         std::string reportPath;
 
+        /**
+         * This is the format of the report to generate, if any.
+         */
+        Reporter::Format reportFormat = Reporter::Format::Xml;
+
         /**
          * If not empty, this holds a list (delimited by colons) of
          * the names of tests to run out of all the tests found.
@@ -199,6 +1532,12 @@ namespace {
          */
         bool listTests = false;
 
+        /**
+         * This flag indicates whether or not the program will print
+         * only about tests which fail, and the summary at the end.
+         */
+        bool brief = false;
+
         /**
          * This flag indicates whether or not the program will output
          * help/usage information and then exit without searching for
@@ -235,22 +1574,259 @@ namespace {
             const std::string arg(argv[i]);
             static const std::string pathOptionPrefix = "--path=";
             static const size_t pathOptionPrefixLength = pathOptionPrefix.length();
+            static const std::string jobsOptionPrefix = "--jobs=";
+            static const size_t jobsOptionPrefixLength = jobsOptionPrefix.length();
+            static const std::string allocatorOptionPrefix = "--allocator=";
+            static const size_t allocatorOptionPrefixLength = allocatorOptionPrefix.length();
+            static const std::string isolateOptionPrefix = "--isolate=";
+            static const size_t isolateOptionPrefixLength = isolateOptionPrefix.length();
+            static const std::string asyncBatchOptionPrefix = "--async_batch=";
+            static const size_t asyncBatchOptionPrefixLength = asyncBatchOptionPrefix.length();
+            static const std::string maxTestMemoryOptionPrefix = "--max_test_memory=";
+            static const size_t maxTestMemoryOptionPrefixLength = maxTestMemoryOptionPrefix.length();
+            static const std::string testTimeoutOptionPrefix = "--test_timeout=";
+            static const size_t testTimeoutOptionPrefixLength = testTimeoutOptionPrefix.length();
+            static const std::string testInstructionLimitOptionPrefix = "--test_instruction_limit=";
+            static const size_t testInstructionLimitOptionPrefixLength = testInstructionLimitOptionPrefix.length();
+            static const std::string profileOptionPrefix = "--profile=";
+            static const size_t profileOptionPrefixLength = profileOptionPrefix.length();
+            static const std::string benchmarkFilterOptionPrefix = "--benchmark_filter=";
+            static const size_t benchmarkFilterOptionPrefixLength = benchmarkFilterOptionPrefix.length();
+            static const std::string benchmarkResultsOptionPrefix = "--benchmark_out=";
+            static const size_t benchmarkResultsOptionPrefixLength = benchmarkResultsOptionPrefix.length();
+            static const std::string benchmarkBaselineOptionPrefix = "--benchmark_baseline=";
+            static const size_t benchmarkBaselineOptionPrefixLength = benchmarkBaselineOptionPrefix.length();
+            static const std::string benchmarkThresholdOptionPrefix = "--benchmark_threshold=";
+            static const size_t benchmarkThresholdOptionPrefixLength = benchmarkThresholdOptionPrefix.length();
+            static const std::string changedSinceOptionPrefix = "--changed_since=";
+            static const size_t changedSinceOptionPrefixLength = changedSinceOptionPrefix.length();
+            static const std::string dependencyGraphOptionPrefix = "--dependency_graph=";
+            static const size_t dependencyGraphOptionPrefixLength = dependencyGraphOptionPrefix.length();
+            static const std::string packOptionPrefix = "--pack=";
+            static const size_t packOptionPrefixLength = packOptionPrefix.length();
+            static const std::string fromPackOptionPrefix = "--from_pack=";
+            static const size_t fromPackOptionPrefixLength = fromPackOptionPrefix.length();
+            static const std::string statusFileOptionPrefix = "--status_file=";
+            static const size_t statusFileOptionPrefixLength = statusFileOptionPrefix.length();
+            static const std::string shardTimingsOptionPrefix = "--shard_timings=";
+            static const size_t shardTimingsOptionPrefixLength = shardTimingsOptionPrefix.length();
             static const std::string gtestFilterOptionPrefix = "--gtest_filter=";
             static const size_t gtestFilterOptionPrefixLength = gtestFilterOptionPrefix.length();
-            static const std::string reportArgumentPrefix = "--gtest_output=xml:";
-            static const auto reportArgumentPrefixLength = reportArgumentPrefix.length();
+            static const std::string xmlReportArgumentPrefix = "--gtest_output=xml:";
+            static const auto xmlReportArgumentPrefixLength = xmlReportArgumentPrefix.length();
+            static const std::string jsonReportArgumentPrefix = "--gtest_output=json:";
+            static const auto jsonReportArgumentPrefixLength = jsonReportArgumentPrefix.length();
             if (arg.substr(0, pathOptionPrefixLength) == pathOptionPrefix) {
                 environment.searchPath = arg.substr(pathOptionPrefixLength);
+            } else if (arg.substr(0, jobsOptionPrefixLength) == jobsOptionPrefix) {
+                const auto jobs = arg.substr(jobsOptionPrefixLength);
+                char* jobsEnd = nullptr;
+                environment.jobs = (size_t)strtoul(jobs.c_str(), &jobsEnd, 10);
+                if (
+                    jobs.empty()
+                    || (*jobsEnd != '\0')
+                    || (environment.jobs == 0)
+                ) {
+                    return false;
+                }
+            } else if (arg == "--no_discovery_cache") {
+                environment.useDiscoveryCache = false;
+            } else if (arg.substr(0, allocatorOptionPrefixLength) == allocatorOptionPrefix) {
+                const auto allocator = arg.substr(allocatorOptionPrefixLength);
+                if (allocator == "system") {
+                    environment.allocator = Runner::Allocator::System;
+                } else if (allocator == "arena") {
+                    environment.allocator = Runner::Allocator::Arena;
+                } else {
+                    return false;
+                }
+            } else if (arg.substr(0, isolateOptionPrefixLength) == isolateOptionPrefix) {
+                const auto isolation = arg.substr(isolateOptionPrefixLength);
+                if (isolation == "thread") {
+                    environment.isolateProcesses = false;
+                    environment.forkPerTest = false;
+                } else if (isolation == "process") {
+                    environment.isolateProcesses = true;
+                    environment.forkPerTest = false;
+                } else if (isolation == "fork") {
+                    environment.isolateProcesses = true;
+                    environment.forkPerTest = true;
+                } else {
+                    return false;
+                }
+            } else if (arg.substr(0, maxTestMemoryOptionPrefixLength) == maxTestMemoryOptionPrefix) {
+                const auto maxTestMemory = arg.substr(maxTestMemoryOptionPrefixLength);
+                char* maxTestMemoryEnd = nullptr;
+                environment.maxTestMemory = (size_t)strtoull(maxTestMemory.c_str(), &maxTestMemoryEnd, 10);
+                if (
+                    maxTestMemory.empty()
+                    || (*maxTestMemoryEnd != '\0')
+                    || (environment.maxTestMemory == 0)
+                ) {
+                    return false;
+                }
+            } else if (arg.substr(0, testTimeoutOptionPrefixLength) == testTimeoutOptionPrefix) {
+                const auto testTimeout = arg.substr(testTimeoutOptionPrefixLength);
+                char* testTimeoutEnd = nullptr;
+                environment.testTimeout = strtod(testTimeout.c_str(), &testTimeoutEnd);
+                if (
+                    testTimeout.empty()
+                    || (*testTimeoutEnd != '\0')
+                    || !(environment.testTimeout > 0.0)
+                ) {
+                    return false;
+                }
+            } else if (arg.substr(0, testInstructionLimitOptionPrefixLength) == testInstructionLimitOptionPrefix) {
+                const auto testInstructionLimit = arg.substr(testInstructionLimitOptionPrefixLength);
+                char* testInstructionLimitEnd = nullptr;
+                environment.testInstructionLimit = (uint64_t)strtoull(testInstructionLimit.c_str(), &testInstructionLimitEnd, 10);
+                if (
+                    testInstructionLimit.empty()
+                    || (*testInstructionLimitEnd != '\0')
+                    || (environment.testInstructionLimit == 0)
+                ) {
+                    return false;
+                }
+            } else if (arg == "--verbose") {
+                environment.verbose = true;
+            } else if (arg == "--test_metrics") {
+                environment.collectMetrics = true;
+            } else if (arg == "--full_table_diff") {
+                environment.fullTableDiff = true;
+            } else if (arg == "--reuse_state_per_suite") {
+                environment.reuseStatePerSuite = true;
+            } else if (arg.substr(0, asyncBatchOptionPrefixLength) == asyncBatchOptionPrefix) {
+                const auto asyncBatch = arg.substr(asyncBatchOptionPrefixLength);
+                char* asyncBatchEnd = nullptr;
+                environment.asyncBatch = (size_t)strtoul(asyncBatch.c_str(), &asyncBatchEnd, 10);
+                if (
+                    asyncBatch.empty()
+                    || (*asyncBatchEnd != '\0')
+                    || (environment.asyncBatch == 0)
+                ) {
+                    return false;
+                }
+            } else if (arg.substr(0, profileOptionPrefixLength) == profileOptionPrefix) {
+                environment.profilePath = arg.substr(profileOptionPrefixLength);
+            } else if (arg == "--run_benchmarks") {
+                environment.runBenchmarks = true;
+            } else if (arg.substr(0, benchmarkFilterOptionPrefixLength) == benchmarkFilterOptionPrefix) {
+                environment.benchmarkFilter = arg.substr(benchmarkFilterOptionPrefixLength);
+            } else if (arg.substr(0, benchmarkResultsOptionPrefixLength) == benchmarkResultsOptionPrefix) {
+                environment.benchmarkResultsPath = arg.substr(benchmarkResultsOptionPrefixLength);
+            } else if (arg.substr(0, benchmarkBaselineOptionPrefixLength) == benchmarkBaselineOptionPrefix) {
+                environment.benchmarkBaselinePath = arg.substr(benchmarkBaselineOptionPrefixLength);
+                if (environment.benchmarkBaselinePath.empty()) {
+                    return false;
+                }
+            } else if (arg.substr(0, benchmarkThresholdOptionPrefixLength) == benchmarkThresholdOptionPrefix) {
+                const auto benchmarkThreshold = arg.substr(benchmarkThresholdOptionPrefixLength);
+                char* benchmarkThresholdEnd = nullptr;
+                environment.benchmarkThreshold = strtod(benchmarkThreshold.c_str(), &benchmarkThresholdEnd) / 100.0;
+                if (
+                    benchmarkThreshold.empty()
+                    || (*benchmarkThresholdEnd != '\0')
+                    || !(environment.benchmarkThreshold >= 0.0)
+                ) {
+                    return false;
+                }
+            } else if (arg.substr(0, changedSinceOptionPrefixLength) == changedSinceOptionPrefix) {
+                environment.changedSince = arg.substr(changedSinceOptionPrefixLength);
+                if (environment.changedSince.empty()) {
+                    return false;
+                }
+            } else if (arg.substr(0, dependencyGraphOptionPrefixLength) == dependencyGraphOptionPrefix) {
+                environment.dependencyGraphPath = arg.substr(dependencyGraphOptionPrefixLength);
+            } else if (arg.substr(0, packOptionPrefixLength) == packOptionPrefix) {
+                environment.packPath = arg.substr(packOptionPrefixLength);
+                if (
+                    environment.packPath.empty()
+                    || !environment.fromPackPath.empty()
+                ) {
+                    return false;
+                }
+            } else if (arg.substr(0, fromPackOptionPrefixLength) == fromPackOptionPrefix) {
+                environment.fromPackPath = arg.substr(fromPackOptionPrefixLength);
+                if (
+                    environment.fromPackPath.empty()
+                    || !environment.packPath.empty()
+                ) {
+                    return false;
+                }
+            } else if (arg.substr(0, statusFileOptionPrefixLength) == statusFileOptionPrefix) {
+                environment.statusFilePath = arg.substr(statusFileOptionPrefixLength);
+                if (environment.statusFilePath.empty()) {
+                    return false;
+                }
+            } else if (arg.substr(0, shardTimingsOptionPrefixLength) == shardTimingsOptionPrefix) {
+                environment.shardTimingsPath = arg.substr(shardTimingsOptionPrefixLength);
+                if (environment.shardTimingsPath.empty()) {
+                    return false;
+                }
+            } else if (arg == "--watch") {
+                environment.watch = true;
             } else if (arg == "--help") {
                 environment.helpRequested = true;
             } else if (arg == "--gtest_list_tests") {
                 environment.listTests = true;
+            } else if (arg == "--gtest_brief") {
+                environment.brief = true;
             } else if (arg.substr(0, gtestFilterOptionPrefixLength) == gtestFilterOptionPrefix) {
                 environment.filter = arg.substr(gtestFilterOptionPrefixLength);
-            } else if (arg.substr(0, reportArgumentPrefixLength) == reportArgumentPrefix) {
-                environment.reportPath = arg.substr(reportArgumentPrefixLength);
+            } else if (arg.substr(0, xmlReportArgumentPrefixLength) == xmlReportArgumentPrefix) {
+                environment.reportPath = arg.substr(xmlReportArgumentPrefixLength);
+                environment.reportFormat = Reporter::Format::Xml;
+            } else if (arg.substr(0, jsonReportArgumentPrefixLength) == jsonReportArgumentPrefix) {
+                environment.reportPath = arg.substr(jsonReportArgumentPrefixLength);
+                environment.reportFormat = Reporter::Format::Json;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * This function updates the program environment to incorporate
+     * any applicable environment variables.  These are the variables
+     * Google Test uses to split tests into shards.
+     *
+     * @param[in,out] environment
+     *     This is the environment to update.
+     *
+     * @return
+     *     An indication of whether or not the function succeeded is returned.
+     */
+    bool ProcessEnvironmentVariables(Environment& environment) {
+        const auto totalShards = getenv("GTEST_TOTAL_SHARDS");
+        const auto shardIndex = getenv("GTEST_SHARD_INDEX");
+        if (
+            (totalShards != NULL)
+            && (shardIndex != NULL)
+        ) {
+            char* totalShardsEnd = nullptr;
+            char* shardIndexEnd = nullptr;
+            environment.totalShards = (size_t)strtoul(totalShards, &totalShardsEnd, 10);
+            environment.shardIndex = (size_t)strtoul(shardIndex, &shardIndexEnd, 10);
+            if (
+                (*totalShards == '\0')
+                || (*totalShardsEnd != '\0')
+                || (*shardIndex == '\0')
+                || (*shardIndexEnd != '\0')
+                || (environment.totalShards == 0)
+                || (environment.shardIndex >= environment.totalShards)
+            ) {
+                fprintf(
+                    stderr,
+                    "ERROR: Invalid sharding: GTEST_TOTAL_SHARDS='%s', GTEST_SHARD_INDEX='%s'\n",
+                    totalShards,
+                    shardIndex
+                );
+                return false;
             }
         }
+        const auto shardStatusPath = getenv("GTEST_SHARD_STATUS_FILE");
+        if (shardStatusPath != NULL) {
+            environment.shardStatusPath = shardStatusPath;
+        }
         return true;
     }
 
@@ -272,12 +1848,27 @@ int main(int argc, char* argv[]) {
     _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif /* _WIN32 */
 
+    // When output isn't going to a terminal, such as when it's
+    // collected into a log, it's buffered so that it's written in
+    // large pieces, rather than a line at a time.
+#ifdef _WIN32
+    const bool outputIsTerminal = (_isatty(_fileno(stdout)) != 0);
+#else /* POSIX */
+    const bool outputIsTerminal = (isatty(fileno(stdout)) != 0);
+#endif /* _WIN32 / POSIX */
+    if (!outputIsTerminal) {
+        (void)setvbuf(stdout, NULL, _IOFBF, outputBufferSize);
+    }
+
     // Process command line and environment variables.
     Environment environment;
     if (!ProcessCommandLineArguments(argc, argv, environment)) {
         PrintUsageInformation();
         return EXIT_FAILURE;
     }
+    if (!ProcessEnvironmentVariables(environment)) {
+        return EXIT_FAILURE;
+    }
 
     // If help is requested, print usage information and exit early.
     if (environment.helpRequested) {
@@ -285,58 +1876,231 @@ int main(int argc, char* argv[]) {
         return EXIT_SUCCESS;
     }
 
-    // Locate the highest-level ancestor folder of the current working
-    // folder that contains a ".moonunit" file, and configure the runner
-    // using it (and any other ".moonunit" files found indirectly).
+    // Unless loading tests from a test pack, locate the highest-level
+    // ancestor folder of the current working folder that contains a
+    // ".moonunit" file, and configure the runner using it (and any other
+    // ".moonunit" files found indirectly).
+    //
+    // The discovery index is kept next to the highest-level ".moonunit"
+    // file, so that it's shared no matter where in the project
+    // the program is run from.  It isn't used when making a test pack,
+    // because the modules each Lua test file loads through "require"
+    // are only learned by executing the file.
     Runner runner;
-    const auto searchPathSegments = StringExtensions::Split(
-        CanonicalPath(environment.searchPath),
-        '/'
+    Runner::Options runnerOptions;
+    runnerOptions.jobs = environment.jobs;
+    runnerOptions.allocator = environment.allocator;
+    runnerOptions.maxTestMemory = environment.maxTestMemory;
+    runnerOptions.testTimeout = environment.testTimeout;
+    runnerOptions.testInstructionLimit = environment.testInstructionLimit;
+    runnerOptions.collectMetrics = environment.collectMetrics;
+    runnerOptions.fullTableDiff = environment.fullTableDiff;
+    // Each test forked from a template is run in its own copy of the
+    // template, which is gone once the test finishes, so there's no
+    // interpreter left to reuse for the next test.
+    runnerOptions.reuseStatePerSuite = (
+        environment.reuseStatePerSuite
+        && !environment.forkPerTest
     );
-    for (size_t i = 1; i <= searchPathSegments.size(); ++i) {
-        std::vector< std::string > possibleConfigurationFilePathSegments(
-            searchPathSegments.begin(),
-            searchPathSegments.begin() + i
-        );
-        possibleConfigurationFilePathSegments.push_back(".moonunit");
-        SystemAbstractions::File possibleConfigurationFile(
-            StringExtensions::Join(possibleConfigurationFilePathSegments, "/")
+    runnerOptions.profile = !environment.profilePath.empty();
+    runner.SetOptions(runnerOptions);
+    std::string discoveryIndexPath;
+    if (!environment.fromPackPath.empty()) {
+        // A test pack holds everything needed to run its tests, so the
+        // configuration files aren't used, and there's nothing to watch.
+        if (
+            environment.watch
+            || !environment.changedSince.empty()
+        ) {
+            fprintf(stderr, "ERROR: Tests loaded from a test pack can't be checked for changes\n");
+            return EXIT_FAILURE;
+        }
+        if (
+            !runner.LoadPack(
+                environment.fromPackPath,
+                [](const std::string& message){
+                    fprintf(stderr, "%s\n", message.c_str());
+                }
+            )
+        ) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        const auto searchPathSegments = StringExtensions::Split(
+            CanonicalPath(environment.searchPath),
+            '/'
         );
-        if (possibleConfigurationFile.IsExisting()) {
-            runner.Configure(
-                possibleConfigurationFile,
+        for (size_t i = 1; i <= searchPathSegments.size(); ++i) {
+            std::vector< std::string > possibleConfigurationFilePathSegments(
+                searchPathSegments.begin(),
+                searchPathSegments.begin() + i
+            );
+            possibleConfigurationFilePathSegments.push_back(".moonunit");
+            SystemAbstractions::File possibleConfigurationFile(
+                StringExtensions::Join(possibleConfigurationFilePathSegments, "/")
+            );
+            if (possibleConfigurationFile.IsExisting()) {
+                if (
+                    environment.useDiscoveryCache
+                    && environment.packPath.empty()
+                    && discoveryIndexPath.empty()
+                ) {
+                    possibleConfigurationFilePathSegments.back() = ".moonunit-cache";
+                    discoveryIndexPath = StringExtensions::Join(possibleConfigurationFilePathSegments, "/");
+                    runner.LoadDiscoveryIndex(discoveryIndexPath);
+                }
+                runner.Configure(
+                    possibleConfigurationFile,
+                    [](const std::string& message){
+                        (void)fwrite(message.data(), message.length(), 1, stderr);
+                    }
+                );
+            }
+        }
+        if (!discoveryIndexPath.empty()) {
+            (void)runner.SaveDiscoveryIndex(discoveryIndexPath);
+        }
+    }
+
+    // Generate the dependency graph if requested.
+    if (!environment.dependencyGraphPath.empty()) {
+        FILE* dependencyGraphFile = fopen(environment.dependencyGraphPath.c_str(), "wt");
+        if (dependencyGraphFile != NULL) {
+            const auto dependencyGraph = runner.GetDependencyGraph();
+            (void)fwrite(dependencyGraph.data(), dependencyGraph.length(), 1, dependencyGraphFile);
+            (void)fclose(dependencyGraphFile);
+        }
+    }
+
+    // If requested, save the tests found to a test pack,
+    // rather than running them.
+    if (!environment.packPath.empty()) {
+        if (
+            !runner.SavePack(
+                environment.packPath,
                 [](const std::string& message){
-                    (void)fwrite(message.data(), message.length(), 1, stderr);
+                    fprintf(stderr, "%s\n", message.c_str());
                 }
+            )
+        ) {
+            return EXIT_FAILURE;
+        }
+        const auto numTests = runner.GetNumTests();
+        printf(
+            "Packed %zu test%s into '%s'\n",
+            numTests,
+            ((numTests == 1) ? "" : "s"),
+            environment.packPath.c_str()
+        );
+        return EXIT_SUCCESS;
+    }
+
+    // If only the tests affected by changes are to be run,
+    // figure out which tests those are.
+    std::set< std::pair< std::string, std::string > > affectedTests;
+    if (!environment.changedSince.empty()) {
+        std::vector< std::string > changedFilePaths;
+        if (!FindChangedFiles(
+                environment.changedSince,
+                environment.searchPath,
+                changedFilePaths
+            )) {
+            fprintf(
+                stderr,
+                "ERROR: Unable to determine which files changed since '%s'\n",
+                environment.changedSince.c_str()
             );
+            return EXIT_FAILURE;
         }
+        const auto affectedTestList = runner.GetTestsAffectedBy(changedFilePaths);
+        affectedTests.insert(affectedTestList.begin(), affectedTestList.end());
     }
 
     // List or run all unit tests.
     bool success = true;
-    std::unordered_map< std::string, std::unordered_set< std::string > > selectedTests;
-    size_t totalTests = 0, totalTestSuites = 0;
-    if (environment.filter.empty()) {
-        const auto testSuiteNames = runner.GetTestSuiteNames();
-        totalTestSuites = testSuiteNames.size();
-        for (const auto& testSuiteName: testSuiteNames) {
-            totalTests += runner.GetTestNames(testSuiteName).size();
-        }
-    } else {
+    const TestFilter filter(environment.filter);
+    if (!environment.filter.empty()) {
         printf("Note: Google Test filter = %s\n", environment.filter.c_str());
-        for (const auto& filter: StringExtensions::Split(environment.filter, ':')) {
-            ++totalTestSuites;
-            const auto delimiterIndex = filter.find('.');
-            if (delimiterIndex != std::string::npos) {
-                const auto testSuiteName = filter.substr(0, delimiterIndex);
-                const auto testName = filter.substr(delimiterIndex + 1);
-                if (selectedTests[testSuiteName].insert(testName).second) {
-                    ++totalTests;
+    }
+    std::vector< SelectedTest > tests;
+    runner.VisitTests(
+        [&](
+            Runner::TestId testId,
+            const std::string& testSuiteName,
+            const std::string& testName
+        ){
+            if (!filter.Matches(testSuiteName, testName)) {
+                return;
+            }
+            if (
+                !environment.changedSince.empty()
+                && (affectedTests.find(std::make_pair(testSuiteName, testName)) == affectedTests.end())
+            ) {
+                return;
+            }
+            if (environment.listTests) {
+                if (
+                    tests.empty()
+                    || (tests.back().testSuiteName != testSuiteName)
+                ) {
+                    printf("%s.\n", testSuiteName.c_str());
                 }
+                printf("  %s\n", testName.c_str());
             }
+            SelectedTest test;
+            test.testId = testId;
+            test.testSuiteName = testSuiteName;
+            test.testName = testName;
+            tests.push_back(std::move(test));
+        }
+    );
+
+    // If the tests are split into shards, keep only the tests
+    // of this instance's shard.
+    const bool sharded = (
+        (environment.totalShards > 1)
+        && !environment.listTests
+    );
+    if (!environment.shardStatusPath.empty()) {
+        FILE* shardStatusFile = fopen(environment.shardStatusPath.c_str(), "wb");
+        if (shardStatusFile != NULL) {
+            (void)fclose(shardStatusFile);
         }
     }
-    if (!environment.listTests) {
+    if (sharded) {
+        TestDurations durations;
+        if (
+            !environment.shardTimingsPath.empty()
+            && !LoadTestDurations(environment.shardTimingsPath, durations)
+        ) {
+            fprintf(
+                stderr,
+                "ERROR: Unable to read test timings from '%s'\n",
+                environment.shardTimingsPath.c_str()
+            );
+            return EXIT_FAILURE;
+        }
+        SelectShard(tests, environment.totalShards, environment.shardIndex, durations);
+        printf(
+            "Note: This is test shard %zu of %zu.\n",
+            environment.shardIndex + 1,
+            environment.totalShards
+        );
+    }
+    const auto totalTests = tests.size();
+    size_t totalTestSuites = 0;
+    for (size_t i = 0; i < tests.size(); ++i) {
+        if (
+            (i == 0)
+            || (tests[i - 1].testSuiteName != tests[i].testSuiteName)
+        ) {
+            ++totalTestSuites;
+        }
+    }
+    if (
+        !environment.listTests
+        && !environment.brief
+    ) {
         printf(
             "[==========] Running %zu test%s from %zu test suite%s.\n"
             "[----------] Global test environment set-up.\n",
@@ -346,107 +2110,117 @@ int main(int argc, char* argv[]) {
             ((totalTestSuites == 1) ? "" : "s")
         );
     }
+
+    // If requested, start the worker processes in which to run tests.
+    // They're started before the report is opened, so that they don't
+    // inherit it.
+    WorkerProcessPool processPool(runner);
+    const bool isolateProcesses = (
+        environment.isolateProcesses
+        && !environment.listTests
+    );
+    if (
+        isolateProcesses
+        && !processPool.Start(environment.jobs, environment.testTimeout, environment.forkPerTest)
+    ) {
+        fprintf(stderr, "ERROR: Unable to start worker processes\n");
+        return EXIT_FAILURE;
+    }
+
+    // Asynchronous tests are only run together in the threads
+    // of this process, each batch in a fresh Lua interpreter.
+    const size_t asyncBatch = (
+        (
+            isolateProcesses
+            || environment.reuseStatePerSuite
+        )
+        ? 1
+        : environment.asyncBatch
+    );
+
+    // Generate report if requested.  The report is written as tests
+    // finish, or all at once if just listing the tests.
+    Reporter reporter(environment.reportFormat, environment.collectMetrics);
+    const bool generateReport = !environment.reportPath.empty();
+    if (
+        generateReport
+        && !reporter.Open(environment.reportPath, tests.size())
+    ) {
+        fprintf(
+            stderr,
+            "ERROR: Unable to create report '%s'\n",
+            environment.reportPath.c_str()
+        );
+        return EXIT_FAILURE;
+    }
     size_t passed = 0;
     std::vector< std::string > failed;
     SystemAbstractions::Time timer;
     const auto runnerStartTime = timer.GetTime();
-    for (const auto& testSuiteName: runner.GetTestSuiteNames()) {
-        const auto selectedTestsEntry = selectedTests.find(testSuiteName);
+    WorkerPool workerPool(environment.jobs);
+    StatusFile statusFile;
+    const bool writeStatusFile = !environment.statusFilePath.empty();
+    const bool printTestSuiteHeaders = (
+        !environment.filter.empty()
+        && !environment.brief
+    );
+    if (environment.listTests) {
+        if (generateReport) {
+            for (size_t i = 0; i < tests.size(); ++i) {
+                ReportSelectedTest(runner, reporter, tests, i, false);
+            }
+        }
+    } else {
         if (
-            !selectedTests.empty()
-            && (selectedTestsEntry == selectedTests.end())
+            writeStatusFile
+            && !StartStatusFile(
+                statusFile,
+                environment.statusFilePath,
+                tests,
+                workerPool.GetNumWorkers()
+            )
         ) {
-            continue;
-        }
-        if (environment.listTests) {
-            printf("%s.\n", testSuiteName.c_str());
-        } else if (selectedTestsEntry != selectedTests.end()) {
-            printf(
-                "[----------] %zu test%s from %s\n",
-                selectedTestsEntry->second.size(),
-                ((selectedTestsEntry->second.size() == 1) ? "" : "s"),
-                testSuiteName.c_str()
-            );
-        }
-        const auto testSuiteStartTime = timer.GetTime();
-        for (const auto& testName: runner.GetTestNames(testSuiteName)) {
-            if (selectedTestsEntry != selectedTests.end()) {
-                const auto selectedTestEntry = selectedTestsEntry->second.find(testName);
-                if (selectedTestEntry == selectedTestsEntry->second.end()) {
-                    continue;
-                }
-            }
-            if (environment.listTests) {
-                printf("  %s\n", testName.c_str());
-            } else {
-                printf(
-                    "[ RUN      ] %s.%s\n",
-                    testSuiteName.c_str(),
-                    testName.c_str()
-                );
-                std::vector< std::string > errorMessages;
-                const auto testStartTime = timer.GetTime();
-                const auto testPassed = runner.RunTest(
-                    testSuiteName,
-                    testName,
-                    [&](const std::string& message){
-                        errorMessages.push_back(message);
-                    }
-                );
-                const auto testEndTime = timer.GetTime();
-                if (testPassed) {
-                    ++passed;
-                    printf(
-                        "[       OK ] %s.%s (%d ms)\n",
-                        testSuiteName.c_str(),
-                        testName.c_str(),
-                        (int)ceil((testEndTime - testStartTime) * 1000.0)
-                    );
-                } else {
-                    failed.push_back(
-                        StringExtensions::sprintf(
-                            "%s.%s",
-                            testSuiteName.c_str(),
-                            testName.c_str()
-                        )
-                    );
-                    if (!errorMessages.empty()) {
-                        for (const auto& line: errorMessages) {
-                            (void)fwrite(
-                                line.data(),
-                                line.length(), 1,
-                                stdout
-                            );
-                        }
-                    }
-                    printf(
-                        "[  FAILED  ] %s.%s (%d ms)\n",
-                        testSuiteName.c_str(),
-                        testName.c_str(),
-                        (int)ceil((testEndTime - testStartTime) * 1000.0)
-                    );
-                    success = false;
-                }
-            }
+            return EXIT_FAILURE;
         }
-        const auto testSuiteEndTime = timer.GetTime();
         if (
-            !environment.listTests
-            && (selectedTestsEntry != selectedTests.end())
+            !RunSelectedTests(
+                runner,
+                workerPool,
+                (isolateProcesses ? &processPool : nullptr),
+                asyncBatch,
+                tests,
+                printTestSuiteHeaders,
+                environment.brief,
+                environment.verbose,
+                environment.collectMetrics,
+                passed,
+                failed,
+                (generateReport ? &reporter : nullptr),
+                (writeStatusFile ? &statusFile : nullptr)
+            )
         ) {
-            printf(
-                "[----------] %zu test%s from %s (%d ms total)\n\n",
-                selectedTestsEntry->second.size(),
-                ((selectedTestsEntry->second.size() == 1) ? "" : "s"),
-                testSuiteName.c_str(),
-                (int)ceil((testSuiteEndTime - testSuiteStartTime) * 1000.0)
-            );
+            success = false;
         }
+        statusFile.Stop();
+    }
+    if (
+        generateReport
+        && !reporter.Close()
+    ) {
+        fprintf(
+            stderr,
+            "ERROR: Unable to write report '%s'\n",
+            environment.reportPath.c_str()
+        );
+        success = false;
     }
+    success = success && failed.empty();
     const auto runnerEndTime = timer.GetTime();
     if (!environment.listTests) {
+        if (!environment.brief) {
+            printf("[----------] Global test environment tear-down\n");
+        }
         printf(
-            "[----------] Global test environment tear-down\n"
             "[==========] %zu test%s from %zu test suite%s ran. (%d ms total)\n"
             "[  PASSED  ] %zu test%s.\n",
             totalTests,
@@ -478,13 +2252,268 @@ int main(int argc, char* argv[]) {
         );
     }
 
-    // Generate report if requested.
-    if (!environment.reportPath.empty()) {
-        FILE* reportFile = fopen(environment.reportPath.c_str(), "wt");
-        if (reportFile != NULL) {
-            const auto report = runner.GetReport();
-            (void)fwrite(report.data(), report.length(), 1, reportFile);
-            (void)fclose(reportFile);
+    // Run benchmarks if requested.  Benchmarks are run one at a time,
+    // so that they don't disturb each other's measurements.
+    if (
+        environment.runBenchmarks
+        && !environment.listTests
+    ) {
+        std::regex benchmarkFilter;
+        if (!environment.benchmarkFilter.empty()) {
+            try {
+                benchmarkFilter = std::regex(environment.benchmarkFilter);
+            } catch (const std::regex_error&) {
+                fprintf(
+                    stderr,
+                    "ERROR: Invalid benchmark filter '%s'\n",
+                    environment.benchmarkFilter.c_str()
+                );
+                return EXIT_FAILURE;
+            }
+        }
+        BenchmarkBaseline baseline(
+            environment.benchmarkThreshold,
+            benchmarkSignificanceLevel
+        );
+        if (!environment.benchmarkBaselinePath.empty()) {
+            SystemAbstractions::File baselineFile(environment.benchmarkBaselinePath);
+            if (!baseline.Load(ReadFile(baselineFile))) {
+                fprintf(
+                    stderr,
+                    "ERROR: Unable to load benchmark baseline '%s'\n",
+                    environment.benchmarkBaselinePath.c_str()
+                );
+                return EXIT_FAILURE;
+            }
+        }
+        std::vector< SelectedBenchmark > benchmarks;
+        for (const auto& benchmarkSuiteName: runner.GetBenchmarkSuiteNames()) {
+            for (const auto& benchmarkName: runner.GetBenchmarkNames(benchmarkSuiteName)) {
+                if (
+                    !environment.benchmarkFilter.empty()
+                    && !std::regex_search(benchmarkSuiteName + "." + benchmarkName, benchmarkFilter)
+                ) {
+                    continue;
+                }
+                SelectedBenchmark benchmark;
+                benchmark.benchmarkSuiteName = benchmarkSuiteName;
+                benchmark.benchmarkName = benchmarkName;
+                benchmarks.push_back(std::move(benchmark));
+            }
+        }
+        printf(
+            "[==========] Running %zu benchmark%s.\n",
+            benchmarks.size(),
+            ((benchmarks.size() == 1) ? "" : "s")
+        );
+        size_t benchmarksFailed = 0;
+        std::vector< std::string > regressions;
+        for (auto& benchmark: benchmarks) {
+            printf(
+                "[ RUN      ] %s.%s\n",
+                benchmark.benchmarkSuiteName.c_str(),
+                benchmark.benchmarkName.c_str()
+            );
+            (void)fflush(stdout);
+            benchmark.passed = runner.RunBenchmark(
+                benchmark.benchmarkSuiteName,
+                benchmark.benchmarkName,
+                [](const std::string& message){
+                    (void)fwrite(message.data(), message.length(), 1, stdout);
+                },
+                benchmark.result
+            );
+            if (benchmark.passed) {
+                const auto& result = benchmark.result;
+                printf(
+                    "[    BENCH ] %s.%s: mean %.1f ns, median %.1f ns, stddev %.1f ns, min %.1f ns (%zu x %zu iterations)\n",
+                    benchmark.benchmarkSuiteName.c_str(),
+                    benchmark.benchmarkName.c_str(),
+                    result.mean,
+                    result.median,
+                    result.standardDeviation,
+                    result.minimum,
+                    result.samples.size(),
+                    result.iterations
+                );
+                if (!environment.benchmarkBaselinePath.empty()) {
+                    const auto comparison = baseline.Compare(
+                        benchmark.benchmarkSuiteName,
+                        benchmark.benchmarkName,
+                        result.samples
+                    );
+                    if (comparison.found) {
+                        printf(
+                            "[ BASELINE ] %s.%s: mean %.1f ns, change %+.1f%%, p = %.4f%s\n",
+                            benchmark.benchmarkSuiteName.c_str(),
+                            benchmark.benchmarkName.c_str(),
+                            comparison.baselineMean,
+                            comparison.change * 100.0,
+                            comparison.pValue,
+                            (comparison.regression ? " (REGRESSION)" : "")
+                        );
+                        if (comparison.regression) {
+                            regressions.push_back(
+                                benchmark.benchmarkSuiteName + "." + benchmark.benchmarkName
+                            );
+                            success = false;
+                        }
+                    } else {
+                        printf(
+                            "[ BASELINE ] %s.%s: not in baseline\n",
+                            benchmark.benchmarkSuiteName.c_str(),
+                            benchmark.benchmarkName.c_str()
+                        );
+                    }
+                }
+            } else {
+                ++benchmarksFailed;
+                printf(
+                    "[  FAILED  ] %s.%s\n",
+                    benchmark.benchmarkSuiteName.c_str(),
+                    benchmark.benchmarkName.c_str()
+                );
+                success = false;
+            }
+        }
+        printf(
+            "[==========] %zu benchmark%s ran, %zu failed.\n",
+            benchmarks.size(),
+            ((benchmarks.size() == 1) ? "" : "s"),
+            benchmarksFailed
+        );
+        if (!regressions.empty()) {
+            printf(
+                "[ REGRESS  ] %zu benchmark%s regressed, listed below:\n",
+                regressions.size(),
+                ((regressions.size() == 1) ? "" : "s")
+            );
+            for (const auto& regression: regressions) {
+                printf(
+                    "[ REGRESS  ] %s\n",
+                    regression.c_str()
+                );
+            }
+        }
+        if (!environment.benchmarkResultsPath.empty()) {
+            FILE* benchmarkResultsFile = fopen(environment.benchmarkResultsPath.c_str(), "wt");
+            if (benchmarkResultsFile != NULL) {
+                const auto benchmarkResults = EncodeBenchmarkResults(benchmarks);
+                (void)fwrite(benchmarkResults.data(), benchmarkResults.length(), 1, benchmarkResultsFile);
+                (void)fclose(benchmarkResultsFile);
+            }
+        }
+    }
+
+    // Generate profile if requested.
+    if (!environment.profilePath.empty()) {
+        FILE* profileFile = fopen(environment.profilePath.c_str(), "wt");
+        if (profileFile != NULL) {
+            const auto profile = runner.GetProfile();
+            (void)fwrite(profile.data(), profile.length(), 1, profileFile);
+            (void)fclose(profileFile);
+        }
+    }
+
+    // If requested, keep watching for changes, and whenever any Lua test
+    // files change, run just the tests found in them.
+    if (
+        environment.watch
+        && !environment.listTests
+    ) {
+        printf("[==========] Watching for changes.  Press Ctrl+C to stop.\n");
+        (void)fflush(stdout);
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(watchPollIntervalMilliseconds));
+            const auto affectedTests = runner.Refresh(
+                [](const std::string& message){
+                    (void)fwrite(message.data(), message.length(), 1, stderr);
+                }
+            );
+            if (affectedTests.empty()) {
+                continue;
+            }
+            if (!discoveryIndexPath.empty()) {
+                (void)runner.SaveDiscoveryIndex(discoveryIndexPath);
+            }
+            tests.clear();
+            for (const auto& affectedTest: affectedTests) {
+                SelectedTest test;
+                if (
+                    !filter.Matches(affectedTest.first, affectedTest.second)
+                    || !runner.FindTest(affectedTest.first, affectedTest.second, test.testId)
+                ) {
+                    continue;
+                }
+                test.testSuiteName = affectedTest.first;
+                test.testName = affectedTest.second;
+                tests.push_back(std::move(test));
+            }
+            if (tests.empty()) {
+                continue;
+            }
+            printf(
+                "\n[==========] Running %zu test%s affected by changes.\n",
+                tests.size(),
+                ((tests.size() == 1) ? "" : "s")
+            );
+            passed = 0;
+            failed.clear();
+            const auto watchStartTime = timer.GetTime();
+
+            // Worker processes are replaced, so that they know about
+            // the changes just found.
+            if (
+                isolateProcesses
+                && !processPool.Start(environment.jobs, environment.testTimeout, environment.forkPerTest)
+            ) {
+                fprintf(stderr, "ERROR: Unable to start worker processes\n");
+                return EXIT_FAILURE;
+            }
+            if (
+                writeStatusFile
+                && !StartStatusFile(
+                    statusFile,
+                    environment.statusFilePath,
+                    tests,
+                    workerPool.GetNumWorkers()
+                )
+            ) {
+                return EXIT_FAILURE;
+            }
+            (void)RunSelectedTests(
+                runner,
+                workerPool,
+                (isolateProcesses ? &processPool : nullptr),
+                asyncBatch,
+                tests,
+                printTestSuiteHeaders,
+                environment.brief,
+                environment.verbose,
+                environment.collectMetrics,
+                passed,
+                failed,
+                nullptr,
+                (writeStatusFile ? &statusFile : nullptr)
+            );
+            statusFile.Stop();
+            printf(
+                "[==========] %zu test%s ran. (%d ms total)\n"
+                "[  PASSED  ] %zu test%s.\n",
+                tests.size(),
+                ((tests.size() == 1) ? "" : "s"),
+                (int)ceil((timer.GetTime() - watchStartTime) * 1000.0),
+                passed,
+                ((passed == 1) ? "" : "s")
+            );
+            for (const auto& instance: failed) {
+                printf(
+                    "[  FAILED  ] %s\n",
+                    instance.c_str()
+                );
+            }
+            printf("[==========] Watching for changes.  Press Ctrl+C to stop.\n");
+            (void)fflush(stdout);
         }
     }
 